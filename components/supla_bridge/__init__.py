@@ -1,41 +1,327 @@
-import esphome.codegen as cg
-import esphome.config_validation as cv
-from esphome.components import sensor, light
-from esphome.const import CONF_ID
-
-CONF_SERVER = "server"
-CONF_LOCATION_ID = "location_id"
-CONF_LOCATION_PASSWORD = "location_password"
-CONF_DEVICE_NAME = "device_name"
-CONF_TEMPERATURE = "temperature"
-CONF_SWITCH = "switch"
-
-supla_ns = cg.esphome_ns.namespace("supla_esphome_bridge")
-SuplaEsphomeBridge = supla_ns.class_("SuplaEsphomeBridge", cg.Component)
-
-CONFIG_SCHEMA = cv.Schema(
-    {
-        cv.GenerateID(): cv.declare_id(SuplaEsphomeBridge),
-        cv.Required(CONF_SERVER): cv.string,
-        cv.Required(CONF_LOCATION_ID): cv.int_,
-        cv.Required(CONF_LOCATION_PASSWORD): cv.string,
-        cv.Optional(CONF_DEVICE_NAME, default="esphome"): cv.string,
-        cv.Required(CONF_TEMPERATURE): cv.use_id(sensor.Sensor),
-        cv.Required(CONF_SWITCH): cv.use_id(light.LightState),
-    }
-)
-
-async def to_code(config):
-    var = cg.new_Pvariable(config[CONF_ID])
-    await cg.register_component(var, config)
-
-    cg.add(var.set_server(config[CONF_SERVER]))
-    cg.add(var.set_location_id(config[CONF_LOCATION_ID]))
-    cg.add(var.set_location_password(config[CONF_LOCATION_PASSWORD]))
-    cg.add(var.set_device_name(config[CONF_DEVICE_NAME]))
-
-    temp = await cg.get_variable(config[CONF_TEMPERATURE])
-    sw = await cg.get_variable(config[CONF_SWITCH])
-
-    cg.add(var.set_temperature_sensor(temp))
-    cg.add(var.set_switch_light(sw))
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import binary_sensor, light, sensor, switch
+from esphome.const import (
+    CONF_ID,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    UNIT_MILLISECOND,
+)
+
+# ping_rtt tworzy encję sensor, a set_ping_rtt_sensor() istnieje tylko przy
+# USE_SENSOR: bez AUTO_LOAD konfiguracja bez innych sensorów się nie kompiluje
+AUTO_LOAD = ["sensor"]
+
+CONF_SERVER = "server"
+CONF_LOCATION_ID = "location_id"
+CONF_LOCATION_PASSWORD = "location_password"
+CONF_DEVICE_NAME = "device_name"
+CONF_EMAIL = "email"
+CONF_AUTH_KEY = "auth_key"
+CONF_TEMPERATURE = "temperature"
+CONF_SWITCH = "switch"
+CONF_TEMPERATURE_DEADBAND = "temperature_deadband"
+CONF_TEMPERATURE_MIN_INTERVAL = "temperature_min_interval"
+CONF_DEBUG_WIRE = "debug_wire"
+CONF_CHANNELS = "channels"
+CONF_NUMBER = "number"
+CONF_FUNCTION = "function"
+CONF_SENSOR = "sensor"
+CONF_BINARY_SENSOR = "binary_sensor"
+CONF_LIGHT = "light"
+CONF_ICON = "icon"
+CONF_DEADBAND = "deadband"
+CONF_MIN_INTERVAL = "min_interval"
+CONF_ACTIVITY_TIMEOUT = "activity_timeout"
+CONF_PING_RTT = "ping_rtt"
+
+SUPLA_CHANNEL_NUMBER_MAX = 127
+
+# Domyślny próg i odstęp wysyłek kanału sensor z listy channels: (każda
+# zmiana, nie częściej niż co 10 s); temperature_deadband/_min_interval
+# dotyczą tylko kanału z klucza temperature
+DEFAULT_DEADBAND = 0.0
+DEFAULT_MIN_INTERVAL_MS = 10000
+
+# Rodzaj encji -> (Type, FuncList) w opisie kanału; dla sensor typ wynika
+# z funkcji (SENSOR_TYPES)
+CHANNEL_TYPES = {
+    # Funkcję czujnika wybiera się w chmurze, FuncList zostaje pusty
+    CONF_BINARY_SENSOR: ("SUPLA_CHANNELTYPE_BINARYSENSOR", "0"),
+    CONF_SWITCH: (
+        "SUPLA_CHANNELTYPE_RELAY",
+        "SUPLA_BIT_FUNC_POWERSWITCH | SUPLA_BIT_FUNC_LIGHTSWITCH",
+    ),
+    CONF_LIGHT: (
+        "SUPLA_CHANNELTYPE_RELAY",
+        "SUPLA_BIT_FUNC_POWERSWITCH | SUPLA_BIT_FUNC_LIGHTSWITCH",
+    ),
+}
+
+# Funkcja kanału sensor -> (Type, FuncList); od typu zależy też kodowanie
+# wartości w supla_esphome_bridge.cpp (value_format)
+SENSOR_TYPES = {
+    "thermometer": ("SUPLA_CHANNELTYPE_THERMOMETER", "SUPLA_BIT_FUNC_THERMOMETER"),
+    "humidity": ("SUPLA_CHANNELTYPE_HUMIDITYSENSOR", "SUPLA_BIT_FUNC_HUMIDITY"),
+    "pressure_sensor": (
+        "SUPLA_CHANNELTYPE_PRESSURESENSOR",
+        "SUPLA_BIT_FUNC_PRESSURESENSOR",
+    ),
+    "wind_sensor": ("SUPLA_CHANNELTYPE_WINDSENSOR", "SUPLA_BIT_FUNC_WINDSENSOR"),
+    "rain_sensor": ("SUPLA_CHANNELTYPE_RAINSENSOR", "SUPLA_BIT_FUNC_RAINSENSOR"),
+    "weight_sensor": ("SUPLA_CHANNELTYPE_WEIGHTSENSOR", "SUPLA_BIT_FUNC_WEIGHTSENSOR"),
+    "distance_sensor": ("SUPLA_CHANNELTYPE_DISTANCESENSOR", "0"),
+    "depth_sensor": ("SUPLA_CHANNELTYPE_DISTANCESENSOR", "0"),
+    "general_purpose_measurement": (
+        "SUPLA_CHANNELTYPE_GENERAL_PURPOSE_MEASUREMENT",
+        "0",
+    ),
+}
+
+# Rodzaj encji -> funkcje SUPLA (nazwa w YAML -> stała z proto.h); pierwsza
+# jest domyślna
+CHANNEL_FUNCTIONS = {
+    CONF_SENSOR: {
+        "thermometer": "SUPLA_CHANNELFNC_THERMOMETER",
+        "humidity": "SUPLA_CHANNELFNC_HUMIDITY",
+        "pressure_sensor": "SUPLA_CHANNELFNC_PRESSURESENSOR",
+        "wind_sensor": "SUPLA_CHANNELFNC_WINDSENSOR",
+        "rain_sensor": "SUPLA_CHANNELFNC_RAINSENSOR",
+        "weight_sensor": "SUPLA_CHANNELFNC_WEIGHTSENSOR",
+        "distance_sensor": "SUPLA_CHANNELFNC_DISTANCESENSOR",
+        "depth_sensor": "SUPLA_CHANNELFNC_DEPTHSENSOR",
+        "general_purpose_measurement": "SUPLA_CHANNELFNC_GENERAL_PURPOSE_MEASUREMENT",
+    },
+    CONF_BINARY_SENSOR: {
+        "opening_sensor_door": "SUPLA_CHANNELFNC_OPENINGSENSOR_DOOR",
+        "opening_sensor_gate": "SUPLA_CHANNELFNC_OPENINGSENSOR_GATE",
+        "opening_sensor_gateway": "SUPLA_CHANNELFNC_OPENINGSENSOR_GATEWAY",
+        "opening_sensor_garage_door": "SUPLA_CHANNELFNC_OPENINGSENSOR_GARAGEDOOR",
+        "opening_sensor_window": "SUPLA_CHANNELFNC_OPENINGSENSOR_WINDOW",
+        "opening_sensor_roof_window": "SUPLA_CHANNELFNC_OPENINGSENSOR_ROOFWINDOW",
+        "opening_sensor_roller_shutter": "SUPLA_CHANNELFNC_OPENINGSENSOR_ROLLERSHUTTER",
+        "no_liquid_sensor": "SUPLA_CHANNELFNC_NOLIQUIDSENSOR",
+        "mail_sensor": "SUPLA_CHANNELFNC_MAILSENSOR",
+        "hotel_card_sensor": "SUPLA_CHANNELFNC_HOTELCARDSENSOR",
+        "alarm_armament_sensor": "SUPLA_CHANNELFNC_ALARMARMAMENTSENSOR",
+    },
+    CONF_SWITCH: {
+        "power_switch": "SUPLA_CHANNELFNC_POWERSWITCH",
+        "light_switch": "SUPLA_CHANNELFNC_LIGHTSWITCH",
+    },
+    CONF_LIGHT: {
+        "light_switch": "SUPLA_CHANNELFNC_LIGHTSWITCH",
+        "power_switch": "SUPLA_CHANNELFNC_POWERSWITCH",
+    },
+}
+
+supla_ns = cg.esphome_ns.namespace("supla_esphome_bridge")
+SuplaEsphomeBridge = supla_ns.class_("SuplaEsphomeBridge", cg.Component)
+ChannelDescriptor = supla_ns.struct("ChannelDescriptor")
+
+CHANNEL_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Optional(CONF_SENSOR): cv.use_id(sensor.Sensor),
+            cv.Optional(CONF_BINARY_SENSOR): cv.use_id(binary_sensor.BinarySensor),
+            cv.Optional(CONF_SWITCH): cv.use_id(switch.Switch),
+            cv.Optional(CONF_LIGHT): cv.use_id(light.LightState),
+            cv.Optional(CONF_NUMBER): cv.int_range(
+                min=0, max=SUPLA_CHANNEL_NUMBER_MAX
+            ),
+            cv.Optional(CONF_FUNCTION): cv.string,
+            # DefaultIcon: wariant ikony funkcji w aplikacji SUPLA
+            cv.Optional(CONF_ICON, default=0): cv.int_range(min=0, max=255),
+            # Tylko sensor: minimalna zmiana (w jednostkach encji) i minimalny
+            # odstęp między wysyłkami do chmury
+            cv.Optional(CONF_DEADBAND): cv.positive_float,
+            cv.Optional(CONF_MIN_INTERVAL): cv.positive_time_period_milliseconds,
+        }
+    ),
+    cv.has_exactly_one_key(CONF_SENSOR, CONF_BINARY_SENSOR, CONF_SWITCH, CONF_LIGHT),
+)
+
+
+def _channel_kind(channel):
+    return next(kind for kind in CHANNEL_FUNCTIONS if kind in channel)
+
+
+def _channel_type(channel):
+    kind = _channel_kind(channel)
+    if kind == CONF_SENSOR:
+        return SENSOR_TYPES[channel[CONF_FUNCTION]]
+    return CHANNEL_TYPES[kind]
+
+
+def validate_auth_key(value):
+    value = cv.string_strict(value).replace(":", "").lower()
+    if len(value) != 32 or any(c not in "0123456789abcdef" for c in value):
+        raise cv.Invalid("auth_key must be 16 bytes in hex (32 characters)")
+    return value
+
+
+def validate_credentials(config):
+    # Lokalizacja (REGISTER_DEVICE_C) albo e-mail + AuthKey (REGISTER_DEVICE_G)
+    if CONF_LOCATION_ID not in config and CONF_EMAIL not in config:
+        raise cv.Invalid(
+            f"Either {CONF_LOCATION_ID}/{CONF_LOCATION_PASSWORD} or "
+            f"{CONF_EMAIL}/{CONF_AUTH_KEY} is required"
+        )
+    return config
+
+
+def validate_channels(config):
+    # Stare klucze temperature/switch to kanały 0 i 1, przed listą channels:
+    channels = []
+    if CONF_TEMPERATURE in config:
+        channels.append(
+            {
+                CONF_SENSOR: config[CONF_TEMPERATURE],
+                CONF_NUMBER: 0,
+                CONF_DEADBAND: config[CONF_TEMPERATURE_DEADBAND],
+                CONF_MIN_INTERVAL: config[CONF_TEMPERATURE_MIN_INTERVAL],
+            }
+        )
+    if CONF_SWITCH in config:
+        channels.append({CONF_LIGHT: config[CONF_SWITCH], CONF_NUMBER: 1})
+    channels.extend(dict(channel) for channel in config.get(CONF_CHANNELS, []))
+
+    if not channels:
+        raise cv.Invalid("At least one SUPLA channel is required")
+
+    used = {channel[CONF_NUMBER] for channel in channels if CONF_NUMBER in channel}
+    if len(used) != sum(CONF_NUMBER in channel for channel in channels):
+        raise cv.Invalid("SUPLA channel numbers must be unique")
+
+    # Kanały bez numeru dostają kolejne wolne numery
+    next_number = 0
+    for channel in channels:
+        if CONF_NUMBER not in channel:
+            while next_number in used:
+                next_number += 1
+            if next_number > SUPLA_CHANNEL_NUMBER_MAX:
+                raise cv.Invalid("Too many SUPLA channels")
+            channel[CONF_NUMBER] = next_number
+            used.add(next_number)
+
+        functions = CHANNEL_FUNCTIONS[_channel_kind(channel)]
+        function = channel.get(CONF_FUNCTION, next(iter(functions)))
+        if function not in functions:
+            raise cv.Invalid(
+                f"Function '{function}' is not valid for SUPLA channel "
+                f"{channel[CONF_NUMBER]}, expected one of: {', '.join(functions)}"
+            )
+        channel[CONF_FUNCTION] = function
+
+        if _channel_kind(channel) != CONF_SENSOR and (
+            CONF_DEADBAND in channel or CONF_MIN_INTERVAL in channel
+        ):
+            raise cv.Invalid(
+                f"{CONF_DEADBAND}/{CONF_MIN_INTERVAL} apply only to sensor "
+                f"channels (SUPLA channel {channel[CONF_NUMBER]})"
+            )
+
+    config = dict(config)
+    config[CONF_CHANNELS] = channels
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(SuplaEsphomeBridge),
+            cv.Required(CONF_SERVER): cv.string,
+            cv.Inclusive(CONF_LOCATION_ID, "location"): cv.int_,
+            cv.Inclusive(CONF_LOCATION_PASSWORD, "location"): cv.string,
+            cv.Inclusive(CONF_EMAIL, "email"): cv.string_strict,
+            cv.Inclusive(CONF_AUTH_KEY, "email"): validate_auth_key,
+            cv.Optional(CONF_DEVICE_NAME, default="esphome"): cv.string,
+            cv.Optional(CONF_TEMPERATURE): cv.use_id(sensor.Sensor),
+            cv.Optional(CONF_SWITCH): cv.use_id(light.LightState),
+            cv.Optional(CONF_CHANNELS): cv.ensure_list(CHANNEL_SCHEMA),
+            cv.Optional(CONF_TEMPERATURE_DEADBAND, default=0.1): cv.positive_float,
+            cv.Optional(
+                CONF_TEMPERATURE_MIN_INTERVAL, default="10s"
+            ): cv.positive_time_period_milliseconds,
+            # Pole uint8 w protokole; zakres serwera (min/max) sprawdzany po
+            # SET_ACTIVITY_TIMEOUT_RESULT
+            cv.Optional(CONF_ACTIVITY_TIMEOUT): cv.All(
+                cv.positive_time_period_seconds,
+                cv.Range(min=cv.TimePeriod(seconds=1), max=cv.TimePeriod(seconds=255)),
+            ),
+            cv.Optional(CONF_PING_RTT): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                accuracy_decimals=1,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_DEBUG_WIRE, default=False): cv.boolean,
+        }
+    ),
+    validate_credentials,
+    validate_channels,
+)
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+
+    cg.add(var.set_server(config[CONF_SERVER]))
+    if CONF_LOCATION_ID in config:
+        cg.add(var.set_location_id(config[CONF_LOCATION_ID]))
+        cg.add(var.set_location_password(config[CONF_LOCATION_PASSWORD]))
+    if CONF_EMAIL in config:
+        cg.add(var.set_email(config[CONF_EMAIL]))
+        cg.add(var.set_auth_key(config[CONF_AUTH_KEY]))
+    cg.add(var.set_device_name(config[CONF_DEVICE_NAME]))
+    if CONF_ACTIVITY_TIMEOUT in config:
+        cg.add(
+            var.set_activity_timeout(config[CONF_ACTIVITY_TIMEOUT].total_seconds)
+        )
+    if CONF_PING_RTT in config:
+        sens = await sensor.new_sensor(config[CONF_PING_RTT])
+        cg.add(var.set_ping_rtt_sensor(sens))
+
+    # Opisy kanałów jako stała tablica (flash na ESP8266), kolejność
+    # {func_list, type, default_function, number, default_icon, deadband,
+    # min_interval_ms}
+    descriptors = []
+    for channel in config[CONF_CHANNELS]:
+        kind = _channel_kind(channel)
+        channel_type, func_list = _channel_type(channel)
+        function = CHANNEL_FUNCTIONS[kind][channel[CONF_FUNCTION]]
+        if kind == CONF_SENSOR:
+            deadband = channel.get(CONF_DEADBAND, DEFAULT_DEADBAND)
+            min_interval = channel.get(CONF_MIN_INTERVAL)
+            min_interval_ms = (
+                DEFAULT_MIN_INTERVAL_MS
+                if min_interval is None
+                else min_interval.total_milliseconds
+            )
+        else:
+            deadband, min_interval_ms = 0.0, 0
+        descriptors.append(
+            f"  {{{func_list}, {channel_type}, {function}, "
+            f"{channel[CONF_NUMBER]}, {channel.get(CONF_ICON, 0)}, "
+            f"{float(deadband)!r}f, {min_interval_ms}}},"
+        )
+
+    table = f"{config[CONF_ID]}_channel_table"
+    cg.add_global(
+        cg.RawStatement(
+            f"static constexpr {ChannelDescriptor} {table}[] "
+            "SUPLA_CHANNEL_TABLE_ATTR = {\n" + "\n".join(descriptors) + "\n};"
+        )
+    )
+    cg.add(var.set_channel_table(cg.RawExpression(table), len(descriptors)))
+
+    # RAM: tylko wskaźniki encji, w kolejności tablicy
+    for channel in config[CONF_CHANNELS]:
+        kind = _channel_kind(channel)
+        entity = await cg.get_variable(channel[kind])
+        cg.add(getattr(var, f"add_{kind}_channel")(entity))
+
+    # Flaga kompilatora, a nie cg.add_define(): log.c jest w C i nie widzi
+    # esphome/core/defines.h
+    if config[CONF_DEBUG_WIRE]:
+        cg.add_build_flag("-DSUPLA_DEBUG_WIRE")
@@ -0,0 +1,210 @@
+/*
+ Copyright (C) AC SOFTWARE SP. Z O.O.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "eh.h"
+
+// eh.h on Linux (EH_EPOLL): epoll + eventfd + timerfd. fd1 is an eventfd,
+// so eh_raise_event() from any thread wakes eh_wait(). Descriptors added
+// with eh_add_fd_ex() may be edge-triggered and carry a user pointer, so one
+// loop serves any number of srpc sessions and learns which of them are
+// ready without scanning the rest. timer_fd is a timerfd for periodic work
+// such as ping and activity timeout checks.
+//
+// ESP8266/ESP32 and Arduino builds compile this file to nothing: srpc runs
+// there with __EH_DISABLED and TEventHandler is never used.
+#if defined(EH_EPOLL)
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+TEventHandler *eh_init(void) {
+  TEventHandler *eh = malloc(sizeof(TEventHandler));
+  if (eh == NULL) return NULL;
+
+  memset(eh, 0, sizeof(TEventHandler));
+  eh->fd2 = -1;
+  eh->fd3 = -1;
+  eh->timer_fd = -1;
+
+  eh->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  eh->fd1 = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = &eh->fd1;
+
+  if (eh->epoll_fd == -1 || eh->fd1 == -1 ||
+      epoll_ctl(eh->epoll_fd, EPOLL_CTL_ADD, eh->fd1, &ev) != 0) {
+    eh_free(eh);
+    return NULL;
+  }
+
+  return eh;
+}
+
+char eh_add_fd_ex(TEventHandler *eh, int fd, int flags, void *user_data) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+
+  if (flags & EH_READ) ev.events |= EPOLLIN | EPOLLRDHUP;
+  if (flags & EH_WRITE) ev.events |= EPOLLOUT;
+  if (flags & EH_EDGE_TRIGGERED) ev.events |= EPOLLET;
+  ev.data.ptr = user_data;
+
+  if (epoll_ctl(eh->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    return 0;
+  }
+
+  eh->nfds++;
+  return 1;
+}
+
+// Watched for input like before, but without the old limit of two: every
+// descriptor is added to epoll. Only the first two are still mirrored in
+// fd2/fd3 for code that reads them; eh_get_ready() reports all of them with
+// a NULL user pointer.
+void eh_add_fd(TEventHandler *eh, int fd) {
+  if (fd < 0 || !eh_add_fd_ex(eh, fd, EH_READ, NULL)) return;
+
+  if (eh->fd2 == -1) {
+    eh->fd2 = fd;
+  } else if (eh->fd3 == -1) {
+    eh->fd3 = fd;
+  }
+}
+
+void eh_del_fd(TEventHandler *eh, int fd, void *user_data) {
+  if (epoll_ctl(eh->epoll_fd, EPOLL_CTL_DEL, fd, NULL) == 0) {
+    eh->nfds--;
+  }
+
+  if (eh->fd2 == fd) eh->fd2 = -1;
+  if (eh->fd3 == fd) eh->fd3 = -1;
+
+  // A session freed while the results of eh_wait() are being walked must
+  // not be reported any more
+  if (user_data != NULL) {
+    for (int a = 0; a < eh->ready_count; a++) {
+      if (eh->ready[a].data.ptr == user_data) {
+        eh->ready[a].data.ptr = NULL;
+        eh->ready[a].events = 0;
+      }
+    }
+  }
+}
+
+char eh_set_timer(TEventHandler *eh, int interval_ms) {
+  if (eh->timer_fd == -1) {
+    if (interval_ms <= 0) return 1;
+
+    eh->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (eh->timer_fd == -1) return 0;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &eh->timer_fd;
+
+    if (epoll_ctl(eh->epoll_fd, EPOLL_CTL_ADD, eh->timer_fd, &ev) != 0) {
+      close(eh->timer_fd);
+      eh->timer_fd = -1;
+      return 0;
+    }
+  }
+
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  if (interval_ms > 0) {
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    its.it_value = its.it_interval;
+  }
+
+  return timerfd_settime(eh->timer_fd, 0, &its, NULL) == 0 ? 1 : 0;
+}
+
+void eh_raise_event(TEventHandler *eh) {
+  uint64_t one = 1;
+
+  if (eh != NULL && write(eh->fd1, &one, sizeof(one)) == -1) {
+    // The counter is saturated, so eh_wait() wakes up anyway
+  }
+}
+
+// usec < 0 waits without a timeout. Returns the number of descriptors that
+// became ready, fd1 and timer_fd included, 0 on timeout and -1 on error.
+int eh_wait(TEventHandler *eh, int usec) {
+  struct epoll_event events[EH_MAX_EVENTS];
+  uint64_t count;
+  int timeout = usec < 0 ? -1 : (usec + 999) / 1000;
+
+  eh->ready_count = 0;
+  eh->timer_expirations = 0;
+
+  int result = epoll_wait(eh->epoll_fd, events, EH_MAX_EVENTS, timeout);
+
+  if (result < 0) {
+    return errno == EINTR ? 0 : -1;
+  }
+
+  for (int a = 0; a < result; a++) {
+    if (events[a].data.ptr == &eh->fd1) {
+      while (read(eh->fd1, &count, sizeof(count)) > 0) {
+      }
+    } else if (events[a].data.ptr == &eh->timer_fd) {
+      if (read(eh->timer_fd, &count, sizeof(count)) == sizeof(count)) {
+        eh->timer_expirations += count;
+      }
+    } else {
+      eh->ready[eh->ready_count++] = events[a];
+    }
+  }
+
+  return result;
+}
+
+// NULL for descriptors added with eh_add_fd() or removed since eh_wait()
+void *eh_get_ready(TEventHandler *eh, int i, int *flags) {
+  if (i < 0 || i >= eh->ready_count) return NULL;
+
+  if (flags != NULL) {
+    uint32_t events = eh->ready[i].events;
+    *flags = ((events & EPOLLIN) ? EH_READ : 0) |
+             ((events & EPOLLOUT) ? EH_WRITE : 0) |
+             ((events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) ? EH_HANGUP : 0);
+  }
+
+  return eh->ready[i].data.ptr;
+}
+
+void eh_free(TEventHandler *eh) {
+  if (eh == NULL) return;
+
+  if (eh->timer_fd != -1) close(eh->timer_fd);
+  if (eh->fd1 != -1) close(eh->fd1);
+  if (eh->epoll_fd != -1) close(eh->epoll_fd);
+  free(eh);
+}
+
+#endif /*EH_EPOLL*/
@@ -27,6 +27,12 @@
 #include <sys/time.h>
 #endif
 
+#if defined(__linux__) && !defined(ESP8266) && !defined(ESP32) && \
+    !defined(ARDUINO)
+#include <sys/epoll.h>
+#define EH_EPOLL
+#endif
+
 #ifdef __AVR__
 #include "proto.h"
 #endif
@@ -35,6 +41,14 @@
 extern "C" {
 #endif
 
+// eh_add_fd_ex() flags, also reported by eh_get_ready()
+#define EH_READ 0x1
+#define EH_WRITE 0x2
+#define EH_EDGE_TRIGGERED 0x4
+#define EH_HANGUP 0x8
+
+#define EH_MAX_EVENTS 64
+
 typedef struct {
   int nfds;
 
@@ -42,11 +56,20 @@ typedef struct {
 
 #ifdef __linux__
   int epoll_fd;
-  int fd1;
+  int fd1;  // eventfd behind eh_raise_event()
 #else
   int fd1[2];
 #endif
 
+#ifdef EH_EPOLL
+  int timer_fd;
+  unsigned long long timer_expirations;
+
+  // Descriptors reported by the last eh_wait(), without fd1 and timer_fd
+  int ready_count;
+  struct epoll_event ready[EH_MAX_EVENTS];
+#endif /*EH_EPOLL*/
+
   int fd2;
   int fd3;
 
@@ -56,11 +79,27 @@ typedef struct {
 } TEventHandler;
 
 TEventHandler *eh_init(void);
+// Watches fd for input. With EH_EPOLL there is no limit on the number of
+// descriptors; only the first two are recorded in fd2/fd3 and all of them
+// are reported by eh_get_ready() with a NULL user pointer.
 void eh_add_fd(TEventHandler *eh, int fd);
 void eh_raise_event(TEventHandler *eh);
 int eh_wait(TEventHandler *eh, int usec);
 void eh_free(TEventHandler *eh);
 
+#ifdef EH_EPOLL
+// Any number of descriptors; user_data comes back from eh_get_ready()
+char eh_add_fd_ex(TEventHandler *eh, int fd, int flags, void *user_data);
+void eh_del_fd(TEventHandler *eh, int fd, void *user_data);
+
+// Periodic timer waking eh_wait() every interval_ms, 0 stops it. The number
+// of expirations since the previous eh_wait() is in timer_expirations.
+char eh_set_timer(TEventHandler *eh, int interval_ms);
+
+// i-th descriptor reported by the last eh_wait(), i < ready_count
+void *eh_get_ready(TEventHandler *eh, int i, int *flags);
+#endif /*EH_EPOLL*/
+
 #ifdef __cplusplus
 }
 #endif
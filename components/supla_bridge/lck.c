@@ -0,0 +1,278 @@
+/*
+ Copyright (C) AC SOFTWARE SP. Z O.O.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "lck.h"
+
+#if !defined(LCK_NONE)
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(LCK_PTHREAD)
+
+#include <pthread.h>
+
+typedef struct {
+  pthread_mutex_t mutex;
+  TLckStats stats;
+} TLck;
+
+void *LCK_ICACHE_FLASH lck_init(void) {
+  TLck *lck = (TLck *)malloc(sizeof(TLck));
+  if (lck == NULL) return NULL;
+
+  memset(&lck->stats, 0, sizeof(TLckStats));
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&lck->mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  return lck;
+}
+
+void LCK_ICACHE_FLASH lck_lock(void *_lck) {
+  TLck *lck = (TLck *)_lck;
+  if (lck == NULL) return;
+
+  // The counters are only written with the mutex held
+  if (pthread_mutex_trylock(&lck->mutex) == EBUSY) {
+    pthread_mutex_lock(&lck->mutex);
+    lck->stats.contended++;
+    lck->stats.parked++;
+  }
+
+  lck->stats.locks++;
+}
+
+char LCK_ICACHE_FLASH lck_lock_with_timeout(void *_lck, int timeout_sec) {
+  TLck *lck = (TLck *)_lck;
+  if (lck == NULL) return 0;
+
+  if (pthread_mutex_trylock(&lck->mutex) == EBUSY) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_sec;
+
+    if (pthread_mutex_timedlock(&lck->mutex, &ts) != 0) return 0;
+
+    lck->stats.contended++;
+    lck->stats.parked++;
+  }
+
+  lck->stats.locks++;
+  return 1;
+}
+
+void LCK_ICACHE_FLASH lck_unlock(void *_lck) {
+  TLck *lck = (TLck *)_lck;
+  if (lck != NULL) pthread_mutex_unlock(&lck->mutex);
+}
+
+void LCK_ICACHE_FLASH lck_free(void *_lck) {
+  TLck *lck = (TLck *)_lck;
+
+  if (lck != NULL) {
+    pthread_mutex_destroy(&lck->mutex);
+    free(lck);
+  }
+}
+
+#elif defined(LCK_ADAPTIVE)
+
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#else
+#include <sched.h>
+#endif /*defined(__linux__)*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LCK_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define LCK_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define LCK_CPU_RELAX()
+#endif
+
+// state: 0 free, 1 taken, 2 taken and somebody may be parked on it
+typedef struct {
+  int state;
+  int spin_count;
+  const void *owner;
+  unsigned int depth;
+  TLckStats stats;
+} TLck;
+
+// Its address identifies the calling thread
+static __thread char lck_thread;
+
+// Waits while state is 2. Returns 0 when timeout (relative, may be NULL)
+// has passed.
+static char lck_park(TLck *lck, const struct timespec *timeout) {
+#if defined(__linux__)
+  if (syscall(SYS_futex, &lck->state, FUTEX_WAIT_PRIVATE, 2, timeout, NULL,
+              0) != 0 &&
+      errno == ETIMEDOUT) {
+    return 0;
+  }
+#else
+  (void)lck;
+  (void)timeout;
+  sched_yield();
+#endif /*defined(__linux__)*/
+  return 1;
+}
+
+static void lck_unpark(TLck *lck) {
+#if defined(__linux__)
+  syscall(SYS_futex, &lck->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+  (void)lck;
+#endif /*defined(__linux__)*/
+}
+
+static char lck_try(TLck *lck) {
+  int expected = 0;
+  return __atomic_compare_exchange_n(&lck->state, &expected, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// deadline: CLOCK_MONOTONIC, NULL waits forever
+static char lck_acquire(TLck *lck, const struct timespec *deadline) {
+  if (__atomic_load_n(&lck->owner, __ATOMIC_RELAXED) == &lck_thread) {
+    lck->depth++;
+    lck->stats.locks++;
+    return 1;
+  }
+
+  char contended = 0;
+  char parked = 0;
+
+  if (!lck_try(lck)) {
+    contended = 1;
+
+    int spin = 0;
+    while (spin < lck->spin_count &&
+           (__atomic_load_n(&lck->state, __ATOMIC_RELAXED) != 0 ||
+            !lck_try(lck))) {
+      LCK_CPU_RELAX();
+      spin++;
+    }
+
+    if (spin == lck->spin_count) {
+      // Marked as 2 so that the owner knows it has to wake somebody up
+      while (__atomic_exchange_n(&lck->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        struct timespec timeout;
+
+        if (deadline != NULL) {
+          struct timespec now;
+          clock_gettime(CLOCK_MONOTONIC, &now);
+
+          timeout.tv_sec = deadline->tv_sec - now.tv_sec;
+          timeout.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+          if (timeout.tv_nsec < 0) {
+            timeout.tv_sec--;
+            timeout.tv_nsec += 1000000000L;
+          }
+
+          if (timeout.tv_sec < 0) return 0;
+        }
+
+        parked = 1;
+        if (!lck_park(lck, deadline ? &timeout : NULL)) return 0;
+      }
+    }
+  }
+
+  __atomic_store_n(&lck->owner, &lck_thread, __ATOMIC_RELAXED);
+  lck->depth = 1;
+  lck->stats.locks++;
+  lck->stats.contended += contended;
+  lck->stats.parked += parked;
+  return 1;
+}
+
+void *LCK_ICACHE_FLASH lck_init(void) {
+  TLck *lck = (TLck *)malloc(sizeof(TLck));
+  if (lck == NULL) return NULL;
+
+  memset(lck, 0, sizeof(TLck));
+  lck->spin_count = LCK_SPIN_COUNT;
+
+#if defined(_SC_NPROCESSORS_ONLN)
+  // Nobody can release the lock while we spin on a single core
+  if (sysconf(_SC_NPROCESSORS_ONLN) == 1) lck->spin_count = 0;
+#endif /*defined(_SC_NPROCESSORS_ONLN)*/
+
+  return lck;
+}
+
+void LCK_ICACHE_FLASH lck_lock(void *lck) {
+  if (lck != NULL) lck_acquire((TLck *)lck, NULL);
+}
+
+char LCK_ICACHE_FLASH lck_lock_with_timeout(void *lck, int timeout_sec) {
+  if (lck == NULL) return 0;
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_sec;
+
+  return lck_acquire((TLck *)lck, &deadline);
+}
+
+void LCK_ICACHE_FLASH lck_unlock(void *_lck) {
+  TLck *lck = (TLck *)_lck;
+
+  if (lck == NULL ||
+      __atomic_load_n(&lck->owner, __ATOMIC_RELAXED) != &lck_thread ||
+      --lck->depth > 0) {
+    return;
+  }
+
+  __atomic_store_n(&lck->owner, NULL, __ATOMIC_RELAXED);
+  if (__atomic_exchange_n(&lck->state, 0, __ATOMIC_RELEASE) == 2) {
+    lck_unpark(lck);
+  }
+}
+
+void LCK_ICACHE_FLASH lck_free(void *lck) { free(lck); }
+
+#endif /*LCK_ADAPTIVE*/
+
+int LCK_ICACHE_FLASH lck_unlock_r(void *lck, int result) {
+  lck_unlock(lck);
+  return result;
+}
+
+void LCK_ICACHE_FLASH lck_get_stats(void *lck, TLckStats *stats) {
+  memset(stats, 0, sizeof(TLckStats));
+  if (lck == NULL) return;
+
+  lck_lock(lck);
+  memcpy(stats, &((TLck *)lck)->stats, sizeof(TLckStats));
+  lck_unlock(lck);
+}
+
+#endif /*!defined(LCK_NONE)*/
@@ -32,10 +32,63 @@
 #define LCK_ICACHE_FLASH
 #endif /*LCK_ICACHE_FLASH*/
 
+// Lock backend, one of:
+//   LCK_NONE      single-threaded targets, every call compiles to nothing
+//   LCK_PTHREAD   recursive pthread mutex (a futex on Linux)
+//   LCK_ADAPTIVE  recursive, spins LCK_SPIN_COUNT times before it parks on
+//                 a futex (sched_yield() outside Linux)
+// ESP8266 and AVR run srpc from one loop and default to LCK_NONE.
+#if !defined(LCK_NONE) && !defined(LCK_PTHREAD) && !defined(LCK_ADAPTIVE)
+#if defined(ESP8266) || defined(__AVR__)
+#define LCK_NONE
+#else
+#define LCK_PTHREAD
+#endif
+#endif
+
+#ifndef LCK_SPIN_COUNT
+#define LCK_SPIN_COUNT 100
+#endif /*LCK_SPIN_COUNT*/
+
+typedef struct {
+  unsigned long long locks;      // all acquisitions, recursive ones included
+  unsigned long long contended;  // acquisitions that found the lock taken
+  unsigned long long parked;     // contended ones that had to sleep
+} TLckStats;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#ifdef LCK_NONE
+
+static inline void lck_lock(void *lck) { (void)lck; }
+
+static inline char lck_lock_with_timeout(void *lck, int timeout_sec) {
+  (void)lck;
+  (void)timeout_sec;
+  return 1;
+}
+
+static inline void lck_unlock(void *lck) { (void)lck; }
+
+static inline int lck_unlock_r(void *lck, int result) {
+  (void)lck;
+  return result;
+}
+
+static inline void *lck_init(void) { return 0; }
+static inline void lck_free(void *lck) { (void)lck; }
+
+static inline void lck_get_stats(void *lck, TLckStats *stats) {
+  (void)lck;
+  stats->locks = 0;
+  stats->contended = 0;
+  stats->parked = 0;
+}
+
+#else
+
 void LCK_ICACHE_FLASH lck_lock(void *lck);
 
 char LCK_ICACHE_FLASH lck_lock_with_timeout(void *lck, int timeout_sec);
@@ -43,6 +96,9 @@ void LCK_ICACHE_FLASH lck_unlock(void *lck);
 int LCK_ICACHE_FLASH lck_unlock_r(void *lck, int result);
 void *LCK_ICACHE_FLASH lck_init(void);
 void LCK_ICACHE_FLASH lck_free(void *lck);
+void LCK_ICACHE_FLASH lck_get_stats(void *lck, TLckStats *stats);
+
+#endif /*LCK_NONE*/
 
 #ifdef __cplusplus
 }
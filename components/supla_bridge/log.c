@@ -0,0 +1,543 @@
+/*
+ Copyright (C) AC SOFTWARE SP. Z O.O.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ as published by the Free Software Foundation; either version 2
+ of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/*
+ Deferred supla_log(). A call only checks the level, copies the format
+ pointer and the raw arguments (strings by value) into a ring buffer and
+ returns; nothing is formatted or printed on the protocol path. The main
+ loop calls supla_log_drain() when it has time and gets finished lines
+ through a sink. One thread logs, another one (or the same) drains: the
+ ring is single-producer/single-consumer and needs no lock.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+
+#ifndef LOG_RING_SIZE
+#if defined(ESP8266) || defined(__AVR__)
+#define LOG_RING_SIZE 1024
+#else
+#define LOG_RING_SIZE 8192
+#endif
+#endif /*LOG_RING_SIZE*/
+
+#if (LOG_RING_SIZE & (LOG_RING_SIZE - 1)) != 0 || LOG_RING_SIZE > 32768
+#error "LOG_RING_SIZE must be a power of two, at most 32768"
+#endif
+
+// Largest record, header included
+#ifndef LOG_RECORD_SIZE
+#define LOG_RECORD_SIZE 192
+#endif /*LOG_RECORD_SIZE*/
+
+// Formatted line handed to the sink
+#ifndef LOG_LINE_SIZE
+#define LOG_LINE_SIZE 128
+#endif /*LOG_LINE_SIZE*/
+
+// %s arguments are copied up to this many characters
+#ifndef LOG_STR_MAXSIZE
+#define LOG_STR_MAXSIZE 48
+#endif /*LOG_STR_MAXSIZE*/
+
+// Bytes kept from one supla_log_hex() call (SUPLA_DEBUG_WIRE builds)
+#ifndef LOG_HEX_MAXSIZE
+#define LOG_HEX_MAXSIZE 64
+#endif /*LOG_HEX_MAXSIZE*/
+
+// Hex dump budget: LOG_HEX_RATE bytes per second, at most LOG_HEX_BURST
+// at once
+#ifndef LOG_HEX_RATE
+#define LOG_HEX_RATE 128
+#endif /*LOG_HEX_RATE*/
+
+#ifndef LOG_HEX_BURST
+#define LOG_HEX_BURST 256
+#endif /*LOG_HEX_BURST*/
+
+#define LOG_RECORD_PAD 0
+#define LOG_RECORD_FMT 1
+#define LOG_RECORD_TEXT 2
+#define LOG_RECORD_HEX 3
+
+#define LOG_ARG_NONE 0
+#define LOG_ARG_INT 1
+#define LOG_ARG_LONG 2
+#define LOG_ARG_LLONG 3
+#define LOG_ARG_SIZE 4
+#define LOG_ARG_DOUBLE 5
+#define LOG_ARG_PTR 6
+#define LOG_ARG_STR 7
+#define LOG_ARG_UNSUPPORTED 8
+
+#define LOG_SPEC_MAXSIZE 16
+
+typedef struct {
+  unsigned short size;  // whole record, multiple of 4
+  unsigned char pri;
+  unsigned char kind;
+} TLogRecordHeader;
+
+#ifdef SUPLA_DEBUG_WIRE
+typedef struct {
+  const char *prefix;
+  unsigned short size;
+  unsigned short total_size;
+} TLogHexHeader;
+#endif /*SUPLA_DEBUG_WIRE*/
+
+static char log_ring[LOG_RING_SIZE];
+
+// Free-running offsets: head is written by the producer only, tail by the
+// consumer only
+static unsigned int log_head;
+static unsigned int log_tail;
+
+static int log_level = LOG_DEBUG;
+
+// Producer side counters, read by supla_log_drain()
+static unsigned int log_dropped;
+
+// Consumer side
+static unsigned int log_dropped_reported;
+
+#ifdef SUPLA_DEBUG_WIRE
+static unsigned int log_hex_spent;
+static unsigned int log_hex_skipped;
+
+static unsigned int log_hex_allowance = LOG_HEX_BURST;
+static unsigned int log_hex_refilled_at;
+static char log_hex_refill_started;
+static unsigned int log_hex_skipped_reported;
+#endif /*SUPLA_DEBUG_WIRE*/
+
+// Type of the argument taken by the conversion at fmt (which points at
+// '%'); *end is set past the conversion
+static char log_arg_type(const char *fmt, const char **end) {
+  const char *p = fmt + 1;
+  char type = LOG_ARG_INT;
+
+  if (*p == '%') {
+    *end = p + 1;
+    return LOG_ARG_NONE;
+  }
+
+  while (*p && strchr("-+ #0", *p)) p++;
+  while (*p >= '0' && *p <= '9') p++;
+  if (*p == '.') {
+    p++;
+    while (*p >= '0' && *p <= '9') p++;
+  }
+
+  if (*p == 'h') {
+    p++;
+    if (*p == 'h') p++;
+  } else if (*p == 'l') {
+    p++;
+    type = LOG_ARG_LONG;
+    if (*p == 'l') {
+      p++;
+      type = LOG_ARG_LLONG;
+    }
+  } else if (*p == 'z') {
+    p++;
+    type = LOG_ARG_SIZE;
+  }
+
+  *end = *p ? p + 1 : p;
+  if (*end - fmt >= LOG_SPEC_MAXSIZE) {
+    return LOG_ARG_UNSUPPORTED;
+  }
+
+  switch (*p) {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      return type;
+    case 'c':
+      return type == LOG_ARG_INT ? LOG_ARG_INT : LOG_ARG_UNSUPPORTED;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+      return type == LOG_ARG_INT ? LOG_ARG_DOUBLE : LOG_ARG_UNSUPPORTED;
+    case 's':
+      return type == LOG_ARG_INT ? LOG_ARG_STR : LOG_ARG_UNSUPPORTED;
+    case 'p':
+      return LOG_ARG_PTR;
+  }
+
+  // '*' widths, %n, wide strings, long double...
+  return LOG_ARG_UNSUPPORTED;
+}
+
+#define LOG_PACK(T)                                  \
+  {                                                  \
+    T v = va_arg(ap, T);                             \
+    if (len + (int)sizeof(T) > size) return -1;      \
+    memcpy(&args[len], &v, sizeof(T));               \
+    len += sizeof(T);                                \
+  }                                                  \
+  break
+
+// Copies the arguments of fmt into args. Returns their size or -1 when
+// they do not fit or fmt needs something that cannot be deferred.
+static int log_pack(char *args, int size, const char *fmt, va_list ap) {
+  const char *p = fmt;
+  int len = 0;
+
+  while ((p = strchr(p, '%')) != NULL) {
+    switch (log_arg_type(p, &p)) {
+      case LOG_ARG_NONE:
+        break;
+      case LOG_ARG_INT:
+        LOG_PACK(int);
+      case LOG_ARG_LONG:
+        LOG_PACK(long);
+      case LOG_ARG_LLONG:
+        LOG_PACK(long long);
+      case LOG_ARG_SIZE:
+        LOG_PACK(size_t);
+      case LOG_ARG_DOUBLE:
+        LOG_PACK(double);
+      case LOG_ARG_PTR:
+        LOG_PACK(void *);
+      case LOG_ARG_STR: {
+        const char *s = va_arg(ap, const char *);
+        int n = 0;
+
+        if (s == NULL) s = "(null)";
+        while (n < LOG_STR_MAXSIZE && s[n]) n++;
+        if (len + n + 1 > size) return -1;
+
+        memcpy(&args[len], s, n);
+        args[len + n] = 0;
+        len += n + 1;
+      } break;
+      default:
+        return -1;
+    }
+  }
+
+  return len;
+}
+
+#define LOG_UNPACK(T)                                     \
+  {                                                       \
+    T v;                                                  \
+    memcpy(&v, args, sizeof(T));                          \
+    args += sizeof(T);                                    \
+    n = snprintf(&line[pos], size - pos, spec, v);        \
+  }                                                       \
+  break
+
+static void log_format(char *line, int size, const char *fmt,
+                       const char *args) {
+  const char *p = fmt;
+  int pos = 0;
+
+  while (*p && pos < size - 1) {
+    if (*p != '%') {
+      line[pos++] = *p++;
+      continue;
+    }
+
+    const char *end;
+    char spec[LOG_SPEC_MAXSIZE];
+    char type = log_arg_type(p, &end);
+    int n = 0;
+
+    memcpy(spec, p, end - p);
+    spec[end - p] = 0;
+    p = end;
+
+    switch (type) {
+      case LOG_ARG_NONE:
+        line[pos++] = '%';
+        break;
+      case LOG_ARG_INT:
+        LOG_UNPACK(int);
+      case LOG_ARG_LONG:
+        LOG_UNPACK(long);
+      case LOG_ARG_LLONG:
+        LOG_UNPACK(long long);
+      case LOG_ARG_SIZE:
+        LOG_UNPACK(size_t);
+      case LOG_ARG_DOUBLE:
+        LOG_UNPACK(double);
+      case LOG_ARG_PTR:
+        LOG_UNPACK(void *);
+      case LOG_ARG_STR:
+        n = snprintf(&line[pos], size - pos, spec, args);
+        args += strlen(args) + 1;
+        break;
+    }
+
+    if (n > 0) pos += n;
+    if (pos > size - 1) pos = size - 1;
+  }
+
+  line[pos] = 0;
+}
+
+// Reserves size bytes (multiple of 4) in one piece, NULL when the ring is
+// full. Published by log_commit().
+static char *log_reserve(unsigned int size) {
+  unsigned int head = log_head;
+  unsigned int used = head - __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE);
+  unsigned int pos = head % LOG_RING_SIZE;
+  unsigned int contiguous = LOG_RING_SIZE - pos;
+
+  if (contiguous < size) {
+    // The record never wraps; the end of the ring is skipped instead
+    if (used + contiguous + size > LOG_RING_SIZE) return NULL;
+
+    TLogRecordHeader pad = {(unsigned short)contiguous, 0, LOG_RECORD_PAD};
+    memcpy(&log_ring[pos], &pad, sizeof(pad));
+    __atomic_store_n(&log_head, head + contiguous, __ATOMIC_RELEASE);
+    pos = 0;
+  } else if (used + size > LOG_RING_SIZE) {
+    return NULL;
+  }
+
+  return &log_ring[pos];
+}
+
+static void log_commit(unsigned int size) {
+  __atomic_store_n(&log_head, log_head + size, __ATOMIC_RELEASE);
+}
+
+static void log_push(unsigned char pri, unsigned char kind, const void *body,
+                     unsigned int body_size) {
+  TLogRecordHeader header;
+  header.size = (sizeof(TLogRecordHeader) + body_size + 3) & ~3U;
+  header.pri = pri;
+  header.kind = kind;
+
+  char *record = log_reserve(header.size);
+  if (record == NULL) {
+    log_dropped++;
+    return;
+  }
+
+  memcpy(record, &header, sizeof(header));
+  memcpy(&record[sizeof(header)], body, body_size);
+  log_commit(header.size);
+}
+
+void LOG_ICACHE_FLASH supla_log(int __pri, const char *__fmt, ...) {
+  char body[LOG_RECORD_SIZE - sizeof(TLogRecordHeader)];
+  va_list ap;
+  int len;
+
+  if (__fmt == NULL || __pri > supla_log_get_level()) return;
+
+  memcpy(body, &__fmt, sizeof(__fmt));
+
+  va_start(ap, __fmt);
+  len = log_pack(&body[sizeof(__fmt)], sizeof(body) - sizeof(__fmt), __fmt,
+                 ap);
+  va_end(ap);
+
+  if (len >= 0) {
+    log_push(__pri, LOG_RECORD_FMT, body, sizeof(__fmt) + len);
+    return;
+  }
+
+  // Not deferrable, formatted right away
+  va_start(ap, __fmt);
+  len = vsnprintf(body, sizeof(body), __fmt, ap);
+  va_end(ap);
+
+  if (len >= 0) {
+    log_push(__pri, LOG_RECORD_TEXT, body, strlen(body) + 1);
+  }
+}
+
+#ifdef SUPLA_DEBUG_WIRE
+void LOG_ICACHE_FLASH supla_log_hex(int __pri, const char *prefix,
+                                    const void *buf, unsigned int size) {
+  char body[sizeof(TLogHexHeader) + LOG_HEX_MAXSIZE];
+  TLogHexHeader hex;
+
+  if (buf == NULL || size == 0 || __pri > supla_log_get_level()) return;
+
+  hex.prefix = prefix;
+  hex.total_size = size > 0xFFFF ? 0xFFFF : size;
+  hex.size = size > LOG_HEX_MAXSIZE ? LOG_HEX_MAXSIZE : size;
+
+  if (__atomic_load_n(&log_hex_allowance, __ATOMIC_ACQUIRE) - log_hex_spent <
+      hex.size) {
+    __atomic_store_n(&log_hex_skipped, log_hex_skipped + size,
+                     __ATOMIC_RELAXED);
+    return;
+  }
+
+  __atomic_store_n(&log_hex_spent, log_hex_spent + hex.size,
+                   __ATOMIC_RELEASE);
+
+  memcpy(body, &hex, sizeof(hex));
+  memcpy(&body[sizeof(hex)], buf, hex.size);
+  log_push(__pri, LOG_RECORD_HEX, body, sizeof(hex) + hex.size);
+}
+
+static void log_drain_hex(_supla_log_sink sink, int pri, const char *body) {
+  const unsigned char *bytes = (const unsigned char *)&body[sizeof(TLogHexHeader)];
+  TLogHexHeader hex;
+  char line[LOG_LINE_SIZE];
+
+  memcpy(&hex, body, sizeof(hex));
+
+  for (unsigned int i = 0; i < hex.size; i += 16) {
+    unsigned int chunk = hex.size - i < 16 ? hex.size - i : 16;
+    int pos = snprintf(line, sizeof(line), "%.16s %04X: ",
+                       hex.prefix ? hex.prefix : "", i);
+
+    for (unsigned int j = 0; j < chunk; j++) {
+      pos += snprintf(&line[pos], sizeof(line) - pos, "%02X ", bytes[i + j]);
+    }
+
+    pos += snprintf(&line[pos], sizeof(line) - pos, " | ");
+
+    for (unsigned int j = 0; j < chunk; j++) {
+      line[pos++] = bytes[i + j] >= 32 && bytes[i + j] < 127 ? bytes[i + j] : '.';
+    }
+
+    line[pos] = 0;
+    sink(pri, line);
+  }
+
+  if (hex.total_size > hex.size) {
+    snprintf(line, sizeof(line), "%.16s ... %u more bytes",
+             hex.prefix ? hex.prefix : "",
+             (unsigned int)(hex.total_size - hex.size));
+    sink(pri, line);
+  }
+}
+
+static void log_refill_hex(unsigned int now_ms) {
+  if (!log_hex_refill_started) {
+    log_hex_refill_started = 1;
+    log_hex_refilled_at = now_ms;
+    return;
+  }
+
+  unsigned int elapsed = now_ms - log_hex_refilled_at;
+  unsigned int refill = elapsed * LOG_HEX_RATE / 1000;
+
+  if (refill == 0) return;
+  log_hex_refilled_at += refill * 1000 / LOG_HEX_RATE;
+
+  unsigned int spent = __atomic_load_n(&log_hex_spent, __ATOMIC_ACQUIRE);
+  unsigned int allowance = log_hex_allowance + refill;
+
+  if (allowance - spent > LOG_HEX_BURST) {
+    allowance = spent + LOG_HEX_BURST;
+  }
+
+  __atomic_store_n(&log_hex_allowance, allowance, __ATOMIC_RELEASE);
+}
+#endif /*SUPLA_DEBUG_WIRE*/
+
+int LOG_ICACHE_FLASH supla_log_drain(_supla_log_sink sink, int max_records,
+                                     unsigned int now_ms) {
+  char line[LOG_LINE_SIZE];
+  int count = 0;
+
+#ifdef SUPLA_DEBUG_WIRE
+  log_refill_hex(now_ms);
+#else
+  (void)now_ms;
+#endif /*SUPLA_DEBUG_WIRE*/
+
+  unsigned int dropped = __atomic_load_n(&log_dropped, __ATOMIC_RELAXED);
+  if (dropped != log_dropped_reported) {
+    snprintf(line, sizeof(line), "%u log records dropped",
+             dropped - log_dropped_reported);
+    log_dropped_reported = dropped;
+    sink(LOG_WARNING, line);
+  }
+
+#ifdef SUPLA_DEBUG_WIRE
+  unsigned int skipped = __atomic_load_n(&log_hex_skipped, __ATOMIC_RELAXED);
+  if (skipped != log_hex_skipped_reported) {
+    snprintf(line, sizeof(line), "%u bytes of hex dump skipped",
+             skipped - log_hex_skipped_reported);
+    log_hex_skipped_reported = skipped;
+    sink(LOG_DEBUG, line);
+  }
+#endif /*SUPLA_DEBUG_WIRE*/
+
+  while (count < max_records) {
+    unsigned int tail = log_tail;
+    if (tail == __atomic_load_n(&log_head, __ATOMIC_ACQUIRE)) break;
+
+    const char *record = &log_ring[tail % LOG_RING_SIZE];
+    const char *body = &record[sizeof(TLogRecordHeader)];
+    TLogRecordHeader header;
+    memcpy(&header, record, sizeof(header));
+
+    switch (header.kind) {
+      case LOG_RECORD_FMT: {
+        const char *fmt;
+        memcpy(&fmt, body, sizeof(fmt));
+        log_format(line, sizeof(line), fmt, &body[sizeof(fmt)]);
+        sink(header.pri, line);
+        count++;
+      } break;
+      case LOG_RECORD_TEXT:
+        sink(header.pri, body);
+        count++;
+        break;
+#ifdef SUPLA_DEBUG_WIRE
+      case LOG_RECORD_HEX:
+        log_drain_hex(sink, header.pri, body);
+        count++;
+        break;
+#endif /*SUPLA_DEBUG_WIRE*/
+    }
+
+    __atomic_store_n(&log_tail, tail + header.size, __ATOMIC_RELEASE);
+  }
+
+  return count;
+}
+
+void LOG_ICACHE_FLASH supla_log_set_level(int level) {
+  __atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
+}
+
+int LOG_ICACHE_FLASH supla_log_get_level(void) {
+  return __atomic_load_n(&log_level, __ATOMIC_RELAXED);
+}
+
+void LOG_ICACHE_FLASH supla_write_state_file(const char *file, int __pri,
+                                             const char *__fmt, ...) {
+  (void)file;
+  (void)__pri;
+  (void)__fmt;
+}
@@ -63,6 +63,23 @@ void LOG_ICACHE_FLASH supla_log_set_callback(_supla_log_callback callback);
 #endif /*__LOG_CALLBACK*/
 
 void LOG_ICACHE_FLASH supla_log(int __pri, const char *__fmt, ...);
+// Logs len bytes of buf as hex lines; log.c keeps at most LOG_HEX_MAXSIZE
+// of them and drops dumps above LOG_HEX_RATE bytes per second. Without
+// SUPLA_DEBUG_WIRE the calls and the dump code are compiled out.
+#ifdef SUPLA_DEBUG_WIRE
+void LOG_ICACHE_FLASH supla_log_hex(int __pri, const char *prefix,
+                                    const void *buf, unsigned int len);
+#else
+#define supla_log_hex(__pri, prefix, buf, len) ((void)0)
+#endif /*SUPLA_DEBUG_WIRE*/
+void LOG_ICACHE_FLASH supla_log_set_level(int level);
+int LOG_ICACHE_FLASH supla_log_get_level(void);
+
+// Formats up to max_records deferred messages into sink and returns how
+// many were handed over. Backends that log synchronously return 0.
+typedef void (*_supla_log_sink)(int __pri, const char *message);
+int LOG_ICACHE_FLASH supla_log_drain(_supla_log_sink sink, int max_records,
+                                     unsigned int now_ms);
 void LOG_ICACHE_FLASH supla_write_state_file(const char *file, int __pri,
                                              const char *__fmt, ...);
 
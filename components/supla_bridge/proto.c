@@ -19,12 +19,19 @@
 #include "proto.h"
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "log.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif /*__SSE2__*/
+
 #if defined(ESP8266) || defined(ESP32)
 
 #if !defined(ARDUINO)
@@ -58,12 +65,28 @@
 #define BUFFER_MAX_SIZE 131072
 #endif /*BUFFER_MAX_SIZE*/
 
+// SPROTO_RING_BUFFER replaces the realloc'd, shift-on-pop buffers with
+// fixed-capacity rings allocated once in sproto_init().
+#ifdef SPROTO_RING_BUFFER
+#ifndef SPROTO_RING_BUFFER_SIZE
+#define SPROTO_RING_BUFFER_SIZE BUFFER_MAX_SIZE
+#endif /*SPROTO_RING_BUFFER_SIZE*/
+// Past the end of the input ring, the wrapped part of a frame is mirrored
+// there so that sproto_peek_in_sdp() can hand it out contiguous
+#define SPROTO_RING_SLACK_SIZE sizeof(TSuplaDataPacket)
+#endif /*SPROTO_RING_BUFFER*/
+
 char sproto_tag[SUPLA_TAG_SIZE] = {'S', 'U', 'P', 'L', 'A'};
 
 typedef struct {
   unsigned char begin_tag;
   unsigned _supla_int_t size;
   unsigned _supla_int_t data_size;
+  // Frame handed out by sproto_peek_in_sdp(), dropped on consume
+  unsigned _supla_int_t peek_size;
+#ifdef SPROTO_RING_BUFFER
+  unsigned _supla_int_t head;
+#endif /*SPROTO_RING_BUFFER*/
 
   char *buffer;
 } TSuplaProtoInBuffer;
@@ -72,6 +95,9 @@ typedef struct {
 typedef struct {
   unsigned _supla_int_t size;
   unsigned _supla_int_t data_size;
+#ifdef SPROTO_RING_BUFFER
+  unsigned _supla_int_t head;
+#endif /*SPROTO_RING_BUFFER*/
 
   char *buffer;
 } TSuplaProtoOutBuffer;
@@ -84,6 +110,11 @@ typedef struct {
 #ifndef SPROTO_WITHOUT_OUT_BUFFER
   TSuplaProtoOutBuffer out;
 #endif
+#ifndef SPROTO_WITHOUT_RESYNC
+  // Set from a resync until the next valid frame
+  unsigned char resyncing;
+  TSuplaProtoResyncStats resync;
+#endif /*SPROTO_WITHOUT_RESYNC*/
 } TSuplaProtoData;
 
 void *sproto_init(void) {
@@ -91,6 +122,25 @@ void *sproto_init(void) {
   if (spd) {
     memset(spd, 0, sizeof(TSuplaProtoData));
     spd->version = SUPLA_PROTO_VERSION;
+
+#ifdef SPROTO_RING_BUFFER
+    spd->in.size = SPROTO_RING_BUFFER_SIZE;
+    spd->in.buffer = malloc(SPROTO_RING_BUFFER_SIZE + SPROTO_RING_SLACK_SIZE);
+    if (spd->in.buffer == NULL) {
+      sproto_free(spd);
+      return (NULL);
+    }
+
+#ifndef SPROTO_WITHOUT_OUT_BUFFER
+    spd->out.size = SPROTO_RING_BUFFER_SIZE;
+    spd->out.buffer = malloc(SPROTO_RING_BUFFER_SIZE);
+    if (spd->out.buffer == NULL) {
+      sproto_free(spd);
+      return (NULL);
+    }
+#endif /*SPROTO_WITHOUT_OUT_BUFFER*/
+#endif /*SPROTO_RING_BUFFER*/
+
     return (spd);
   }
 
@@ -149,11 +199,87 @@ unsigned char PROTO_ICACHE_FLASH sproto_buffer_append(
   return (SUPLA_RESULT_TRUE);
 }
 
+#ifdef SPROTO_RING_BUFFER
+// offset may point past the end of the ring (head + n < 2 * size)
+static void PROTO_ICACHE_FLASH sproto_ring_write(
+    char *buffer, unsigned _supla_int_t size, unsigned _supla_int_t offset,
+    const char *data, unsigned _supla_int_t data_size) {
+  unsigned _supla_int_t first;
+
+  if (offset >= size) offset -= size;
+
+  first = size - offset;
+  if (first > data_size) first = data_size;
+
+  memcpy(&buffer[offset], data, first);
+  if (data_size > first) memcpy(buffer, &data[first], data_size - first);
+}
+
+static void PROTO_ICACHE_FLASH sproto_ring_read(
+    const char *buffer, unsigned _supla_int_t size,
+    unsigned _supla_int_t offset, char *data, unsigned _supla_int_t data_size) {
+  unsigned _supla_int_t first;
+
+  if (offset >= size) offset -= size;
+
+  first = size - offset;
+  if (first > data_size) first = data_size;
+
+  memcpy(data, &buffer[offset], first);
+  if (data_size > first) memcpy(&data[first], buffer, data_size - first);
+}
+
+static void PROTO_ICACHE_FLASH sproto_ring_consume(
+    unsigned _supla_int_t size, unsigned _supla_int_t *head,
+    unsigned _supla_int_t *data_size, unsigned _supla_int_t count) {
+  if (count > *data_size) count = *data_size;
+
+  *head += count;
+  if (*head >= size) *head -= size;
+
+  *data_size -= count;
+
+  // Empty ring: rewind so that the next packet is contiguous
+  if (*data_size == 0) *head = 0;
+}
+
+// Copies the first count bytes of the ring to the slack after its end, so
+// that data wrapping around the end can be read as one block. count is at
+// most SPROTO_RING_SLACK_SIZE.
+static void PROTO_ICACHE_FLASH sproto_ring_mirror(TSuplaProtoInBuffer *in,
+                                                  unsigned _supla_int_t count) {
+  memcpy(&in->buffer[in->size], in->buffer, count);
+}
+#endif /*SPROTO_RING_BUFFER*/
+
+// Copies size bytes starting offset bytes after the first unread one
+static void PROTO_ICACHE_FLASH sproto_in_read(TSuplaProtoInBuffer *in,
+                                              unsigned _supla_int_t offset,
+                                              char *data,
+                                              unsigned _supla_int_t size) {
+#ifdef SPROTO_RING_BUFFER
+  sproto_ring_read(in->buffer, in->size, in->head + offset, data, size);
+#else
+  memcpy(data, &in->buffer[offset], size);
+#endif /*SPROTO_RING_BUFFER*/
+}
+
 char PROTO_ICACHE_FLASH sproto_in_buffer_append(
     void *spd_ptr, char *data, unsigned _supla_int_t data_size) {
   TSuplaProtoData *spd = (TSuplaProtoData *)spd_ptr;
+#ifdef SPROTO_RING_BUFFER
+  if (data_size > spd->in.size - spd->in.data_size)
+    return (SUPLA_RESULT_BUFFER_OVERFLOW);
+
+  sproto_ring_write(spd->in.buffer, spd->in.size,
+                    spd->in.head + spd->in.data_size, data, data_size);
+  spd->in.data_size += data_size;
+
+  return (SUPLA_RESULT_TRUE);
+#else
   return sproto_buffer_append(spd_ptr, &spd->in.buffer, &spd->in.size,
                               &spd->in.data_size, data, data_size);
+#endif /*SPROTO_RING_BUFFER*/
 }
 
 #ifndef SPROTO_WITHOUT_OUT_BUFFER
@@ -166,38 +292,74 @@ char PROTO_ICACHE_FLASH sproto_out_buffer_append(void *spd_ptr,
 
   if (packet_size > sdp_size) return SUPLA_RESULT_DATA_TOO_LARGE;
 
+#ifdef SPROTO_RING_BUFFER
+  if (packet_size + SUPLA_TAG_SIZE > spd->out.size - spd->out.data_size)
+    return (SUPLA_RESULT_BUFFER_OVERFLOW);
+
+  sproto_ring_write(spd->out.buffer, spd->out.size,
+                    spd->out.head + spd->out.data_size, (char *)sdp,
+                    packet_size);
+  spd->out.data_size += packet_size;
+
+  sproto_ring_write(spd->out.buffer, spd->out.size,
+                    spd->out.head + spd->out.data_size, sproto_tag,
+                    SUPLA_TAG_SIZE);
+  spd->out.data_size += SUPLA_TAG_SIZE;
+
+  return (SUPLA_RESULT_TRUE);
+#else
   if (SUPLA_RESULT_TRUE ==
       sproto_buffer_append(spd_ptr, &spd->out.buffer, &spd->out.size,
                            &spd->out.data_size, (char *)sdp, packet_size)) {
-    return sproto_buffer_append(spd_ptr, &spd->out.buffer, &spd->out.size,
-                                &spd->out.data_size, sproto_tag,
-                                SUPLA_TAG_SIZE);
+    char result = sproto_buffer_append(spd_ptr, &spd->out.buffer,
+                                       &spd->out.size, &spd->out.data_size,
+                                       sproto_tag, SUPLA_TAG_SIZE);
+    // Never leave a packet without its closing tag in the buffer
+    if (result != SUPLA_RESULT_TRUE) spd->out.data_size -= packet_size;
+    return result;
   }
 
   return (SUPLA_RESULT_FALSE);
+#endif /*SPROTO_RING_BUFFER*/
 }
 
-unsigned _supla_int_t PROTO_ICACHE_FLASH sproto_pop_out_data(
-    void *spd_ptr, char *buffer, unsigned _supla_int_t buffer_size) {
-  unsigned _supla_int_t a;
-  unsigned _supla_int_t b;
-
+unsigned _supla_int_t PROTO_ICACHE_FLASH
+sproto_peek_out_data(void *spd_ptr, char **data) {
   TSuplaProtoData *spd = (TSuplaProtoData *)spd_ptr;
 
-  if (spd->out.data_size <= 0 || buffer_size == 0 || buffer == NULL) return (0);
+  if (spd->out.data_size == 0) return (0);
 
-  if (spd->out.data_size < buffer_size) buffer_size = spd->out.data_size;
+#ifdef SPROTO_RING_BUFFER
+  *data = &spd->out.buffer[spd->out.head];
+  if (spd->out.head + spd->out.data_size > spd->out.size) {
+    return spd->out.size - spd->out.head;
+  }
+#else
+  *data = spd->out.buffer;
+#endif /*SPROTO_RING_BUFFER*/
 
-  memcpy(buffer, spd->out.buffer, buffer_size);
+  return spd->out.data_size;
+}
 
-  b = 0;
+void PROTO_ICACHE_FLASH sproto_consume_out_data(void *spd_ptr,
+                                                unsigned _supla_int_t size) {
+  TSuplaProtoData *spd = (TSuplaProtoData *)spd_ptr;
+
+  if (size > spd->out.data_size) size = spd->out.data_size;
 
-  for (a = buffer_size; a < spd->out.data_size; a++) {
+#ifdef SPROTO_RING_BUFFER
+  sproto_ring_consume(spd->out.size, &spd->out.head, &spd->out.data_size,
+                      size);
+#else
+  unsigned _supla_int_t a;
+  unsigned _supla_int_t b = 0;
+
+  for (a = size; a < spd->out.data_size; a++) {
     spd->out.buffer[b] = spd->out.buffer[a];
     b++;
   }
 
-  spd->out.data_size -= buffer_size;
+  spd->out.data_size -= size;
 
   if (spd->out.data_size < spd->out.size) {
     b = spd->out.size;
@@ -215,6 +377,25 @@ unsigned _supla_int_t PROTO_ICACHE_FLASH sproto_pop_out_data(
       }
     }
   }
+#endif /*SPROTO_RING_BUFFER*/
+}
+
+unsigned _supla_int_t PROTO_ICACHE_FLASH sproto_pop_out_data(
+    void *spd_ptr, char *buffer, unsigned _supla_int_t buffer_size) {
+  TSuplaProtoData *spd = (TSuplaProtoData *)spd_ptr;
+
+  if (spd->out.data_size <= 0 || buffer_size == 0 || buffer == NULL) return (0);
+
+  if (spd->out.data_size < buffer_size) buffer_size = spd->out.data_size;
+
+#ifdef SPROTO_RING_BUFFER
+  sproto_ring_read(spd->out.buffer, spd->out.size, spd->out.head, buffer,
+                   buffer_size);
+#else
+  memcpy(buffer, spd->out.buffer, buffer_size);
+#endif /*SPROTO_RING_BUFFER*/
+
+  sproto_consume_out_data(spd_ptr, buffer_size);
 
   return (buffer_size);
 }
@@ -237,10 +418,16 @@ char PROTO_ICACHE_FLASH sproto_in_dataexists(void *spd_ptr) {
 
 void PROTO_ICACHE_FLASH sproto_shrink_in_buffer(TSuplaProtoInBuffer *in,
                                                 unsigned _supla_int_t size) {
+#ifdef SPROTO_RING_BUFFER
+  in->begin_tag = 0;
+  in->peek_size = 0;
+  sproto_ring_consume(in->size, &in->head, &in->data_size, size);
+#else
   unsigned _supla_int_t old_size = in->size;
   unsigned _supla_int_t a, b;
 
   in->begin_tag = 0;
+  in->peek_size = 0;
 
   if (size > in->data_size) size = in->data_size;
 
@@ -268,20 +455,144 @@ void PROTO_ICACHE_FLASH sproto_shrink_in_buffer(TSuplaProtoInBuffer *in,
       }
     }
   }
+#endif /*SPROTO_RING_BUFFER*/
 }
 
-char PROTO_ICACHE_FLASH sproto_pop_in_sdp(void *spd_ptr,
-                                          TSuplaDataPacket *sdp) {
+static inline char PROTO_ICACHE_FLASH sproto_tag_at(
+    const unsigned char *data, unsigned _supla_int_t size) {
+  if (size > SUPLA_TAG_SIZE) size = SUPLA_TAG_SIZE;
+  return data[0] == 'S' && memcmp(data, sproto_tag, size) == 0;
+}
+
+unsigned _supla_int_t PROTO_ICACHE_FLASH
+sproto_find_tag(const char *data, unsigned _supla_int_t size) {
+  const unsigned char *p = (const unsigned char *)data;
+  unsigned _supla_int_t i = 0;
+
+#if defined(__SSE2__)
+  // 'S', 'U' and 'A' compared at their offsets, 16 candidates per step
+  const __m128i s = _mm_set1_epi8('S');
+  const __m128i u = _mm_set1_epi8('U');
+  const __m128i a = _mm_set1_epi8('A');
+
+  for (; i + 16 + SUPLA_TAG_SIZE - 1 <= size; i += 16) {
+    __m128i m = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&p[i]), s);
+    m = _mm_and_si128(
+        m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&p[i + 1]), u));
+    m = _mm_and_si128(
+        m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&p[i + 4]), a));
+
+    unsigned int mask = (unsigned int)_mm_movemask_epi8(m);
+    while (mask) {
+      unsigned _supla_int_t n = i + __builtin_ctz(mask);
+      if (memcmp(&p[n], sproto_tag, SUPLA_TAG_SIZE) == 0) return n;
+      mask &= mask - 1;
+    }
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t s = vdupq_n_u8('S');
+  const uint8x16_t u = vdupq_n_u8('U');
+  const uint8x16_t a = vdupq_n_u8('A');
+
+  for (; i + 16 + SUPLA_TAG_SIZE - 1 <= size; i += 16) {
+    uint8x16_t m = vceqq_u8(vld1q_u8(&p[i]), s);
+    m = vandq_u8(m, vceqq_u8(vld1q_u8(&p[i + 1]), u));
+    m = vandq_u8(m, vceqq_u8(vld1q_u8(&p[i + 4]), a));
+
+    // 4 bits per byte lane
+    uint64_t mask = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+    while (mask) {
+      unsigned _supla_int_t n = i + (__builtin_ctzll(mask) >> 2);
+      if (memcmp(&p[n], sproto_tag, SUPLA_TAG_SIZE) == 0) return n;
+      mask &= ~(0xFULL << (__builtin_ctzll(mask) & ~3));
+    }
+  }
+#else
+  // Word at a time on aligned loads (Xtensa cannot load unaligned words):
+  // only words holding an 'S' byte are looked at bytewise
+  while (i < size && ((uintptr_t)&p[i] & 3)) {
+    if (sproto_tag_at(&p[i], size - i)) return i;
+    i++;
+  }
+
+  for (; i + 4 + SUPLA_TAG_SIZE - 1 <= size; i += 4) {
+    uint32_t w;
+    memcpy(&w, &p[i], sizeof(w));
+    w ^= 0x53535353UL;
+    if (((w - 0x01010101UL) & ~w & 0x80808080UL) == 0) continue;
+
+    for (unsigned char b = 0; b < 4; b++) {
+      if (sproto_tag_at(&p[i + b], SUPLA_TAG_SIZE)) return i + b;
+    }
+  }
+#endif /*__SSE2__*/
+
+  // Tail, including a tag cut off by the end of data
+  for (; i < size; i++) {
+    if (sproto_tag_at(&p[i], size - i)) return i;
+  }
+
+  return size;
+}
+
+#ifndef SPROTO_WITHOUT_RESYNC
+// Drops the byte at the front of the input buffer and everything up to the
+// next tag (or the start of a tag cut off by the end of the data received so
+// far).
+static void PROTO_ICACHE_FLASH sproto_resync_in_buffer(TSuplaProtoData *spd) {
+  unsigned _supla_int_t skip;
+
+#ifdef SPROTO_RING_BUFFER
+  unsigned _supla_int_t start = spd->in.head + 1;  // may be in.size
+  unsigned _supla_int_t rest = spd->in.data_size - 1;
+
+  if (start + rest <= spd->in.size) {
+    skip = 1 + sproto_find_tag(&spd->in.buffer[start], rest);
+  } else {
+    // Two segments. The first one is scanned with up to SUPLA_TAG_SIZE - 1
+    // bytes of the second mirrored after it, for a tag across the end of the
+    // ring. A tag found at or past the end of the ring is found again in the
+    // second segment.
+    unsigned _supla_int_t first = spd->in.size - start;
+    unsigned _supla_int_t extra = rest - first;
+
+    if (extra > SUPLA_TAG_SIZE - 1) extra = SUPLA_TAG_SIZE - 1;
+    sproto_ring_mirror(&spd->in, extra);
+
+    skip = sproto_find_tag(&spd->in.buffer[start], first + extra);
+    if (skip >= first) {
+      skip = first + sproto_find_tag(spd->in.buffer, rest - first);
+    }
+    skip++;
+  }
+#else
+  skip = 1 + sproto_find_tag(&spd->in.buffer[1], spd->in.data_size - 1);
+#endif /*SPROTO_RING_BUFFER*/
+
+  spd->resyncing = 1;
+  spd->resync.count++;
+  spd->resync.discarded += skip;
+  sproto_shrink_in_buffer(&spd->in, skip);
+}
+#endif /*SPROTO_WITHOUT_RESYNC*/
+
+// Validates the frame at the front of the input buffer. On success *size is
+// the frame length without the closing tag.
+static char PROTO_ICACHE_FLASH sproto_check_in_frame(
+    TSuplaProtoData *spd, unsigned _supla_int_t *size, unsigned char *version) {
   unsigned _supla_int_t header_size;
   TSuplaDataPacket *_sdp;
-
-  TSuplaProtoData *spd = (TSuplaProtoData *)spd_ptr;
+  char tag[SUPLA_TAG_SIZE];
+#ifdef SPROTO_RING_BUFFER
+  char header[sizeof(TSuplaDataPacket) - SUPLA_MAX_DATA_SIZE];
+#endif /*SPROTO_RING_BUFFER*/
 
   if (spd->in.begin_tag == 0 && spd->in.data_size >= SUPLA_TAG_SIZE) {
-    if (memcmp(spd->in.buffer, sproto_tag, SUPLA_TAG_SIZE) == 0) {
+    sproto_in_read(&spd->in, 0, tag, SUPLA_TAG_SIZE);
+    if (memcmp(tag, sproto_tag, SUPLA_TAG_SIZE) == 0) {
       spd->in.begin_tag = 1;
     } else {
-      sproto_shrink_in_buffer(&spd->in, spd->in.data_size);
       return SUPLA_RESULT_DATA_ERROR;
     }
   }
@@ -289,36 +600,45 @@ char PROTO_ICACHE_FLASH sproto_pop_in_sdp(void *spd_ptr,
   if (spd->in.begin_tag == 1) {
     header_size = sizeof(TSuplaDataPacket) - SUPLA_MAX_DATA_SIZE;
     if ((spd->in.data_size - SUPLA_TAG_SIZE) >= header_size) {
+#ifdef SPROTO_RING_BUFFER
+      // The header itself may wrap around the end of the ring
+      sproto_in_read(&spd->in, 0, header, header_size);
+      _sdp = (TSuplaDataPacket *)header;
+#else
       _sdp = (TSuplaDataPacket *)spd->in.buffer;
+#endif /*SPROTO_RING_BUFFER*/
 
       if (_sdp->version > SUPLA_PROTO_VERSION ||
           _sdp->version < SUPLA_PROTO_VERSION_MIN) {
-        sdp->version = _sdp->version;
+#ifndef SPROTO_WITHOUT_RESYNC
+        // A tag found by resync may be part of a payload, its "version"
+        // says nothing about the peer
+        if (spd->resyncing) return SUPLA_RESULT_DATA_ERROR;
+#endif /*SPROTO_WITHOUT_RESYNC*/
+        *version = _sdp->version;
         sproto_shrink_in_buffer(&spd->in, spd->in.data_size);
 
         return SUPLA_RESULT_VERSION_ERROR;
       }
 
       if ((header_size + _sdp->data_size) > sizeof(TSuplaDataPacket)) {
-        sproto_shrink_in_buffer(&spd->in, spd->in.data_size);
         return SUPLA_RESULT_DATA_ERROR;
       }
 
       if ((header_size + _sdp->data_size + SUPLA_TAG_SIZE) > spd->in.data_size)
         return SUPLA_RESULT_FALSE;
 
-      if (header_size + _sdp->data_size >= spd->in.size ||
-          memcmp(&spd->in.buffer[header_size + _sdp->data_size], sproto_tag,
-                 SUPLA_TAG_SIZE) != 0) {
-        sproto_shrink_in_buffer(&spd->in, spd->in.data_size);
-
+      if (header_size + _sdp->data_size >= spd->in.size) {
         return SUPLA_RESULT_DATA_ERROR;
       }
 
-      memcpy(sdp, spd->in.buffer, header_size + _sdp->data_size);
-      sproto_shrink_in_buffer(&spd->in,
-                              header_size + _sdp->data_size + SUPLA_TAG_SIZE);
+      sproto_in_read(&spd->in, header_size + _sdp->data_size, tag,
+                     SUPLA_TAG_SIZE);
+      if (memcmp(tag, sproto_tag, SUPLA_TAG_SIZE) != 0) {
+        return SUPLA_RESULT_DATA_ERROR;
+      }
 
+      *size = header_size + _sdp->data_size;
       return (SUPLA_RESULT_TRUE);
     }
   }
@@ -326,6 +646,86 @@ char PROTO_ICACHE_FLASH sproto_pop_in_sdp(void *spd_ptr,
   return (SUPLA_RESULT_FALSE);
 }
 
+// Without SPROTO_WITHOUT_RESYNC a malformed frame costs only the bytes up to
+// the next tag instead of the whole input buffer, and is not reported: the
+// next frame, if any, is validated right away.
+static char PROTO_ICACHE_FLASH sproto_check_in_sdp(
+    TSuplaProtoData *spd, unsigned _supla_int_t *size, unsigned char *version) {
+  char result;
+
+  while ((result = sproto_check_in_frame(spd, size, version)) ==
+         (char)SUPLA_RESULT_DATA_ERROR) {
+#ifdef SPROTO_WITHOUT_RESYNC
+    sproto_shrink_in_buffer(&spd->in, spd->in.data_size);
+    break;
+#else
+    sproto_resync_in_buffer(spd);
+#endif /*SPROTO_WITHOUT_RESYNC*/
+  }
+
+#ifndef SPROTO_WITHOUT_RESYNC
+  if (result == SUPLA_RESULT_TRUE) spd->resyncing = 0;
+#endif /*SPROTO_WITHOUT_RESYNC*/
+
+  return result;
+}
+
+char PROTO_ICACHE_FLASH sproto_pop_in_sdp(void *spd_ptr,
+                                          TSuplaDataPacket *sdp) {
+  TSuplaProtoData *spd = (TSuplaProtoData *)spd_ptr;
+  unsigned _supla_int_t size = 0;
+  unsigned char version = 0;
+
+  char result = sproto_check_in_sdp(spd, &size, &version);
+
+  if (result == SUPLA_RESULT_TRUE) {
+    sproto_in_read(&spd->in, 0, (char *)sdp, size);
+    sproto_shrink_in_buffer(&spd->in, size + SUPLA_TAG_SIZE);
+  } else if (result == (char)SUPLA_RESULT_VERSION_ERROR) {
+    sdp->version = version;
+  }
+
+  return result;
+}
+
+char PROTO_ICACHE_FLASH sproto_peek_in_sdp(void *spd_ptr,
+                                           TSuplaDataPacket **sdp,
+                                           unsigned char *version) {
+  TSuplaProtoData *spd = (TSuplaProtoData *)spd_ptr;
+  unsigned _supla_int_t size = 0;
+  unsigned char _version = 0;
+
+  char result = sproto_check_in_sdp(spd, &size, &_version);
+
+  if (result == SUPLA_RESULT_TRUE) {
+#ifdef SPROTO_RING_BUFFER
+    // The frame is at most sizeof(TSuplaDataPacket), so its wrapped part
+    // fits in the slack. Bytes appended before it is consumed go to the ring
+    // and leave the mirror alone.
+    if (spd->in.head + size > spd->in.size) {
+      sproto_ring_mirror(&spd->in, spd->in.head + size - spd->in.size);
+    }
+    *sdp = (TSuplaDataPacket *)&spd->in.buffer[spd->in.head];
+#else
+    *sdp = (TSuplaDataPacket *)spd->in.buffer;
+#endif /*SPROTO_RING_BUFFER*/
+    spd->in.peek_size = size + SUPLA_TAG_SIZE;
+  } else if (result == (char)SUPLA_RESULT_VERSION_ERROR && version) {
+    *version = _version;
+  }
+
+  return result;
+}
+
+void PROTO_ICACHE_FLASH sproto_consume_in_sdp(void *spd_ptr) {
+  TSuplaProtoData *spd = (TSuplaProtoData *)spd_ptr;
+
+  if (spd->in.peek_size > 0) {
+    sproto_shrink_in_buffer(&spd->in, spd->in.peek_size);
+    spd->in.peek_size = 0;
+  }
+}
+
 void PROTO_ICACHE_FLASH sproto_set_version(void *spd_ptr,
                                            unsigned char version) {
   if (version >= SUPLA_PROTO_VERSION_MIN && version <= SUPLA_PROTO_VERSION) {
@@ -376,6 +776,13 @@ char PROTO_ICACHE_FLASH sproto_set_data(TSuplaDataPacket *sdp, char *data,
   return SUPLA_RESULT_TRUE;
 }
 
+#ifndef SPROTO_WITHOUT_RESYNC
+void PROTO_ICACHE_FLASH sproto_get_resync_stats(void *spd_ptr,
+                                                TSuplaProtoResyncStats *stats) {
+  *stats = ((TSuplaProtoData *)spd_ptr)->resync;
+}
+#endif /*SPROTO_WITHOUT_RESYNC*/
+
 void PROTO_ICACHE_FLASH sproto_log_summary(void *spd_ptr) {
   if (spd_ptr == NULL) {
     supla_log(LOG_DEBUG, "SPROTO - Not initialized!");
@@ -388,10 +795,20 @@ void PROTO_ICACHE_FLASH sproto_log_summary(void *spd_ptr) {
   supla_log(LOG_DEBUG, "         size: %i", spd->in.size);
   supla_log(LOG_DEBUG, "    data_size: %i", spd->in.data_size);
   supla_log(LOG_DEBUG, "    begin_tag: %i", spd->in.begin_tag);
+#ifdef SPROTO_RING_BUFFER
+  supla_log(LOG_DEBUG, "         head: %i", spd->in.head);
+#endif /*SPROTO_RING_BUFFER*/
+#ifndef SPROTO_WITHOUT_RESYNC
+  supla_log(LOG_DEBUG, "       resync: %i", spd->resync.count);
+  supla_log(LOG_DEBUG, "    discarded: %i", spd->resync.discarded);
+#endif /*SPROTO_WITHOUT_RESYNC*/
 #ifndef SPROTO_WITHOUT_OUT_BUFFER
   supla_log(LOG_DEBUG, "BUFFER OUT");
   supla_log(LOG_DEBUG, "         size: %i", spd->out.size);
   supla_log(LOG_DEBUG, "    data_size: %i", spd->out.data_size);
+#ifdef SPROTO_RING_BUFFER
+  supla_log(LOG_DEBUG, "         head: %i", spd->out.head);
+#endif /*SPROTO_RING_BUFFER*/
 #endif /*SPROTO_WITHOUT_OUT_BUFFER*/
 }
 
@@ -399,21 +816,40 @@ void PROTO_ICACHE_FLASH sproto_buffer_dump(void *spd_ptr, unsigned char in) {
   _supla_int_t a;
   char *buffer = NULL;
   _supla_int_t size = 0;
+#ifdef SPROTO_RING_BUFFER
+  _supla_int_t capacity = 1;
+  _supla_int_t head = 0;
+#endif /*SPROTO_RING_BUFFER*/
 
   TSuplaProtoData *spd = (TSuplaProtoData *)spd_ptr;
 
   if (in != 0) {
     buffer = spd->in.buffer;
     size = spd->in.data_size;
+#ifdef SPROTO_RING_BUFFER
+    capacity = spd->in.size;
+    head = spd->in.head;
+#endif /*SPROTO_RING_BUFFER*/
 #ifndef SPROTO_WITHOUT_OUT_BUFFER
   } else {
     buffer = spd->out.buffer;
     size = spd->out.data_size;
+#ifdef SPROTO_RING_BUFFER
+    capacity = spd->out.size;
+    head = spd->out.head;
+#endif /*SPROTO_RING_BUFFER*/
 #endif /*SPROTO_WITHOUT_OUT_BUFFER*/
   }
 
+#ifdef SPROTO_RING_BUFFER
+  for (a = 0; a < size; a++) {
+    char c = buffer[(head + a) % capacity];
+    supla_log(LOG_DEBUG, "%c [%i]", c, c);
+  }
+#else
   for (a = 0; a < size; a++)
     supla_log(LOG_DEBUG, "%c [%i]", buffer[a], buffer[a]);
+#endif /*SPROTO_RING_BUFFER*/
 }
 
 void PROTO_ICACHE_FLASH sproto_set_null_terminated_string(
@@ -16,7 +16,10 @@
  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
+// The component targets ESP8266; host/ builds it natively (SUPLA_HOST_BUILD)
+#if !defined(ESP8266) && !defined(SUPLA_HOST_BUILD)
 #define ESP8266
+#endif
 
 #ifndef supla_proto_H_
 #define supla_proto_H_
@@ -122,7 +125,9 @@ extern char sproto_tag[SUPLA_TAG_SIZE];
 // SC  - server -> client
 
 //#define SUPLA_PROTO_VERSION 28
-#define SUPLA_PROTO_VERSION 6
+// Highest version with every device call implemented in srpc.c; the bridge
+// negotiates down with SUPLA_DCS_CALL_GETVERSION
+#define SUPLA_PROTO_VERSION 25
 #define SUPLA_PROTO_VERSION_MIN 1
 
 #if defined(ARDUINO_ARCH_AVR) || defined(ARDUINO) || defined(SUPLA_DEVICE)
@@ -1047,6 +1052,21 @@ typedef struct {
 } TDS_SuplaRegisterDevice_C;            // ver. >= 6
 //#pragma pack(pop)
 
+typedef struct {
+  // device -> server
+
+  _supla_int_t LocationID;
+  char LocationPWD[SUPLA_LOCATION_PWD_MAXSIZE];  // UTF8
+
+  char GUID[SUPLA_GUID_SIZE];
+  char Name[SUPLA_DEVICE_NAME_MAXSIZE];  // UTF8
+  char SoftVer[SUPLA_SOFTVER_MAXSIZE];
+
+  char ServerName[SUPLA_SERVER_NAME_MAXSIZE];
+
+  unsigned char channel_count;
+} TDS_SuplaRegisterDeviceHeader_C;  // ver. >= 6
+
 typedef struct {
   // device -> server
 
@@ -3904,6 +3924,13 @@ typedef struct {
 
 #pragma pack(pop)
 
+#ifndef SPROTO_WITHOUT_RESYNC
+typedef struct {
+  unsigned _supla_int_t count;      // malformed frames skipped
+  unsigned _supla_int_t discarded;  // bytes dropped while looking for a tag
+} TSuplaProtoResyncStats;
+#endif /*SPROTO_WITHOUT_RESYNC*/
+
 void *PROTO_ICACHE_FLASH sproto_init(void);
 void PROTO_ICACHE_FLASH sproto_free(void *spd_ptr);
 
@@ -3912,13 +3939,37 @@ char PROTO_ICACHE_FLASH sproto_out_buffer_append(void *spd_ptr,
                                                  TSuplaDataPacket *sdp);
 unsigned _supla_int_t sproto_pop_out_data(void *spd_ptr, char *buffer,
                                           unsigned _supla_int_t buffer_size);
+// Zero-copy counterpart of sproto_pop_out_data(): *data points at the
+// pending output, the return value is how many bytes of it are contiguous
+// (all of them unless a ring buffer wraps). Drop what was written with
+// sproto_consume_out_data().
+unsigned _supla_int_t PROTO_ICACHE_FLASH sproto_peek_out_data(void *spd_ptr,
+                                                              char **data);
+void PROTO_ICACHE_FLASH sproto_consume_out_data(void *spd_ptr,
+                                                unsigned _supla_int_t size);
 #endif /*SPROTO_WITHOUT_OUT_BUFFER*/
 char PROTO_ICACHE_FLASH sproto_out_dataexists(void *spd_ptr);
 char PROTO_ICACHE_FLASH sproto_in_buffer_append(
     void *spd_ptr, char *data, unsigned _supla_int_t data_size);
 
 char PROTO_ICACHE_FLASH sproto_pop_in_sdp(void *spd_ptr, TSuplaDataPacket *sdp);
+// Zero-copy counterpart of sproto_pop_in_sdp(). On SUPLA_RESULT_TRUE *sdp
+// points at the validated frame inside the input buffer; only its header and
+// data_size bytes of data may be accessed. The view stays valid until
+// sproto_consume_in_sdp() or the next sproto_in_buffer_append().
+char PROTO_ICACHE_FLASH sproto_peek_in_sdp(void *spd_ptr,
+                                           TSuplaDataPacket **sdp,
+                                           unsigned char *version);
+void PROTO_ICACHE_FLASH sproto_consume_in_sdp(void *spd_ptr);
 char PROTO_ICACHE_FLASH sproto_in_dataexists(void *spd_ptr);
+// Offset of the first sproto_tag in data, or of a tag prefix running to the
+// end of data; size when there is neither
+unsigned _supla_int_t PROTO_ICACHE_FLASH
+sproto_find_tag(const char *data, unsigned _supla_int_t size);
+#ifndef SPROTO_WITHOUT_RESYNC
+void PROTO_ICACHE_FLASH sproto_get_resync_stats(void *spd_ptr,
+                                                TSuplaProtoResyncStats *stats);
+#endif /*SPROTO_WITHOUT_RESYNC*/
 
 unsigned char PROTO_ICACHE_FLASH sproto_get_version(void *spd_ptr);
 void PROTO_ICACHE_FLASH sproto_set_version(void *spd_ptr,
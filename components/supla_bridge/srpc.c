@@ -18,6 +18,7 @@
 
 #include "srpc.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -32,7 +33,7 @@
 #endif /*__EH_DISABLED*/
 #define SRPC_BUFFER_SIZE 256
 #define SRPC_QUEUE_SIZE 2
-#define SRPC_QUEUE_MIN_ALLOC_COUNT 2
+#define SRPC_QUEUE_POOL_SIZE 512
 
 #if !defined(ESP32)
 #include <mem.h>
@@ -41,6 +42,7 @@
 
 #if defined(ARDUINO_ARCH_ESP8266)
 #include <ets_sys.h>
+#include <pgmspace.h>
 #elif defined(ARDUINO_ARCH_ESP32)
 #else
 // ESP8266 nonos SDK target
@@ -51,9 +53,10 @@
 
 // ARDUINO MEGA
 #elif defined(__AVR__)
+#include <avr/pgmspace.h>
 #define SRPC_BUFFER_SIZE 32
 #define SRPC_QUEUE_SIZE 1
-#define SRPC_QUEUE_MIN_ALLOC_COUNT 1
+#define SRPC_QUEUE_POOL_SIZE 64
 #define __EH_DISABLED
 
 // OTHER SUPLA_DEVICE
@@ -76,16 +79,42 @@
 #define SRPC_QUEUE_SIZE 10
 #endif /*SRPC_QUEUE_SIZE*/
 
-#ifndef SRPC_QUEUE_MIN_ALLOC_COUNT
-#define SRPC_QUEUE_MIN_ALLOC_COUNT 0
-#endif /*SRPC_QUEUE_MIN_ALLOC_COUNT*/
+// Bytes of freed queue entries a queue keeps for reuse
+#ifndef SRPC_QUEUE_POOL_SIZE
+#define SRPC_QUEUE_POOL_SIZE 4096
+#endif /*SRPC_QUEUE_POOL_SIZE*/
 
+// Queue entries come in size classes of 64, 256 and 1024 data bytes, and
+// SUPLA_MAX_DATA_SIZE for the rest
+#define SRPC_QUEUE_CLASS_COUNT 4
+
+#define SRPC_PACKET_SIZE(data_size) \
+  (sizeof(TSuplaDataPacket) - SUPLA_MAX_DATA_SIZE + (data_size))
+
+#ifdef SRPC_QUEUE_SPSC
+// Single-producer/single-consumer ring of packets preallocated in
+// srpc_init(). head is advanced only by the consumer and tail only by the
+// producer, each published with a release store, so the two sides never
+// wait for each other. The counters run freely; tail - head is the count.
+typedef struct {
+  unsigned _supla_int_t head;
+  unsigned _supla_int_t tail;
+
+  TSuplaDataPacket *item;
+} Tsrpc_Queue;
+#else
+// Entries are allocated for their size class only, so a queued ping does
+// not take a whole TSuplaDataPacket. Freed entries go to a per-class free
+// list (linked through the first bytes of the entry) while the pool holds
+// less than SRPC_QUEUE_POOL_SIZE bytes.
 typedef struct {
   unsigned char item_count;
-  unsigned char alloc_count;
+  unsigned _supla_int_t pool_size;
 
+  TSuplaDataPacket *pool[SRPC_QUEUE_CLASS_COUNT];
   TSuplaDataPacket *item[SRPC_QUEUE_SIZE];
 } Tsrpc_Queue;
+#endif /*SRPC_QUEUE_SPSC*/
 
 typedef struct {
   void *proto;
@@ -93,12 +122,31 @@ typedef struct {
 
   TSuplaDataPacket sdp;
 
+  // Frame being dispatched to on_remote_call_received (sproto_peek_in_sdp)
+  TSuplaDataPacket *in_sdp;
+
+  // Packet srpc_getdata*() is decoding, read by srpc_getpack()
+  TSuplaDataPacket *getdata_sdp;
+
+  // Decoded payloads when params.rd_arena is set (see srpc_rd_alloc)
+  char *rd_arena;
+  TsrpcRdStats rd_stats;
+
 #ifndef SRPC_WITHOUT_IN_QUEUE
   Tsrpc_Queue in_queue;
 #endif /*SRPC_WITHOUT_IN_QUEUE*/
 
 #ifndef SRPC_WITHOUT_OUT_QUEUE
   Tsrpc_Queue out_queue;
+#ifdef SRPC_QUEUE_SPSC
+  // Serializes out_queue producers (application thread, callbacks);
+  // srpc_iterate*() never takes it
+  void *out_lck;
+  // Packet header state for producers that do not hold srpc->lck, in place
+  // of the rr_id counter and version of srpc->proto (see srpc_sdp_init)
+  unsigned _supla_int_t next_rr_id;
+  unsigned char version;
+#endif /*SRPC_QUEUE_SPSC*/
 #endif /*SRPC_WITHOUT_OUT_QUEUE*/
 
   void *lck;
@@ -107,6 +155,16 @@ typedef struct {
 void SRPC_ICACHE_FLASH srpc_get_scene_pack(Tsrpc *srpc, TsrpcReceivedData *rd);
 void SRPC_ICACHE_FLASH srpc_get_scene_state_pack(Tsrpc *srpc,
                                                  TsrpcReceivedData *rd);
+static unsigned _supla_int_t SRPC_ICACHE_FLASH srpc_rd_arena_size(void);
+static void *SRPC_ICACHE_FLASH srpc_rd_alloc(Tsrpc *srpc,
+                                             TSuplaDataPacket *sdp,
+                                             size_t size,
+                                             unsigned char in_place);
+static void SRPC_ICACHE_FLASH srpc_rd_release(Tsrpc *srpc, void *ptr);
+#if defined(SRPC_QUEUE_SPSC) && \
+    (!defined(SRPC_WITHOUT_IN_QUEUE) || !defined(SRPC_WITHOUT_OUT_QUEUE))
+static char SRPC_ICACHE_FLASH srpc_queue_init(Tsrpc_Queue *queue);
+#endif /*SRPC_QUEUE_SPSC*/
 
 void SRPC_ICACHE_FLASH srpc_params_init(TsrpcParams *params) {
   memset(params, 0, sizeof(TsrpcParams));
@@ -134,8 +192,37 @@ void *SRPC_ICACHE_FLASH srpc_init(TsrpcParams *params) {
 
   memcpy(&srpc->params, params, sizeof(TsrpcParams));
 
+  if (srpc->params.rd_arena) {
+    srpc->rd_stats.arena_size = srpc_rd_arena_size();
+    srpc->rd_arena = (char *)malloc(srpc->rd_stats.arena_size);
+
+    if (srpc->rd_arena == NULL) {
+      srpc->rd_stats.arena_size = 0;
+    }
+  }
+
   srpc->lck = lck_init();
 
+#if defined(SRPC_QUEUE_SPSC) && \
+    (!defined(SRPC_WITHOUT_IN_QUEUE) || !defined(SRPC_WITHOUT_OUT_QUEUE))
+  if (
+#ifndef SRPC_WITHOUT_IN_QUEUE
+      !srpc_queue_init(&srpc->in_queue) ||
+#endif /*SRPC_WITHOUT_IN_QUEUE*/
+#ifndef SRPC_WITHOUT_OUT_QUEUE
+      !srpc_queue_init(&srpc->out_queue) ||
+#endif /*SRPC_WITHOUT_OUT_QUEUE*/
+      0) {
+    srpc_free(srpc);
+    return NULL;
+  }
+
+#ifndef SRPC_WITHOUT_OUT_QUEUE
+  srpc->out_lck = lck_init();
+  srpc->version = sproto_get_version(srpc->proto);
+#endif /*SRPC_WITHOUT_OUT_QUEUE*/
+#endif /*SRPC_QUEUE_SPSC*/
+
   return srpc;
 }
 
@@ -148,15 +235,34 @@ void SRPC_ICACHE_FLASH srpc_unlock(void *_srpc) {
 }
 
 void SRPC_ICACHE_FLASH srpc_queue_free(Tsrpc_Queue *queue) {
+#ifdef SRPC_QUEUE_SPSC
+  if (queue->item != NULL) {
+    free(queue->item);
+    queue->item = NULL;
+  }
+
+  queue->head = 0;
+  queue->tail = 0;
+#else
   _supla_int_t a;
-  for (a = 0; a < SRPC_QUEUE_SIZE; a++) {
-    if (queue->item[a] != NULL) {
-      free(queue->item[a]);
+  TSuplaDataPacket *next;
+
+  for (a = 0; a < queue->item_count; a++) {
+    free(queue->item[a]);
+    queue->item[a] = NULL;
+  }
+
+  for (a = 0; a < SRPC_QUEUE_CLASS_COUNT; a++) {
+    while (queue->pool[a] != NULL) {
+      memcpy(&next, queue->pool[a], sizeof(next));
+      free(queue->pool[a]);
+      queue->pool[a] = next;
     }
   }
 
   queue->item_count = 0;
-  queue->alloc_count = 0;
+  queue->pool_size = 0;
+#endif /*SRPC_QUEUE_SPSC*/
 }
 
 void SRPC_ICACHE_FLASH srpc_free(void *_srpc) {
@@ -171,64 +277,217 @@ void SRPC_ICACHE_FLASH srpc_free(void *_srpc) {
 
 #ifndef SRPC_WITHOUT_OUT_QUEUE
     srpc_queue_free(&srpc->out_queue);
+#ifdef SRPC_QUEUE_SPSC
+    lck_free(srpc->out_lck);
+#endif /*SRPC_QUEUE_SPSC*/
 #endif /*SRPC_WITHOUT_OUT_QUEUE*/
     lck_free(srpc->lck);
 
+    if (srpc->rd_arena) {
+      free(srpc->rd_arena);
+    }
+
     free(srpc);
   }
 }
 
+#if !defined(SRPC_WITHOUT_IN_QUEUE) || !defined(SRPC_WITHOUT_OUT_QUEUE)
+#ifdef SRPC_QUEUE_SPSC
+static char SRPC_ICACHE_FLASH srpc_queue_init(Tsrpc_Queue *queue) {
+  queue->item =
+      (TSuplaDataPacket *)malloc(SRPC_QUEUE_SIZE * sizeof(TSuplaDataPacket));
+  return queue->item != NULL;
+}
+
+static unsigned _supla_int_t SRPC_ICACHE_FLASH
+srpc_queue_count(Tsrpc_Queue *queue) {
+  return __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) -
+         __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+}
+
+// Producer side: a free slot to fill, published by srpc_queue_commit()
+static TSuplaDataPacket *SRPC_ICACHE_FLASH
+srpc_queue_reserve(Tsrpc_Queue *queue) {
+  unsigned _supla_int_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+  if (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) >=
+      SRPC_QUEUE_SIZE) {
+    return NULL;
+  }
+
+  return &queue->item[tail % SRPC_QUEUE_SIZE];
+}
+
+static void SRPC_ICACHE_FLASH srpc_queue_commit(Tsrpc_Queue *queue) {
+  __atomic_store_n(&queue->tail,
+                   __atomic_load_n(&queue->tail, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELEASE);
+}
+
+// Consumer side: the oldest packet, released by srpc_queue_drop_front()
+static TSuplaDataPacket *SRPC_ICACHE_FLASH
+srpc_queue_front(Tsrpc_Queue *queue) {
+  unsigned _supla_int_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+
+  if (__atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) == head) {
+    return NULL;
+  }
+
+  return &queue->item[head % SRPC_QUEUE_SIZE];
+}
+
+static void SRPC_ICACHE_FLASH srpc_queue_drop_front(Tsrpc_Queue *queue) {
+  __atomic_store_n(&queue->head,
+                   __atomic_load_n(&queue->head, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELEASE);
+}
+
 char SRPC_ICACHE_FLASH srpc_queue_push(Tsrpc_Queue *queue,
                                        TSuplaDataPacket *sdp) {
-  if (queue->item_count >= SRPC_QUEUE_SIZE) {
+  TSuplaDataPacket *item = srpc_queue_reserve(queue);
+
+  if (item == NULL) {
     return SUPLA_RESULT_FALSE;
   }
 
-  if (queue->item[queue->item_count] == NULL) {
-    queue->item[queue->item_count] =
-        (TSuplaDataPacket *)malloc(sizeof(TSuplaDataPacket));
+  if (sdp->data_size > SUPLA_MAX_DATA_SIZE) {
+    return SUPLA_RESULT_FALSE;
   }
 
-  if (queue->item[queue->item_count] == NULL) {
+  memcpy(item, sdp, SRPC_PACKET_SIZE(sdp->data_size));
+  srpc_queue_commit(queue);
+
+  return SUPLA_RESULT_TRUE;
+}
+
+// Only the oldest packet can be taken; a ring cannot give up a slot in the
+// middle
+char SRPC_ICACHE_FLASH srpc_queue_pop(Tsrpc_Queue *queue, TSuplaDataPacket *sdp,
+                                      unsigned _supla_int_t rr_id) {
+  TSuplaDataPacket *item = srpc_queue_front(queue);
+
+  if (item == NULL || (rr_id != 0 && item->rr_id != rr_id)) {
+    return SUPLA_RESULT_FALSE;
+  }
+
+  memcpy(sdp, item, SRPC_PACKET_SIZE(item->data_size));
+  srpc_queue_drop_front(queue);
+
+  return SUPLA_RESULT_TRUE;
+}
+#else
+static unsigned _supla_int_t SRPC_ICACHE_FLASH
+srpc_queue_class_size(unsigned char c) {
+  unsigned _supla_int_t size =
+      c < SRPC_QUEUE_CLASS_COUNT - 1 ? 64U << (2 * c) : SUPLA_MAX_DATA_SIZE;
+  return size < SUPLA_MAX_DATA_SIZE ? size : SUPLA_MAX_DATA_SIZE;
+}
+
+static unsigned char SRPC_ICACHE_FLASH
+srpc_queue_class(unsigned _supla_int_t data_size) {
+  unsigned char c = 0;
+
+  while (c < SRPC_QUEUE_CLASS_COUNT - 1 &&
+         data_size > srpc_queue_class_size(c)) {
+    c++;
+  }
+
+  return c;
+}
+
+static TSuplaDataPacket *SRPC_ICACHE_FLASH
+srpc_queue_entry_alloc(Tsrpc_Queue *queue, unsigned _supla_int_t data_size) {
+  unsigned char c = srpc_queue_class(data_size);
+  TSuplaDataPacket *entry = queue->pool[c];
+
+  if (entry != NULL) {
+    memcpy(&queue->pool[c], entry, sizeof(entry));
+    queue->pool_size -= SRPC_PACKET_SIZE(srpc_queue_class_size(c));
+    return entry;
+  }
+
+  return (TSuplaDataPacket *)malloc(
+      SRPC_PACKET_SIZE(srpc_queue_class_size(c)));
+}
+
+static void SRPC_ICACHE_FLASH srpc_queue_entry_free(Tsrpc_Queue *queue,
+                                                    TSuplaDataPacket *entry) {
+  unsigned char c = srpc_queue_class(entry->data_size);
+  unsigned _supla_int_t size = SRPC_PACKET_SIZE(srpc_queue_class_size(c));
+
+  if (queue->pool_size + size > SRPC_QUEUE_POOL_SIZE) {
+    free(entry);
+    return;
+  }
+
+  memcpy(entry, &queue->pool[c], sizeof(entry));
+  queue->pool[c] = entry;
+  queue->pool_size += size;
+}
+
+char SRPC_ICACHE_FLASH srpc_queue_push(Tsrpc_Queue *queue,
+                                       TSuplaDataPacket *sdp) {
+  TSuplaDataPacket *entry;
+
+  if (queue->item_count >= SRPC_QUEUE_SIZE ||
+      sdp->data_size > SUPLA_MAX_DATA_SIZE) {
+    return SUPLA_RESULT_FALSE;
+  }
+
+  if ((entry = srpc_queue_entry_alloc(queue, sdp->data_size)) == NULL) {
     return SUPLA_RESULT_FALSE;
-  } else {
-    queue->alloc_count++;
   }
 
-  memcpy(queue->item[queue->item_count], sdp, sizeof(TSuplaDataPacket));
+  memcpy(entry, sdp, SRPC_PACKET_SIZE(sdp->data_size));
+  queue->item[queue->item_count] = entry;
   queue->item_count++;
 
   return SUPLA_RESULT_TRUE;
 }
 
-char SRPC_ICACHE_FLASH srpc_queue_pop(Tsrpc_Queue *queue, TSuplaDataPacket *sdp,
-                                      unsigned _supla_int_t rr_id) {
-  _supla_int_t a, b;
+static void SRPC_ICACHE_FLASH srpc_queue_remove(Tsrpc_Queue *queue,
+                                                _supla_int_t a) {
+  _supla_int_t b;
 
-  for (a = 0; a < queue->item_count; a++)
-    if (rr_id == 0 || queue->item[a]->rr_id == rr_id) {
-      memcpy(sdp, queue->item[a], sizeof(TSuplaDataPacket));
+  srpc_queue_entry_free(queue, queue->item[a]);
 
-      if (queue->alloc_count > SRPC_QUEUE_MIN_ALLOC_COUNT) {
-        queue->alloc_count--;
-        free(queue->item[a]);
-        queue->item[a] = NULL;
-      }
+  for (b = a; b < queue->item_count - 1; b++) {
+    queue->item[b] = queue->item[b + 1];
+  }
 
-      TSuplaDataPacket *item = queue->item[a];
+  queue->item_count--;
+  queue->item[queue->item_count] = NULL;
+}
 
-      for (b = a; b < queue->item_count - 1; b++) {
-        queue->item[b] = queue->item[b + 1];
-      }
+static unsigned _supla_int_t SRPC_ICACHE_FLASH
+srpc_queue_count(Tsrpc_Queue *queue) {
+  return queue->item_count;
+}
+
+static TSuplaDataPacket *SRPC_ICACHE_FLASH
+srpc_queue_front(Tsrpc_Queue *queue) {
+  return queue->item_count > 0 ? queue->item[0] : NULL;
+}
 
-      queue->item_count--;
-      queue->item[queue->item_count] = item;
+static void SRPC_ICACHE_FLASH srpc_queue_drop_front(Tsrpc_Queue *queue) {
+  srpc_queue_remove(queue, 0);
+}
+
+char SRPC_ICACHE_FLASH srpc_queue_pop(Tsrpc_Queue *queue, TSuplaDataPacket *sdp,
+                                      unsigned _supla_int_t rr_id) {
+  _supla_int_t a;
 
+  for (a = 0; a < queue->item_count; a++)
+    if (rr_id == 0 || queue->item[a]->rr_id == rr_id) {
+      memcpy(sdp, queue->item[a], SRPC_PACKET_SIZE(queue->item[a]->data_size));
+      srpc_queue_remove(queue, a);
       return SUPLA_RESULT_TRUE;
     }
 
   return SUPLA_RESULT_FALSE;
 }
+#endif /*SRPC_QUEUE_SPSC*/
+#endif /*!SRPC_WITHOUT_IN_QUEUE || !SRPC_WITHOUT_OUT_QUEUE*/
 
 char SRPC_ICACHE_FLASH srpc_in_queue_pop(Tsrpc *srpc, TSuplaDataPacket *sdp,
                                          unsigned _supla_int_t rr_id) {
@@ -242,6 +501,23 @@ char SRPC_ICACHE_FLASH srpc_in_queue_pop(Tsrpc *srpc, TSuplaDataPacket *sdp,
 #endif /*SRPC_WITHOUT_IN_QUEUE*/
 }
 
+// Packet to decode: without an in queue it is the frame srpc_iterate*() is
+// dispatching, viewed in the sproto input buffer; otherwise it is popped from
+// the queue into srpc->sdp.
+static TSuplaDataPacket *SRPC_ICACHE_FLASH
+srpc_in_queue_pop_sdp(Tsrpc *srpc, unsigned _supla_int_t rr_id) {
+#ifdef SRPC_WITHOUT_IN_QUEUE
+  (void)(rr_id);
+  srpc->getdata_sdp = srpc->in_sdp;
+#else
+  srpc->getdata_sdp =
+      srpc_in_queue_pop(srpc, &srpc->sdp, rr_id) == SUPLA_RESULT_TRUE
+          ? &srpc->sdp
+          : NULL;
+#endif /*SRPC_WITHOUT_IN_QUEUE*/
+  return srpc->getdata_sdp;
+}
+
 #ifndef SRPC_WITHOUT_IN_QUEUE
 char SRPC_ICACHE_FLASH srpc_in_queue_push(Tsrpc *srpc, TSuplaDataPacket *sdp) {
   return srpc_queue_push(&srpc->in_queue, sdp);
@@ -286,7 +562,7 @@ unsigned char SRPC_ICACHE_FLASH srpc_out_queue_item_count(void *srpc) {
 #ifdef SRPC_WITHOUT_OUT_QUEUE
   return 0;
 #else
-  return ((Tsrpc *)srpc)->out_queue.item_count;
+  return srpc_queue_count(&((Tsrpc *)srpc)->out_queue);
 #endif /*SRPC_WITHOUT_OUT_QUEUE*/
 }
 
@@ -306,6 +582,139 @@ char SRPC_ICACHE_FLASH srpc_output_dataexists(void *_srpc) {
   return lck_unlock_r(srpc->lck, result);
 }
 
+#ifndef SRPC_WITHOUT_OUT_QUEUE
+// Moves queued packets into the sproto output buffer. A packet that does not
+// fit stays queued.
+static char SRPC_ICACHE_FLASH srpc_out_queue_spill(Tsrpc *srpc) {
+  TSuplaDataPacket *sdp;
+  char result;
+
+  while ((sdp = srpc_queue_front(&srpc->out_queue)) != NULL) {
+    result = sproto_out_buffer_append(srpc->proto, sdp);
+
+    if (result == SUPLA_RESULT_FALSE ||
+        result == (char)SUPLA_RESULT_BUFFER_OVERFLOW) {
+      break;
+    } else if (result != SUPLA_RESULT_TRUE) {
+      return result;
+    }
+
+    srpc_queue_drop_front(&srpc->out_queue);
+  }
+
+  return SUPLA_RESULT_TRUE;
+}
+
+// Spills the whole out queue and hands the output buffer to data_write in
+// one call (two if a ring buffer wraps)
+static char SRPC_ICACHE_FLASH srpc_out_flush(Tsrpc *srpc) {
+  char result;
+  char *data;
+  unsigned _supla_int_t size;
+  _supla_int_t written;
+
+  if (SUPLA_RESULT_TRUE != (result = srpc_out_queue_spill(srpc))) {
+    return result;
+  }
+
+  while ((size = sproto_peek_out_data(srpc->proto, &data)) > 0) {
+    written = srpc->params.data_write(data, size, srpc->params.user_params);
+    if (written <= 0) {
+      break;
+    }
+
+    sproto_consume_out_data(srpc->proto, written);
+
+    if ((unsigned _supla_int_t)written < size) {
+      break;
+    }
+  }
+
+  return SUPLA_RESULT_TRUE;
+}
+#endif /*SRPC_WITHOUT_OUT_QUEUE*/
+
+// Dispatches every complete frame in the sproto input buffer. The lock is
+// released only around on_remote_call_received, so with no callback the
+// whole batch runs under it. Returns SUPLA_RESULT_FALSE when no complete
+// frame is left (or the in queue is full), otherwise the error that stopped
+// the drain.
+static char SRPC_ICACHE_FLASH srpc_in_drain(Tsrpc *srpc,
+                                            unsigned char *version) {
+  char result;
+
+  for (;;) {
+#ifdef SRPC_WITHOUT_IN_QUEUE
+    // Frames are dispatched straight from the input buffer, no copy
+    if ((result = sproto_peek_in_sdp(srpc->proto, &srpc->in_sdp, version)) !=
+        SUPLA_RESULT_TRUE) {
+      return result;
+    }
+
+    if (srpc->params.on_remote_call_received) {
+      lck_unlock(srpc->lck);
+      srpc->params.on_remote_call_received(
+          srpc, srpc->in_sdp->rr_id, srpc->in_sdp->call_id,
+          srpc->params.user_params, srpc->in_sdp->version);
+      lck_lock(srpc->lck);
+    }
+
+    srpc->in_sdp = NULL;
+    sproto_consume_in_sdp(srpc->proto);
+#else
+    // Frames that do not fit wait in the sproto input buffer
+    if (srpc_queue_count(&srpc->in_queue) >= SRPC_QUEUE_SIZE) {
+      return SUPLA_RESULT_FALSE;
+    }
+
+    if ((result = sproto_pop_in_sdp(srpc->proto, &srpc->sdp)) !=
+        SUPLA_RESULT_TRUE) {
+      *version = srpc->sdp.version;
+      return result;
+    }
+
+    if (SUPLA_RESULT_TRUE != srpc_in_queue_push(srpc, &srpc->sdp)) {
+      supla_log(LOG_DEBUG, "ssrpc_in_queue_push error");
+      return SUPLA_RESULT_BUFFER_OVERFLOW;
+    }
+
+    if (srpc->params.on_remote_call_received) {
+      lck_unlock(srpc->lck);
+      srpc->params.on_remote_call_received(
+          srpc, srpc->sdp.rr_id, srpc->sdp.call_id, srpc->params.user_params,
+          srpc->sdp.version);
+      lck_lock(srpc->lck);
+    }
+#endif /*SRPC_WITHOUT_IN_QUEUE*/
+
+#ifndef SRPC_WITHOUT_OUT_QUEUE
+    // Replies to a burst outnumber the out queue; they wait in the sproto
+    // output buffer for the single write at the end of the batch
+    if (srpc_queue_count(&srpc->out_queue) >= SRPC_QUEUE_SIZE) {
+      srpc_out_queue_spill(srpc);
+    }
+#endif /*SRPC_WITHOUT_OUT_QUEUE*/
+  }
+}
+
+// Reports a failed drain and releases the lock
+static char SRPC_ICACHE_FLASH srpc_in_failed(Tsrpc *srpc, char result,
+                                             unsigned char version) {
+  if (result == (char)SUPLA_RESULT_VERSION_ERROR) {
+    if (srpc->params.on_version_error) {
+      lck_unlock(srpc->lck);
+
+      srpc->params.on_version_error(srpc, version, srpc->params.user_params);
+      return SUPLA_RESULT_FALSE;
+    }
+  } else {
+    supla_log(LOG_DEBUG, "sproto_pop_in_sdp error: %i", result);
+  }
+
+  return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
+}
+
+
 char SRPC_ICACHE_FLASH srpc_iterate(void *_srpc) {
   Tsrpc *srpc = (Tsrpc *)_srpc;
   char data_buffer[SRPC_BUFFER_SIZE];
@@ -332,20 +741,25 @@ char SRPC_ICACHE_FLASH srpc_iterate(void *_srpc) {
     return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
   }
 
-  if (SUPLA_RESULT_TRUE ==
-      (result = sproto_pop_in_sdp(srpc->proto, &srpc->sdp))) {
-#ifndef __EH_DISABLED
-    raise_event = sproto_in_dataexists(srpc->proto) == 1 ? 1 : 0;
-#endif /*__EH_DISABLED*/
+#ifdef SRPC_WITHOUT_IN_QUEUE
+  result = sproto_peek_in_sdp(srpc->proto, &srpc->in_sdp, &version);
+#else
+  result = sproto_pop_in_sdp(srpc->proto, &srpc->sdp);
+  version = srpc->sdp.version;
+#endif /*SRPC_WITHOUT_IN_QUEUE*/
 
+  if (SUPLA_RESULT_TRUE == result) {
 #ifdef SRPC_WITHOUT_IN_QUEUE
     if (srpc->params.on_remote_call_received) {
       lck_unlock(srpc->lck);
       srpc->params.on_remote_call_received(
-          srpc, srpc->sdp.rr_id, srpc->sdp.call_id, srpc->params.user_params,
-          srpc->sdp.version);
+          srpc, srpc->in_sdp->rr_id, srpc->in_sdp->call_id,
+          srpc->params.user_params, srpc->in_sdp->version);
       lck_lock(srpc->lck);
     }
+
+    srpc->in_sdp = NULL;
+    sproto_consume_in_sdp(srpc->proto);
 #else
     if (SUPLA_RESULT_TRUE == srpc_in_queue_push(srpc, &srpc->sdp)) {
       if (srpc->params.on_remote_call_received) {
@@ -362,10 +776,13 @@ char SRPC_ICACHE_FLASH srpc_iterate(void *_srpc) {
     }
 #endif /*SRPC_WITHOUT_IN_QUEUE*/
 
+#ifndef __EH_DISABLED
+    raise_event = sproto_in_dataexists(srpc->proto) == 1 ? 1 : 0;
+#endif /*__EH_DISABLED*/
+
   } else if (result != SUPLA_RESULT_FALSE) {
     if (result == (char)SUPLA_RESULT_VERSION_ERROR) {
       if (srpc->params.on_version_error) {
-        version = srpc->sdp.version;
         lck_unlock(srpc->lck);
 
         srpc->params.on_version_error(srpc, version, srpc->params.user_params);
@@ -412,11 +829,74 @@ char SRPC_ICACHE_FLASH srpc_iterate(void *_srpc) {
   return lck_unlock_r(srpc->lck, SUPLA_RESULT_TRUE);
 }
 
+char SRPC_ICACHE_FLASH srpc_iterate_batch(void *_srpc) {
+  Tsrpc *srpc = (Tsrpc *)_srpc;
+  char data_buffer[SRPC_BUFFER_SIZE];
+  char result;
+  unsigned char version = 0;
+  _supla_int_t data_size = -1;
+
+  lck_lock(srpc->lck);
+
+  // --------- IN ---------------
+  // Frames left behind by a full in queue go first
+  if ((result = srpc_in_drain(srpc, &version)) != SUPLA_RESULT_FALSE) {
+    return srpc_in_failed(srpc, result, version);
+  }
+
+  for (;;) {
+#ifndef SRPC_WITHOUT_IN_QUEUE
+    if (srpc_queue_count(&srpc->in_queue) >= SRPC_QUEUE_SIZE) {
+      break;
+    }
+#endif /*SRPC_WITHOUT_IN_QUEUE*/
+
+    data_size = srpc->params.data_read(data_buffer, SRPC_BUFFER_SIZE,
+                                       srpc->params.user_params);
+    if (data_size <= 0) {
+      break;
+    }
+
+    if (SUPLA_RESULT_TRUE != (result = sproto_in_buffer_append(
+                                  srpc->proto, data_buffer, data_size))) {
+      supla_log(LOG_DEBUG, "sproto_in_buffer_append: %i, datasize: %i", result,
+                data_size);
+      return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
+    }
+
+    if ((result = srpc_in_drain(srpc, &version)) != SUPLA_RESULT_FALSE) {
+      return srpc_in_failed(srpc, result, version);
+    }
+  }
+
+  if (data_size == 0) {
+    return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
+  }
+
+  // --------- OUT ---------------
+#ifndef SRPC_WITHOUT_OUT_QUEUE
+  if (SUPLA_RESULT_TRUE != (result = srpc_out_flush(srpc))) {
+    supla_log(LOG_DEBUG, "sproto_out_buffer_append error: %i", result);
+    return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
+  }
+
+#ifndef __EH_DISABLED
+  if (srpc->params.eh != 0 && (sproto_out_dataexists(srpc->proto) == 1 ||
+                               srpc_out_queue_item_count(srpc))) {
+    eh_raise_event(srpc->params.eh);
+  }
+#endif /*__EH_DISABLED*/
+#endif /*SRPC_WITHOUT_OUT_QUEUE*/
+
+  return lck_unlock_r(srpc->lck, SUPLA_RESULT_TRUE);
+}
+
 #ifndef SRPC_EXCLUDE_DEVICE
 char SRPC_ICACHE_FLASH srpc_iterate_device(void *_srpc) {
   Tsrpc *srpc = (Tsrpc *)_srpc;
   char data_buffer[SRPC_BUFFER_SIZE];
   char result = SUPLA_RESULT_TRUE;
+  unsigned char version = 0;
 
   lck_lock(srpc->lck);
   _supla_int_t data_size = 0;
@@ -430,35 +910,8 @@ char SRPC_ICACHE_FLASH srpc_iterate_device(void *_srpc) {
       return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
     }
 
-    while ((result = sproto_pop_in_sdp(srpc->proto, &srpc->sdp)) ==
-           SUPLA_RESULT_TRUE) {
-      // repeat while there are messages in the input buffer
-      if (srpc->params.on_remote_call_received) {
-        lck_unlock(srpc->lck);
-        srpc->params.on_remote_call_received(
-            srpc, srpc->sdp.rr_id, srpc->sdp.call_id, srpc->params.user_params,
-            srpc->sdp.version);
-        lck_lock(srpc->lck);
-      }
-    }
-
-    if (result != SUPLA_RESULT_FALSE) {
-      if (result == (char)SUPLA_RESULT_VERSION_ERROR) {
-        if (srpc->params.on_version_error) {
-          unsigned char version = srpc->sdp.version;
-          lck_unlock(srpc->lck);
-
-          srpc->params.on_version_error(srpc, version,
-                                        srpc->params.user_params);
-          return SUPLA_RESULT_FALSE;
-        }
-      } else {
-        supla_log(LOG_DEBUG, "sproto_pop_in_sdp error: %i", result);
-      }
-      return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
-    } else {
-      // no more messages in the input buffer
-      break;
+    if ((result = srpc_in_drain(srpc, &version)) != SUPLA_RESULT_FALSE) {
+      return srpc_in_failed(srpc, result, version);
     }
   }
 
@@ -493,35 +946,35 @@ void SRPC_ICACHE_FLASH srpc_getpack(
   _supla_int_t c_header_size = item_sizeof - caption_max_size;
   _supla_int_t a, count, size, offset, pack_size;
   void *pack = NULL;
+  TSuplaDataPacket *sdp = srpc->getdata_sdp;
 
-  if (srpc->sdp.data_size < header_size || srpc->sdp.data_size > pack_sizeof) {
+  if (sdp->data_size < header_size || sdp->data_size > pack_sizeof) {
     return;
   }
 
-  count = pack_get_count(srpc->sdp.data);
+  count = pack_get_count(sdp->data);
 
   if (count < 0 || count > pack_max_count) {
     return;
   }
 
   pack_size = header_size + (item_sizeof * count);
-  pack = (TSC_SuplaChannelPack *)malloc(pack_size);
+  pack = srpc_rd_alloc(srpc, sdp, pack_size, 0);
 
   if (pack == NULL) return;
 
-  memset(pack, 0, pack_size);
-  memcpy(pack, srpc->sdp.data, header_size);
+  memcpy(pack, sdp->data, header_size);
 
   offset = header_size;
   pack_set_count(pack, 0, 0);
 
   for (a = 0; a < count; a++)
-    if (srpc->sdp.data_size - offset >= c_header_size) {
-      size = get_item_caption_size(&srpc->sdp.data[offset]);
+    if (sdp->data_size - offset >= c_header_size) {
+      size = get_item_caption_size(&sdp->data[offset]);
 
       if (size >= 0 && size <= caption_max_size &&
-          srpc->sdp.data_size - offset >= c_header_size + size) {
-        memcpy(get_item_ptr(pack, a), &srpc->sdp.data[offset],
+          sdp->data_size - offset >= c_header_size + size) {
+        memcpy(get_item_ptr(pack, a), &sdp->data[offset],
                c_header_size + size);
         offset += c_header_size + size;
         pack_set_count(pack, 1, 1);
@@ -532,12 +985,12 @@ void SRPC_ICACHE_FLASH srpc_getpack(
     }
 
   if (count == pack_get_count(pack)) {
-    srpc->sdp.data_size = 0;
+    sdp->data_size = 0;
     // dcs_ping is 1st variable in union
     rd->data.dcs_ping = pack;
 
   } else {
-    free(pack);
+    srpc_rd_release(srpc, pack);
   }
 }
 
@@ -808,1054 +1261,750 @@ void SRPC_ICACHE_FLASH srpc_getlocationpack(Tsrpc *srpc,
       &srpc_locationpack_get_item_caption_size);
 }
 
-#define VALID_SIZE(MIAN_TYPE, ITEM_TYPE, SIZE_VAR, MAX)                   \
-  srpc->sdp.data_size >= (sizeof(MIAN_TYPE) - sizeof(ITEM_TYPE) * MAX) && \
-      srpc->sdp.data_size <= sizeof(MIAN_TYPE) &&                         \
-      (((MIAN_TYPE *)srpc->sdp.data)->SIZE_VAR) * sizeof(ITEM_TYPE) ==    \
-          srpc->sdp.data_size - (sizeof(MIAN_TYPE) - sizeof(ITEM_TYPE) * MAX)
-
-char SRPC_ICACHE_FLASH srpc_getdata(void *_srpc, TsrpcReceivedData *rd,
-                                    unsigned _supla_int_t rr_id) {
-  Tsrpc *srpc = (Tsrpc *)_srpc;
-  char call_with_no_data = 0;
-  rd->call_id = 0;
-
-  lck_lock(srpc->lck);
-
-  if (SUPLA_RESULT_TRUE == srpc_in_queue_pop(srpc, &srpc->sdp, rr_id)) {
-    rd->call_id = srpc->sdp.call_id;
-    rd->rr_id = srpc->sdp.rr_id;
-
-    // first one
-    rd->data.dcs_ping = NULL;
+#define VALID_SIZE(MIAN_TYPE, ITEM_TYPE, SIZE_VAR, MAX)              \
+  sdp->data_size >= (sizeof(MIAN_TYPE) - sizeof(ITEM_TYPE) * MAX) && \
+      sdp->data_size <= sizeof(MIAN_TYPE) &&                         \
+      (((MIAN_TYPE *)sdp->data)->SIZE_VAR) * sizeof(ITEM_TYPE) ==    \
+          sdp->data_size - (sizeof(MIAN_TYPE) - sizeof(ITEM_TYPE) * MAX)
 
-    switch (srpc->sdp.call_id) {
-      case SUPLA_DCS_CALL_GETVERSION:
-      case SUPLA_CS_CALL_GET_NEXT:
-      case SUPLA_DCS_CALL_GET_REGISTRATION_ENABLED:
-        call_with_no_data = 1;
-        break;
-
-      case SUPLA_SDC_CALL_GETVERSION_RESULT:
+// How srpc_getdata decodes the payload of a call
+#define SRPC_DECODE_NO_DATA 0   // no payload
+#define SRPC_DECODE_FIXED 1     // data_size == size
+#define SRPC_DECODE_VARIABLE 2  // the VALID_SIZE rule
+#define SRPC_DECODE_CUSTOM 3    // srpc_getdata_custom()
 
-        if (srpc->sdp.data_size == sizeof(TSDC_SuplaGetVersionResult))
-          rd->data.sdc_getversion_result = (TSDC_SuplaGetVersionResult *)calloc(
-              1, sizeof(TSDC_SuplaGetVersionResult));
-
-        break;
+#define SRPC_CALL_COMMON 0
+#define SRPC_CALL_DEVICE 1  // skipped with SRPC_EXCLUDE_DEVICE
+#define SRPC_CALL_CLIENT 2  // skipped with SRPC_EXCLUDE_CLIENT
 
-      case SUPLA_SDC_CALL_VERSIONERROR:
-
-        if (srpc->sdp.data_size == sizeof(TSDC_SuplaVersionError))
-          rd->data.sdc_version_error = (TSDC_SuplaVersionError *)calloc(
-              1, sizeof(TSDC_SuplaVersionError));
-
-        break;
-
-      case SUPLA_DCS_CALL_PING_SERVER:
+typedef struct {
+  unsigned _supla_int_t call_id;
+  unsigned char min_version;
+  unsigned char decode;
+  unsigned char group;
+  unsigned char count_width;  // sizeof the item counter
+  unsigned _supla_int_t size;
+  unsigned _supla_int_t header_size;  // size without the item array
+  unsigned short item_size;
+  unsigned short count_offset;  // offsetof the item counter
+} TsrpcCallDesc;
+
+#define SRPC_CALL_NO_DATA(CALL_ID, MIN_VERSION, GROUP) \
+  { CALL_ID, MIN_VERSION, SRPC_DECODE_NO_DATA, GROUP, 0, 0, 0, 0, 0 }
+
+// TYPE is the largest structure the custom decoder hands out
+#define SRPC_CALL_CUSTOM(CALL_ID, MIN_VERSION, GROUP, TYPE)                 \
+  {                                                                         \
+    CALL_ID, MIN_VERSION, SRPC_DECODE_CUSTOM, GROUP, 0, sizeof(TYPE), 0, 0, \
+        0                                                                   \
+  }
 
-        if (srpc->sdp.data_size == sizeof(TDCS_SuplaPingServer) ||
-            srpc->sdp.data_size == sizeof(TDCS_SuplaPingServer_COMPAT)) {
-          rd->data.dcs_ping =
-              (TDCS_SuplaPingServer *)calloc(1, sizeof(TDCS_SuplaPingServer));
+#define SRPC_CALL_FIXED(CALL_ID, MIN_VERSION, GROUP, TYPE)                 \
+  {                                                                        \
+    CALL_ID, MIN_VERSION, SRPC_DECODE_FIXED, GROUP, 0, sizeof(TYPE), 0, 0, \
+        0                                                                  \
+  }
 
-#ifndef __AVR__
-          if (srpc->sdp.data_size == sizeof(TDCS_SuplaPingServer_COMPAT)) {
-            TDCS_SuplaPingServer_COMPAT *compat =
-                (TDCS_SuplaPingServer_COMPAT *)srpc->sdp.data;
+#define SRPC_CALL_VARIABLE(CALL_ID, MIN_VERSION, GROUP, TYPE, ITEM_TYPE, \
+                           COUNT, MAX)                                   \
+  {                                                                      \
+    CALL_ID, MIN_VERSION, SRPC_DECODE_VARIABLE, GROUP,                   \
+        sizeof(((TYPE *)0)->COUNT), sizeof(TYPE),                        \
+        sizeof(TYPE) - sizeof(ITEM_TYPE) * (MAX), sizeof(ITEM_TYPE),     \
+        offsetof(TYPE, COUNT)                                            \
+  }
 
-            rd->data.dcs_ping->now.tv_sec = compat->now.tv_sec;
-            rd->data.dcs_ping->now.tv_usec = compat->now.tv_usec;
-            call_with_no_data = 1;
-          }
+#if defined(ARDUINO_ARCH_ESP8266) || defined(__AVR__)
+// Keep the table in flash, it is read with the _P helpers
+#define SRPC_CALL_DESC_ATTR PROGMEM
+#define SRPC_CALL_DESC_ID(IDX) pgm_read_dword(&srpc_call_desc[IDX].call_id)
+#define SRPC_CALL_DESC_COPY(DESC, IDX) \
+  memcpy_P(DESC, &srpc_call_desc[IDX], sizeof(TsrpcCallDesc))
+#else
+#define SRPC_CALL_DESC_ATTR
+#define SRPC_CALL_DESC_ID(IDX) srpc_call_desc[IDX].call_id
+#define SRPC_CALL_DESC_COPY(DESC, IDX) \
+  memcpy(DESC, &srpc_call_desc[IDX], sizeof(TsrpcCallDesc))
 #endif
-        }
-        break;
-
-      case SUPLA_SDC_CALL_PING_SERVER_RESULT:
-
-        if (srpc->sdp.data_size == sizeof(TSDC_SuplaPingServerResult))
-          rd->data.sdc_ping_result = (TSDC_SuplaPingServerResult *)calloc(
-              1, sizeof(TSDC_SuplaPingServerResult));
-
-        break;
-
-      case SUPLA_DCS_CALL_SET_ACTIVITY_TIMEOUT:
-
-        if (srpc->sdp.data_size == sizeof(TDCS_SuplaSetActivityTimeout))
-          rd->data.dcs_set_activity_timeout =
-              (TDCS_SuplaSetActivityTimeout *)calloc(
-                  1, sizeof(TDCS_SuplaSetActivityTimeout));
-
-        break;
-
-      case SUPLA_SDC_CALL_SET_ACTIVITY_TIMEOUT_RESULT:
-
-        if (srpc->sdp.data_size == sizeof(TSDC_SuplaSetActivityTimeoutResult))
-          rd->data.sdc_set_activity_timeout_result =
-              (TSDC_SuplaSetActivityTimeoutResult *)calloc(
-                  1, sizeof(TSDC_SuplaSetActivityTimeoutResult));
-
-        break;
-
-      case SUPLA_SDC_CALL_GET_REGISTRATION_ENABLED_RESULT:
-
-        if (srpc->sdp.data_size == sizeof(TSDC_RegistrationEnabled))
-          rd->data.sdc_reg_enabled = (TSDC_RegistrationEnabled *)calloc(
-              1, sizeof(TSDC_RegistrationEnabled));
-
-        break;
-      case SUPLA_DCS_CALL_GET_USER_LOCALTIME:
-        call_with_no_data = 1;
-        break;
-      case SUPLA_DCS_CALL_GET_USER_LOCALTIME_RESULT:
-        if (VALID_SIZE(TSDC_UserLocalTimeResult, char, timezoneSize,
-                       SUPLA_TIMEZONE_MAXSIZE)) {
-          rd->data.sdc_user_localtime_result =
-              (TSDC_UserLocalTimeResult *)calloc(
-                  1, sizeof(TSDC_UserLocalTimeResult));
-        }
-
-        break;
-
-      case SUPLA_CSD_CALL_GET_CHANNEL_STATE:
-        if (srpc->sdp.data_size == sizeof(TCSD_ChannelStateRequest))
-          rd->data.csd_channel_state_request =
-              (TCSD_ChannelStateRequest *)calloc(
-                  1, sizeof(TCSD_ChannelStateRequest));
-        break;
-      case SUPLA_DSC_CALL_CHANNEL_STATE_RESULT:
-        if (srpc->sdp.data_size == sizeof(TDSC_ChannelState))
-          rd->data.dsc_channel_state =
-              (TDSC_ChannelState *)calloc(1, sizeof(TDSC_ChannelState));
-        break;
-
-      case SUPLA_SCD_CALL_SET_CHANNEL_CAPTION_RESULT:
-        if (VALID_SIZE(TSCD_SetCaptionResult, char, CaptionSize,
-                       SUPLA_CAPTION_MAXSIZE))
-          rd->data.scd_set_caption_result =
-              (TSCD_SetCaptionResult *)calloc(1, sizeof(TSCD_SetCaptionResult));
-        break;
-
-#ifndef SRPC_EXCLUDE_DEVICE
-      case SUPLA_DS_CALL_REGISTER_DEVICE:
-        if (VALID_SIZE(TDS_SuplaRegisterDevice, TDS_SuplaDeviceChannel,
-                       channel_count, SUPLA_CHANNELMAXCOUNT)) {
-          rd->data.ds_register_device = (TDS_SuplaRegisterDevice *)calloc(
-              1, sizeof(TDS_SuplaRegisterDevice));
-        }
-
-        break;
-
-      case SUPLA_DS_CALL_REGISTER_DEVICE_B:  // ver. >= 2
-
-        if (VALID_SIZE(TDS_SuplaRegisterDevice_B, TDS_SuplaDeviceChannel_B,
-                       channel_count, SUPLA_CHANNELMAXCOUNT)) {
-          rd->data.ds_register_device_b = (TDS_SuplaRegisterDevice_B *)calloc(
-              1, sizeof(TDS_SuplaRegisterDevice_B));
-        }
-
-        break;
-
-      case SUPLA_DS_CALL_REGISTER_DEVICE_C:  // ver. >= 6
-
-        if (VALID_SIZE(TDS_SuplaRegisterDevice_C, TDS_SuplaDeviceChannel_B,
-                       channel_count, SUPLA_CHANNELMAXCOUNT)) {
-          rd->data.ds_register_device_c = (TDS_SuplaRegisterDevice_C *)calloc(
-              1, sizeof(TDS_SuplaRegisterDevice_C));
-        }
-
-        break;
-
-      case SUPLA_DS_CALL_REGISTER_DEVICE_D:  // ver. >= 7
-
-        if (VALID_SIZE(TDS_SuplaRegisterDevice_D, TDS_SuplaDeviceChannel_B,
-                       channel_count, SUPLA_CHANNELMAXCOUNT)) {
-          rd->data.ds_register_device_d = (TDS_SuplaRegisterDevice_D *)calloc(
-              1, sizeof(TDS_SuplaRegisterDevice_D));
-        }
-
-        break;
-
-      case SUPLA_DS_CALL_REGISTER_DEVICE_E:  // ver. >= 10
-
-        if (VALID_SIZE(TDS_SuplaRegisterDevice_E, TDS_SuplaDeviceChannel_C,
-                       channel_count, SUPLA_CHANNELMAXCOUNT)) {
-          rd->data.ds_register_device_e = (TDS_SuplaRegisterDevice_E *)calloc(
-              1, sizeof(TDS_SuplaRegisterDevice_E));
-        }
-
-        break;
-
-      case SUPLA_DS_CALL_REGISTER_DEVICE_F:  // ver. >= 23
-
-        if (VALID_SIZE(TDS_SuplaRegisterDevice_F, TDS_SuplaDeviceChannel_D,
-                       channel_count, SUPLA_CHANNELMAXCOUNT)) {
-          rd->data.ds_register_device_f = (TDS_SuplaRegisterDevice_F *)calloc(
-              1, sizeof(TDS_SuplaRegisterDevice_F));
-        }
-
-        break;
-
-      case SUPLA_DS_CALL_REGISTER_DEVICE_G:  // ver. >= 25
-
-        if (VALID_SIZE(TDS_SuplaRegisterDevice_G, TDS_SuplaDeviceChannel_E,
-                       channel_count, SUPLA_CHANNELMAXCOUNT)) {
-          rd->data.ds_register_device_g = (TDS_SuplaRegisterDevice_G *)calloc(
-              1, sizeof(TDS_SuplaRegisterDevice_G));
-        }
-
-        break;
-
-      case SUPLA_SD_CALL_REGISTER_DEVICE_RESULT:
-
-        if (srpc->sdp.data_size == sizeof(TSD_SuplaRegisterDeviceResult))
-          rd->data.sd_register_device_result =
-              (TSD_SuplaRegisterDeviceResult *)calloc(
-                  1, sizeof(TSD_SuplaRegisterDeviceResult));
-        break;
-
-      case SUPLA_SD_CALL_REGISTER_DEVICE_RESULT_B:
-
-        if (VALID_SIZE(TSD_SuplaRegisterDeviceResult_B, unsigned char,
-                       channel_report_size, CHANNEL_REPORT_MAXSIZE))
-          rd->data.sd_register_device_result_b =
-              (TSD_SuplaRegisterDeviceResult_B *)calloc(
-                  1, sizeof(TSD_SuplaRegisterDeviceResult_B));
-        break;
-
-      case SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED:
-
-        if (srpc->sdp.data_size == sizeof(TDS_SuplaDeviceChannelValue))
-          rd->data.ds_device_channel_value =
-              (TDS_SuplaDeviceChannelValue *)calloc(
-                  1, sizeof(TDS_SuplaDeviceChannelValue));
 
-        break;
-
-      case SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED_B:
-
-        if (srpc->sdp.data_size == sizeof(TDS_SuplaDeviceChannelValue_B))
-          rd->data.ds_device_channel_value_b =
-              (TDS_SuplaDeviceChannelValue_B *)calloc(
-                  1, sizeof(TDS_SuplaDeviceChannelValue_B));
-
-        break;
-
-      case SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED_C:
-
-        if (srpc->sdp.data_size == sizeof(TDS_SuplaDeviceChannelValue_C))
-          rd->data.ds_device_channel_value_c =
-              (TDS_SuplaDeviceChannelValue_C *)calloc(
-                  1, sizeof(TDS_SuplaDeviceChannelValue_C));
-
-        break;
-
-      case SUPLA_DS_CALL_DEVICE_CHANNEL_EXTENDEDVALUE_CHANGED:
-
-        if (VALID_SIZE(TDS_SuplaDeviceChannelExtendedValue, char, value.size,
-                       SUPLA_CHANNELEXTENDEDVALUE_SIZE))
-          rd->data.ds_device_channel_extendedvalue =
-              (TDS_SuplaDeviceChannelExtendedValue *)calloc(
-                  1, sizeof(TDS_SuplaDeviceChannelExtendedValue));
-
-        break;
-
-      case SUPLA_SD_CALL_CHANNEL_SET_VALUE:
-
-        if (srpc->sdp.data_size == sizeof(TSD_SuplaChannelNewValue))
-          rd->data.sd_channel_new_value = (TSD_SuplaChannelNewValue *)calloc(
-              1, sizeof(TSD_SuplaChannelNewValue));
-
-        break;
-
-      case SUPLA_SD_CALL_CHANNELGROUP_SET_VALUE:
-
-        if (srpc->sdp.data_size == sizeof(TSD_SuplaChannelGroupNewValue))
-          rd->data.sd_channelgroup_new_value =
-              (TSD_SuplaChannelGroupNewValue *)calloc(
-                  1, sizeof(TSD_SuplaChannelGroupNewValue));
-
-        break;
-
-      case SUPLA_DS_CALL_CHANNEL_SET_VALUE_RESULT:
-
-        if (srpc->sdp.data_size == sizeof(TDS_SuplaChannelNewValueResult))
-          rd->data.ds_channel_new_value_result =
-              (TDS_SuplaChannelNewValueResult *)calloc(
-                  1, sizeof(TDS_SuplaChannelNewValueResult));
-
-        break;
-
-      case SUPLA_DS_CALL_GET_FIRMWARE_UPDATE_URL:
-
-        if (srpc->sdp.data_size == sizeof(TDS_FirmwareUpdateParams))
-          rd->data.ds_firmware_update_params =
-              (TDS_FirmwareUpdateParams *)calloc(
-                  1, sizeof(TDS_FirmwareUpdateParams));
-
-        break;
-
-      case SUPLA_SD_CALL_GET_FIRMWARE_UPDATE_URL_RESULT:
-
-        if (srpc->sdp.data_size == sizeof(TSD_FirmwareUpdate_UrlResult) ||
-            srpc->sdp.data_size == sizeof(char)) {
-          rd->data.sc_firmware_update_url_result =
-              (TSD_FirmwareUpdate_UrlResult *)calloc(
-                  1, sizeof(TSD_FirmwareUpdate_UrlResult));
-
-          if (srpc->sdp.data_size == sizeof(char) &&
-              rd->data.sc_firmware_update_url_result != NULL)
-            memset(rd->data.sc_firmware_update_url_result, 0,
-                   sizeof(TSD_FirmwareUpdate_UrlResult));
-        }
-        break;
-      case SUPLA_SD_CALL_DEVICE_CALCFG_REQUEST:
-        if (VALID_SIZE(TSD_DeviceCalCfgRequest, char, DataSize,
-                       SUPLA_CALCFG_DATA_MAXSIZE)) {
-          rd->data.sd_device_calcfg_request = (TSD_DeviceCalCfgRequest *)calloc(
-              1, sizeof(TSD_DeviceCalCfgRequest));
-        }
-        break;
-      case SUPLA_DS_CALL_DEVICE_CALCFG_RESULT:
-        if (VALID_SIZE(TDS_DeviceCalCfgResult, char, DataSize,
-                       SUPLA_CALCFG_DATA_MAXSIZE)) {
-          rd->data.ds_device_calcfg_result = (TDS_DeviceCalCfgResult *)calloc(
-              1, sizeof(TDS_DeviceCalCfgResult));
-        }
-        break;
-      case SUPLA_DS_CALL_GET_CHANNEL_FUNCTIONS:
-        call_with_no_data = 1;
-        break;
-      case SUPLA_SD_CALL_GET_CHANNEL_FUNCTIONS_RESULT:
-        if (VALID_SIZE(TSD_ChannelFunctions, _supla_int_t, ChannelCount,
-                       SUPLA_CHANNELMAXCOUNT)) {
-          rd->data.sd_channel_functions =
-              (TSD_ChannelFunctions *)calloc(1, sizeof(TSD_ChannelFunctions));
-        }
-        break;
-      case SUPLA_DS_CALL_GET_CHANNEL_CONFIG:
-        if (srpc->sdp.data_size == sizeof(TDS_GetChannelConfigRequest)) {
-          rd->data.ds_get_channel_config_request =
-              (TDS_GetChannelConfigRequest *)calloc(
-                  1, sizeof(TDS_GetChannelConfigRequest));
-        }
-        break;
-      case SUPLA_SD_CALL_GET_CHANNEL_CONFIG_RESULT:
-        if (VALID_SIZE(TSD_ChannelConfig, char, ConfigSize,
-                       SUPLA_CHANNEL_CONFIG_MAXSIZE)) {
-          rd->data.sd_channel_config =
-              (TSD_ChannelConfig *)calloc(1, sizeof(TSD_ChannelConfig));
-        }
-        break;
-      case SUPLA_DS_CALL_ACTIONTRIGGER:
-        if (srpc->sdp.data_size == sizeof(TDS_ActionTrigger)) {
-          rd->data.ds_action_trigger =
-              (TDS_ActionTrigger *)calloc(1, sizeof(TDS_ActionTrigger));
-        }
-        break;
-      case SUPLA_DS_CALL_REGISTER_PUSH_NOTIFICATION:
-        if (srpc->sdp.data_size == sizeof(TDS_RegisterPushNotification)) {
-          rd->data.ds_register_push_notification =
-              (TDS_RegisterPushNotification *)calloc(
-                  1, sizeof(TDS_RegisterPushNotification));
-        }
-        break;
-      case SUPLA_DS_CALL_SEND_PUSH_NOTIFICATION:
-        if (VALID_SIZE(
-                TDS_PushNotification, char,
-                TitleSize + ((TDS_PushNotification *)srpc->sdp.data)->BodySize,
-                (SUPLA_PN_TITLE_MAXSIZE + SUPLA_PN_BODY_MAXSIZE))) {
-          rd->data.ds_push_notification =
-              (TDS_PushNotification *)calloc(1, sizeof(TDS_PushNotification));
-        }
-        break;
-      case SUPLA_DS_CALL_SET_CHANNEL_CONFIG:
-      case SUPLA_SD_CALL_SET_CHANNEL_CONFIG:
-        if (VALID_SIZE(TSDS_SetChannelConfig, char, ConfigSize,
-                       SUPLA_CHANNEL_CONFIG_MAXSIZE)) {
-          rd->data.sds_set_channel_config_request =
-              (TSDS_SetChannelConfig *)malloc(sizeof(TSDS_SetChannelConfig));
-        }
-        break;
-      case SUPLA_DS_CALL_SET_CHANNEL_CONFIG_RESULT:
-      case SUPLA_SD_CALL_SET_CHANNEL_CONFIG_RESULT:
-        if (srpc->sdp.data_size == sizeof(TSDS_SetChannelConfigResult)) {
-          rd->data.sds_set_channel_config_result =
-              (TSDS_SetChannelConfigResult *)malloc(
-                  sizeof(TSDS_SetChannelConfigResult));
-        }
-        break;
-      case SUPLA_SD_CALL_CHANNEL_CONFIG_FINISHED:
-        if (srpc->sdp.data_size == sizeof(TSD_ChannelConfigFinished)) {
-          rd->data.sd_channel_config_finished =
-              (TSD_ChannelConfigFinished *)malloc(
-                  sizeof(TSD_ChannelConfigFinished));
-        }
-        break;
-      case SUPLA_DS_CALL_SET_DEVICE_CONFIG:
-      case SUPLA_SD_CALL_SET_DEVICE_CONFIG:
-        if (VALID_SIZE(TSDS_SetDeviceConfig, char, ConfigSize,
-                       SUPLA_DEVICE_CONFIG_MAXSIZE)) {
-          rd->data.sds_set_device_config_request =
-              (TSDS_SetDeviceConfig *)malloc(sizeof(TSDS_SetDeviceConfig));
-        }
-        break;
-      case SUPLA_SD_CALL_SET_DEVICE_CONFIG_RESULT:
-      case SUPLA_DS_CALL_SET_DEVICE_CONFIG_RESULT:
-        if (srpc->sdp.data_size == sizeof(TSDS_SetDeviceConfigResult)) {
-          rd->data.sds_set_device_config_result =
-              (TSDS_SetDeviceConfigResult *)malloc(
-                  sizeof(TSDS_SetDeviceConfigResult));
-        }
-        break;
-      case SUPLA_DS_CALL_SET_SUBDEVICE_DETAILS:
-        if (srpc->sdp.data_size == sizeof(TDS_SubdeviceDetails)) {
-          rd->data.ds_subdevice_details =
-              (TDS_SubdeviceDetails *)malloc(sizeof(TDS_SubdeviceDetails));
-        }
-        break;
-#endif /*#ifndef SRPC_EXCLUDE_DEVICE*/
-
-#ifndef SRPC_EXCLUDE_CLIENT
-      case SUPLA_CS_CALL_REGISTER_CLIENT:
-
-        if (srpc->sdp.data_size == sizeof(TCS_SuplaRegisterClient))
-          rd->data.cs_register_client = (TCS_SuplaRegisterClient *)calloc(
-              1, sizeof(TCS_SuplaRegisterClient));
-
-        break;
-
-      case SUPLA_CS_CALL_REGISTER_CLIENT_B:  // ver. >= 6
-
-        if (srpc->sdp.data_size == sizeof(TCS_SuplaRegisterClient_B))
-          rd->data.cs_register_client_b = (TCS_SuplaRegisterClient_B *)calloc(
-              1, sizeof(TCS_SuplaRegisterClient_B));
-
-        break;
-
-      case SUPLA_CS_CALL_REGISTER_CLIENT_C:  // ver. >= 7
-
-        if (srpc->sdp.data_size == sizeof(TCS_SuplaRegisterClient_C))
-          rd->data.cs_register_client_c = (TCS_SuplaRegisterClient_C *)calloc(
-              1, sizeof(TCS_SuplaRegisterClient_C));
-
-        break;
-
-      case SUPLA_CS_CALL_REGISTER_CLIENT_D:  // ver. >= 12
-
-        if (srpc->sdp.data_size == sizeof(TCS_SuplaRegisterClient_D))
-          rd->data.cs_register_client_d = (TCS_SuplaRegisterClient_D *)calloc(
-              1, sizeof(TCS_SuplaRegisterClient_D));
-
-        break;
-
-      case SUPLA_SC_CALL_REGISTER_CLIENT_RESULT:
-
-        if (srpc->sdp.data_size == sizeof(TSC_SuplaRegisterClientResult))
-          rd->data.sc_register_client_result =
-              (TSC_SuplaRegisterClientResult *)calloc(
-                  1, sizeof(TSC_SuplaRegisterClientResult));
-
-        break;
-
-      case SUPLA_SC_CALL_REGISTER_CLIENT_RESULT_B:
-
-        if (srpc->sdp.data_size == sizeof(TSC_SuplaRegisterClientResult_B))
-          rd->data.sc_register_client_result_b =
-              (TSC_SuplaRegisterClientResult_B *)calloc(
-                  1, sizeof(TSC_SuplaRegisterClientResult_B));
-
-        break;
-
-      case SUPLA_SC_CALL_REGISTER_CLIENT_RESULT_C:
-
-        if (srpc->sdp.data_size == sizeof(TSC_SuplaRegisterClientResult_C))
-          rd->data.sc_register_client_result_c =
-              (TSC_SuplaRegisterClientResult_C *)calloc(
-                  1, sizeof(TSC_SuplaRegisterClientResult_C));
-
-        break;
-
-      case SUPLA_SC_CALL_REGISTER_CLIENT_RESULT_D:
-
-        if (srpc->sdp.data_size == sizeof(TSC_SuplaRegisterClientResult_D))
-          rd->data.sc_register_client_result_d =
-              (TSC_SuplaRegisterClientResult_D *)calloc(
-                  1, sizeof(TSC_SuplaRegisterClientResult_D));
-
-        break;
-
-      case SUPLA_SC_CALL_LOCATION_UPDATE:
-
-        if (VALID_SIZE(TSC_SuplaLocation, char, CaptionSize,
-                       SUPLA_LOCATION_CAPTION_MAXSIZE)) {
-          rd->data.sc_location =
-              (TSC_SuplaLocation *)calloc(1, sizeof(TSC_SuplaLocation));
-        }
+// Sorted by call_id (srpc_call_desc_find does a binary search)
+static const TsrpcCallDesc srpc_call_desc[] SRPC_CALL_DESC_ATTR = {
+    SRPC_CALL_NO_DATA(SUPLA_DCS_CALL_GETVERSION, 1, SRPC_CALL_COMMON),
+    SRPC_CALL_FIXED(SUPLA_SDC_CALL_GETVERSION_RESULT, 1, SRPC_CALL_COMMON,
+                    TSDC_SuplaGetVersionResult),
+    SRPC_CALL_FIXED(SUPLA_SDC_CALL_VERSIONERROR, 1, SRPC_CALL_COMMON,
+                    TSDC_SuplaVersionError),
+    SRPC_CALL_CUSTOM(SUPLA_DCS_CALL_PING_SERVER, 1, SRPC_CALL_COMMON,
+                     TDCS_SuplaPingServer),
+    SRPC_CALL_FIXED(SUPLA_SDC_CALL_PING_SERVER_RESULT, 1, SRPC_CALL_COMMON,
+                    TSDC_SuplaPingServerResult),
+    SRPC_CALL_VARIABLE(SUPLA_DS_CALL_REGISTER_DEVICE, 1, SRPC_CALL_DEVICE,
+                       TDS_SuplaRegisterDevice, TDS_SuplaDeviceChannel,
+                       channel_count, SUPLA_CHANNELMAXCOUNT),
+    SRPC_CALL_VARIABLE(SUPLA_DS_CALL_REGISTER_DEVICE_B, 2, SRPC_CALL_DEVICE,
+                       TDS_SuplaRegisterDevice_B, TDS_SuplaDeviceChannel_B,
+                       channel_count, SUPLA_CHANNELMAXCOUNT),
+    SRPC_CALL_VARIABLE(SUPLA_DS_CALL_REGISTER_DEVICE_C, 6, SRPC_CALL_DEVICE,
+                       TDS_SuplaRegisterDevice_C, TDS_SuplaDeviceChannel_B,
+                       channel_count, SUPLA_CHANNELMAXCOUNT),
+    SRPC_CALL_VARIABLE(SUPLA_DS_CALL_REGISTER_DEVICE_D, 7, SRPC_CALL_DEVICE,
+                       TDS_SuplaRegisterDevice_D, TDS_SuplaDeviceChannel_B,
+                       channel_count, SUPLA_CHANNELMAXCOUNT),
+    SRPC_CALL_VARIABLE(SUPLA_DS_CALL_REGISTER_DEVICE_E, 10, SRPC_CALL_DEVICE,
+                       TDS_SuplaRegisterDevice_E, TDS_SuplaDeviceChannel_C,
+                       channel_count, SUPLA_CHANNELMAXCOUNT),
+    SRPC_CALL_FIXED(SUPLA_SD_CALL_REGISTER_DEVICE_RESULT, 1, SRPC_CALL_DEVICE,
+                    TSD_SuplaRegisterDeviceResult),
+    SRPC_CALL_VARIABLE(SUPLA_SD_CALL_REGISTER_DEVICE_RESULT_B, 25,
+                       SRPC_CALL_DEVICE, TSD_SuplaRegisterDeviceResult_B,
+                       unsigned char, channel_report_size,
+                       CHANNEL_REPORT_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_DS_CALL_REGISTER_DEVICE_F, 23, SRPC_CALL_DEVICE,
+                       TDS_SuplaRegisterDevice_F, TDS_SuplaDeviceChannel_D,
+                       channel_count, SUPLA_CHANNELMAXCOUNT),
+    SRPC_CALL_VARIABLE(SUPLA_DS_CALL_REGISTER_DEVICE_G, 25, SRPC_CALL_DEVICE,
+                       TDS_SuplaRegisterDevice_G, TDS_SuplaDeviceChannel_E,
+                       channel_count, SUPLA_CHANNELMAXCOUNT),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_REGISTER_CLIENT, 1, SRPC_CALL_CLIENT,
+                    TCS_SuplaRegisterClient),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_REGISTER_CLIENT_B, 6, SRPC_CALL_CLIENT,
+                    TCS_SuplaRegisterClient_B),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_REGISTER_CLIENT_C, 7, SRPC_CALL_CLIENT,
+                    TCS_SuplaRegisterClient_C),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_REGISTER_CLIENT_D, 12, SRPC_CALL_CLIENT,
+                    TCS_SuplaRegisterClient_D),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_REGISTER_CLIENT_RESULT, 1, SRPC_CALL_CLIENT,
+                    TSC_SuplaRegisterClientResult),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_REGISTER_CLIENT_RESULT_B, 9, SRPC_CALL_CLIENT,
+                    TSC_SuplaRegisterClientResult_B),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_REGISTER_CLIENT_RESULT_C, 17,
+                    SRPC_CALL_CLIENT, TSC_SuplaRegisterClientResult_C),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_REGISTER_CLIENT_RESULT_D, 19,
+                    SRPC_CALL_CLIENT, TSC_SuplaRegisterClientResult_D),
+    SRPC_CALL_FIXED(SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED, 1,
+                    SRPC_CALL_DEVICE, TDS_SuplaDeviceChannelValue),
+    SRPC_CALL_FIXED(SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED_B, 12,
+                    SRPC_CALL_DEVICE, TDS_SuplaDeviceChannelValue_B),
+    SRPC_CALL_FIXED(SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED_C, 12,
+                    SRPC_CALL_DEVICE, TDS_SuplaDeviceChannelValue_C),
+    SRPC_CALL_VARIABLE(SUPLA_DS_CALL_DEVICE_CHANNEL_EXTENDEDVALUE_CHANGED, 10,
+                       SRPC_CALL_DEVICE, TDS_SuplaDeviceChannelExtendedValue,
+                       char, value.size, SUPLA_CHANNELEXTENDEDVALUE_SIZE),
+    SRPC_CALL_FIXED(SUPLA_SD_CALL_CHANNEL_SET_VALUE, 1, SRPC_CALL_DEVICE,
+                    TSD_SuplaChannelNewValue),
+    SRPC_CALL_FIXED(SUPLA_SD_CALL_CHANNELGROUP_SET_VALUE, 13, SRPC_CALL_DEVICE,
+                    TSD_SuplaChannelGroupNewValue),
+    SRPC_CALL_FIXED(SUPLA_DS_CALL_CHANNEL_SET_VALUE_RESULT, 1, SRPC_CALL_DEVICE,
+                    TDS_SuplaChannelNewValueResult),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_LOCATION_UPDATE, 1, SRPC_CALL_CLIENT,
+                       TSC_SuplaLocation, char, CaptionSize,
+                       SUPLA_LOCATION_CAPTION_MAXSIZE),
+    SRPC_CALL_CUSTOM(SUPLA_SC_CALL_LOCATIONPACK_UPDATE, 1, SRPC_CALL_CLIENT,
+                     TSC_SuplaLocationPack),
+    SRPC_CALL_CUSTOM(SUPLA_SC_CALL_CHANNELPACK_UPDATE, 1, SRPC_CALL_CLIENT,
+                     TSC_SuplaChannelPack),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_CHANNEL_VALUE_UPDATE, 1, SRPC_CALL_CLIENT,
+                    TSC_SuplaChannelValue),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_CHANNEL_VALUE_UPDATE_B, 15, SRPC_CALL_CLIENT,
+                    TSC_SuplaChannelValue_B),
+    SRPC_CALL_NO_DATA(SUPLA_CS_CALL_GET_NEXT, 1, SRPC_CALL_COMMON),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_EVENT, 1, SRPC_CALL_CLIENT, TSC_SuplaEvent,
+                       char, SenderNameSize, SUPLA_SENDER_NAME_MAXSIZE),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_CHANNEL_SET_VALUE, 1, SRPC_CALL_CLIENT,
+                    TCS_SuplaChannelNewValue),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_CHANNEL_SET_VALUE_B, 3, SRPC_CALL_CLIENT,
+                    TCS_SuplaChannelNewValue_B),
+    SRPC_CALL_FIXED(SUPLA_DCS_CALL_SET_ACTIVITY_TIMEOUT, 2, SRPC_CALL_COMMON,
+                    TDCS_SuplaSetActivityTimeout),
+    SRPC_CALL_FIXED(SUPLA_SDC_CALL_SET_ACTIVITY_TIMEOUT_RESULT, 2,
+                    SRPC_CALL_COMMON, TSDC_SuplaSetActivityTimeoutResult),
+    SRPC_CALL_FIXED(SUPLA_DS_CALL_GET_FIRMWARE_UPDATE_URL, 5, SRPC_CALL_DEVICE,
+                    TDS_FirmwareUpdateParams),
+    SRPC_CALL_CUSTOM(SUPLA_SD_CALL_GET_FIRMWARE_UPDATE_URL_RESULT, 5,
+                     SRPC_CALL_DEVICE, TSD_FirmwareUpdate_UrlResult),
+    SRPC_CALL_NO_DATA(SUPLA_DCS_CALL_GET_REGISTRATION_ENABLED, 7,
+                      SRPC_CALL_COMMON),
+    SRPC_CALL_FIXED(SUPLA_SDC_CALL_GET_REGISTRATION_ENABLED_RESULT, 7,
+                    SRPC_CALL_COMMON, TSDC_RegistrationEnabled),
+    SRPC_CALL_NO_DATA(SUPLA_CS_CALL_OAUTH_TOKEN_REQUEST, 10, SRPC_CALL_CLIENT),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_OAUTH_TOKEN_REQUEST_RESULT, 10,
+                       SRPC_CALL_CLIENT, TSC_OAuthTokenRequestResult, char,
+                       Token.TokenSize, SUPLA_OAUTH_TOKEN_MAXSIZE),
+    SRPC_CALL_CUSTOM(SUPLA_SC_CALL_CHANNELPACK_UPDATE_B, 8, SRPC_CALL_CLIENT,
+                     TSC_SuplaChannelPack_B),
+    SRPC_CALL_CUSTOM(SUPLA_SC_CALL_CHANNELPACK_UPDATE_C, 10, SRPC_CALL_CLIENT,
+                     TSC_SuplaChannelPack_C),
+    SRPC_CALL_CUSTOM(SUPLA_SC_CALL_CHANNELPACK_UPDATE_D, 15, SRPC_CALL_CLIENT,
+                     TSC_SuplaChannelPack_D),
+    SRPC_CALL_CUSTOM(SUPLA_SC_CALL_CHANNELPACK_UPDATE_E, 23, SRPC_CALL_CLIENT,
+                     TSC_SuplaChannelPack_E),
+    SRPC_CALL_CUSTOM(SUPLA_SC_CALL_CHANNELGROUP_PACK_UPDATE, 9,
+                     SRPC_CALL_CLIENT, TSC_SuplaChannelGroupPack),
+    SRPC_CALL_CUSTOM(SUPLA_SC_CALL_CHANNELGROUP_PACK_UPDATE_B, 10,
+                     SRPC_CALL_CLIENT, TSC_SuplaChannelGroupPack_B),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_CHANNELGROUP_RELATION_PACK_UPDATE, 9,
+                       SRPC_CALL_CLIENT, TSC_SuplaChannelGroupRelationPack,
+                       TSC_SuplaChannelGroupRelation, count,
+                       SUPLA_CHANNELGROUP_RELATION_PACK_MAXCOUNT),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_CHANNEL_RELATION_PACK_UPDATE, 21,
+                       SRPC_CALL_CLIENT, TSC_SuplaChannelRelationPack,
+                       TSC_SuplaChannelRelation, count,
+                       SUPLA_CHANNEL_RELATION_PACK_MAXCOUNT),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_CHANNELVALUE_PACK_UPDATE, 9,
+                       SRPC_CALL_CLIENT, TSC_SuplaChannelValuePack,
+                       TSC_SuplaChannelValue, count,
+                       SUPLA_CHANNELVALUE_PACK_MAXCOUNT),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_CHANNELVALUE_PACK_UPDATE_B, 15,
+                       SRPC_CALL_CLIENT, TSC_SuplaChannelValuePack_B,
+                       TSC_SuplaChannelValue_B, count,
+                       SUPLA_CHANNELVALUE_PACK_MAXCOUNT),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_CHANNELEXTENDEDVALUE_PACK_UPDATE, 10,
+                       SRPC_CALL_CLIENT, TSC_SuplaChannelExtendedValuePack,
+                       char, pack_size,
+                       SUPLA_CHANNELEXTENDEDVALUE_PACK_MAXDATASIZE),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_CHANNEL_STATE_PACK_UPDATE, 26,
+                       SRPC_CALL_CLIENT, TSC_SuplaChannelStatePack,
+                       TDSC_ChannelState, count,
+                       SUPLA_CHANNEL_STATE_PACK_MAXCOUNT),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_SET_VALUE, 9, SRPC_CALL_CLIENT,
+                    TCS_SuplaNewValue),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_SUPERUSER_AUTHORIZATION_REQUEST, 10,
+                    SRPC_CALL_CLIENT, TCS_SuperUserAuthorizationRequest),
+    SRPC_CALL_NO_DATA(SUPLA_CS_CALL_GET_SUPERUSER_AUTHORIZATION_RESULT, 12,
+                      SRPC_CALL_CLIENT),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_SUPERUSER_AUTHORIZATION_RESULT, 10,
+                    SRPC_CALL_CLIENT, TSC_SuperUserAuthorizationResult),
+    SRPC_CALL_VARIABLE(SUPLA_CS_CALL_DEVICE_CALCFG_REQUEST, 10,
+                       SRPC_CALL_CLIENT, TCS_DeviceCalCfgRequest, char,
+                       DataSize, SUPLA_CALCFG_DATA_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_CS_CALL_DEVICE_CALCFG_REQUEST_B, 11,
+                       SRPC_CALL_CLIENT, TCS_DeviceCalCfgRequest_B, char,
+                       DataSize, SUPLA_CALCFG_DATA_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_DEVICE_CALCFG_RESULT, 10, SRPC_CALL_CLIENT,
+                       TSC_DeviceCalCfgResult, char, DataSize,
+                       SUPLA_CALCFG_DATA_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_SD_CALL_DEVICE_CALCFG_REQUEST, 10,
+                       SRPC_CALL_DEVICE, TSD_DeviceCalCfgRequest, char,
+                       DataSize, SUPLA_CALCFG_DATA_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_DS_CALL_DEVICE_CALCFG_RESULT, 10, SRPC_CALL_DEVICE,
+                       TDS_DeviceCalCfgResult, char, DataSize,
+                       SUPLA_CALCFG_DATA_MAXSIZE),
+    SRPC_CALL_NO_DATA(SUPLA_DCS_CALL_GET_USER_LOCALTIME, 11, SRPC_CALL_COMMON),
+    SRPC_CALL_VARIABLE(SUPLA_DCS_CALL_GET_USER_LOCALTIME_RESULT, 11,
+                       SRPC_CALL_COMMON, TSDC_UserLocalTimeResult, char,
+                       timezoneSize, SUPLA_TIMEZONE_MAXSIZE),
+    SRPC_CALL_FIXED(SUPLA_CSD_CALL_GET_CHANNEL_STATE, 12, SRPC_CALL_COMMON,
+                    TCSD_ChannelStateRequest),
+    SRPC_CALL_FIXED(SUPLA_DSC_CALL_CHANNEL_STATE_RESULT, 12, SRPC_CALL_COMMON,
+                    TDSC_ChannelState),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_GET_CHANNEL_BASIC_CFG, 12, SRPC_CALL_CLIENT,
+                    TCS_ChannelBasicCfgRequest),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_CHANNEL_BASIC_CFG_RESULT, 12,
+                       SRPC_CALL_CLIENT, TSC_ChannelBasicCfg, char, CaptionSize,
+                       SUPLA_CHANNEL_CAPTION_MAXSIZE),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_SET_CHANNEL_FUNCTION, 12, SRPC_CALL_CLIENT,
+                    TCS_SetChannelFunction),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_SET_CHANNEL_FUNCTION_RESULT, 12,
+                    SRPC_CALL_CLIENT, TSC_SetChannelFunctionResult),
+    SRPC_CALL_NO_DATA(SUPLA_CS_CALL_CLIENTS_RECONNECT_REQUEST, 12,
+                      SRPC_CALL_CLIENT),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_CLIENTS_RECONNECT_REQUEST_RESULT, 12,
+                    SRPC_CALL_CLIENT, TSC_ClientsReconnectRequestResult),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_SET_REGISTRATION_ENABLED, 12,
+                    SRPC_CALL_CLIENT, TCS_SetRegistrationEnabled),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_SET_REGISTRATION_ENABLED_RESULT, 12,
+                    SRPC_CALL_CLIENT, TSC_SetRegistrationEnabledResult),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_DEVICE_RECONNECT_REQUEST, 12,
+                    SRPC_CALL_CLIENT, TCS_DeviceReconnectRequest),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_DEVICE_RECONNECT_REQUEST_RESULT, 12,
+                    SRPC_CALL_CLIENT, TSC_DeviceReconnectRequestResult),
+    SRPC_CALL_NO_DATA(SUPLA_DS_CALL_GET_CHANNEL_FUNCTIONS, 12,
+                      SRPC_CALL_DEVICE),
+    SRPC_CALL_VARIABLE(SUPLA_SD_CALL_GET_CHANNEL_FUNCTIONS_RESULT, 12,
+                       SRPC_CALL_DEVICE, TSD_ChannelFunctions, _supla_int_t,
+                       ChannelCount, SUPLA_CHANNELMAXCOUNT),
+    SRPC_CALL_VARIABLE(SUPLA_DCS_CALL_SET_CHANNEL_CAPTION, 12, SRPC_CALL_CLIENT,
+                       TDCS_SetCaption, char, CaptionSize,
+                       SUPLA_CAPTION_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_CS_CALL_SET_CHANNEL_GROUP_CAPTION, 20,
+                       SRPC_CALL_CLIENT, TDCS_SetCaption, char, CaptionSize,
+                       SUPLA_CAPTION_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_CS_CALL_SET_LOCATION_CAPTION, 14, SRPC_CALL_CLIENT,
+                       TDCS_SetCaption, char, CaptionSize,
+                       SUPLA_CAPTION_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_SCD_CALL_SET_CHANNEL_CAPTION_RESULT, 12,
+                       SRPC_CALL_COMMON, TSCD_SetCaptionResult, char,
+                       CaptionSize, SUPLA_CAPTION_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_SET_CHANNEL_GROUP_CAPTION_RESULT, 20,
+                       SRPC_CALL_CLIENT, TSCD_SetCaptionResult, char,
+                       CaptionSize, SUPLA_CAPTION_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_SET_LOCATION_CAPTION_RESULT, 14,
+                       SRPC_CALL_CLIENT, TSCD_SetCaptionResult, char,
+                       CaptionSize, SUPLA_CAPTION_MAXSIZE),
+    SRPC_CALL_FIXED(SUPLA_DS_CALL_GET_CHANNEL_CONFIG, 16, SRPC_CALL_DEVICE,
+                    TDS_GetChannelConfigRequest),
+    SRPC_CALL_VARIABLE(SUPLA_DS_CALL_SET_CHANNEL_CONFIG, 21, SRPC_CALL_DEVICE,
+                       TSDS_SetChannelConfig, char, ConfigSize,
+                       SUPLA_CHANNEL_CONFIG_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_SD_CALL_SET_CHANNEL_CONFIG, 21, SRPC_CALL_DEVICE,
+                       TSDS_SetChannelConfig, char, ConfigSize,
+                       SUPLA_CHANNEL_CONFIG_MAXSIZE),
+    SRPC_CALL_FIXED(SUPLA_SD_CALL_CHANNEL_CONFIG_FINISHED, 21, SRPC_CALL_DEVICE,
+                    TSD_ChannelConfigFinished),
+    SRPC_CALL_VARIABLE(SUPLA_DS_CALL_SET_DEVICE_CONFIG, 21, SRPC_CALL_DEVICE,
+                       TSDS_SetDeviceConfig, char, ConfigSize,
+                       SUPLA_DEVICE_CONFIG_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_SD_CALL_SET_DEVICE_CONFIG, 21, SRPC_CALL_DEVICE,
+                       TSDS_SetDeviceConfig, char, ConfigSize,
+                       SUPLA_DEVICE_CONFIG_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_SD_CALL_GET_CHANNEL_CONFIG_RESULT, 16,
+                       SRPC_CALL_DEVICE, TSD_ChannelConfig, char, ConfigSize,
+                       SUPLA_CHANNEL_CONFIG_MAXSIZE),
+    SRPC_CALL_FIXED(SUPLA_SD_CALL_SET_CHANNEL_CONFIG_RESULT, 21,
+                    SRPC_CALL_DEVICE, TSDS_SetChannelConfigResult),
+    SRPC_CALL_FIXED(SUPLA_DS_CALL_SET_CHANNEL_CONFIG_RESULT, 21,
+                    SRPC_CALL_DEVICE, TSDS_SetChannelConfigResult),
+    SRPC_CALL_FIXED(SUPLA_SD_CALL_SET_DEVICE_CONFIG_RESULT, 21,
+                    SRPC_CALL_DEVICE, TSDS_SetDeviceConfigResult),
+    SRPC_CALL_FIXED(SUPLA_DS_CALL_SET_DEVICE_CONFIG_RESULT, 21,
+                    SRPC_CALL_DEVICE, TSDS_SetDeviceConfigResult),
+    SRPC_CALL_FIXED(SUPLA_DS_CALL_ACTIONTRIGGER, 16, SRPC_CALL_DEVICE,
+                    TDS_ActionTrigger),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_TIMER_ARM, 17, SRPC_CALL_CLIENT,
+                    TCS_TimerArmRequest),
+    SRPC_CALL_CUSTOM(SUPLA_SC_CALL_SCENE_PACK_UPDATE, 18, SRPC_CALL_CLIENT,
+                     TSC_SuplaScenePack),
+    SRPC_CALL_CUSTOM(SUPLA_SC_CALL_SCENE_STATE_PACK_UPDATE, 18,
+                     SRPC_CALL_CLIENT, TSC_SuplaSceneStatePack),
+    SRPC_CALL_VARIABLE(SUPLA_CS_CALL_EXECUTE_ACTION, 19, SRPC_CALL_CLIENT,
+                       TCS_Action, char, ParamSize, SUPLA_ACTION_PARAM_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_CS_CALL_EXECUTE_ACTION_WITH_AUTH, 19,
+                       SRPC_CALL_CLIENT, TCS_ActionWithAuth, char,
+                       Action.ParamSize, SUPLA_ACTION_PARAM_MAXSIZE),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_ACTION_EXECUTION_RESULT, 19, SRPC_CALL_CLIENT,
+                    TSC_ActionExecutionResult),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_GET_CHANNEL_VALUE_WITH_AUTH, 19,
+                    SRPC_CALL_CLIENT, TCS_GetChannelValueWithAuth),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_GET_CHANNEL_VALUE_RESULT, 19,
+                       SRPC_CALL_CLIENT, TSC_GetChannelValueResult, char,
+                       ExtendedValue.size, SUPLA_CHANNELEXTENDEDVALUE_SIZE),
+    SRPC_CALL_VARIABLE(SUPLA_CS_CALL_SET_SCENE_CAPTION, 19, SRPC_CALL_CLIENT,
+                       TDCS_SetCaption, char, CaptionSize,
+                       SUPLA_CAPTION_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_SET_SCENE_CAPTION_RESULT, 19,
+                       SRPC_CALL_CLIENT, TSCD_SetCaptionResult, char,
+                       CaptionSize, SUPLA_CAPTION_MAXSIZE),
+    SRPC_CALL_FIXED(SUPLA_DS_CALL_REGISTER_PUSH_NOTIFICATION, 20,
+                    SRPC_CALL_DEVICE, TDS_RegisterPushNotification),
+    SRPC_CALL_CUSTOM(SUPLA_DS_CALL_SEND_PUSH_NOTIFICATION, 20, SRPC_CALL_DEVICE,
+                     TDS_PushNotification),
+    SRPC_CALL_VARIABLE(SUPLA_CS_CALL_REGISTER_PN_CLIENT_TOKEN, 20,
+                       SRPC_CALL_CLIENT, TCS_RegisterPnClientToken, char,
+                       Token.TokenSize, SUPLA_PN_CLIENT_TOKEN_MAXSIZE),
+    SRPC_CALL_FIXED(SUPLA_SC_CALL_REGISTER_PN_CLIENT_TOKEN_RESULT, 20,
+                    SRPC_CALL_CLIENT, TSC_RegisterPnClientTokenResult),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_GET_CHANNEL_CONFIG, 21, SRPC_CALL_CLIENT,
+                    TCS_GetChannelConfigRequest),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_CHANNEL_CONFIG_UPDATE_OR_RESULT, 21,
+                       SRPC_CALL_CLIENT, TSC_ChannelConfigUpdateOrResult, char,
+                       Config.ConfigSize, SUPLA_CHANNEL_CONFIG_MAXSIZE),
+    SRPC_CALL_VARIABLE(SUPLA_CS_CALL_SET_CHANNEL_CONFIG, 21, SRPC_CALL_CLIENT,
+                       TSCS_ChannelConfig, char, ConfigSize,
+                       SUPLA_CHANNEL_CONFIG_MAXSIZE),
+    SRPC_CALL_FIXED(SUPLA_CS_CALL_GET_DEVICE_CONFIG, 21, SRPC_CALL_CLIENT,
+                    TCS_GetDeviceConfigRequest),
+    SRPC_CALL_VARIABLE(SUPLA_SC_CALL_DEVICE_CONFIG_UPDATE_OR_RESULT, 21,
+                       SRPC_CALL_CLIENT, TSC_DeviceConfigUpdateOrResult, char,
+                       Config.ConfigSize, SUPLA_DEVICE_CONFIG_MAXSIZE),
+    SRPC_CALL_FIXED(SUPLA_DS_CALL_SET_SUBDEVICE_DETAILS, 25, SRPC_CALL_DEVICE,
+                    TDS_SubdeviceDetails),
+};
+
+#define SRPC_CALL_DESC_COUNT \
+  (sizeof(srpc_call_desc) / sizeof(srpc_call_desc[0]))
+
+static char SRPC_ICACHE_FLASH srpc_call_desc_find(unsigned _supla_int_t call_id,
+                                                  TsrpcCallDesc *desc) {
+  unsigned _supla_int_t id;
+  int low = 0;
+  int high = SRPC_CALL_DESC_COUNT - 1;
+
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    id = SRPC_CALL_DESC_ID(mid);
+
+    if (id == call_id) {
+      SRPC_CALL_DESC_COPY(desc, mid);
+      return 1;
+    }
 
-        break;
+    if (id < call_id) {
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
 
-      case SUPLA_SC_CALL_LOCATIONPACK_UPDATE:
-        srpc_getlocationpack(srpc, rd);
-        break;
+  return 0;
+}
 
-      case SUPLA_SC_CALL_CHANNELPACK_UPDATE:
-        srpc_getchannelpack(srpc, rd);
-        break;
+// VALID_SIZE driven by the descriptor
+static char SRPC_ICACHE_FLASH srpc_valid_size(TSuplaDataPacket *sdp,
+                                              const TsrpcCallDesc *desc) {
+  unsigned _supla_int_t count = 0;
 
-      case SUPLA_SC_CALL_CHANNELPACK_UPDATE_B:
-        srpc_getchannelpack_b(srpc, rd);
-        break;
+  if (sdp->data_size < desc->header_size || sdp->data_size > desc->size) {
+    return 0;
+  }
 
-      case SUPLA_SC_CALL_CHANNELPACK_UPDATE_C:
-        srpc_getchannelpack_c(srpc, rd);
-        break;
+  // The counter may be unaligned, so never dereference it directly
+  switch (desc->count_width) {
+    case 1: {
+      unsigned char c = 0;
+      memcpy(&c, &sdp->data[desc->count_offset], sizeof(c));
+      count = c;
+    } break;
+    case 2: {
+      unsigned short c = 0;
+      memcpy(&c, &sdp->data[desc->count_offset], sizeof(c));
+      count = c;
+    } break;
+    case 4:
+      memcpy(&count, &sdp->data[desc->count_offset], sizeof(count));
+      break;
+    default:
+      return 0;
+  }
 
-      case SUPLA_SC_CALL_CHANNELPACK_UPDATE_D:
-        srpc_getchannelpack_d(srpc, rd);
-        break;
+  // Bounding count first keeps the product below data_size
+  return count <= (sdp->data_size - desc->header_size) / desc->item_size &&
+         count * desc->item_size == sdp->data_size - desc->header_size;
+}
 
-      case SUPLA_SC_CALL_CHANNELPACK_UPDATE_E:
-        srpc_getchannelpack_e(srpc, rd);
-        break;
+static char SRPC_ICACHE_FLASH srpc_call_desc_enabled(const TsrpcCallDesc *desc) {
+#ifdef SRPC_EXCLUDE_DEVICE
+  if (desc->group == SRPC_CALL_DEVICE) {
+    return 0;
+  }
+#endif /*SRPC_EXCLUDE_DEVICE*/
 
-      case SUPLA_SC_CALL_CHANNEL_VALUE_UPDATE:
+#ifdef SRPC_EXCLUDE_CLIENT
+  if (desc->group == SRPC_CALL_CLIENT) {
+    return 0;
+  }
+#endif /*SRPC_EXCLUDE_CLIENT*/
 
-        if (srpc->sdp.data_size == sizeof(TSC_SuplaChannelValue))
-          rd->data.sc_channel_value =
-              (TSC_SuplaChannelValue *)calloc(1, sizeof(TSC_SuplaChannelValue));
+  (void)(desc);
+  return 1;
+}
 
-        break;
+// Largest structure srpc_getdata can hand out in this build
+static unsigned _supla_int_t SRPC_ICACHE_FLASH srpc_rd_arena_size(void) {
+  unsigned _supla_int_t size = 0;
+  TsrpcCallDesc desc;
+  unsigned int a;
 
-      case SUPLA_SC_CALL_CHANNEL_VALUE_UPDATE_B:
+  for (a = 0; a < SRPC_CALL_DESC_COUNT; a++) {
+    SRPC_CALL_DESC_COPY(&desc, a);
+    if (srpc_call_desc_enabled(&desc) && desc.size > size) {
+      size = desc.size;
+    }
+  }
 
-        if (srpc->sdp.data_size == sizeof(TSC_SuplaChannelValue_B))
-          rd->data.sc_channel_value_b = (TSC_SuplaChannelValue_B *)calloc(
-              1, sizeof(TSC_SuplaChannelValue_B));
+  return size;
+}
+
+#define SRPC_RD_ALLOC(TYPE) \
+  ((TYPE *)srpc_rd_alloc(srpc, sdp, sizeof(TYPE), in_place))
+
+// Zeroed storage for a decoded payload. In-place decoding hands out the
+// received packet, the arena is reused for every call and the heap is the
+// fallback. Called with srpc->lck held.
+//
+// Only a packet carrying the whole structure is handed out in place: past
+// data_size sdp->data holds whatever the previous packet left there, while
+// callers rely on the unsent tail (string terminators, newer fields) being
+// zero.
+static void *SRPC_ICACHE_FLASH srpc_rd_alloc(Tsrpc *srpc,
+                                             TSuplaDataPacket *sdp,
+                                             size_t size,
+                                             unsigned char in_place) {
+  void *ptr;
+
+  if (in_place && sdp->data_size == size) {
+    srpc->rd_stats.in_place_count++;
+    return sdp->data;
+  }
 
-        break;
+  if (srpc->rd_arena != NULL && size <= srpc->rd_stats.arena_size) {
+    srpc->rd_stats.arena_count++;
+    memset(srpc->rd_arena, 0, size);
+    return srpc->rd_arena;
+  }
 
-      case SUPLA_SC_CALL_CHANNELGROUP_PACK_UPDATE:
-        srpc_getchannelgroup_pack(srpc, rd);
-        break;
+  ptr = calloc(1, size);
 
-      case SUPLA_SC_CALL_CHANNELGROUP_PACK_UPDATE_B:
-        srpc_getchannelgroup_pack_b(srpc, rd);
-        break;
+  if (ptr != NULL) {
+    srpc->rd_stats.heap_count++;
+    srpc->rd_stats.heap_bytes += size;
+  }
 
-      case SUPLA_SC_CALL_CHANNELGROUP_RELATION_PACK_UPDATE:
-        if (VALID_SIZE(TSC_SuplaChannelGroupRelationPack,
-                       TSC_SuplaChannelGroupRelation, count,
-                       SUPLA_CHANNELGROUP_RELATION_PACK_MAXCOUNT)) {
-          rd->data.sc_channelgroup_relation_pack =
-              (TSC_SuplaChannelGroupRelationPack *)calloc(
-                  1, sizeof(TSC_SuplaChannelGroupRelationPack));
-        }
-        break;
+  return ptr;
+}
 
-      case SUPLA_SC_CALL_CHANNEL_RELATION_PACK_UPDATE:
-        if (VALID_SIZE(TSC_SuplaChannelRelationPack, TSC_SuplaChannelRelation,
-                       count, SUPLA_CHANNEL_RELATION_PACK_MAXCOUNT)) {
-          rd->data.sc_channel_relation_pack =
-              (TSC_SuplaChannelRelationPack *)calloc(
-                  1, sizeof(TSC_SuplaChannelRelationPack));
-        }
-        break;
+static void SRPC_ICACHE_FLASH srpc_rd_release(Tsrpc *srpc, void *ptr) {
+  if (ptr != NULL && ptr != srpc->rd_arena) {
+    free(ptr);
+  }
+}
 
-      case SUPLA_SC_CALL_CHANNELVALUE_PACK_UPDATE:
-        if (VALID_SIZE(TSC_SuplaChannelValuePack, TSC_SuplaChannelValue, count,
-                       SUPLA_CHANNELVALUE_PACK_MAXCOUNT) &&
-            srpc->sdp.data_size <= sizeof(TSC_SuplaChannelValuePack)) {
-          rd->data.sc_channelvalue_pack = (TSC_SuplaChannelValuePack *)calloc(
-              1, sizeof(TSC_SuplaChannelValuePack));
-        }
-        break;
+// Calls that do not fit the table. Returns 1 when rd->data is already
+// filled in and the payload must not be copied over it.
+static char SRPC_ICACHE_FLASH srpc_getdata_custom(Tsrpc *srpc,
+                                                  TSuplaDataPacket *sdp,
+                                                  TsrpcReceivedData *rd,
+                                                  unsigned char in_place) {
+  (void)(in_place);
 
-      case SUPLA_SC_CALL_CHANNELVALUE_PACK_UPDATE_B:
-        if (VALID_SIZE(TSC_SuplaChannelValuePack_B, TSC_SuplaChannelValue_B,
-                       count, SUPLA_CHANNELVALUE_PACK_MAXCOUNT)) {
-          rd->data.sc_channelvalue_pack_b =
-              (TSC_SuplaChannelValuePack_B *)calloc(
-                  1, sizeof(TSC_SuplaChannelValuePack_B));
-        }
-        break;
+  switch (sdp->call_id) {
+    case SUPLA_DCS_CALL_PING_SERVER:
 
-      case SUPLA_SC_CALL_CHANNELEXTENDEDVALUE_PACK_UPDATE:
-        if (VALID_SIZE(TSC_SuplaChannelExtendedValuePack, char, pack_size,
-                       SUPLA_CHANNELEXTENDEDVALUE_PACK_MAXDATASIZE)) {
-          rd->data.sc_channelextendedvalue_pack =
-              (TSC_SuplaChannelExtendedValuePack *)calloc(
-                  1, sizeof(TSC_SuplaChannelExtendedValuePack));
-        }
-        break;
+      if (sdp->data_size == sizeof(TDCS_SuplaPingServer) ||
+          sdp->data_size == sizeof(TDCS_SuplaPingServer_COMPAT)) {
+        // COMPAT layout is converted, so never decoded in place
+        rd->data.dcs_ping = (TDCS_SuplaPingServer *)srpc_rd_alloc(
+            srpc, sdp, sizeof(TDCS_SuplaPingServer), 0);
 
-      case SUPLA_SC_CALL_CHANNEL_STATE_PACK_UPDATE:
-        if (VALID_SIZE(TSC_SuplaChannelStatePack, TDSC_ChannelState, count,
-                       SUPLA_CHANNEL_STATE_PACK_MAXCOUNT)) {
-          rd->data.sc_channel_state_pack = (TSC_SuplaChannelStatePack *)calloc(
-              1, sizeof(TSC_SuplaChannelStatePack));
+#ifndef __AVR__
+        if (sdp->data_size == sizeof(TDCS_SuplaPingServer_COMPAT) &&
+            rd->data.dcs_ping != NULL) {
+          TDCS_SuplaPingServer_COMPAT *compat =
+              (TDCS_SuplaPingServer_COMPAT *)sdp->data;
+
+          rd->data.dcs_ping->now.tv_sec = compat->now.tv_sec;
+          rd->data.dcs_ping->now.tv_usec = compat->now.tv_usec;
+          return 1;
         }
-        break;
+#endif
+      }
+      break;
 
-      case SUPLA_CS_CALL_CHANNEL_SET_VALUE:
+#ifndef SRPC_EXCLUDE_DEVICE
+    case SUPLA_SD_CALL_GET_FIRMWARE_UPDATE_URL_RESULT:
 
-        if (srpc->sdp.data_size == sizeof(TCS_SuplaChannelNewValue))
-          rd->data.cs_channel_new_value = (TCS_SuplaChannelNewValue *)calloc(
-              1, sizeof(TCS_SuplaChannelNewValue));
+      if (sdp->data_size == sizeof(TSD_FirmwareUpdate_UrlResult) ||
+          sdp->data_size == sizeof(char)) {
+        rd->data.sc_firmware_update_url_result =
+            SRPC_RD_ALLOC(TSD_FirmwareUpdate_UrlResult);
 
-        break;
+        if (sdp->data_size == sizeof(char) &&
+            rd->data.sc_firmware_update_url_result != NULL)
+          memset(rd->data.sc_firmware_update_url_result, 0,
+                 sizeof(TSD_FirmwareUpdate_UrlResult));
+      }
+      break;
 
-      case SUPLA_CS_CALL_SET_VALUE:
+    case SUPLA_DS_CALL_SEND_PUSH_NOTIFICATION:
+      if (VALID_SIZE(
+              TDS_PushNotification, char,
+              TitleSize + ((TDS_PushNotification *)sdp->data)->BodySize,
+              (SUPLA_PN_TITLE_MAXSIZE + SUPLA_PN_BODY_MAXSIZE))) {
+        rd->data.ds_push_notification = SRPC_RD_ALLOC(TDS_PushNotification);
+      }
+      break;
+#endif /*#ifndef SRPC_EXCLUDE_DEVICE*/
 
-        if (srpc->sdp.data_size == sizeof(TCS_SuplaNewValue))
-          rd->data.cs_new_value =
-              (TCS_SuplaNewValue *)calloc(1, sizeof(TCS_SuplaNewValue));
+#ifndef SRPC_EXCLUDE_CLIENT
+    case SUPLA_SC_CALL_LOCATIONPACK_UPDATE:
+      srpc_getlocationpack(srpc, rd);
+      break;
 
-        break;
+    case SUPLA_SC_CALL_CHANNELPACK_UPDATE:
+      srpc_getchannelpack(srpc, rd);
+      break;
 
-      case SUPLA_CS_CALL_CHANNEL_SET_VALUE_B:
+    case SUPLA_SC_CALL_CHANNELPACK_UPDATE_B:
+      srpc_getchannelpack_b(srpc, rd);
+      break;
 
-        if (srpc->sdp.data_size == sizeof(TCS_SuplaChannelNewValue_B))
-          rd->data.cs_channel_new_value_b =
-              (TCS_SuplaChannelNewValue_B *)calloc(
-                  1, sizeof(TCS_SuplaChannelNewValue_B));
+    case SUPLA_SC_CALL_CHANNELPACK_UPDATE_C:
+      srpc_getchannelpack_c(srpc, rd);
+      break;
 
-        break;
+    case SUPLA_SC_CALL_CHANNELPACK_UPDATE_D:
+      srpc_getchannelpack_d(srpc, rd);
+      break;
 
-      case SUPLA_SC_CALL_EVENT:
+    case SUPLA_SC_CALL_CHANNELPACK_UPDATE_E:
+      srpc_getchannelpack_e(srpc, rd);
+      break;
 
-        if (VALID_SIZE(TSC_SuplaEvent, char, SenderNameSize,
-                       SUPLA_SENDER_NAME_MAXSIZE)) {
-          rd->data.sc_event =
-              (TSC_SuplaEvent *)calloc(1, sizeof(TSC_SuplaEvent));
-        }
+    case SUPLA_SC_CALL_CHANNELGROUP_PACK_UPDATE:
+      srpc_getchannelgroup_pack(srpc, rd);
+      break;
 
-        break;
+    case SUPLA_SC_CALL_CHANNELGROUP_PACK_UPDATE_B:
+      srpc_getchannelgroup_pack_b(srpc, rd);
+      break;
 
-      case SUPLA_CS_CALL_OAUTH_TOKEN_REQUEST:
-        call_with_no_data = 1;
-        break;
+    case SUPLA_SC_CALL_SCENE_PACK_UPDATE:
+      srpc_get_scene_pack(srpc, rd);
+      break;
 
-      case SUPLA_SC_CALL_OAUTH_TOKEN_REQUEST_RESULT:
-        if (VALID_SIZE(TSC_OAuthTokenRequestResult, char, Token.TokenSize,
-                       SUPLA_OAUTH_TOKEN_MAXSIZE)) {
-          rd->data.sc_oauth_tokenrequest_result =
-              (TSC_OAuthTokenRequestResult *)calloc(
-                  1, sizeof(TSC_OAuthTokenRequestResult));
-        }
-        break;
-      case SUPLA_CS_CALL_SUPERUSER_AUTHORIZATION_REQUEST:
-        if (srpc->sdp.data_size == sizeof(TCS_SuperUserAuthorizationRequest))
-          rd->data.cs_superuser_authorization_request =
-              (TCS_SuperUserAuthorizationRequest *)calloc(
-                  1, sizeof(TCS_SuperUserAuthorizationRequest));
-        break;
-      case SUPLA_CS_CALL_GET_SUPERUSER_AUTHORIZATION_RESULT:
-        call_with_no_data = 1;
-        break;
-      case SUPLA_SC_CALL_SUPERUSER_AUTHORIZATION_RESULT:
-        if (srpc->sdp.data_size == sizeof(TSC_SuperUserAuthorizationResult))
-          rd->data.sc_superuser_authorization_result =
-              (TSC_SuperUserAuthorizationResult *)calloc(
-                  1, sizeof(TSC_SuperUserAuthorizationResult));
-        break;
-      case SUPLA_CS_CALL_DEVICE_CALCFG_REQUEST:
-        if (VALID_SIZE(TCS_DeviceCalCfgRequest, char, DataSize,
-                       SUPLA_CALCFG_DATA_MAXSIZE)) {
-          rd->data.cs_device_calcfg_request = (TCS_DeviceCalCfgRequest *)calloc(
-              1, sizeof(TCS_DeviceCalCfgRequest));
-        }
-        break;
-      case SUPLA_CS_CALL_DEVICE_CALCFG_REQUEST_B:
-        if (VALID_SIZE(TCS_DeviceCalCfgRequest_B, char, DataSize,
-                       SUPLA_CALCFG_DATA_MAXSIZE)) {
-          rd->data.cs_device_calcfg_request_b =
-              (TCS_DeviceCalCfgRequest_B *)calloc(
-                  1, sizeof(TCS_DeviceCalCfgRequest_B));
-        }
-        break;
-      case SUPLA_SC_CALL_DEVICE_CALCFG_RESULT:
-        if (VALID_SIZE(TSC_DeviceCalCfgResult, char, DataSize,
-                       SUPLA_CALCFG_DATA_MAXSIZE)) {
-          rd->data.sc_device_calcfg_result = (TSC_DeviceCalCfgResult *)calloc(
-              1, sizeof(TSC_DeviceCalCfgResult));
-        }
-        break;
+    case SUPLA_SC_CALL_SCENE_STATE_PACK_UPDATE:
+      srpc_get_scene_state_pack(srpc, rd);
+      break;
+#endif /*#ifndef SRPC_EXCLUDE_CLIENT*/
+  }
 
-      case SUPLA_CS_CALL_GET_CHANNEL_BASIC_CFG:
-        if (srpc->sdp.data_size == sizeof(TCS_ChannelBasicCfgRequest))
-          rd->data.cs_channel_basic_cfg_request =
-              (TCS_ChannelBasicCfgRequest *)calloc(
-                  1, sizeof(TCS_ChannelBasicCfgRequest));
-        break;
-      case SUPLA_SC_CALL_CHANNEL_BASIC_CFG_RESULT:
-        if (VALID_SIZE(TSC_ChannelBasicCfg, char, CaptionSize,
-                       SUPLA_CHANNEL_CAPTION_MAXSIZE))
-          rd->data.sc_channel_basic_cfg =
-              (TSC_ChannelBasicCfg *)calloc(1, sizeof(TSC_ChannelBasicCfg));
-        break;
+  return 0;
+}
 
-      case SUPLA_CS_CALL_SET_CHANNEL_FUNCTION:
-        if (srpc->sdp.data_size == sizeof(TCS_SetChannelFunction))
-          rd->data.cs_set_channel_function = (TCS_SetChannelFunction *)calloc(
-              1, sizeof(TCS_SetChannelFunction));
-        break;
+// Decodes sdp into rd. Called with srpc->lck held.
+static char SRPC_ICACHE_FLASH srpc_getdata_sdp(Tsrpc *srpc,
+                                               TSuplaDataPacket *sdp,
+                                               TsrpcReceivedData *rd,
+                                               unsigned char in_place) {
+  TsrpcCallDesc desc;
+  char converted = 0;
 
-      case SUPLA_SC_CALL_SET_CHANNEL_FUNCTION_RESULT:
-        if (srpc->sdp.data_size == sizeof(TSC_SetChannelFunctionResult))
-          rd->data.sc_set_channel_function_result =
-              (TSC_SetChannelFunctionResult *)calloc(
-                  1, sizeof(TSC_SetChannelFunctionResult));
-        break;
+  rd->call_id = sdp->call_id;
+  rd->rr_id = sdp->rr_id;
 
-      case SUPLA_DCS_CALL_SET_CHANNEL_CAPTION:
-      case SUPLA_CS_CALL_SET_CHANNEL_GROUP_CAPTION:
-      case SUPLA_CS_CALL_SET_LOCATION_CAPTION:
-      case SUPLA_CS_CALL_SET_SCENE_CAPTION:
-        if (VALID_SIZE(TDCS_SetCaption, char, CaptionSize,
-                       SUPLA_CAPTION_MAXSIZE))
-          rd->data.dcs_set_caption =
-              (TDCS_SetCaption *)calloc(1, sizeof(TDCS_SetCaption));
-        break;
+  // first one
+  rd->data.dcs_ping = NULL;
 
-      case SUPLA_SC_CALL_SET_CHANNEL_GROUP_CAPTION_RESULT:
-      case SUPLA_SC_CALL_SET_LOCATION_CAPTION_RESULT:
-      case SUPLA_SC_CALL_SET_SCENE_CAPTION_RESULT:
-        if (VALID_SIZE(TSCD_SetCaptionResult, char, CaptionSize,
-                       SUPLA_CAPTION_MAXSIZE))
-          rd->data.scd_set_caption_result =
-              (TSCD_SetCaptionResult *)calloc(1, sizeof(TSCD_SetCaptionResult));
-        break;
+  if (!srpc_call_desc_find(sdp->call_id, &desc)) {
+    return SUPLA_RESULT_DATA_ERROR;
+  }
 
-      case SUPLA_CS_CALL_CLIENTS_RECONNECT_REQUEST:
-        call_with_no_data = 1;
-        break;
+  if (!srpc_call_desc_enabled(&desc)) {
+    return SUPLA_RESULT_DATA_ERROR;
+  }
 
-      case SUPLA_SC_CALL_CLIENTS_RECONNECT_REQUEST_RESULT:
-        if (srpc->sdp.data_size == sizeof(TSC_ClientsReconnectRequestResult))
-          rd->data.sc_clients_reconnect_result =
-              (TSC_ClientsReconnectRequestResult *)calloc(
-                  1, sizeof(TSC_ClientsReconnectRequestResult));
-        break;
+  // Every member of rd->data is a pointer, dcs_ping stands for all of them
+  switch (desc.decode) {
+    case SRPC_DECODE_NO_DATA:
+      return SUPLA_RESULT_TRUE;
 
-      case SUPLA_CS_CALL_SET_REGISTRATION_ENABLED:
-        if (srpc->sdp.data_size == sizeof(TCS_SetRegistrationEnabled))
-          rd->data.cs_set_registration_enabled =
-              (TCS_SetRegistrationEnabled *)calloc(
-                  1, sizeof(TCS_SetRegistrationEnabled));
-        break;
+    case SRPC_DECODE_FIXED:
+      if (sdp->data_size == desc.size) {
+        rd->data.dcs_ping = (TDCS_SuplaPingServer *)srpc_rd_alloc(
+            srpc, sdp, desc.size, in_place);
+      }
+      break;
 
-      case SUPLA_SC_CALL_SET_REGISTRATION_ENABLED_RESULT:
-        if (srpc->sdp.data_size == sizeof(TSC_SetRegistrationEnabledResult))
-          rd->data.sc_set_registration_enabled_result =
-              (TSC_SetRegistrationEnabledResult *)calloc(
-                  1, sizeof(TSC_SetRegistrationEnabledResult));
-        break;
+    case SRPC_DECODE_VARIABLE:
+      if (srpc_valid_size(sdp, &desc)) {
+        rd->data.dcs_ping = (TDCS_SuplaPingServer *)srpc_rd_alloc(
+            srpc, sdp, desc.size, in_place);
+      }
+      break;
 
-      case SUPLA_CS_CALL_DEVICE_RECONNECT_REQUEST:
-        if (srpc->sdp.data_size == sizeof(TCS_DeviceReconnectRequest))
-          rd->data.cs_device_reconnect_request =
-              (TCS_DeviceReconnectRequest *)calloc(
-                  1, sizeof(TCS_DeviceReconnectRequest));
-        break;
-      case SUPLA_SC_CALL_DEVICE_RECONNECT_REQUEST_RESULT:
-        if (srpc->sdp.data_size == sizeof(TSC_DeviceReconnectRequestResult))
-          rd->data.sc_device_reconnect_request_result =
-              (TSC_DeviceReconnectRequestResult *)calloc(
-                  1, sizeof(TSC_DeviceReconnectRequestResult));
-        break;
+    case SRPC_DECODE_CUSTOM:
+      converted = srpc_getdata_custom(srpc, sdp, rd, in_place);
+      break;
+  }
 
-      case SUPLA_CS_CALL_TIMER_ARM:
-        if (srpc->sdp.data_size == sizeof(TCS_TimerArmRequest))
-          rd->data.cs_timer_arm_request =
-              (TCS_TimerArmRequest *)calloc(1, sizeof(TCS_TimerArmRequest));
-        break;
+  if (rd->data.dcs_ping == NULL) {
+    return SUPLA_RESULT_DATA_ERROR;
+  }
 
-      case SUPLA_SC_CALL_SCENE_PACK_UPDATE:
-        srpc_get_scene_pack(srpc, rd);
-        break;
+  if ((char *)rd->data.dcs_ping == sdp->data) {
+    rd->in_place = 1;
+  } else {
+    rd->in_place = (char *)rd->data.dcs_ping == srpc->rd_arena;
 
-      case SUPLA_SC_CALL_SCENE_STATE_PACK_UPDATE:
-        srpc_get_scene_state_pack(srpc, rd);
-        break;
+    if (!converted && sdp->data_size > 0) {
+      memcpy(rd->data.dcs_ping, sdp->data, sdp->data_size);
+    }
+  }
 
-      case SUPLA_CS_CALL_EXECUTE_ACTION:
-        if (VALID_SIZE(TCS_Action, char, ParamSize,
-                       SUPLA_ACTION_PARAM_MAXSIZE)) {
-          rd->data.cs_action = (TCS_Action *)calloc(1, sizeof(TCS_Action));
-        }
-        break;
+  return SUPLA_RESULT_TRUE;
+}
 
-      case SUPLA_CS_CALL_EXECUTE_ACTION_WITH_AUTH:
-        if (VALID_SIZE(TCS_ActionWithAuth, char, Action.ParamSize,
-                       SUPLA_ACTION_PARAM_MAXSIZE)) {
-          rd->data.cs_action_with_auth =
-              (TCS_ActionWithAuth *)calloc(1, sizeof(TCS_ActionWithAuth));
-        }
-        break;
+#undef SRPC_RD_ALLOC
 
-      case SUPLA_SC_CALL_ACTION_EXECUTION_RESULT:
-        if (srpc->sdp.data_size == sizeof(TSC_ActionExecutionResult))
-          rd->data.sc_action_execution_result =
-              (TSC_ActionExecutionResult *)calloc(
-                  1, sizeof(TSC_ActionExecutionResult));
-        break;
+char SRPC_ICACHE_FLASH srpc_getdata(void *_srpc, TsrpcReceivedData *rd,
+                                    unsigned _supla_int_t rr_id) {
+  Tsrpc *srpc = (Tsrpc *)_srpc;
+  TSuplaDataPacket *sdp;
+  char result = SUPLA_RESULT_FALSE;
+  rd->call_id = 0;
+  rd->in_place = 0;
 
-      case SUPLA_CS_CALL_GET_CHANNEL_VALUE_WITH_AUTH:
-        if (srpc->sdp.data_size == sizeof(TCS_GetChannelValueWithAuth)) {
-          rd->data.cs_get_value_with_auth =
-              (TCS_GetChannelValueWithAuth *)calloc(
-                  1, sizeof(TCS_GetChannelValueWithAuth));
-        }
-        break;
+  lck_lock(srpc->lck);
 
-      case SUPLA_SC_CALL_GET_CHANNEL_VALUE_RESULT:
-        if (VALID_SIZE(TSC_GetChannelValueResult, char, ExtendedValue.size,
-                       SUPLA_CHANNELEXTENDEDVALUE_SIZE)) {
-          rd->data.sc_get_value_result = (TSC_GetChannelValueResult *)calloc(
-              1, sizeof(TSC_GetChannelValueResult));
-        }
-        break;
-      case SUPLA_CS_CALL_REGISTER_PN_CLIENT_TOKEN:
-        if (VALID_SIZE(TCS_RegisterPnClientToken, char, Token.TokenSize,
-                       SUPLA_PN_CLIENT_TOKEN_MAXSIZE)) {
-          rd->data.cs_register_pn_client_token =
-              (TCS_RegisterPnClientToken *)calloc(
-                  1, sizeof(TCS_RegisterPnClientToken));
-        }
-        break;
-      case SUPLA_SC_CALL_REGISTER_PN_CLIENT_TOKEN_RESULT:
-        if (srpc->sdp.data_size == sizeof(TSC_RegisterPnClientTokenResult)) {
-          rd->data.sc_register_pn_client_token_result =
-              (TSC_RegisterPnClientTokenResult *)calloc(
-                  1, sizeof(TSC_RegisterPnClientTokenResult));
-        }
-        break;
-      case SUPLA_CS_CALL_SET_CHANNEL_CONFIG:
-        if (VALID_SIZE(TSCS_ChannelConfig, char, ConfigSize,
-                       SUPLA_CHANNEL_CONFIG_MAXSIZE)) {
-          rd->data.scs_channel_config =
-              (TSCS_ChannelConfig *)malloc(sizeof(TSCS_ChannelConfig));
-        }
-        break;
-      case SUPLA_CS_CALL_GET_CHANNEL_CONFIG:
-        if (srpc->sdp.data_size == sizeof(TCS_GetChannelConfigRequest)) {
-          rd->data.cs_get_channel_config_request =
-              (TCS_GetChannelConfigRequest *)calloc(
-                  1, sizeof(TCS_GetChannelConfigRequest));
-        }
-        break;
-      case SUPLA_SC_CALL_CHANNEL_CONFIG_UPDATE_OR_RESULT:
-        if (VALID_SIZE(TSC_ChannelConfigUpdateOrResult, char, Config.ConfigSize,
-                       SUPLA_CHANNEL_CONFIG_MAXSIZE)) {
-          rd->data.sc_channel_config_update_or_result =
-              (TSC_ChannelConfigUpdateOrResult *)calloc(
-                  1, sizeof(TSC_ChannelConfigUpdateOrResult));
-        }
-        break;
-      case SUPLA_CS_CALL_GET_DEVICE_CONFIG:
-        if (srpc->sdp.data_size == sizeof(TCS_GetDeviceConfigRequest)) {
-          rd->data.cs_get_device_config_request =
-              (TCS_GetDeviceConfigRequest *)malloc(
-                  sizeof(TCS_GetDeviceConfigRequest));
-        }
-        break;
-      case SUPLA_SC_CALL_DEVICE_CONFIG_UPDATE_OR_RESULT:
-        if (VALID_SIZE(TSC_DeviceConfigUpdateOrResult, char, Config.ConfigSize,
-                       SUPLA_DEVICE_CONFIG_MAXSIZE)) {
-          rd->data.sc_device_config_update_or_result =
-              (TSC_DeviceConfigUpdateOrResult *)malloc(
-                  sizeof(TSC_DeviceConfigUpdateOrResult));
-        }
-        break;
-#endif /*#ifndef SRPC_EXCLUDE_CLIENT*/
-    }
+  if ((sdp = srpc_in_queue_pop_sdp(srpc, rr_id)) != NULL) {
+    result = srpc_getdata_sdp(srpc, sdp, rd, 0);
+  }
 
-    if (call_with_no_data == 1) {
-      return lck_unlock_r(srpc->lck, SUPLA_RESULT_TRUE);
-    }
+  return lck_unlock_r(srpc->lck, result);
+}
 
-    if (rd->data.dcs_ping != NULL) {
-      if (srpc->sdp.data_size > 0) {
-        memcpy(rd->data.dcs_ping, srpc->sdp.data, srpc->sdp.data_size);
-      }
+char SRPC_ICACHE_FLASH srpc_getdata_in_place(void *_srpc,
+                                             TsrpcReceivedData *rd,
+                                             unsigned _supla_int_t rr_id) {
+#ifdef SRPC_WITHOUT_IN_QUEUE
+  Tsrpc *srpc = (Tsrpc *)_srpc;
+  TSuplaDataPacket *sdp;
+  char result = SUPLA_RESULT_FALSE;
+  rd->call_id = 0;
+  rd->in_place = 0;
 
-      return lck_unlock_r(srpc->lck, SUPLA_RESULT_TRUE);
-    }
+  lck_lock(srpc->lck);
 
-    return lck_unlock_r(srpc->lck, SUPLA_RESULT_DATA_ERROR);
+  if ((sdp = srpc_in_queue_pop_sdp(srpc, rr_id)) != NULL) {
+    result = srpc_getdata_sdp(srpc, sdp, rd, 1);
   }
 
-  return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
+  return lck_unlock_r(srpc->lck, result);
+#else
+  // srpc->sdp is reused by every outgoing call, so queued packets are
+  // always copied out
+  return srpc_getdata(_srpc, rd, rr_id);
+#endif /*SRPC_WITHOUT_IN_QUEUE*/
 }
 
 void SRPC_ICACHE_FLASH srpc_rd_free(TsrpcReceivedData *rd) {
   if (rd->call_id > 0) {
     // first one
 
-    if (rd->data.dcs_ping != NULL) free(rd->data.dcs_ping);
+    if (rd->data.dcs_ping != NULL && !rd->in_place) free(rd->data.dcs_ping);
 
     rd->call_id = 0;
   }
 }
 
-unsigned char SRPC_ICACHE_FLASH
-srpc_call_min_version_required(void *_srpc, unsigned _supla_int_t call_id) {
-  (void)(_srpc);
-  switch (call_id) {
-    case SUPLA_DCS_CALL_GETVERSION:
-    case SUPLA_SDC_CALL_GETVERSION_RESULT:
-    case SUPLA_SDC_CALL_VERSIONERROR:
-    case SUPLA_DCS_CALL_PING_SERVER:
-    case SUPLA_SDC_CALL_PING_SERVER_RESULT:
-    case SUPLA_DS_CALL_REGISTER_DEVICE:
-    case SUPLA_SD_CALL_REGISTER_DEVICE_RESULT:
-    case SUPLA_CS_CALL_REGISTER_CLIENT:
-    case SUPLA_SC_CALL_REGISTER_CLIENT_RESULT:
-    case SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED:
-    case SUPLA_SD_CALL_CHANNEL_SET_VALUE:
-    case SUPLA_DS_CALL_CHANNEL_SET_VALUE_RESULT:
-    case SUPLA_SC_CALL_LOCATION_UPDATE:
-    case SUPLA_SC_CALL_LOCATIONPACK_UPDATE:
-    case SUPLA_SC_CALL_CHANNELPACK_UPDATE:
-    case SUPLA_SC_CALL_CHANNEL_VALUE_UPDATE:
-    case SUPLA_CS_CALL_GET_NEXT:
-    case SUPLA_SC_CALL_EVENT:
-    case SUPLA_CS_CALL_CHANNEL_SET_VALUE:
-      return 1;
-
-    case SUPLA_DS_CALL_REGISTER_DEVICE_B:
-    case SUPLA_DCS_CALL_SET_ACTIVITY_TIMEOUT:
-    case SUPLA_SDC_CALL_SET_ACTIVITY_TIMEOUT_RESULT:
-      return 2;
+void SRPC_ICACHE_FLASH srpc_get_rd_stats(void *_srpc, TsrpcRdStats *stats) {
+  Tsrpc *srpc = (Tsrpc *)_srpc;
 
-    case SUPLA_CS_CALL_CHANNEL_SET_VALUE_B:
-      return 3;
+  lck_lock(srpc->lck);
+  memcpy(stats, &srpc->rd_stats, sizeof(TsrpcRdStats));
+  lck_unlock(srpc->lck);
+}
 
-    case SUPLA_DS_CALL_GET_FIRMWARE_UPDATE_URL:
-    case SUPLA_SD_CALL_GET_FIRMWARE_UPDATE_URL_RESULT:
-      return 5;
+void SRPC_ICACHE_FLASH srpc_get_lck_stats(void *_srpc, TLckStats *stats) {
+  Tsrpc *srpc = (Tsrpc *)_srpc;
 
-    case SUPLA_DS_CALL_REGISTER_DEVICE_C:
-    case SUPLA_CS_CALL_REGISTER_CLIENT_B:
-      return 6;
+  lck_get_stats(srpc->lck, stats);
 
-    case SUPLA_CS_CALL_REGISTER_CLIENT_C:
-    case SUPLA_DS_CALL_REGISTER_DEVICE_D:
-    case SUPLA_DCS_CALL_GET_REGISTRATION_ENABLED:
-    case SUPLA_SDC_CALL_GET_REGISTRATION_ENABLED_RESULT:
-      return 7;
+#if defined(SRPC_QUEUE_SPSC) && !defined(SRPC_WITHOUT_OUT_QUEUE)
+  TLckStats out;
+  lck_get_stats(srpc->out_lck, &out);
+  stats->locks += out.locks;
+  stats->contended += out.contended;
+  stats->parked += out.parked;
+#endif /*SRPC_QUEUE_SPSC*/
+}
 
-    case SUPLA_SC_CALL_CHANNELPACK_UPDATE_B:
-      return 8;
+unsigned char SRPC_ICACHE_FLASH
+srpc_call_min_version_required(void *_srpc, unsigned _supla_int_t call_id) {
+  (void)(_srpc);
+  TsrpcCallDesc desc;
 
-    case SUPLA_SC_CALL_REGISTER_CLIENT_RESULT_B:
-    case SUPLA_SC_CALL_CHANNELGROUP_PACK_UPDATE:
-    case SUPLA_SC_CALL_CHANNELGROUP_RELATION_PACK_UPDATE:
-    case SUPLA_SC_CALL_CHANNELVALUE_PACK_UPDATE:
-    case SUPLA_CS_CALL_SET_VALUE:
-      return 9;
-
-    case SUPLA_DS_CALL_DEVICE_CHANNEL_EXTENDEDVALUE_CHANGED:
-    case SUPLA_SC_CALL_CHANNELEXTENDEDVALUE_PACK_UPDATE:
-    case SUPLA_CS_CALL_OAUTH_TOKEN_REQUEST:
-    case SUPLA_SC_CALL_OAUTH_TOKEN_REQUEST_RESULT:
-    case SUPLA_DS_CALL_REGISTER_DEVICE_E:
-    case SUPLA_CS_CALL_SUPERUSER_AUTHORIZATION_REQUEST:
-    case SUPLA_SC_CALL_SUPERUSER_AUTHORIZATION_RESULT:
-    case SUPLA_CS_CALL_DEVICE_CALCFG_REQUEST:
-    case SUPLA_SC_CALL_DEVICE_CALCFG_RESULT:
-    case SUPLA_SD_CALL_DEVICE_CALCFG_REQUEST:
-    case SUPLA_DS_CALL_DEVICE_CALCFG_RESULT:
-    case SUPLA_SC_CALL_CHANNELGROUP_PACK_UPDATE_B:
-    case SUPLA_SC_CALL_CHANNELPACK_UPDATE_C:
-      return 10;
-    case SUPLA_DCS_CALL_GET_USER_LOCALTIME:
-    case SUPLA_DCS_CALL_GET_USER_LOCALTIME_RESULT:
-    case SUPLA_CS_CALL_DEVICE_CALCFG_REQUEST_B:
-      return 11;
-    case SUPLA_CS_CALL_REGISTER_CLIENT_D:
-    case SUPLA_CSD_CALL_GET_CHANNEL_STATE:
-    case SUPLA_DSC_CALL_CHANNEL_STATE_RESULT:
-    case SUPLA_CS_CALL_GET_CHANNEL_BASIC_CFG:
-    case SUPLA_SC_CALL_CHANNEL_BASIC_CFG_RESULT:
-    case SUPLA_CS_CALL_SET_CHANNEL_FUNCTION:
-    case SUPLA_SC_CALL_SET_CHANNEL_FUNCTION_RESULT:
-    case SUPLA_DCS_CALL_SET_CHANNEL_CAPTION:
-    case SUPLA_SCD_CALL_SET_CHANNEL_CAPTION_RESULT:
-    case SUPLA_CS_CALL_CLIENTS_RECONNECT_REQUEST:
-    case SUPLA_SC_CALL_CLIENTS_RECONNECT_REQUEST_RESULT:
-    case SUPLA_CS_CALL_SET_REGISTRATION_ENABLED:
-    case SUPLA_SC_CALL_SET_REGISTRATION_ENABLED_RESULT:
-    case SUPLA_CS_CALL_DEVICE_RECONNECT_REQUEST:
-    case SUPLA_SC_CALL_DEVICE_RECONNECT_REQUEST_RESULT:
-    case SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED_B:
-    case SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED_C:
-    case SUPLA_DS_CALL_GET_CHANNEL_FUNCTIONS:
-    case SUPLA_SD_CALL_GET_CHANNEL_FUNCTIONS_RESULT:
-    case SUPLA_CS_CALL_GET_SUPERUSER_AUTHORIZATION_RESULT:
-      return 12;
-    case SUPLA_SD_CALL_CHANNELGROUP_SET_VALUE:
-      return 13;
-    case SUPLA_CS_CALL_SET_LOCATION_CAPTION:
-    case SUPLA_SC_CALL_SET_LOCATION_CAPTION_RESULT:
-      return 14;
-    case SUPLA_SC_CALL_CHANNELPACK_UPDATE_D:
-    case SUPLA_SC_CALL_CHANNEL_VALUE_UPDATE_B:
-    case SUPLA_SC_CALL_CHANNELVALUE_PACK_UPDATE_B:
-      return 15;
-    case SUPLA_DS_CALL_GET_CHANNEL_CONFIG:
-    case SUPLA_SD_CALL_GET_CHANNEL_CONFIG_RESULT:
-    case SUPLA_DS_CALL_ACTIONTRIGGER:
-      return 16;
-    case SUPLA_SC_CALL_REGISTER_CLIENT_RESULT_C:
-    case SUPLA_CS_CALL_TIMER_ARM:
-      return 17;
-    case SUPLA_SC_CALL_SCENE_PACK_UPDATE:
-    case SUPLA_SC_CALL_SCENE_STATE_PACK_UPDATE:
-      return 18;
-    case SUPLA_CS_CALL_EXECUTE_ACTION:
-    case SUPLA_CS_CALL_EXECUTE_ACTION_WITH_AUTH:
-    case SUPLA_SC_CALL_ACTION_EXECUTION_RESULT:
-    case SUPLA_SC_CALL_REGISTER_CLIENT_RESULT_D:
-    case SUPLA_CS_CALL_GET_CHANNEL_VALUE_WITH_AUTH:
-    case SUPLA_SC_CALL_GET_CHANNEL_VALUE_RESULT:
-    case SUPLA_CS_CALL_SET_SCENE_CAPTION:
-    case SUPLA_SC_CALL_SET_SCENE_CAPTION_RESULT:
-      return 19;
-    case SUPLA_DS_CALL_REGISTER_PUSH_NOTIFICATION:
-    case SUPLA_DS_CALL_SEND_PUSH_NOTIFICATION:
-    case SUPLA_CS_CALL_REGISTER_PN_CLIENT_TOKEN:
-    case SUPLA_SC_CALL_REGISTER_PN_CLIENT_TOKEN_RESULT:
-    case SUPLA_CS_CALL_SET_CHANNEL_GROUP_CAPTION:
-    case SUPLA_SC_CALL_SET_CHANNEL_GROUP_CAPTION_RESULT:
-      return 20;
-    case SUPLA_DS_CALL_SET_CHANNEL_CONFIG:
-    case SUPLA_SD_CALL_SET_CHANNEL_CONFIG_RESULT:
-    case SUPLA_SD_CALL_SET_CHANNEL_CONFIG:
-    case SUPLA_DS_CALL_SET_CHANNEL_CONFIG_RESULT:
-    case SUPLA_DS_CALL_SET_DEVICE_CONFIG:
-    case SUPLA_SD_CALL_SET_DEVICE_CONFIG_RESULT:
-    case SUPLA_SD_CALL_SET_DEVICE_CONFIG:
-    case SUPLA_DS_CALL_SET_DEVICE_CONFIG_RESULT:
-    case SUPLA_SC_CALL_CHANNEL_RELATION_PACK_UPDATE:
-    case SUPLA_CS_CALL_GET_CHANNEL_CONFIG:
-    case SUPLA_SC_CALL_CHANNEL_CONFIG_UPDATE_OR_RESULT:
-    case SUPLA_CS_CALL_SET_CHANNEL_CONFIG:
-    case SUPLA_CS_CALL_GET_DEVICE_CONFIG:
-    case SUPLA_SC_CALL_DEVICE_CONFIG_UPDATE_OR_RESULT:
-    case SUPLA_SD_CALL_CHANNEL_CONFIG_FINISHED:
-      return 21;
-    case SUPLA_SC_CALL_CHANNELPACK_UPDATE_E:
-    case SUPLA_DS_CALL_REGISTER_DEVICE_F:
-      return 23;
-    case SUPLA_DS_CALL_REGISTER_DEVICE_G:
-    case SUPLA_SD_CALL_REGISTER_DEVICE_RESULT_B:
-    case SUPLA_DS_CALL_SET_SUBDEVICE_DETAILS:
-      return 25;
-    case SUPLA_SC_CALL_CHANNEL_STATE_PACK_UPDATE:
-      return 26;
+  if (srpc_call_desc_find(call_id, &desc)) {
+    return desc.min_version;
   }
 
   return 255;
@@ -1872,6 +2021,28 @@ srpc_call_allowed(void *_srpc, unsigned _supla_int_t call_id) {
   return 0;
 }
 
+// Tag, rr_id and version of an outgoing packet. SPSC producers hold only
+// out_lck, so there the counter and the version are atomics shared by every
+// sender of this srpc.
+static void SRPC_ICACHE_FLASH srpc_sdp_init(Tsrpc *srpc,
+                                            TSuplaDataPacket *sdp) {
+#if defined(SRPC_QUEUE_SPSC) && !defined(SRPC_WITHOUT_OUT_QUEUE)
+  unsigned _supla_int_t rr_id;
+
+  memset(sdp, 0, sizeof(TSuplaDataPacket));
+  memcpy(sdp->tag, sproto_tag, SUPLA_TAG_SIZE);
+
+  do {
+    rr_id = __atomic_add_fetch(&srpc->next_rr_id, 1, __ATOMIC_RELAXED);
+  } while (rr_id == 0);
+
+  sdp->rr_id = rr_id;
+  sdp->version = __atomic_load_n(&srpc->version, __ATOMIC_RELAXED);
+#else
+  sproto_sdp_init(srpc->proto, sdp);
+#endif /*SRPC_QUEUE_SPSC*/
+}
+
 _supla_int_t SRPC_ICACHE_FLASH srpc_async__call(void *_srpc,
                                                 unsigned _supla_int_t call_id,
                                                 char *data,
@@ -1897,9 +2068,36 @@ _supla_int_t SRPC_ICACHE_FLASH srpc_async__call(void *_srpc,
     srpc->params.before_async_call(_srpc, call_id, srpc->params.user_params);
   }
 
+#if defined(SRPC_QUEUE_SPSC) && !defined(SRPC_WITHOUT_OUT_QUEUE)
+  // The packet is built straight in the ring slot. srpc->lck is not taken
+  // (srpc_sdp_init() uses atomics), so a caller on another thread never waits
+  // for srpc_iterate*().
+  TSuplaDataPacket *sdp;
+  _supla_int_t rr_id = SUPLA_RESULT_FALSE;
+
+  lck_lock(srpc->out_lck);
+
+  if ((sdp = srpc_queue_reserve(&srpc->out_queue)) != NULL) {
+    srpc_sdp_init(srpc, sdp);
+
+    if (version != NULL) sdp->version = *version;
+
+    if (SUPLA_RESULT_TRUE == sproto_set_data(sdp, data, data_size, call_id)) {
+      rr_id = sdp->rr_id;
+      srpc_queue_commit(&srpc->out_queue);
+#ifndef __EH_DISABLED
+      if (srpc->params.eh != 0) {
+        eh_raise_event(srpc->params.eh);
+      }
+#endif
+    }
+  }
+
+  return lck_unlock_r(srpc->out_lck, rr_id);
+#else
   lck_lock(srpc->lck);
 
-  sproto_sdp_init(srpc->proto, &srpc->sdp);
+  srpc_sdp_init(srpc, &srpc->sdp);
 
   if (version != NULL) srpc->sdp.version = *version;
 
@@ -1916,6 +2114,7 @@ _supla_int_t SRPC_ICACHE_FLASH srpc_async__call(void *_srpc,
   }
 
   return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
+#endif /*SRPC_QUEUE_SPSC*/
 }
 
 _supla_int_t SRPC_ICACHE_FLASH
@@ -1932,9 +2131,14 @@ unsigned char SRPC_ICACHE_FLASH srpc_get_proto_version(void *_srpc) {
   }
 
   Tsrpc *srpc = (Tsrpc *)_srpc;
+#if defined(SRPC_QUEUE_SPSC) && !defined(SRPC_WITHOUT_OUT_QUEUE)
+  // srpc_call_allowed() on the producer path stays off srpc->lck
+  version = __atomic_load_n(&srpc->version, __ATOMIC_RELAXED);
+#else
   lck_lock(srpc->lck);
   version = sproto_get_version(srpc->proto);
   lck_unlock(srpc->lck);
+#endif /*SRPC_QUEUE_SPSC*/
 
   return version;
 }
@@ -1945,6 +2149,10 @@ void SRPC_ICACHE_FLASH srpc_set_proto_version(void *_srpc,
 
   lck_lock(srpc->lck);
   sproto_set_version(srpc->proto, version);
+#if defined(SRPC_QUEUE_SPSC) && !defined(SRPC_WITHOUT_OUT_QUEUE)
+  __atomic_store_n(&srpc->version, sproto_get_version(srpc->proto),
+                   __ATOMIC_RELAXED);
+#endif /*SRPC_QUEUE_SPSC*/
   lck_unlock(srpc->lck);
 }
 
@@ -2205,7 +2413,7 @@ _supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_registerdevice_in_chunks(
 
   lck_lock(srpc->lck);
 
-  sproto_sdp_init(srpc->proto, &srpc->sdp);
+  srpc_sdp_init(srpc, &srpc->sdp);
 
   if (SUPLA_RESULT_TRUE ==
       sproto_set_data(&srpc->sdp, (char *)registerdevice,
@@ -2262,7 +2470,7 @@ _supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_registerdevice_in_chunks_g(
 
   lck_lock(srpc->lck);
 
-  sproto_sdp_init(srpc->proto, &srpc->sdp);
+  srpc_sdp_init(srpc, &srpc->sdp);
 
   if (SUPLA_RESULT_TRUE ==
       sproto_set_data(&srpc->sdp, (char *)registerdevice,
@@ -2290,6 +2498,102 @@ _supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_registerdevice_in_chunks_g(
   return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
 }
 
+// Streams a registration through data_write without building the whole
+// packet: the packet header and the registration header are written from
+// srpc->sdp, channels straight from the caller. Once the header is out a
+// short write leaves a truncated frame, so the caller has to drop the
+// connection when this returns SUPLA_RESULT_FALSE.
+static _supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_registerdevice_chunked(
+    void *_srpc, int call_id, void *registerdevice,
+    unsigned _supla_int_t registerdevice_size, unsigned char channel_count,
+    _supla_int_t channel_size,
+    void *(*get_channel_data_callback)(int, void *user_params)) {
+  if (channel_count > SUPLA_CHANNELMAXCOUNT) {
+    return SUPLA_RESULT_FALSE;
+  }
+
+  Tsrpc *srpc = (Tsrpc *)_srpc;
+
+  if (!srpc_call_allowed(_srpc, call_id)) {
+    if (srpc->params.on_min_version_required != NULL) {
+      srpc->params.on_min_version_required(
+          _srpc, call_id, srpc_call_min_version_required(_srpc, call_id),
+          srpc->params.user_params);
+    }
+    return SUPLA_RESULT_FALSE;
+  }
+
+  if (srpc->params.before_async_call != NULL) {
+    srpc->params.before_async_call(_srpc, call_id, srpc->params.user_params);
+  }
+
+  lck_lock(srpc->lck);
+
+  srpc_sdp_init(srpc, &srpc->sdp);
+
+  if (SUPLA_RESULT_TRUE != sproto_set_data(&srpc->sdp, (char *)registerdevice,
+                                           registerdevice_size, call_id)) {
+    return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
+  }
+
+  srpc->sdp.data_size = registerdevice_size + channel_size * channel_count;
+
+  unsigned _supla_int_t header_size = sizeof(TSuplaDataPacket);
+  header_size -= SUPLA_MAX_DATA_SIZE;
+  header_size += registerdevice_size;
+  if (srpc->params.data_write((char *)&srpc->sdp, header_size,
+                              srpc->params.user_params) !=
+      (_supla_int_t)header_size) {
+    return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
+  }
+
+  for (int i = 0; i < channel_count; i++) {
+    void *data = get_channel_data_callback(i, srpc->params.user_params);
+    if (data == NULL ||
+        srpc->params.data_write((char *)data, channel_size,
+                                srpc->params.user_params) != channel_size) {
+      return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
+    }
+  }
+
+  if (srpc->params.data_write(sproto_tag, SUPLA_TAG_SIZE,
+                              srpc->params.user_params) != SUPLA_TAG_SIZE) {
+    return lck_unlock_r(srpc->lck, SUPLA_RESULT_FALSE);
+  }
+
+  return lck_unlock_r(srpc->lck, srpc->sdp.rr_id);
+}
+
+_supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_registerdevice_in_chunks_g_ex(
+    void *_srpc, TDS_SuplaRegisterDeviceHeader *registerdevice,
+    TDS_SuplaDeviceChannel_E *(*get_channel_data_callback)(int,
+                                                           void *user_params)) {
+  if (_srpc == NULL || registerdevice == NULL) {
+    return SUPLA_RESULT_FALSE;
+  }
+
+  return srpc_ds_async_registerdevice_chunked(
+      _srpc, SUPLA_DS_CALL_REGISTER_DEVICE_G, registerdevice,
+      sizeof(TDS_SuplaRegisterDeviceHeader), registerdevice->channel_count,
+      sizeof(TDS_SuplaDeviceChannel_E),
+      (void *(*)(int, void *))get_channel_data_callback);
+}
+
+_supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_registerdevice_in_chunks_c(
+    void *_srpc, TDS_SuplaRegisterDeviceHeader_C *registerdevice,
+    TDS_SuplaDeviceChannel_B *(*get_channel_data_callback)(int,
+                                                           void *user_params)) {
+  if (_srpc == NULL || registerdevice == NULL) {
+    return SUPLA_RESULT_FALSE;
+  }
+
+  return srpc_ds_async_registerdevice_chunked(
+      _srpc, SUPLA_DS_CALL_REGISTER_DEVICE_C, registerdevice,
+      sizeof(TDS_SuplaRegisterDeviceHeader_C), registerdevice->channel_count,
+      sizeof(TDS_SuplaDeviceChannel_B),
+      (void *(*)(int, void *))get_channel_data_callback);
+}
+
 _supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_registerdevice_f(
     void *_srpc, TDS_SuplaRegisterDevice_F *registerdevice) {
   _supla_int_t size =
@@ -22,6 +22,7 @@
 #include <stdio.h>
 
 #include "eh.h"
+#include "lck.h"
 #include "proto.h"
 #if defined(ESP32)
 #include <esp8266-compat.h>
@@ -86,9 +87,22 @@ typedef struct {
 
   TEventHandler *eh;
 
+  // Decode received payloads into one buffer preallocated by srpc_init()
+  // (sized to the largest enabled structure) instead of calloc per call.
+  // rd->data is then valid until the next srpc_getdata*().
+  unsigned char rd_arena;
+
   void *user_params;
 } TsrpcParams;
 
+typedef struct {
+  unsigned _supla_int_t arena_size;
+  unsigned _supla_int_t arena_count;     // payloads decoded into the arena
+  unsigned _supla_int_t in_place_count;  // payloads left in the packet
+  unsigned _supla_int_t heap_count;      // payloads that needed malloc
+  unsigned _supla_int_t heap_bytes;      // sum of those malloc sizes
+} TsrpcRdStats;
+
 union TsrpcDataPacketData {
   TDCS_SuplaPingServer *dcs_ping;
   TSDC_SuplaPingServerResult *sdc_ping_result;
@@ -198,6 +212,7 @@ union TsrpcDataPacketData {
 typedef struct {
   unsigned _supla_int_t call_id;
   unsigned _supla_int_t rr_id;
+  unsigned char in_place;  // data is owned by srpc (packet or arena)
 
   union TsrpcDataPacketData data;
 } TsrpcReceivedData;
@@ -215,12 +230,27 @@ char SRPC_ICACHE_FLASH srpc_output_dataexists(void *_srpc);
 unsigned char SRPC_ICACHE_FLASH srpc_out_queue_item_count(void *srpc);
 
 char SRPC_ICACHE_FLASH srpc_iterate(void *_srpc);
+// Reads until data_read runs dry, dispatches every complete frame and writes
+// the whole out queue with a single data_write
+char SRPC_ICACHE_FLASH srpc_iterate_batch(void *_srpc);
 char SRPC_ICACHE_FLASH srpc_iterate_device(void *_srpc);
 
 char SRPC_ICACHE_FLASH srpc_getdata(void *_srpc, TsrpcReceivedData *rd,
                                     unsigned _supla_int_t rr_id);
 
+// Like srpc_getdata() but without copies: rd->data points straight into the
+// received packet and is only valid inside on_remote_call_received.
+// Payloads shorter than their structure (variable-size calls) are copied into
+// zeroed storage as srpc_getdata() does, so unsent fields read as zero.
+// Builds with an in queue fall back to srpc_getdata().
+char SRPC_ICACHE_FLASH srpc_getdata_in_place(void *_srpc,
+                                             TsrpcReceivedData *rd,
+                                             unsigned _supla_int_t rr_id);
 void SRPC_ICACHE_FLASH srpc_rd_free(TsrpcReceivedData *rd);
+void SRPC_ICACHE_FLASH srpc_get_rd_stats(void *_srpc, TsrpcRdStats *stats);
+// Lock counters of this srpc (all zero with LCK_NONE), e.g. to see whether
+// a single-threaded build could drop locking
+void SRPC_ICACHE_FLASH srpc_get_lck_stats(void *_srpc, TLckStats *stats);
 
 unsigned char SRPC_ICACHE_FLASH srpc_get_proto_version(void *_srpc);
 void SRPC_ICACHE_FLASH srpc_set_proto_version(void *_srpc,
@@ -288,6 +318,20 @@ _supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_registerdevice_in_chunks(
 _supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_registerdevice_in_chunks_g(
     void *_srpc, TDS_SuplaRegisterDeviceHeader *registerdevice,
     TDS_SuplaDeviceChannel_E *(*get_channel_data_callback)(int));  // ver. >= 25
+// Same as srpc_ds_async_registerdevice_in_chunks_g(), but
+// get_channel_data_callback gets TsrpcParams.user_params and, as in
+// srpc_ds_async_registerdevice_in_chunks_c(), a NULL channel or a short
+// write fails the call.
+_supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_registerdevice_in_chunks_g_ex(
+    void *_srpc, TDS_SuplaRegisterDeviceHeader *registerdevice,
+    TDS_SuplaDeviceChannel_E *(*get_channel_data_callback)(
+        int, void *user_params));  // ver. >= 25
+// Streams TDS_SuplaRegisterDevice_C through data_write without building the
+// whole packet; get_channel_data_callback gets TsrpcParams.user_params.
+_supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_registerdevice_in_chunks_c(
+    void *_srpc, TDS_SuplaRegisterDeviceHeader_C *registerdevice,
+    TDS_SuplaDeviceChannel_B *(*get_channel_data_callback)(
+        int, void *user_params));  // ver. >= 6
 
 _supla_int_t SRPC_ICACHE_FLASH srpc_ds_async_channel_value_changed(
     void *_srpc, unsigned char channel_number, char *value);
@@ -1,378 +1,1115 @@
 #include "supla_esphome_bridge.h"
+#if defined(ARDUINO_ARCH_ESP32)
+#include <lwip/tcpip.h>
+#endif
+#include <cmath>
 #include <cstddef>
 #include <cstring>
 #include <cstdint>
+#include <cstdlib>
 
+#include "log.h"
 
-namespace supla_esphome_bridge {
 
+namespace supla_esphome_bridge {
 
+// GUID: 1C81FE5A-EDDD-BCD1-FCC1-0F42C159618E
+const uint8_t SuplaEsphomeBridge::GUID_BIN[SUPLA_GUID_SIZE] = {
+    0x1C, 0x81, 0xFE, 0x5A, 0xED, 0xDD, 0xBC, 0xD1,
+    0xFC, 0xC1, 0x0F, 0x42, 0xC1, 0x59, 0x61, 0x8E};
 
 SuplaEsphomeBridge::SuplaEsphomeBridge() {
 }
 
 SuplaEsphomeBridge::~SuplaEsphomeBridge() {
-  if (sproto_ctx_) {
-    sproto_free(sproto_ctx_);
-    sproto_ctx_ = nullptr;
+  close_session();
+}
+
+// Próg supla_log() zgodny z poziomem loggera ESPHome
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_VERBOSE
+static const int SUPLA_LOG_LEVEL = LOG_VERBOSE;
+#elif ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_DEBUG
+static const int SUPLA_LOG_LEVEL = LOG_DEBUG;
+#elif ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_INFO
+static const int SUPLA_LOG_LEVEL = LOG_INFO;
+#elif ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_WARN
+static const int SUPLA_LOG_LEVEL = LOG_WARNING;
+#else
+static const int SUPLA_LOG_LEVEL = LOG_ERR;
+#endif
+
+// Komunikaty supla_log() wypisywane w jednym wywołaniu loop()
+static const int SUPLA_LOG_DRAIN_PER_LOOP = 4;
+
+static void supla_log_sink(int pri, const char *message) {
+  if (pri <= LOG_ERR) {
+    ESP_LOGE("supla", "%s", message);
+  } else if (pri == LOG_WARNING) {
+    ESP_LOGW("supla", "%s", message);
+  } else if (pri <= LOG_INFO) {
+    ESP_LOGI("supla", "%s", message);
+  } else if (pri == LOG_DEBUG) {
+    ESP_LOGD("supla", "%s", message);
+  } else {
+    ESP_LOGV("supla", "%s", message);
   }
 }
 
 void SuplaEsphomeBridge::setup() {
   ESP_LOGI("supla", "SuplaEsphomeBridge setup()");
+  supla_log_set_level(SUPLA_LOG_LEVEL);
+
+  for (size_t i = 0; i < channels_.size(); i++) {
+    Channel &ch = channels_[i];
+
+    switch (ch.kind) {
+#ifdef USE_SENSOR
+      case ChannelKind::SENSOR:
+        static_cast<esphome::sensor::Sensor *>(ch.entity)->add_on_state_callback(
+            [this, i](float) { on_channel_changed(i); });
+        break;
+#endif
+#ifdef USE_BINARY_SENSOR
+      case ChannelKind::BINARY_SENSOR:
+        static_cast<esphome::binary_sensor::BinarySensor *>(ch.entity)
+            ->add_on_state_callback([this, i](bool) { on_channel_changed(i); });
+        break;
+#endif
+#ifdef USE_SWITCH
+      case ChannelKind::SWITCH:
+        static_cast<esphome::switch_::Switch *>(ch.entity)->add_on_state_callback(
+            [this, i](bool) { on_channel_changed(i); });
+        break;
+#endif
+#ifdef USE_LIGHT
+      case ChannelKind::LIGHT:
+        static_cast<esphome::light::LightState *>(ch.entity)
+            ->add_new_remote_values_callback([this, i]() { on_channel_changed(i); });
+        break;
+#endif
+      default:
+        break;
+    }
+  }
+
+  ESP_LOGI("supla", "%u channel(s) configured", (unsigned)channels_.size());
+}
+
+// Limity pracy wykonywanej w jednym wywołaniu loop(); DNS idzie w tle
+// (lwIP), a na odpowiedź czekamy najwyżej SUPLA_RESOLVE_TIMEOUT_MS
+static const uint32_t SUPLA_CONNECT_TIMEOUT_MS = 500;
+static const uint32_t SUPLA_RESOLVE_TIMEOUT_MS = 10000;
+
+// Ponowienia: losowo z [0, min(MAX, BASE * 2^próba)] (full jitter)
+static const uint32_t SUPLA_BACKOFF_BASE_MS = 1000;
+static const uint32_t SUPLA_BACKOFF_MAX_MS = 60000;
+// Pierwsza próba, dla której okno to już SUPLA_BACKOFF_MAX_MS
+static const uint8_t SUPLA_BACKOFF_CAP_ATTEMPT = 6;
+static_assert((SUPLA_BACKOFF_BASE_MS << SUPLA_BACKOFF_CAP_ATTEMPT) >= SUPLA_BACKOFF_MAX_MS,
+              "SUPLA_BACKOFF_CAP_ATTEMPT must reach SUPLA_BACKOFF_MAX_MS");
+
+// Brak odczytu czujnika w kodowaniu SUPLA
+static const double SUPLA_TEMPERATURE_NOT_AVAILABLE = -275.0;
+static const double SUPLA_MEASUREMENT_NOT_AVAILABLE = -1.0;
+
+// Keepalive: ping po połowie activity timeout bez wysyłki; brak odpowiedzi
+// w SUPLA_PING_TIMEOUT_MS to martwe łącze
+static const uint8_t SUPLA_DEFAULT_ACTIVITY_TIMEOUT_S = 120;
+static const uint32_t SUPLA_PING_TIMEOUT_MS = 10000;
+
+void SuplaEsphomeBridge::set_state(State state) {
+  state_ = state;
+  state_since_ = millis();
+}
+
+void SuplaEsphomeBridge::enter_backoff() {
+  uint32_t window = SUPLA_BACKOFF_MAX_MS;
+  if (backoff_attempt_ < 16 &&
+      (SUPLA_BACKOFF_BASE_MS << backoff_attempt_) < SUPLA_BACKOFF_MAX_MS) {
+    window = SUPLA_BACKOFF_BASE_MS << backoff_attempt_;
+  }
+
+  if (backoff_attempt_ < 255) {
+    backoff_attempt_++;
+  }
+
+  backoff_ms_ = esphome::random_uint32() % (window + 1);
+  ESP_LOGI("supla", "Next attempt in %u ms (attempt %u)", (unsigned)backoff_ms_,
+           (unsigned)backoff_attempt_);
+  set_state(State::BACKOFF);
 }
 
 void SuplaEsphomeBridge::loop() {
-  static unsigned long last_try = 0;
-  if (!registered_ && millis() - last_try > 40000) {
-    last_try = millis();
-    register_device(3000);
-    yield();
-    delay(1);
-  }
-}
-
-void SuplaEsphomeBridge::hex_dump(const uint8_t *buf, size_t len, const char *prefix) {
-  const size_t per_line = 16;
-  char line[128];
-  for (size_t i = 0; i < len; i += per_line) {
-    size_t chunk = (i + per_line <= len) ? per_line : (len - i);
-    int pos = snprintf(line, sizeof(line), "%s %04X: ", prefix, (unsigned)i);
-    for (size_t j = 0; j < chunk; j++)
-      pos += snprintf(line + pos, sizeof(line) - pos, "%02X ", buf[i + j]);
-    pos += snprintf(line + pos, sizeof(line) - pos, " | ");
-    for (size_t j = 0; j < chunk; j++) {
-      char c = buf[i + j];
-      line[pos++] = (c >= 32 && c < 127) ? c : '.';
-    }
-    line[pos] = 0;
-    ESP_LOGD("supla", "%s", line);
+  // Powrót sieci: nie czekamy do końca backoffu
+  const bool network_connected = esphome::network::is_connected();
+  if (network_connected && !network_connected_ && state_ == State::BACKOFF) {
+    ESP_LOGI("supla", "Network up, reconnecting now");
+    backoff_attempt_ = 0;
+    set_state(State::DISCONNECTED);
+  }
+  network_connected_ = network_connected;
+
+  switch (state_) {
+    case State::DISCONNECTED:
+      if (server_.empty()) {
+        ESP_LOGW("supla", "No SUPLA server configured");
+        backoff_ms_ = SUPLA_BACKOFF_MAX_MS;
+        set_state(State::BACKOFF);
+        break;
+      }
+      if (!network_connected_) {
+        break;
+      }
+      start_resolving();
+      break;
+
+    case State::RESOLVING:
+      loop_resolving();
+      break;
+
+    case State::CONNECTING:
+      loop_connecting();
+      break;
+
+    case State::REGISTERING:
+      loop_registering();
+      break;
+
+    case State::REGISTERED:
+      loop_session();
+      flush_channels();
+      loop_keepalive();
+      break;
+
+    case State::BACKOFF:
+      if (millis() - state_since_ >= backoff_ms_) {
+        set_state(State::DISCONNECTED);
+      }
+      break;
+  }
+
+  // Logi z sesji (supla_log) wypisywane poza łączeniem i rejestracją
+  if (state_ != State::CONNECTING && state_ != State::REGISTERING) {
+    supla_log_drain(&supla_log_sink, SUPLA_LOG_DRAIN_PER_LOOP, millis());
   }
 }
 
-bool SuplaEsphomeBridge::register_device(unsigned long timeout_ms) {
+void SuplaEsphomeBridge::start_resolving() {
+  if (server_ip_ != 0) {
+    set_state(State::CONNECTING);
+    return;
+  }
 
-  if (server_.empty()) {
-    ESP_LOGW("supla", "No SUPLA server configured");
-    return false;
+  // Nazwa z cache lwIP albo adres IP wraca od razu (ERR_OK), inaczej wynik
+  // przychodzi do on_dns_found()
+  ip_addr_t addr;
+  __atomic_store_n(&resolve_done_, 0, __ATOMIC_RELAXED);
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_LWIP_TCPIP_CORE_LOCKING)
+  LOCK_TCPIP_CORE();
+#endif
+  const err_t err = dns_gethostbyname(server_.c_str(), &addr, on_dns_found, this);
+#if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_LWIP_TCPIP_CORE_LOCKING)
+  UNLOCK_TCPIP_CORE();
+#endif
+
+  if (err == ERR_OK) {
+    server_ip_ = ip4_addr_get_u32(ip_2_ip4(&addr));
+    set_state(State::CONNECTING);
+  } else if (err == ERR_INPROGRESS) {
+    ESP_LOGD("supla", "Resolving SUPLA server %s", server_.c_str());
+    set_state(State::RESOLVING);
+  } else {
+    ESP_LOGW("supla", "Cannot resolve SUPLA server %s", server_.c_str());
+    enter_backoff();
   }
-  
-  ESP_LOGI("supla", "client_.setTimeout(1000)");
-  client_.setTimeout(3000);
-  yield();
-  delay(1);
-  
-  ESP_LOGI("supla", "Connecting to SUPLA server %s:2015", server_.c_str());
-
-  bool ok = false;
-  for (int i = 0; i < 50; i++) {
-    if (client_.connect(server_.c_str(), 2015)) { 
-      ok = true;
-      break;
+}
+
+void SuplaEsphomeBridge::on_dns_found(const char *name, const ip_addr_t *ipaddr,
+                                      void *arg) {
+  (void)name;
+  auto *self = static_cast<SuplaEsphomeBridge *>(arg);
+  __atomic_store_n(&self->resolved_ip_,
+                   ipaddr != nullptr ? ip4_addr_get_u32(ip_2_ip4(ipaddr)) : 0,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&self->resolve_done_, 1, __ATOMIC_RELEASE);
+}
+
+void SuplaEsphomeBridge::loop_resolving() {
+  if (__atomic_load_n(&resolve_done_, __ATOMIC_ACQUIRE) == 0) {
+    if (millis() - state_since_ >= SUPLA_RESOLVE_TIMEOUT_MS) {
+      ESP_LOGW("supla", "Timeout resolving SUPLA server %s", server_.c_str());
+      enter_backoff();
     }
-    delay(10);
-    yield();
+    return;
   }
-  
-  if (!ok) {
+
+  server_ip_ = __atomic_load_n(&resolved_ip_, __ATOMIC_RELAXED);
+  if (server_ip_ == 0) {
+    ESP_LOGW("supla", "Cannot resolve SUPLA server %s", server_.c_str());
+    enter_backoff();
+    return;
+  }
+
+  set_state(State::CONNECTING);
+}
+
+void SuplaEsphomeBridge::loop_connecting() {
+  const IPAddress ip(server_ip_);
+  ESP_LOGI("supla", "Connecting to SUPLA server %s (%s):2015", server_.c_str(),
+           ip.toString().c_str());
+
+  // Jedna próba connect() na IP na próbę, najwyżej SUPLA_CONNECT_TIMEOUT_MS;
+  // kolejna dopiero po backoffie, z ponownym DNS (serwer mógł zmienić adres)
+  client_.setTimeout(SUPLA_CONNECT_TIMEOUT_MS);
+  if (!client_.connect(ip, 2015)) {
     ESP_LOGW("supla", "Cannot connect to SUPLA server");
-    return false;
+    server_ip_ = 0;
+    enter_backoff();
+    return;
   }
+
   ESP_LOGI("supla", "Connected to SUPLA server %s:2015", server_.c_str());
+  client_.setNoDelay(true);
+
+  // Najpierw GETVERSION; rejestracja dopiero w uzgodnionej wersji
+  if (!open_session() ||
+      srpc_dcs_async_getversion(srpc_) == SUPLA_RESULT_FALSE) {
+    close_session();
+    enter_backoff();
+    return;
+  }
 
-  yield();
-  delay(1);
-  
-  sproto_ctx_ = sproto_init();
-  if (sproto_ctx_) {
-    sproto_set_version(sproto_ctx_, SUPLA_PROTO_VERSION);
-    ESP_LOGI("supla", "sproto initialized, forced proto version=%u",
-             (unsigned)SUPLA_PROTO_VERSION);
-  } else {
-    ESP_LOGW("supla", "sproto_init failed");
+  set_state(State::REGISTERING);
+}
+
+void SuplaEsphomeBridge::loop_registering() {
+  loop_session();
+
+  if (state_ != State::REGISTERING) {
+    return;
   }
 
-  yield();
-  delay(1);
-  
-  const unsigned call_id = SUPLA_DS_CALL_REGISTER_DEVICE_C;
-  ESP_LOGI("supla", "Attempting register with call_id=%u", call_id);
+  // Pierwsza rejestracja po GETVERSION_RESULT; VERSIONERROR z niższą wersją
+  // powtarza ją w tej wersji
+  if (version_received_ &&
+      (register_version_ == 0 || server_version_ < register_version_)) {
+    if (!send_register_packet()) {
+      close_session();
+      enter_backoff();
+      return;
+    }
+    set_state(State::REGISTERING);
+    return;
+  }
 
-  // -------------------------
-  // Build TDS_SuplaRegisterDevice_..
-  // -------------------------
-  static TDS_SuplaRegisterDevice_C reg;
-  memset(&reg, 0, sizeof(reg));
+  // Ramka wyniku kompletna: stan zmienia się od razu, nie po timeoucie
+  if (register_result_ != SUPLA_RESULTCODE_NONE) {
+    finish_registration();
+    return;
+  }
 
-  yield();
-  delay(1);
+  if (millis() - state_since_ < register_timeout_ms_) {
+    return;
+  }
 
-  // LocationID / LocationPWD
-  reg.LocationID = location_id_;
+  ESP_LOGW("supla", "Timeout waiting for %s",
+           register_version_ == 0 ? "GETVERSION_RESULT" : "register response");
+  close_session();
+  enter_backoff();
+}
 
- strncpy(reg.LocationPWD, location_password_.c_str(), SUPLA_LOCATION_PWD_MAXSIZE - 1);
-  reg.LocationPWD[SUPLA_LOCATION_PWD_MAXSIZE - 1] = '\0';
+// Wyniki, po których ponowienie ma sens bez zmiany konfiguracji
+static bool register_error_is_temporary(int result_code) {
+  switch (result_code) {
+    case SUPLA_RESULTCODE_FALSE:
+    case SUPLA_RESULTCODE_TEMPORARILY_UNAVAILABLE:
+    case SUPLA_RESULTCODE_UNKNOWN_ERROR:
+    case SUPLA_RESULTCODE_RESTART_REQUESTED:
+      return true;
+    default:
+      return false;
+  }
+}
 
-  // EMAIL
-  //strncpy(reg.Email, "stokiloton@gmail.com", SUPLA_EMAIL_MAXSIZE - 1);
-  //reg.Email[SUPLA_EMAIL_MAXSIZE - 1] = '\0';
+void SuplaEsphomeBridge::finish_registration() {
+  const int result_code = register_result_;
+  register_result_ = SUPLA_RESULTCODE_NONE;
+
+  if (result_code == SUPLA_RESULTCODE_TRUE) {
+    ESP_LOGI("supla", "Registered in %u ms, activity timeout %u s",
+             (unsigned)(millis() - state_since_), (unsigned)activity_timeout_s_);
+    backoff_attempt_ = 0;
+    set_state(State::REGISTERED);
+
+    // Wynik (z min/max serwera) w handle_activity_timeout_result()
+    if (activity_timeout_request_s_ != 0 &&
+        activity_timeout_request_s_ != activity_timeout_s_) {
+      TDCS_SuplaSetActivityTimeout request;
+      request.activity_timeout = activity_timeout_request_s_;
+      srpc_dcs_async_set_activity_timeout(srpc_, &request);
+    }
+    return;
+  }
 
-  // AUTHKEY (16 bytes, stały)
-  static const uint8_t AUTHKEY[SUPLA_AUTHKEY_SIZE] = {
-    0xA3,0x5F,0x91,0x0C,0x67,0x2B,0x4E,0x88,
-    0x19,0xC4,0x5A,0x0D,0x6E,0x3F,0x12,0x99
-  };
- // memcpy(reg.AuthKey, AUTHKEY, SUPLA_AUTHKEY_SIZE);
-  
+  ESP_LOGW("supla", "Registration rejected, result_code=%d", result_code);
+  close_session();
 
-  // GUID: 1C81FE5A-DDDD-BCD1-FCC1-0F42C159618E
-  uint8_t GUID_BIN[SUPLA_GUID_SIZE] = {
-    0x1C, 0x81, 0xFE, 0x5A, 0xED, 0xDD, 0xBC, 0xD1,
-    0xFC, 0xC1, 0x0F, 0x42, 0xC1, 0x59, 0x61, 0x8E
-  };
+  if (register_error_is_temporary(result_code)) {
+    enter_backoff();
+    return;
+  }
 
-  // GUID
-  memcpy(reg.GUID, GUID_BIN, SUPLA_GUID_SIZE);
+  // Błąd danych logowania lub konta: bez sensu próbować częściej, od razu
+  // pełne okno, ale z jitterem (cała flota nie wraca w tej samej sekundzie)
+  backoff_attempt_ = SUPLA_BACKOFF_CAP_ATTEMPT;
+  enter_backoff();
+}
 
-  // Name
-  strncpy(reg.Name, device_name_.c_str(), SUPLA_DEVICE_NAME_MAXSIZE - 1);
-  reg.Name[SUPLA_DEVICE_NAME_MAXSIZE - 1] = '\0';
+void SuplaEsphomeBridge::apply_channel_report(const unsigned char *report,
+                                              size_t size) {
+  for (size_t i = 0; i < channels_.size(); i++) {
+    // Bez raportu (REGISTER_DEVICE_RESULT) kanały uznajemy za przyjęte
+    Channel &ch = channels_[i];
+    ch.rejected = i < size && (!(report[i] & CHANNEL_REPORT_CHANNEL_REGISTERED) ||
+                               (report[i] & CHANNEL_REPORT_INCORRECT_CHANNEL_TYPE));
+    if (ch.rejected) {
+      supla_log(LOG_WARNING, "Channel %u not accepted by server (report 0x%02x)",
+                (unsigned)ch.number, (unsigned)report[i]);
+    }
+  }
+}
 
-  // SoftVer
-  strncpy(reg.SoftVer, "2.0", SUPLA_SOFTVER_MAXSIZE - 1);
-  reg.SoftVer[SUPLA_SOFTVER_MAXSIZE - 1] = '\0';
-
-  // ServerName
-  strncpy(reg.ServerName, server_.c_str(), SUPLA_SERVER_NAME_MAXSIZE - 1);
-  reg.ServerName[SUPLA_SERVER_NAME_MAXSIZE - 1] = '\0';
-  
-  // Flags, ManufacturerID, ProductID
-  //reg.Flags = 0;
-  //reg.ManufacturerID = 0;
-  //reg.ProductID = 0;
-
-  yield();
-  delay(1);
-
-
-  reg.channel_count = 1;
-
-  TDS_SuplaDeviceChannel_B &ch = reg.channels[0];
-   memset(&ch, 0, sizeof(ch));
-
-  ch.Number = 0;
-  ch.Type = SUPLA_CHANNELTYPE_THERMOMETER;
-  ch.FuncList = SUPLA_BIT_FUNC_THERMOMETER;
-  ch.Default = 1;
-  memset(ch.value, 0, SUPLA_CHANNELVALUE_SIZE);
-
-
-//  TDS_SuplaDeviceChannel_E &ch = reg.channels[0];
- // memset(&ch, 0, sizeof(ch));
-
-//  ch.Number = 0;
-//  ch.Type = SUPLA_CHANNELTYPE_THERMOMETER;
- // ch.FuncList = SUPLA_BIT_FUNC_THERMOMETER;
- // ch.Default = 1;
-//  ch.Flags = 0;
- // ch.Offline = 0;
-  //ch.ValueValidityTimeSec = 0;
-  //memset(ch.value, 0, SUPLA_CHANNELVALUE_SIZE);
- // ch.DefaultIcon = 0;
- // ch.SubDeviceId = 0;
-
-  
-
-  // -------------------------
-  // Payload size
-  // -------------------------
-  yield();
-  delay(1);
-
-  size_t payload_size =
-      offsetof(TDS_SuplaRegisterDevice_C, channels) +
-      reg.channel_count * sizeof(TDS_SuplaDeviceChannel_B);
-
-  ESP_LOGI("supla", "Prepared REGISTER_DEVICE payload_size=%u (channel_count=%u)",
-           (unsigned)payload_size, (unsigned)reg.channel_count);
-
-  yield();
-  delay(10);
-  
-  hex_dump((const uint8_t*)&reg, payload_size, "REG-PAYLOAD");
-
-  yield();
-  delay(1);
-  
-  // -------------------------
-  // Build SDP (RAW MODE)
-  // -------------------------
-  TSuplaDataPacket *sdp = sproto_sdp_malloc(sproto_ctx_);
-  if (!sdp) {
-    ESP_LOGW("supla", "sproto_sdp_malloc failed");
-    client_.stop();
-    return false;
+void SuplaEsphomeBridge::loop_session() {
+  if (srpc_iterate_device(srpc_) == SUPLA_RESULT_TRUE) {
+    return;
   }
-  ESP_LOGI("supla", "sproto_sdp_malloc OK");
-  
-  yield();
-  delay(1);
-  
-  sproto_sdp_init(sproto_ctx_, sdp);
-  
-  yield();
-  delay(1);
-
-  size_t dat_size = sizeof(TDS_SuplaRegisterDevice_C);
-  
-  ESP_LOGI("supla", "SUPLA_MAX_DATA_SIZE=%u , payload_size=%u, dat_size=%u  ", SUPLA_MAX_DATA_SIZE, payload_size, dat_size);
-  
-  if (!sproto_set_data(sdp, (char*)&reg, (unsigned _supla_int_t)payload_size, call_id)) {
-    ESP_LOGW("supla", "sproto_set_data failed");
-    sproto_sdp_free(sdp);
-    client_.stop();
-    return false;
+
+  ESP_LOGW("supla", "SUPLA session closed");
+  close_session();
+  enter_backoff();
+}
+
+void SuplaEsphomeBridge::loop_keepalive() {
+  if (state_ != State::REGISTERED) {
+    return;
   }
-  ESP_LOGW("supla", "sproto_set_data OK");
 
-  size_t packet_len =
-      sizeof(TSuplaDataPacket) - SUPLA_MAX_DATA_SIZE + sdp->data_size;
+  const uint32_t now = millis();
+  const uint32_t window_ms =
+      (activity_timeout_s_ ? activity_timeout_s_ : SUPLA_DEFAULT_ACTIVITY_TIMEOUT_S) *
+      500u;
 
-  ESP_LOGI("supla", "Sending RAW REGISTER_DEVICE_G (call_id=%u), len=%u",
-           call_id, (unsigned)packet_len);
+  if (ping_pending_) {
+    const uint32_t timeout_ms =
+        window_ms < SUPLA_PING_TIMEOUT_MS ? window_ms : SUPLA_PING_TIMEOUT_MS;
+    if (now - ping_sent_ms_ < timeout_ms) {
+      return;
+    }
 
-  yield();
-  delay(1);
-  
-  hex_dump((uint8_t*)sdp, packet_len, "TX");
+    ESP_LOGW("supla", "No PING_SERVER_RESULT in %u ms, connection lost",
+             (unsigned)timeout_ms);
+    close_session();
+    enter_backoff();
+    return;
+  }
 
-  yield();
-  delay(1);
+  // Każda ramka (np. wartość kanału) też podtrzymuje sesję po stronie serwera
+  if (now - last_tx_ms_ < window_ms) {
+    return;
+  }
 
+  if (srpc_dcs_async_ping_server(srpc_) == SUPLA_RESULT_FALSE) {
+    ESP_LOGW("supla", "PING_SERVER send failed");
+    close_session();
+    enter_backoff();
+    return;
+  }
 
-  size_t sent = client_.write((uint8_t*)sdp, packet_len);
+  ping_pending_ = true;
+  ping_sent_ms_ = now;
+  ping_sent_us_ = micros();
+}
 
-  yield();
-  delay(1);
-  
-  client_.flush();
+void SuplaEsphomeBridge::handle_ping_result() {
+  if (!ping_pending_) {
+    return;
+  }
+  ping_pending_ = false;
 
-  yield();
-  delay(1);
-  
-  sproto_sdp_free(sdp);
+  const float rtt_ms = (micros() - ping_sent_us_) / 1000.0f;
+  supla_log(LOG_DEBUG, "PING_SERVER_RESULT, rtt %.2f ms", (double)rtt_ms);
+#ifdef USE_SENSOR
+  if (ping_rtt_sensor_ != nullptr) {
+    ping_rtt_sensor_->publish_state(rtt_ms);
+  }
+#endif
+}
 
-      yield();
-    delay(1);
+void SuplaEsphomeBridge::handle_activity_timeout_result(
+    const TSDC_SuplaSetActivityTimeoutResult *result) {
+  // Zakres serwera obowiązuje też kolejne sesje: żądanie przycięte do min/max
+  uint8_t requested = activity_timeout_request_s_;
+  if (requested < result->min) {
+    requested = result->min;
+  }
+  if (result->max != 0 && requested > result->max) {
+    requested = result->max;
+  }
+  activity_timeout_request_s_ = requested;
 
-  if (sent != packet_len) {
-    ESP_LOGW("supla", "Sent mismatch: %u != %u",
-            (unsigned)sent, (unsigned)packet_len);
-    client_.stop();
-    return false;
+  uint8_t applied = result->activity_timeout;
+  if (applied < result->min) {
+    applied = result->min;
+  }
+  if (result->max != 0 && applied > result->max) {
+    applied = result->max;
   }
+  activity_timeout_s_ = applied;
 
-  ESP_LOGI("supla", "REGISTER_DEVICE_G sent");
+  supla_log(LOG_INFO, "Activity timeout %u s (server range %u-%u s)",
+            (unsigned)activity_timeout_s_, (unsigned)result->min,
+            (unsigned)result->max);
+}
 
-  yield();
-  delay(1);
-  
-  //tymczsow 1 proba
-  registered_ = true;
+bool SuplaEsphomeBridge::open_session() {
+  // Tylko poprzedni kontekst srpc; świeżo połączony client_ zostaje otwarty
+  if (srpc_) {
+    srpc_free(srpc_);
+    srpc_ = nullptr;
+  }
 
-  bool resp = read_register_response(client_, timeout_ms);
+  TsrpcParams params;
+  srpc_params_init(&params);
+  params.data_read = &SuplaEsphomeBridge::data_read;
+  params.data_write = &SuplaEsphomeBridge::data_write;
+  params.on_remote_call_received = &SuplaEsphomeBridge::on_remote_call_received;
+  params.on_version_error = &SuplaEsphomeBridge::on_version_error;
+  params.user_params = this;
+
+  srpc_ = srpc_init(&params);
+  if (srpc_ == nullptr) {
+    ESP_LOGW("supla", "srpc_init failed");
+    return false;
+  }
 
-    //tymczsow 1 proba
-  registered_ = true;
-  resp = true;
-  
-  yield();
-  delay(1);
-  client_.stop();
-  return resp;
+  // Po VERSIONERROR z poprzedniego połączenia od razu w wersji serwera
+  if (server_version_ != 0 && server_version_ < SUPLA_PROTO_VERSION) {
+    srpc_set_proto_version(srpc_, server_version_);
+  } else {
+    srpc_set_proto_version(srpc_, SUPLA_PROTO_VERSION);
+  }
+  version_received_ = false;
+  register_version_ = 0;
+  register_result_ = SUPLA_RESULTCODE_NONE;
+  ping_pending_ = false;
+
+  // Nowa sesja: pierwszy odczyt idzie do chmury bez deadbandu
+  // Stany dwustanowe idą od razu, odczyty czujników z pierwszym callbackiem
+  for (Channel &ch : channels_) {
+    ch.sent_valid = false;
+    ch.dirty = ch.kind != ChannelKind::SENSOR;
+  }
+  return true;
 }
 
+void SuplaEsphomeBridge::close_session() {
+  client_.stop();
 
-void SuplaEsphomeBridge::fill_channel_D(
-    TDS_SuplaDeviceChannel_D &ch,
-    uint8_t number,
-    int type,
-    int func,
-    int default_value,
-    int64_t flags,
-    bool offline,
-    unsigned value_validity_sec,
-    const char *initial_value,
-    uint8_t default_icon
-) {
-    // Wyzerowanie całej struktury (bardzo ważne!)
-    memset(&ch, 0, sizeof(TDS_SuplaDeviceChannel_D));
+  if (srpc_) {
+    srpc_free(srpc_);
+    srpc_ = nullptr;
+  }
+}
 
-    // Numer kanału
-    ch.Number = number;
+_supla_int_t SuplaEsphomeBridge::data_read(void *buf, _supla_int_t count,
+                                           void *user_params) {
+  auto *self = static_cast<SuplaEsphomeBridge *>(user_params);
 
-    // Typ kanału (np. SUPLA_CHANNELTYPE_RELAY)
-    ch.Type = type;
+  // 0 = połączenie zamknięte, -1 = brak danych (srpc spróbuje w następnym loop())
+  int avail = self->client_.available();
+  if (avail <= 0) {
+    return self->client_.connected() ? -1 : 0;
+  }
 
-    // Funkcja kanału (np. SUPLA_CHANNELFNC_POWERSWITCH)
-    ch.FuncList = func;
+  if (avail < count) {
+    count = avail;
+  }
 
-    // Wartość domyślna (np. 0/1)
-    ch.Default = default_value;
+  int r = self->client_.read((uint8_t*)buf, count);
+  if (r <= 0) {
+    return -1;
+  }
 
-    // Flagi kanału (np. SUPLA_CHANNEL_FLAG_RUNTIME_CHANNEL_CONFIG)
-    ch.Flags = flags;
+  supla_log_hex(LOG_DEBUG, "RX", buf, r);
+  return r;
+}
 
-    // Czy kanał jest offline
-    ch.Offline = offline ? 1 : 0;
+_supla_int_t SuplaEsphomeBridge::data_write(void *buf, _supla_int_t count,
+                                            void *user_params) {
+  auto *self = static_cast<SuplaEsphomeBridge *>(user_params);
 
-    // Czas ważności wartości (0 = bez limitu)
-    ch.ValueValidityTimeSec = value_validity_sec;
+  size_t sent = self->client_.write((const uint8_t*)buf, count);
+  if (sent > 0) {
+    self->last_tx_ms_ = millis();
+  }
 
-    // Wartość początkowa
-    if (initial_value) {
-        strncpy(ch.value, initial_value, SUPLA_CHANNELVALUE_SIZE);
-        //ch.value[SUPLA_CHANNELVALUE_SIZE - 1] = '\0';
+  if (self->register_heap_min_) {
+    uint32_t heap = ESP.getFreeHeap();
+    if (heap < self->register_heap_min_) {
+      self->register_heap_min_ = heap;
     }
+  }
+  if (sent != (size_t)count) {
+    supla_log(LOG_WARNING, "Sent mismatch: %u != %u", (unsigned)sent,
+              (unsigned)count);
+    return -1;
+  }
+
+  return count;
+}
 
-    // Ikona domyślna (np. SUPLA_ICON_RELAY)
-    ch.DefaultIcon = default_icon;
+void SuplaEsphomeBridge::on_remote_call_received(void *_srpc,
+                                                 unsigned _supla_int_t rr_id,
+                                                 unsigned _supla_int_t call_id,
+                                                 void *user_params,
+                                                 unsigned char proto_version) {
+  auto *self = static_cast<SuplaEsphomeBridge *>(user_params);
+
+  TsrpcReceivedData rd;
+  char result = srpc_getdata_in_place(_srpc, &rd, rr_id);
+  if (result != SUPLA_RESULT_TRUE) {
+    supla_log(LOG_DEBUG, "srpc_getdata failed: call_id=%u result=%d",
+              (unsigned)call_id, (int)result);
+    return;
+  }
+
+#ifdef SUPLA_DEBUG_WIRE
+  supla_log(LOG_DEBUG, "RX call_id=%u rr_id=%u proto=%u", (unsigned)call_id,
+            (unsigned)rr_id, (unsigned)proto_version);
+#else
+  (void)proto_version;
+#endif /*SUPLA_DEBUG_WIRE*/
+
+  self->handle_remote_call(rd);
+  srpc_rd_free(&rd);
+}
+
+void SuplaEsphomeBridge::on_version_error(void *_srpc,
+                                          unsigned char remote_version,
+                                          void *user_params) {
+  (void)_srpc;
+  (void)user_params;
+  supla_log(LOG_WARNING, "Protocol version error, remote version=%u",
+            (unsigned)remote_version);
+}
+
+void SuplaEsphomeBridge::set_auth_key(const std::string &hex) {
+  memset(auth_key_, 0, sizeof(auth_key_));
+
+  for (size_t i = 0; i < hex.size() / 2 && i < sizeof(auth_key_); i++) {
+    char byte[3] = {hex[i * 2], hex[i * 2 + 1], 0};
+    auth_key_[i] = (char)strtoul(byte, nullptr, 16);
+  }
+}
+
+void SuplaEsphomeBridge::set_channel_table(const ChannelDescriptor *table,
+                                           uint8_t count) {
+  channel_table_ = table;
+  channel_table_size_ = count;
+  channels_.clear();
+  channels_.reserve(count);
 }
 
+void SuplaEsphomeBridge::read_descriptor(size_t index,
+                                         ChannelDescriptor *out) const {
+#if defined(ARDUINO_ARCH_ESP8266)
+  memcpy_P(out, &channel_table_[index], sizeof(ChannelDescriptor));
+#else
+  memcpy(out, &channel_table_[index], sizeof(ChannelDescriptor));
+#endif
+}
+
+void SuplaEsphomeBridge::add_channel(ChannelKind kind, void *entity) {
+  if (entity == nullptr || channels_.size() >= channel_table_size_) {
+    ESP_LOGW("supla", "Channel entity %u has no descriptor",
+             (unsigned)channels_.size());
+    return;
+  }
+
+  ChannelDescriptor descriptor;
+  read_descriptor(channels_.size(), &descriptor);
+
+  Channel ch;
+  memset(&ch, 0, sizeof(ch));
+  ch.entity = entity;
+  ch.number = descriptor.number;
+  ch.kind = kind;
+  ch.format = value_format(descriptor.type);
+  channels_.push_back(ch);
+}
+
+#ifdef USE_SENSOR
+void SuplaEsphomeBridge::add_sensor_channel(esphome::sensor::Sensor *s) {
+  add_channel(ChannelKind::SENSOR, s);
+}
+#endif
+
+#ifdef USE_BINARY_SENSOR
+void SuplaEsphomeBridge::add_binary_sensor_channel(
+    esphome::binary_sensor::BinarySensor *s) {
+  add_channel(ChannelKind::BINARY_SENSOR, s);
+}
+#endif
+
+#ifdef USE_SWITCH
+void SuplaEsphomeBridge::add_switch_channel(esphome::switch_::Switch *s) {
+  add_channel(ChannelKind::SWITCH, s);
+}
+#endif
+
+#ifdef USE_LIGHT
+void SuplaEsphomeBridge::add_light_channel(esphome::light::LightState *l) {
+  add_channel(ChannelKind::LIGHT, l);
+}
+#endif
+
+SuplaEsphomeBridge::Channel *SuplaEsphomeBridge::find_channel(uint8_t number) {
+  for (Channel &ch : channels_) {
+    if (ch.number == number) {
+      return &ch;
+    }
+  }
+  return nullptr;
+}
 
+unsigned char SuplaEsphomeBridge::channel_offline(const Channel &ch) const {
+#ifdef USE_SENSOR
+  // Czujnik bez odczytu: kanał offline zamiast samej wartości -275
+  if (ch.kind == ChannelKind::SENSOR) {
+    auto *s = static_cast<esphome::sensor::Sensor *>(ch.entity);
+    if (!s->has_state() || std::isnan(s->state)) {
+      return SUPLA_CHANNEL_OFFLINE_FLAG_OFFLINE;
+    }
+  }
+#endif
+  return SUPLA_CHANNEL_OFFLINE_FLAG_ONLINE;
+}
 
+SuplaEsphomeBridge::ValueFormat SuplaEsphomeBridge::value_format(uint16_t type) {
+  switch (type) {
+    case SUPLA_CHANNELTYPE_THERMOMETER:
+      return ValueFormat::TEMPERATURE;
+    case SUPLA_CHANNELTYPE_HUMIDITYSENSOR:
+      return ValueFormat::HUMIDITY;
+    case SUPLA_CHANNELTYPE_PRESSURESENSOR:
+    case SUPLA_CHANNELTYPE_WINDSENSOR:
+    case SUPLA_CHANNELTYPE_RAINSENSOR:
+    case SUPLA_CHANNELTYPE_WEIGHTSENSOR:
+    case SUPLA_CHANNELTYPE_DISTANCESENSOR:
+      return ValueFormat::MEASUREMENT;
+    case SUPLA_CHANNELTYPE_GENERAL_PURPOSE_MEASUREMENT:
+      return ValueFormat::GENERAL_PURPOSE;
+    default:
+      return ValueFormat::BINARY;
+  }
+}
 
+float SuplaEsphomeBridge::read_channel(const Channel &ch) const {
+  switch (ch.kind) {
+#ifdef USE_SENSOR
+    case ChannelKind::SENSOR: {
+      auto *s = static_cast<esphome::sensor::Sensor *>(ch.entity);
+      if (s->has_state() && !std::isnan(s->state)) {
+        return s->state;
+      }
+
+      switch (ch.format) {
+        case ValueFormat::TEMPERATURE:
+          return (float)SUPLA_TEMPERATURE_NOT_AVAILABLE;
+        case ValueFormat::GENERAL_PURPOSE:
+          return NAN;
+        default:
+          return (float)SUPLA_MEASUREMENT_NOT_AVAILABLE;
+      }
+    }
+#endif
+#ifdef USE_BINARY_SENSOR
+    case ChannelKind::BINARY_SENSOR:
+      return static_cast<esphome::binary_sensor::BinarySensor *>(ch.entity)->state
+                 ? 1
+                 : 0;
+#endif
+#ifdef USE_SWITCH
+    case ChannelKind::SWITCH:
+      return static_cast<esphome::switch_::Switch *>(ch.entity)->state ? 1 : 0;
+#endif
+#ifdef USE_LIGHT
+    case ChannelKind::LIGHT:
+      return static_cast<esphome::light::LightState *>(ch.entity)
+                     ->remote_values.is_on()
+                 ? 1
+                 : 0;
+#endif
+    default:
+      return 0;
+  }
+}
 
+void SuplaEsphomeBridge::encode_value(const Channel &ch, float value,
+                                      char out[SUPLA_CHANNELVALUE_SIZE]) {
+  memset(out, 0, SUPLA_CHANNELVALUE_SIZE);
+
+  switch (ch.format) {
+    case ValueFormat::TEMPERATURE:
+    case ValueFormat::MEASUREMENT:
+    case ValueFormat::GENERAL_PURPOSE: {
+      // Little-endian double na całych 8 bajtach wartości
+      static_assert(sizeof(double) == SUPLA_CHANNELVALUE_SIZE,
+                    "SUPLA measurement value must be an 8-byte double");
+      const double measurement = value;
+      memcpy(out, &measurement, sizeof(measurement));
+      break;
+    }
+    case ValueFormat::HUMIDITY: {
+      // Jak HUMIDITYANDTEMPSENSOR, ale bez temperatury
+      const _supla_int_t temperature =
+          (_supla_int_t)(SUPLA_TEMPERATURE_NOT_AVAILABLE * 1000);
+      const _supla_int_t humidity = (_supla_int_t)lround(value * 1000.0);
+      memcpy(out, &temperature, sizeof(temperature));
+      memcpy(out + sizeof(temperature), &humidity, sizeof(humidity));
+      break;
+    }
+    default:
+      out[0] = value != 0 ? 1 : 0;
+      break;
+  }
+}
 
-bool SuplaEsphomeBridge::read_register_response(WiFiClient &client,
-                                                unsigned long timeout_ms) {
+void SuplaEsphomeBridge::on_channel_changed(size_t index) {
+  Channel &ch = channels_[index];
+  ch.dirty = true;
 
-  unsigned long start = millis();
-  char inbuf[1536];
+  // Zmiana lokalna (przycisk, API, web_server) albo z chmury: wysyłka od razu;
+  // odczyty czujników czekają na loop() (deadband, min_interval)
+  if (ch.kind != ChannelKind::SENSOR) {
+    flush_channel(ch);
+  }
+}
 
-  while (millis() - start < timeout_ms) {
-    yield();
-    delay(1);
-    if (client.available()) {
+void SuplaEsphomeBridge::flush_channels() {
+  for (Channel &ch : channels_) {
+    flush_channel(ch);
+  }
+}
 
-      int r = client.read(inbuf, sizeof(inbuf));
-      if (r <= 0) continue;
+void SuplaEsphomeBridge::flush_channel(Channel &ch) {
+  if (!ch.dirty || ch.rejected || srpc_ == nullptr ||
+      state_ != State::REGISTERED) {
+    return;
+  }
 
-          yield();
-    delay(1);
+  const uint32_t now = millis();
+  const float current = read_channel(ch);
+
+  if (ch.sent_valid) {
+    if (ch.kind == ChannelKind::SENSOR) {
+      // Próg i odstęp danego kanału (tablica we flashu)
+      ChannelDescriptor descriptor;
+      read_descriptor(&ch - channels_.data(), &descriptor);
+
+      if (now - ch.sent_at < descriptor.min_interval_ms) {
+        return;
+      }
+
+      // Brak odczytu (NaN) nie jest zmianą względem poprzedniego braku
+      if (current == ch.sent || fabsf(current - ch.sent) < descriptor.deadband ||
+          (std::isnan(current) && std::isnan(ch.sent))) {
+        ch.dirty = false;
+        return;
+      }
+    } else if (current == ch.sent) {
+      ch.dirty = false;
+      return;
+    }
+  }
 
-      ESP_LOGI("supla", "Received %d bytes", r);
-      hex_dump((uint8_t*)inbuf, r, "RX");
+  char value[SUPLA_CHANNELVALUE_SIZE];
+  encode_value(ch, current, value);
+
+  // VALUE_CHANGED_C (wersja >= 12) niesie też flagę offline
+  const _supla_int_t result =
+      srpc_call_allowed(srpc_, SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED_C)
+          ? srpc_ds_async_channel_value_changed_c(srpc_, ch.number, value,
+                                                  channel_offline(ch), 0)
+          : srpc_ds_async_channel_value_changed(srpc_, ch.number, value);
+  if (result == SUPLA_RESULT_FALSE) {
+    return;
+  }
 
-    yield();
-    delay(1);
+  supla_log(LOG_DEBUG, "Channel %u value sent: %.2f", (unsigned)ch.number,
+            (double)current);
 
+  ch.sent = current;
+  ch.sent_at = now;
+  ch.sent_valid = true;
+  ch.dirty = false;
+}
 
+void SuplaEsphomeBridge::handle_channel_set_value(TSD_SuplaChannelNewValue *value) {
+  const uint32_t started = millis();
+  const bool on = value->value[0] != 0;
+  Channel *ch = find_channel(value->ChannelNumber);
+  char success = 0;
+
+  if (ch != nullptr) {
+    switch (ch->kind) {
+#ifdef USE_SWITCH
+      case ChannelKind::SWITCH: {
+        auto *sw = static_cast<esphome::switch_::Switch *>(ch->entity);
+        if (on) {
+          sw->turn_on();
+        } else {
+          sw->turn_off();
+        }
+        success = 1;
+        break;
+      }
+#endif
+#ifdef USE_LIGHT
+      case ChannelKind::LIGHT: {
+        auto call = static_cast<esphome::light::LightState *>(ch->entity)->make_call();
+        call.set_state(on);
+        call.perform();
+        success = 1;
+        break;
+      }
+#endif
+      default:
+        break;
     }
   }
 
-  ESP_LOGW("supla", "Timeout waiting for register response");
-  return false;
+  if (success) {
+    supla_log(LOG_INFO, "SET_VALUE ch=%u -> %s (sender=%d)",
+              (unsigned)value->ChannelNumber, on ? "ON" : "OFF",
+              (int)value->SenderID);
+  } else {
+    supla_log(LOG_WARNING, "SET_VALUE for unsupported channel %u",
+              (unsigned)value->ChannelNumber);
+  }
+
+  srpc_ds_async_set_channel_result(srpc_, value->ChannelNumber, value->SenderID,
+                                   success);
+
+  // Czas od odebrania ramki do wysłania potwierdzenia (część lokalna RTT)
+  supla_log(LOG_DEBUG, "SET_VALUE handled in %u ms",
+            (unsigned)(millis() - started));
+}
+
+void SuplaEsphomeBridge::handle_remote_call(TsrpcReceivedData &rd) {
+  switch (rd.call_id) {
+    case SUPLA_SDC_CALL_GETVERSION_RESULT:
+      if (rd.data.sdc_getversion_result &&
+          rd.data.sdc_getversion_result->proto_version >= SUPLA_PROTO_VERSION_MIN) {
+        supla_log(LOG_INFO, "Server protocol version %u",
+                  (unsigned)rd.data.sdc_getversion_result->proto_version);
+        server_version_ = rd.data.sdc_getversion_result->proto_version;
+        version_received_ = true;
+      }
+      break;
+
+    case SUPLA_SDC_CALL_VERSIONERROR:
+      if (rd.data.sdc_version_error &&
+          rd.data.sdc_version_error->server_version >= SUPLA_PROTO_VERSION_MIN) {
+        supla_log(LOG_WARNING, "VERSIONERROR, server protocol version %u",
+                  (unsigned)rd.data.sdc_version_error->server_version);
+        server_version_ = rd.data.sdc_version_error->server_version;
+        version_received_ = true;
+      }
+      break;
+
+    case SUPLA_SD_CALL_REGISTER_DEVICE_RESULT:
+      if (rd.data.sd_register_device_result && state_ == State::REGISTERING) {
+        const TSD_SuplaRegisterDeviceResult *result =
+            rd.data.sd_register_device_result;
+        supla_log(LOG_INFO, "REGISTER_DEVICE_RESULT result_code=%d",
+                  (int)result->result_code);
+        apply_channel_report(nullptr, 0);
+        activity_timeout_s_ = result->activity_timeout;
+        register_result_ = result->result_code;
+      }
+      break;
+
+    case SUPLA_SD_CALL_REGISTER_DEVICE_RESULT_B:
+      if (rd.data.sd_register_device_result_b && state_ == State::REGISTERING) {
+        const TSD_SuplaRegisterDeviceResult_B *result =
+            rd.data.sd_register_device_result_b;
+        supla_log(LOG_INFO, "REGISTER_DEVICE_RESULT_B result_code=%d",
+                  (int)result->result_code);
+        apply_channel_report(result->channel_report,
+                             result->channel_report_size < CHANNEL_REPORT_MAXSIZE
+                                 ? result->channel_report_size
+                                 : CHANNEL_REPORT_MAXSIZE);
+        activity_timeout_s_ = result->activity_timeout;
+        register_result_ = result->result_code;
+      }
+      break;
+
+    case SUPLA_SDC_CALL_SET_ACTIVITY_TIMEOUT_RESULT:
+      if (rd.data.sdc_set_activity_timeout_result) {
+        handle_activity_timeout_result(rd.data.sdc_set_activity_timeout_result);
+      }
+      break;
+
+    case SUPLA_SDC_CALL_PING_SERVER_RESULT:
+      handle_ping_result();
+      break;
+
+    case SUPLA_SD_CALL_CHANNEL_SET_VALUE:
+      if (rd.data.sd_channel_new_value) {
+        handle_channel_set_value(rd.data.sd_channel_new_value);
+      }
+      break;
+
+    default:
+      supla_log(LOG_DEBUG, "Unhandled call_id=%u", (unsigned)rd.call_id);
+      break;
+  }
+}
+
+bool SuplaEsphomeBridge::register_device(unsigned long timeout_ms) {
+  register_timeout_ms_ = timeout_ms;
+
+  if (state_ == State::RESOLVING || state_ == State::CONNECTING ||
+      state_ == State::REGISTERING) {
+    return false;
+  }
+
+  close_session();
+  backoff_attempt_ = 0;
+  set_state(State::DISCONNECTED);
+  return true;
+}
+
+TDS_SuplaDeviceChannel_B *SuplaEsphomeBridge::get_register_channel(
+    int index, void *user_params) {
+  auto *self = static_cast<SuplaEsphomeBridge *>(user_params);
+  TDS_SuplaDeviceChannel_B &ch = self->register_channel_.b;
+  memset(&ch, 0, sizeof(ch));
+
+  if (index < 0 || (size_t)index >= self->channels_.size()) {
+    return nullptr;
+  }
+
+  // Opis prosto z tablicy we flashu, z RAM tylko bieżący stan encji
+  ChannelDescriptor descriptor;
+  self->read_descriptor(index, &descriptor);
+
+  const Channel &entry = self->channels_[index];
+  ch.Number = descriptor.number;
+  ch.Type = descriptor.type;
+  ch.FuncList = descriptor.func_list;
+  ch.Default = descriptor.default_function;
+  encode_value(entry, self->read_channel(entry), ch.value);
+  return &ch;
+}
+
+TDS_SuplaDeviceChannel_E *SuplaEsphomeBridge::get_register_channel_e(
+    int index, void *user_params) {
+  auto *self = static_cast<SuplaEsphomeBridge *>(user_params);
+  TDS_SuplaDeviceChannel_E &ch = self->register_channel_.e;
+  memset(&ch, 0, sizeof(ch));
+
+  if (index < 0 || (size_t)index >= self->channels_.size()) {
+    return nullptr;
+  }
+
+  ChannelDescriptor descriptor;
+  self->read_descriptor(index, &descriptor);
+
+  const Channel &entry = self->channels_[index];
+  ch.Number = descriptor.number;
+  ch.Type = descriptor.type;
+  ch.FuncList = descriptor.func_list;
+  ch.Default = descriptor.default_function;
+  // Flags zostają 0: każda flaga deklaruje funkcję (stan kanału, timer,
+  // kalibracja...), której most nie obsługuje
+  ch.DefaultIcon = descriptor.default_icon;
+  ch.Offline = self->channel_offline(entry);
+  encode_value(entry, self->read_channel(entry), ch.value);
+  return &ch;
+}
+
+// Pola wspólne nagłówków REGISTER_DEVICE_C i _G
+template <typename T>
+static void fill_register_header(T &reg, const uint8_t *guid,
+                                 const std::string &name,
+                                 const std::string &server,
+                                 unsigned char channel_count) {
+  memcpy(reg.GUID, guid, SUPLA_GUID_SIZE);
+  strncpy(reg.Name, name.c_str(), SUPLA_DEVICE_NAME_MAXSIZE - 1);
+  strncpy(reg.SoftVer, "2.0", SUPLA_SOFTVER_MAXSIZE - 1);
+  strncpy(reg.ServerName, server.c_str(), SUPLA_SERVER_NAME_MAXSIZE - 1);
+  reg.channel_count = channel_count;
+}
+
+bool SuplaEsphomeBridge::send_register_packet() {
+  register_version_ = server_version_ < SUPLA_PROTO_VERSION ? server_version_
+                                                            : SUPLA_PROTO_VERSION;
+  srpc_set_proto_version(srpc_, register_version_);
+
+  // G (e-mail + AuthKey, kanały E) gdy wersja pozwala, inaczej C (lokalizacja)
+  const bool use_g = !email_.empty() &&
+                     srpc_call_allowed(srpc_, SUPLA_DS_CALL_REGISTER_DEVICE_G);
+  if (!use_g && (location_id_ == 0 ||
+                 !srpc_call_allowed(srpc_, SUPLA_DS_CALL_REGISTER_DEVICE_C))) {
+    ESP_LOGW("supla", "No registration method for protocol version %u",
+             (unsigned)register_version_);
+    return false;
+  }
+
+  const unsigned char channel_count = (unsigned char)channels_.size();
+  const uint32_t heap_before = ESP.getFreeHeap();
+  register_heap_min_ = heap_before;
+
+  // Nagłówek na stosie, kanały pojedynczo przez get_register_channel*():
+  // ramka idzie prosto do gniazda, bez kopii całego TSuplaDataPacket
+  _supla_int_t result;
+  if (use_g) {
+    TDS_SuplaRegisterDeviceHeader reg;
+    memset(&reg, 0, sizeof(reg));
+    strncpy(reg.Email, email_.c_str(), SUPLA_EMAIL_MAXSIZE - 1);
+    memcpy(reg.AuthKey, auth_key_, SUPLA_AUTHKEY_SIZE);
+    fill_register_header(reg, GUID_BIN, device_name_, server_, channel_count);
+
+    result = srpc_ds_async_registerdevice_in_chunks_g_ex(
+        srpc_, &reg, &SuplaEsphomeBridge::get_register_channel_e);
+  } else {
+    TDS_SuplaRegisterDeviceHeader_C reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.LocationID = location_id_;
+    strncpy(reg.LocationPWD, location_password_.c_str(), SUPLA_LOCATION_PWD_MAXSIZE - 1);
+    fill_register_header(reg, GUID_BIN, device_name_, server_, channel_count);
+
+    result = srpc_ds_async_registerdevice_in_chunks_c(
+        srpc_, &reg, &SuplaEsphomeBridge::get_register_channel);
+  }
+
+  const uint32_t heap_min = register_heap_min_;
+  register_heap_min_ = 0;
+
+  if (result == SUPLA_RESULT_FALSE) {
+    ESP_LOGW("supla", "REGISTER_DEVICE_%c send failed", use_g ? 'G' : 'C');
+    return false;
+  }
+
+  // Szczyt zużycia sterty w trakcie wysyłki (próbkowany w data_write)
+  ESP_LOGI("supla",
+           "REGISTER_DEVICE_%c sent (version %u, channel_count=%u), free heap %u, "
+           "peak use %u B",
+           use_g ? 'G' : 'C', (unsigned)register_version_, (unsigned)channel_count,
+           (unsigned)heap_before, (unsigned)(heap_before - heap_min));
+  return true;
 }
 
 }  // namespace supla_esphome_bridge
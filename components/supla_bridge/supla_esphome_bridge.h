@@ -2,70 +2,229 @@
 
 #include "esphome.h"
 #include <WiFiClient.h>
+#include <lwip/dns.h>
 #include <cstdint>
 #include <cstring>
 #include <string>
+#include <vector>
 
 #include "proto.h"
 #include "srpc.h"
 
 namespace supla_esphome_bridge {
 
+#if defined(ARDUINO_ARCH_ESP8266)
+// Tablica kanałów z codegenu leży we flashu, czytana przez memcpy_P
+#define SUPLA_CHANNEL_TABLE_ATTR PROGMEM
+#else
+#define SUPLA_CHANNEL_TABLE_ATTR
+#endif
+
+// Opis kanału znany już przy generowaniu main.cpp (__init__.py emituje
+// tablicę constexpr); w RAM zostaje tylko encja i stan wysyłki
+struct ChannelDescriptor {
+  uint32_t func_list;
+  uint16_t type;
+  uint16_t default_function;
+  uint8_t number;
+  uint8_t default_icon;
+  // Kanały SENSOR: minimalna zmiana i minimalny odstęp między wysyłkami
+  float deadband;
+  uint32_t min_interval_ms;
+};
+
 class SuplaEsphomeBridge : public esphome::Component {
  public:
+  // Stany połączenia z serwerem SUPLA (przełączane wyłącznie w loop())
+  enum class State : uint8_t {
+    DISCONNECTED,
+    RESOLVING,
+    CONNECTING,
+    REGISTERING,
+    REGISTERED,
+    BACKOFF,
+  };
+
   SuplaEsphomeBridge();
   ~SuplaEsphomeBridge();
 
+  // Rodzaj encji ESPHome za kanałem SUPLA
+  enum class ChannelKind : uint8_t {
+    SENSOR,
+    BINARY_SENSOR,
+    SWITCH,
+    LIGHT,
+  };
+
   // Konfiguracja
   void set_server(const std::string &server) { server_ = server; }
   void set_location_id(int location_id) { location_id_ = location_id; }
   void set_location_password(const std::string &pwd) { location_password_ = pwd; }
   void set_device_name(const std::string &name) { device_name_ = name; }
-
-  // Metody wymagane przez wygenerowany main.cpp
-  void set_temperature_sensor(esphome::sensor::Sensor *s) { temperature_sensor_ = s; }
-  void set_switch_light(esphome::light::LightState *l) { switch_light_ = l; }
+  // Rejestracja e-mailem (REGISTER_DEVICE_G, protokół >= 25); klucz jako hex
+  void set_email(const std::string &email) { email_ = email; }
+  void set_auth_key(const std::string &hex);
+  // Activity timeout zgłaszany serwerowi po rejestracji (0 = domyślny serwera)
+  void set_activity_timeout(uint8_t seconds) { activity_timeout_request_s_ = seconds; }
+#ifdef USE_SENSOR
+  // Czas odpowiedzi na PING_SERVER [ms]
+  void set_ping_rtt_sensor(esphome::sensor::Sensor *s) { ping_rtt_sensor_ = s; }
+#endif
+
+  // Kanały z listy channels: (wygenerowany main.cpp, przed setup()):
+  // tablica opisów, potem encje w tej samej kolejności
+  void set_channel_table(const ChannelDescriptor *table, uint8_t count);
+#ifdef USE_SENSOR
+  void add_sensor_channel(esphome::sensor::Sensor *s);
+#endif
+#ifdef USE_BINARY_SENSOR
+  void add_binary_sensor_channel(esphome::binary_sensor::BinarySensor *s);
+#endif
+#ifdef USE_SWITCH
+  void add_switch_channel(esphome::switch_::Switch *s);
+#endif
+#ifdef USE_LIGHT
+  void add_light_channel(esphome::light::LightState *l);
+#endif
 
   // Cykl życia komponentu
   void setup() override;
   void loop() override;
 
-  // Ręczna rejestracja
+  // Ręczna rejestracja: nie blokuje, tylko wymusza nową próbę w loop()
   bool register_device(unsigned long timeout_ms = 3000);
 
-void fill_channel_D(
-    TDS_SuplaDeviceChannel_D &ch,
-    uint8_t number,
-    int type,
-    int func,
-    int default_value,
-    int64_t flags,
-    bool offline,
-    unsigned value_validity_sec,
-    const char *initial_value,
-    uint8_t default_icon
-);
-
-  bool is_registered() const { return registered_; }
+  State get_state() const { return state_; }
+  bool is_registered() const { return state_ == State::REGISTERED; }
 
  private:
-  bool send_register_packet(WiFiClient &client);
-  bool read_register_response(WiFiClient &client, unsigned long timeout_ms);
-
-  void hex_dump(const uint8_t *buf, size_t len, const char *prefix);
+  void set_state(State state);
+  void enter_backoff();
+
+  void start_resolving();
+  void loop_resolving();
+  static void on_dns_found(const char *name, const ip_addr_t *ipaddr, void *arg);
+  void loop_connecting();
+  void loop_registering();
+  void finish_registration();
+  void apply_channel_report(const unsigned char *report, size_t size);
+  void loop_session();
+  void loop_keepalive();
+  void handle_activity_timeout_result(const TSDC_SuplaSetActivityTimeoutResult *result);
+  void handle_ping_result();
+
+  // Sesja srpc żyjąca tak długo jak połączenie TCP
+  bool open_session();
+  void close_session();
+  void handle_remote_call(TsrpcReceivedData &rd);
+
+  static _supla_int_t data_read(void *buf, _supla_int_t count, void *user_params);
+  static _supla_int_t data_write(void *buf, _supla_int_t count, void *user_params);
+  static void on_remote_call_received(void *_srpc, unsigned _supla_int_t rr_id,
+                                      unsigned _supla_int_t call_id, void *user_params,
+                                      unsigned char proto_version);
+  static void on_version_error(void *_srpc, unsigned char remote_version, void *user_params);
+
+  bool send_register_packet();
+  static TDS_SuplaDeviceChannel_B *get_register_channel(int index, void *user_params);
+  static TDS_SuplaDeviceChannel_E *get_register_channel_e(int index, void *user_params);
+
+  // Kodowanie wartości kanału, wynika z typu w ChannelDescriptor
+  enum class ValueFormat : uint8_t {
+    BINARY,           // bajt 0: 0/1 (przekaźniki, czujniki dwustanowe)
+    TEMPERATURE,      // double, brak odczytu -275
+    HUMIDITY,         // int32 temperatura*1000 (-275000) i int32 wilgotność*1000
+    MEASUREMENT,      // double, brak odczytu -1 (ciśnienie, wiatr, odległość...)
+    GENERAL_PURPOSE,  // double, brak odczytu NaN
+  };
+
+  // Stan kanału w RAM; stan encji czytany dopiero przy wysyłce
+  struct Channel {
+    void *entity;
+    uint32_t sent_at;
+    float sent;
+    uint8_t number;
+    ChannelKind kind;
+    ValueFormat format;
+    bool dirty : 1;
+    bool sent_valid : 1;
+    // Serwer nie przyjął kanału (raport z REGISTER_DEVICE_RESULT_B)
+    bool rejected : 1;
+  };
+
+  void read_descriptor(size_t index, ChannelDescriptor *out) const;
+  void add_channel(ChannelKind kind, void *entity);
+  Channel *find_channel(uint8_t number);
+  static ValueFormat value_format(uint16_t type);
+  float read_channel(const Channel &ch) const;
+  unsigned char channel_offline(const Channel &ch) const;
+  static void encode_value(const Channel &ch, float value,
+                           char out[SUPLA_CHANNELVALUE_SIZE]);
+  void on_channel_changed(size_t index);
+  void flush_channels();
+  void flush_channel(Channel &ch);
+  void handle_channel_set_value(TSD_SuplaChannelNewValue *value);
 
   std::string server_;
   int location_id_{0};
   std::string location_password_;
   std::string device_name_{"esphome-supla"};
-  bool registered_{false};
+  std::string email_;
+  char auth_key_[SUPLA_AUTHKEY_SIZE]{};
   WiFiClient client_;
-
-  esphome::sensor::Sensor *temperature_sensor_{nullptr};
-  esphome::light::LightState *switch_light_{nullptr};
-
-  // sproto/srpc context (typ zwracany przez sproto_init w Twoim srpc.h)
-  void *sproto_ctx_{nullptr};
+  // Adres serwera z DNS (0 = nieznany); connect() idzie na IP, więc w loop()
+  // zostaje tylko connect ograniczony timeoutem
+  uint32_t server_ip_{0};
+  // Wynik dns_gethostbyname() z callbacku lwIP (na ESP32 z wątku tcpip),
+  // czytany w loop() przez __atomic
+  uint32_t resolved_ip_{0};
+  uint8_t resolve_done_{0};
+
+  // Maszyna stanów połączenia
+  State state_{State::DISCONNECTED};
+  uint32_t state_since_{0};
+  // Backoff tej instancji: kolejna próba po backoff_ms_ od wejścia w BACKOFF
+  uint32_t backoff_ms_{0};
+  uint8_t backoff_attempt_{0};
+  bool network_connected_{false};
+  unsigned long register_timeout_ms_{3000};
+
+  // Opisy kanałów (flash) i ich stan (RAM) w kolejności rejestracji
+  const ChannelDescriptor *channel_table_{nullptr};
+  uint8_t channel_table_size_{0};
+  std::vector<Channel> channels_;
+
+  // Kontekst srpc aktywnej sesji (nullptr gdy brak połączenia)
+  void *srpc_{nullptr};
+
+  // Wersja protokołu serwera z GETVERSION_RESULT/VERSIONERROR; pamiętana
+  // między połączeniami (0 = nieznana)
+  uint8_t server_version_{0};
+  // Bieżąca sesja: odpowiedź na GETVERSION i wersja wysłanej rejestracji
+  bool version_received_{false};
+  uint8_t register_version_{0};
+  // Wynik rejestracji z handle_remote_call(), obsługiwany w loop()
+  int register_result_{SUPLA_RESULTCODE_NONE};
+  // Activity timeout przydzielony przez serwer [s]
+  uint8_t activity_timeout_s_{0};
+  uint8_t activity_timeout_request_s_{0};
+
+  // Keepalive: PING_SERVER dopiero po oknie bez żadnej wysyłki
+  uint32_t last_tx_ms_{0};
+  uint32_t ping_sent_ms_{0};
+  uint32_t ping_sent_us_{0};
+  bool ping_pending_{false};
+#ifdef USE_SENSOR
+  esphome::sensor::Sensor *ping_rtt_sensor_{nullptr};
+#endif
+
+  // Bufor jednego kanału wysyłanego w REGISTER_DEVICE_C/G
+  union {
+    TDS_SuplaDeviceChannel_B b;
+    TDS_SuplaDeviceChannel_E e;
+  } register_channel_{};
+  // Najniższa wolna sterta w trakcie rejestracji (0 = poza rejestracją)
+  uint32_t register_heap_min_{0};
 
   // Stały GUID (binarnie)
   static const uint8_t GUID_BIN[SUPLA_GUID_SIZE];
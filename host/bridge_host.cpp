@@ -0,0 +1,208 @@
+// Native runner for SuplaEsphomeBridge.
+//
+// Drives the component the way ESPHome does (setup() once, then loop() at a
+// fixed interval) against host stand-ins for the sensor, the light and
+// WiFiClient. Point it at mock_supla_server (or a real SUPLA server) to
+// profile the connection state machine and the srpc session on a PC.
+//
+//   bridge_host [-s server] [-l location_id] [-p password] [-i loop_ms]
+//               [-t temperature_period_ms] [-d run_seconds] [-w offline_s]
+//               [-c extra_switches] [-e email -k auth_key_hex]
+//               [-a activity_timeout_s] [-u]
+//
+// -w keeps network::is_connected() false for the first offline_s seconds.
+// -c registers extra_switches switch channels after the thermometer (0) and
+// the light (1), numbered from 2. -e registers with e-mail and AuthKey
+// (REGISTER_DEVICE_G) instead of the location. -a asks the server for that
+// activity timeout; ping RTT samples are logged under the "host" tag. -u adds
+// a humidity sensor channel (HUMIDITYSENSOR) after the others.
+
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "esphome.h"
+#include "supla_esphome_bridge.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int) { running = 0; }
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [-s server] [-l location_id] [-p password] [-i loop_ms]\n"
+          "          [-t temperature_period_ms] [-d run_seconds] [-w offline_s]\n"
+          "          [-c extra_switches] [-e email -k auth_key_hex]\n"
+          "          [-a activity_timeout_s] [-u]\n",
+          argv0);
+}
+
+int main(int argc, char **argv) {
+  const char *server = "127.0.0.1";
+  int location_id = 1;
+  const char *password = "host";
+  uint32_t loop_interval_ms = 16;
+  uint32_t temperature_period_ms = 1000;
+  uint32_t run_seconds = 0;
+  uint32_t offline_seconds = 0;
+  int extra_switches = 0;
+  const char *email = nullptr;
+  const char *auth_key = "";
+  int activity_timeout = 0;
+  bool humidity_channel = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:l:p:i:t:d:w:c:e:k:a:uh")) != -1) {
+    switch (opt) {
+      case 's':
+        server = optarg;
+        break;
+      case 'l':
+        location_id = atoi(optarg);
+        break;
+      case 'p':
+        password = optarg;
+        break;
+      case 'i':
+        loop_interval_ms = (uint32_t)strtoul(optarg, nullptr, 10);
+        break;
+      case 't':
+        temperature_period_ms = (uint32_t)strtoul(optarg, nullptr, 10);
+        break;
+      case 'd':
+        run_seconds = (uint32_t)strtoul(optarg, nullptr, 10);
+        break;
+      case 'w':
+        offline_seconds = (uint32_t)strtoul(optarg, nullptr, 10);
+        break;
+      case 'c':
+        extra_switches = atoi(optarg);
+        break;
+      case 'e':
+        email = optarg;
+        break;
+      case 'k':
+        auth_key = optarg;
+        break;
+      case 'a':
+        activity_timeout = atoi(optarg);
+        break;
+      case 'u':
+        humidity_channel = true;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  esphome::sensor::Sensor temperature;
+  esphome::light::LightState light;
+  light.set_output([](bool on) {
+    ESP_LOGI("gpio", "GPIO12 -> %s", on ? "HIGH" : "LOW");
+  });
+
+  supla_esphome_bridge::SuplaEsphomeBridge bridge;
+  bridge.set_server(server);
+  bridge.set_location_id(location_id);
+  bridge.set_location_password(password);
+  bridge.set_device_name("esphome-supla-host");
+  if (email) {
+    bridge.set_email(email);
+    bridge.set_auth_key(auth_key);
+  }
+  bridge.set_activity_timeout((uint8_t)activity_timeout);
+
+  esphome::sensor::Sensor ping_rtt;
+  ping_rtt.add_on_state_callback(
+      [](float rtt_ms) { ESP_LOGI("host", "Ping RTT %.3f ms", rtt_ms); });
+  bridge.set_ping_rtt_sensor(&ping_rtt);
+
+  // The table __init__.py would generate for the same configuration
+  std::vector<supla_esphome_bridge::ChannelDescriptor> table = {
+      {SUPLA_BIT_FUNC_THERMOMETER, SUPLA_CHANNELTYPE_THERMOMETER,
+       SUPLA_CHANNELFNC_THERMOMETER, 0, 0, 0.1f, 10000},
+      {SUPLA_BIT_FUNC_POWERSWITCH | SUPLA_BIT_FUNC_LIGHTSWITCH,
+       SUPLA_CHANNELTYPE_RELAY, SUPLA_CHANNELFNC_LIGHTSWITCH, 1, 0, 0.0f, 0},
+  };
+  std::vector<esphome::switch_::Switch> switches(
+      extra_switches > 0 ? extra_switches : 0);
+  for (size_t i = 0; i < switches.size(); i++) {
+    table.push_back({SUPLA_BIT_FUNC_POWERSWITCH | SUPLA_BIT_FUNC_LIGHTSWITCH,
+                     SUPLA_CHANNELTYPE_RELAY, SUPLA_CHANNELFNC_POWERSWITCH,
+                     (uint8_t)(2 + i), 0, 0.0f, 0});
+  }
+
+  esphome::sensor::Sensor humidity;
+  if (humidity_channel) {
+    table.push_back({SUPLA_BIT_FUNC_HUMIDITY, SUPLA_CHANNELTYPE_HUMIDITYSENSOR,
+                     SUPLA_CHANNELFNC_HUMIDITY, (uint8_t)table.size(), 0,
+                     0.5f, 10000});
+  }
+
+  bridge.set_channel_table(table.data(), table.size());
+  bridge.add_sensor_channel(&temperature);
+  bridge.add_light_channel(&light);
+  for (auto &sw : switches) {
+    bridge.add_switch_channel(&sw);
+  }
+  if (humidity_channel) {
+    bridge.add_sensor_channel(&humidity);
+  }
+
+  bridge.setup();
+  temperature.publish_state(21.0f);
+  if (humidity_channel) {
+    humidity.publish_state(55.3f);
+  }
+
+  uint32_t temperature_at = millis();
+  uint32_t max_loop_us = 0;
+  uint64_t total_loop_ns = 0;
+  uint64_t loops = 0;
+
+  while (running && (run_seconds == 0 || millis() < run_seconds * 1000)) {
+    if (esphome_host_network_connected != (millis() >= offline_seconds * 1000)) {
+      esphome_host_network_connected = !esphome_host_network_connected;
+      ESP_LOGI("host", "Network %s",
+               esphome_host_network_connected ? "up" : "down");
+    }
+
+    if (temperature_period_ms &&
+        millis() - temperature_at >= temperature_period_ms) {
+      temperature_at = millis();
+      temperature.publish_state(21.0f + 2.0f * sinf(temperature_at / 60000.0f));
+      if (humidity_channel) {
+        humidity.publish_state(55.3f + 5.0f * sinf(temperature_at / 60000.0f));
+      }
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    bridge.loop();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    uint64_t loop_ns = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL +
+                       t1.tv_nsec - t0.tv_nsec;
+    uint32_t loop_us = (uint32_t)(loop_ns / 1000);
+    if (loop_us > max_loop_us) {
+      max_loop_us = loop_us;
+      ESP_LOGD("host", "New longest loop(): %u us", (unsigned)max_loop_us);
+    }
+    total_loop_ns += loop_ns;
+    loops++;
+
+    delay(loop_interval_ms);
+  }
+
+  ESP_LOGI("host", "%llu loop() calls, longest %u us, average %.2f us",
+           (unsigned long long)loops, (unsigned)max_loop_us,
+           loops ? total_loop_ns / 1000.0 / loops : 0.0);
+  return 0;
+}
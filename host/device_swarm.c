@@ -0,0 +1,290 @@
+/*
+ Many simulated devices in one thread, for loading mock_supla_server.
+
+ Each session is a TCP connection with its own srpc: it registers one relay
+ channel (TDS_SuplaRegisterDevice_C), answers SUPLA_SD_CALL_CHANNEL_SET_VALUE
+ and pings the server every -i seconds. All sessions are driven by one
+ eh.h (epoll) loop: sockets are edge-triggered and a 1 s timer sends the
+ pings, so an idle session costs nothing per wakeup. Every second the
+ totals are printed.
+
+   device_swarm [-s host] [-p port] [-n sessions] [-d seconds] [-i ping_s]
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eh.h"
+#include "proto.h"
+#include "srpc.h"
+
+typedef struct {
+  int fd;
+  char closed;
+  void *srpc;
+  unsigned char registered;
+} TSwarmSession;
+
+static volatile sig_atomic_t running = 1;
+
+static unsigned registered;
+static unsigned disconnected;
+static unsigned long long set_values;
+static unsigned long long pongs;
+static unsigned long long wakeups;
+
+static void on_signal(int sig) {
+  (void)sig;
+  running = 0;
+}
+
+static _supla_int_t swarm_data_read(void *buf, _supla_int_t count,
+                                    void *user_params) {
+  TSwarmSession *s = (TSwarmSession *)user_params;
+  ssize_t r = recv(s->fd, buf, count, MSG_DONTWAIT);
+
+  if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    s->closed = 1;
+    return 0;
+  }
+
+  return r > 0 ? (_supla_int_t)r : -1;
+}
+
+static _supla_int_t swarm_data_write(void *buf, _supla_int_t count,
+                                     void *user_params) {
+  TSwarmSession *s = (TSwarmSession *)user_params;
+  ssize_t r = send(s->fd, buf, count, MSG_NOSIGNAL);
+  return r >= 0 ? (_supla_int_t)r : -1;
+}
+
+static void swarm_on_remote_call_received(void *_srpc,
+                                          unsigned _supla_int_t rr_id,
+                                          unsigned _supla_int_t call_id,
+                                          void *user_params,
+                                          unsigned char proto_version) {
+  (void)rr_id;
+  (void)call_id;
+  (void)proto_version;
+  TSwarmSession *s = (TSwarmSession *)user_params;
+  TsrpcReceivedData rd;
+
+  if (srpc_getdata(_srpc, &rd, 0) != SUPLA_RESULT_TRUE) {
+    return;
+  }
+
+  switch (rd.call_id) {
+    case SUPLA_SD_CALL_REGISTER_DEVICE_RESULT:
+      if (rd.data.sd_register_device_result &&
+          rd.data.sd_register_device_result->result_code ==
+              SUPLA_RESULTCODE_TRUE &&
+          !s->registered) {
+        s->registered = 1;
+        registered++;
+      }
+      break;
+    case SUPLA_SD_CALL_CHANNEL_SET_VALUE:
+      if (rd.data.sd_channel_new_value) {
+        srpc_ds_async_set_channel_result(
+            _srpc, rd.data.sd_channel_new_value->ChannelNumber,
+            rd.data.sd_channel_new_value->SenderID, 1);
+        set_values++;
+      }
+      break;
+    case SUPLA_SDC_CALL_PING_SERVER_RESULT:
+      pongs++;
+      break;
+  }
+
+  srpc_rd_free(&rd);
+}
+
+static char swarm_connect(TSwarmSession *s, struct sockaddr_in *addr,
+                          int index, TEventHandler *eh) {
+  s->fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (s->fd < 0) return 0;
+
+  fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL, 0) | O_NONBLOCK);
+  int flag = 1;
+  setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+  if (connect(s->fd, (struct sockaddr *)addr, sizeof(*addr)) != 0 &&
+      errno != EINPROGRESS) {
+    close(s->fd);
+    return 0;
+  }
+
+  TsrpcParams params;
+  srpc_params_init(&params);
+  params.data_read = swarm_data_read;
+  params.data_write = swarm_data_write;
+  params.on_remote_call_received = swarm_on_remote_call_received;
+  params.user_params = s;
+
+  s->srpc = srpc_init(&params);
+  if (s->srpc == NULL) {
+    close(s->fd);
+    return 0;
+  }
+
+  // Queued now, written once the connection is up and reports EH_WRITE
+  TDS_SuplaRegisterDevice_C reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.LocationID = 1;
+  snprintf(reg.Name, sizeof(reg.Name), "swarm-%i", index);
+  snprintf(reg.SoftVer, sizeof(reg.SoftVer), "swarm");
+  memcpy(reg.GUID, &index, sizeof(index));
+  reg.channel_count = 1;
+  reg.channels[0].Number = 0;
+  reg.channels[0].Type = SUPLA_CHANNELTYPE_RELAY;
+  reg.channels[0].FuncList = SUPLA_BIT_FUNC_POWERSWITCH;
+  reg.channels[0].Default = SUPLA_CHANNELFNC_POWERSWITCH;
+  srpc_ds_async_registerdevice_c(s->srpc, &reg);
+
+  return eh_add_fd_ex(eh, s->fd, EH_READ | EH_WRITE | EH_EDGE_TRIGGERED, s);
+}
+
+static void swarm_close(TSwarmSession *s, TEventHandler *eh) {
+  if (s->srpc == NULL) return;
+
+  eh_del_fd(eh, s->fd, s);
+  srpc_free(s->srpc);
+  s->srpc = NULL;
+  close(s->fd);
+
+  if (s->registered) registered--;
+  disconnected++;
+}
+
+static void swarm_iterate(TSwarmSession *s, TEventHandler *eh) {
+  if (!srpc_iterate_batch(s->srpc) || s->closed) {
+    swarm_close(s, eh);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *host = "127.0.0.1";
+  int port = 2015;
+  int count = 1000;
+  int duration = 10;
+  int ping_s = 5;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:p:n:d:i:h")) != -1) {
+    switch (opt) {
+      case 's':
+        host = optarg;
+        break;
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'd':
+        duration = atoi(optarg);
+        break;
+      case 'i':
+        ping_s = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-s host] [-p port] [-n sessions] [-d seconds] "
+                "[-i ping_s]\n",
+                argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((unsigned short)port);
+  if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+    fprintf(stderr, "bad address: %s\n", host);
+    return 1;
+  }
+
+  TEventHandler *eh = eh_init();
+  TSwarmSession *sessions = calloc(count, sizeof(TSwarmSession));
+  if (eh == NULL || sessions == NULL || !eh_set_timer(eh, 1000)) {
+    perror("eh_init");
+    return 1;
+  }
+
+  int connected = 0;
+  for (int a = 0; a < count; a++) {
+    if (swarm_connect(&sessions[a], &addr, a, eh)) {
+      connected++;
+    } else {
+      perror("connect");
+      break;
+    }
+  }
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  int seconds = 0;
+
+  while (running && seconds < duration) {
+    if (eh_wait(eh, -1) < 0) break;
+    wakeups++;
+
+    for (int a = 0; a < eh->ready_count; a++) {
+      TSwarmSession *s = (TSwarmSession *)eh_get_ready(eh, a, NULL);
+      if (s != NULL && s->srpc != NULL) swarm_iterate(s, eh);
+    }
+
+    for (unsigned long long t = 0; t < eh->timer_expirations; t++) {
+      seconds++;
+      for (int a = 0; ping_s > 0 && seconds % ping_s == 0 && a < count; a++) {
+        if (sessions[a].srpc != NULL && sessions[a].registered) {
+          srpc_dcs_async_ping_server(sessions[a].srpc);
+          swarm_iterate(&sessions[a], eh);
+        }
+      }
+
+      printf("%3is sessions %i registered %u disconnected %u set values "
+             "%llu pongs %llu\n",
+             seconds, connected, registered, disconnected, set_values, pongs);
+      fflush(stdout);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+               (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+
+  printf("%i sessions, %u registered, %llu wakeups, cpu %.2f s in %.2f s, "
+         "max rss %li KB\n",
+         connected, registered, wakeups, cpu, elapsed, ru.ru_maxrss);
+
+  for (int a = 0; a < count; a++) {
+    swarm_close(&sessions[a], eh);
+  }
+
+  free(sessions);
+  eh_free(eh);
+  return 0;
+}
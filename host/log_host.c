@@ -0,0 +1,58 @@
+/*
+ Host implementation of log.h for the native server-side build: writes to
+ stderr right away. The device configuration (supla_proto_device) uses the
+ component's deferred log.c instead.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "log.h"
+
+static int supla_log_level = LOG_DEBUG;
+
+void supla_log(int __pri, const char *__fmt, ...) {
+  if (__fmt == NULL || __pri > supla_log_level) return;
+
+  va_list args;
+  va_start(args, __fmt);
+  fprintf(stderr, "[supla:%i] ", __pri);
+  vfprintf(stderr, __fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+#ifdef SUPLA_DEBUG_WIRE
+void supla_log_hex(int __pri, const char *prefix, const void *buf,
+                   unsigned int len) {
+  const unsigned char *bytes = (const unsigned char *)buf;
+  if (buf == NULL || __pri > supla_log_level) return;
+
+  for (unsigned int i = 0; i < len; i += 16) {
+    fprintf(stderr, "[supla:%i] %s %04X:", __pri, prefix, i);
+    for (unsigned int j = i; j < len && j < i + 16; j++) {
+      fprintf(stderr, " %02X", bytes[j]);
+    }
+    fputc('\n', stderr);
+  }
+}
+#endif /*SUPLA_DEBUG_WIRE*/
+
+void supla_log_set_level(int level) { supla_log_level = level; }
+
+int supla_log_get_level(void) { return supla_log_level; }
+
+int supla_log_drain(_supla_log_sink sink, int max_records,
+                    unsigned int now_ms) {
+  (void)sink;
+  (void)max_records;
+  (void)now_ms;
+  return 0;
+}
+
+void supla_write_state_file(const char *file, int __pri, const char *__fmt,
+                            ...) {
+  (void)file;
+  (void)__pri;
+  (void)__fmt;
+}
@@ -0,0 +1,594 @@
+/*
+ Minimal SUPLA server for exercising the bridge on a PC.
+
+ Answers registration, pings and activity timeout requests, prints reported
+ channel values and (optionally) toggles the relay channel periodically,
+ measuring the time from SUPLA_SD_CALL_CHANNEL_SET_VALUE to the matching
+ SUPLA_DS_CALL_CHANNEL_SET_VALUE_RESULT. Devices are served concurrently
+ from one thread on eh.h (epoll): sessions are edge-triggered and a timer
+ drives the toggles and drops devices that exceed the activity timeout.
+ -q leaves out the per-call output, for runs with many devices. -r answers
+ every registration with the given SUPLA_RESULTCODE_* instead of TRUE.
+ REGISTER_DEVICE_G gets REGISTER_DEVICE_RESULT_B with a channel report.
+ Activity timeout requests are clamped to MOCK_ACTIVITY_TIMEOUT_MIN..MAX and
+ the result applies to that device. -P leaves pings unanswered, so the
+ device sees a dead link while its socket stays open.
+
+   mock_supla_server [-p port] [-t toggle_ms] [-n toggle_count] [-r result_code]
+                     [-P] [-q]
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eh.h"
+#include "log.h"
+#include "proto.h"
+#include "srpc.h"
+
+#define MOCK_TIMER_MS 1000
+#define MOCK_ACTIVITY_TIMEOUT 120
+#define MOCK_ACTIVITY_TIMEOUT_MIN 10
+#define MOCK_ACTIVITY_TIMEOUT_MAX 240
+
+typedef struct {
+  int fd;
+  char closed;
+  void *srpc;
+  int index;
+  unsigned long long activity_us;
+  unsigned char activity_timeout;
+
+  unsigned char registered;
+  int channel_type[SUPLA_CHANNELMAXCOUNT];
+  int relay_channel;
+  char relay_state;
+  char relay_requested;
+
+  int sender_id;
+  unsigned long long set_value_sent_us;
+
+  unsigned long long toggled_us;
+  unsigned toggles;
+
+  unsigned rtt_count;
+  double rtt_min_ms;
+  double rtt_max_ms;
+  double rtt_sum_ms;
+} TMockDevice;
+
+static volatile sig_atomic_t running = 1;
+static int verbose = 1;
+static int register_result_code = SUPLA_RESULTCODE_TRUE;
+static int answer_pings = 1;
+
+static TEventHandler *eh;
+static TMockDevice **devices;
+static int device_count;
+static int device_capacity;
+
+// All devices, for -q
+static unsigned long long total_rtt_count;
+static double total_rtt_sum_ms;
+static double total_rtt_max_ms;
+static unsigned long long total_devices;
+
+static void on_signal(int sig) {
+  (void)sig;
+  running = 0;
+}
+
+static unsigned long long now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static _supla_int_t mock_data_read(void *buf, _supla_int_t count,
+                                   void *user_params) {
+  TMockDevice *dev = (TMockDevice *)user_params;
+  ssize_t r = recv(dev->fd, buf, count, MSG_DONTWAIT);
+
+  if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    dev->closed = 1;
+    return 0;
+  }
+
+  if (r > 0) {
+    dev->activity_us = now_us();
+    return (_supla_int_t)r;
+  }
+
+  return -1;
+}
+
+static _supla_int_t mock_data_write(void *buf, _supla_int_t count,
+                                    void *user_params) {
+  TMockDevice *dev = (TMockDevice *)user_params;
+  ssize_t r = send(dev->fd, buf, count, MSG_NOSIGNAL);
+  return r >= 0 ? (_supla_int_t)r : -1;
+}
+
+static void mock_register_channel(TMockDevice *dev, unsigned char number,
+                                  int type, int func_list, int default_func,
+                                  const char *value, int offline) {
+  dev->channel_type[number] = type;
+
+  if (verbose) {
+    printf("  channel %u: type=%i funclist=0x%x default=%i%s\n", number, type,
+           func_list, default_func, offline ? " offline" : "");
+  }
+
+  if (type == SUPLA_CHANNELTYPE_RELAY && dev->relay_channel == -1) {
+    dev->relay_channel = number;
+    dev->relay_state = value[0];
+  }
+}
+
+static void mock_register_result(TMockDevice *dev) {
+  TSD_SuplaRegisterDeviceResult result;
+  memset(&result, 0, sizeof(result));
+  result.result_code = register_result_code;
+  result.activity_timeout = MOCK_ACTIVITY_TIMEOUT;
+  result.version = SUPLA_PROTO_VERSION;
+  result.version_min = SUPLA_PROTO_VERSION_MIN;
+
+  srpc_sd_async_registerdevice_result(dev->srpc, &result);
+  dev->registered = register_result_code == SUPLA_RESULTCODE_TRUE;
+}
+
+// Every channel is reported as registered
+static void mock_register_result_b(TMockDevice *dev,
+                                   unsigned char channel_count) {
+  TSD_SuplaRegisterDeviceResult_B result;
+  memset(&result, 0, sizeof(result));
+  result.result_code = register_result_code;
+  result.activity_timeout = MOCK_ACTIVITY_TIMEOUT;
+  result.version = SUPLA_PROTO_VERSION;
+  result.version_min = SUPLA_PROTO_VERSION_MIN;
+  result.channel_report_size = channel_count;
+  memset(result.channel_report, CHANNEL_REPORT_CHANNEL_REGISTERED,
+         channel_count);
+
+  srpc_sd_async_registerdevice_result_b(dev->srpc, &result);
+  dev->registered = register_result_code == SUPLA_RESULTCODE_TRUE;
+}
+
+static void mock_register_device(TMockDevice *dev,
+                                 TDS_SuplaRegisterDevice_C *reg) {
+  reg->Name[SUPLA_DEVICE_NAME_MAXSIZE - 1] = 0;
+  reg->SoftVer[SUPLA_SOFTVER_MAXSIZE - 1] = 0;
+
+  if (verbose) {
+    printf("register: name=\"%s\" softver=\"%s\" location=%i channels=%u\n",
+           reg->Name, reg->SoftVer, reg->LocationID, reg->channel_count);
+  }
+
+  dev->relay_channel = -1;
+  for (int a = 0; a < reg->channel_count; a++) {
+    TDS_SuplaDeviceChannel_B *ch = &reg->channels[a];
+    mock_register_channel(dev, ch->Number, ch->Type, ch->FuncList, ch->Default,
+                          ch->value, 0);
+  }
+
+  mock_register_result(dev);
+}
+
+static void mock_register_device_g(TMockDevice *dev,
+                                   TDS_SuplaRegisterDevice_G *reg) {
+  reg->Email[SUPLA_EMAIL_MAXSIZE - 1] = 0;
+  reg->Name[SUPLA_DEVICE_NAME_MAXSIZE - 1] = 0;
+  reg->SoftVer[SUPLA_SOFTVER_MAXSIZE - 1] = 0;
+
+  if (verbose) {
+    printf("register G: name=\"%s\" softver=\"%s\" email=%s channels=%u\n",
+           reg->Name, reg->SoftVer, reg->Email, reg->channel_count);
+  }
+
+  dev->relay_channel = -1;
+  for (int a = 0; a < reg->channel_count; a++) {
+    TDS_SuplaDeviceChannel_E *ch = &reg->channels[a];
+    mock_register_channel(dev, ch->Number, ch->Type, ch->FuncList, ch->Default,
+                          ch->value, ch->Offline);
+  }
+
+  mock_register_result_b(dev, reg->channel_count);
+}
+
+static void mock_value_changed(TMockDevice *dev, unsigned char number,
+                               const char *value, int offline) {
+  if ((int)number == dev->relay_channel) {
+    dev->relay_state = value[0];
+  }
+
+  if (!verbose) return;
+
+  switch (dev->channel_type[number]) {
+    case SUPLA_CHANNELTYPE_THERMOMETER:
+    case SUPLA_CHANNELTYPE_PRESSURESENSOR:
+    case SUPLA_CHANNELTYPE_WINDSENSOR:
+    case SUPLA_CHANNELTYPE_RAINSENSOR:
+    case SUPLA_CHANNELTYPE_WEIGHTSENSOR:
+    case SUPLA_CHANNELTYPE_DISTANCESENSOR:
+    case SUPLA_CHANNELTYPE_GENERAL_PURPOSE_MEASUREMENT: {
+      double v;
+      memcpy(&v, value, sizeof(v));
+      printf("value: channel %u = %.2f%s\n", number, v,
+             offline ? " offline" : "");
+      return;
+    }
+    case SUPLA_CHANNELTYPE_HUMIDITYSENSOR:
+    case SUPLA_CHANNELTYPE_HUMIDITYANDTEMPSENSOR: {
+      _supla_int_t t, h;
+      memcpy(&t, value, sizeof(t));
+      memcpy(&h, value + sizeof(t), sizeof(h));
+      printf("value: channel %u = %.3f C %.3f %%%s\n", number, t / 1000.0,
+             h / 1000.0, offline ? " offline" : "");
+      return;
+    }
+  }
+
+  printf("value: channel %u =", number);
+  for (int a = 0; a < SUPLA_CHANNELVALUE_SIZE; a++) {
+    printf(" %02X", (unsigned char)value[a]);
+  }
+  printf("%s\n", offline ? " offline" : "");
+}
+
+static void mock_set_value_result(TMockDevice *dev,
+                                  TDS_SuplaChannelNewValueResult *result) {
+  if (result->SenderID != dev->sender_id || dev->set_value_sent_us == 0) {
+    printf("set value result: channel %u sender %i success %i (unexpected)\n",
+           result->ChannelNumber, result->SenderID, result->Success);
+    return;
+  }
+
+  double rtt_ms = (now_us() - dev->set_value_sent_us) / 1000.0;
+  dev->set_value_sent_us = 0;
+
+  if (result->Success) {
+    dev->relay_state = dev->relay_requested;
+  }
+
+  if (dev->rtt_count == 0 || rtt_ms < dev->rtt_min_ms) dev->rtt_min_ms = rtt_ms;
+  if (rtt_ms > dev->rtt_max_ms) dev->rtt_max_ms = rtt_ms;
+  dev->rtt_sum_ms += rtt_ms;
+  dev->rtt_count++;
+
+  if (verbose) {
+    printf("set value result: channel %u success %i rtt %.3f ms\n",
+           result->ChannelNumber, result->Success, rtt_ms);
+  }
+}
+
+static void mock_on_remote_call_received(void *_srpc, unsigned _supla_int_t rr_id,
+                                         unsigned _supla_int_t call_id,
+                                         void *user_params,
+                                         unsigned char proto_version) {
+  (void)rr_id;
+  TMockDevice *dev = (TMockDevice *)user_params;
+  TsrpcReceivedData rd;
+
+  if (srpc_getdata(_srpc, &rd, 0) != SUPLA_RESULT_TRUE) {
+    printf("call %u: getdata failed\n", call_id);
+    return;
+  }
+
+  srpc_set_proto_version(_srpc, proto_version);
+
+  switch (rd.call_id) {
+    case SUPLA_DCS_CALL_GETVERSION: {
+      char softver[SUPLA_SOFTVER_MAXSIZE] = "mock";
+      srpc_sdc_async_getversion_result(_srpc, softver);
+    } break;
+    case SUPLA_DCS_CALL_PING_SERVER:
+      if (answer_pings) srpc_sdc_async_ping_server_result(_srpc);
+      break;
+    case SUPLA_DCS_CALL_SET_ACTIVITY_TIMEOUT:
+      if (rd.data.dcs_set_activity_timeout) {
+        TSDC_SuplaSetActivityTimeoutResult result;
+        unsigned char requested =
+            rd.data.dcs_set_activity_timeout->activity_timeout;
+        result.min = MOCK_ACTIVITY_TIMEOUT_MIN;
+        result.max = MOCK_ACTIVITY_TIMEOUT_MAX;
+        result.activity_timeout = requested < result.min   ? result.min
+                                  : requested > result.max ? result.max
+                                                           : requested;
+        dev->activity_timeout = result.activity_timeout;
+        srpc_dcs_async_set_activity_timeout_result(_srpc, &result);
+        if (verbose) {
+          printf("activity timeout: requested %u s, set %u s\n", requested,
+                 dev->activity_timeout);
+        }
+      }
+      break;
+    case SUPLA_DS_CALL_REGISTER_DEVICE_C:
+      if (rd.data.ds_register_device_c) {
+        mock_register_device(dev, rd.data.ds_register_device_c);
+      }
+      break;
+    case SUPLA_DS_CALL_REGISTER_DEVICE_G:
+      if (rd.data.ds_register_device_g) {
+        mock_register_device_g(dev, rd.data.ds_register_device_g);
+      }
+      break;
+    case SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED:
+      if (rd.data.ds_device_channel_value) {
+        mock_value_changed(dev, rd.data.ds_device_channel_value->ChannelNumber,
+                           rd.data.ds_device_channel_value->value, 0);
+      }
+      break;
+    case SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED_C:
+      if (rd.data.ds_device_channel_value_c) {
+        mock_value_changed(dev, rd.data.ds_device_channel_value_c->ChannelNumber,
+                           rd.data.ds_device_channel_value_c->value,
+                           rd.data.ds_device_channel_value_c->Offline);
+      }
+      break;
+    case SUPLA_DS_CALL_CHANNEL_SET_VALUE_RESULT:
+      if (rd.data.ds_channel_new_value_result) {
+        mock_set_value_result(dev, rd.data.ds_channel_new_value_result);
+      }
+      break;
+    default:
+      printf("call %u: not handled by the mock\n", rd.call_id);
+      break;
+  }
+
+  srpc_rd_free(&rd);
+  if (verbose) fflush(stdout);
+}
+
+static void mock_toggle_relay(TMockDevice *dev) {
+  TSD_SuplaChannelNewValue value;
+  memset(&value, 0, sizeof(value));
+
+  value.SenderID = ++dev->sender_id;
+  value.ChannelNumber = (unsigned char)dev->relay_channel;
+  value.value[0] = dev->relay_state ? 0 : 1;
+  dev->relay_requested = value.value[0];
+
+  dev->set_value_sent_us = now_us();
+  dev->toggled_us = dev->set_value_sent_us;
+  dev->toggles++;
+  srpc_sd_async_set_channel_value(dev->srpc, &value);
+}
+
+static int mock_listen(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+
+  int flag = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons((unsigned short)port);
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  return fd;
+}
+
+static void mock_accept(int fd) {
+  TMockDevice *dev = calloc(1, sizeof(TMockDevice));
+  if (dev == NULL || (device_count == device_capacity &&
+                      (devices = realloc(devices, (device_capacity + 64) *
+                                                      sizeof(TMockDevice *))) ==
+                          NULL)) {
+    free(dev);
+    close(fd);
+    return;
+  }
+
+  if (device_count == device_capacity) device_capacity += 64;
+
+  dev->fd = fd;
+  dev->relay_channel = -1;
+  dev->activity_us = now_us();
+  dev->toggled_us = dev->activity_us;
+  dev->activity_timeout = MOCK_ACTIVITY_TIMEOUT;
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  int flag = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+  TsrpcParams params;
+  srpc_params_init(&params);
+  params.data_read = mock_data_read;
+  params.data_write = mock_data_write;
+  params.on_remote_call_received = mock_on_remote_call_received;
+  params.user_params = dev;
+
+  dev->srpc = srpc_init(&params);
+
+  // Edge-triggered: srpc_iterate_batch() reads until EAGAIN, and a socket
+  // that was full gets another wakeup once it drains
+  if (dev->srpc == NULL ||
+      !eh_add_fd_ex(eh, fd, EH_READ | EH_WRITE | EH_EDGE_TRIGGERED, dev)) {
+    srpc_free(dev->srpc);
+    free(dev);
+    close(fd);
+    return;
+  }
+
+  dev->index = device_count;
+  devices[device_count++] = dev;
+
+  if (verbose) {
+    printf("device connected\n");
+    fflush(stdout);
+  }
+}
+
+static void mock_disconnect(TMockDevice *dev, const char *reason) {
+  total_devices++;
+  total_rtt_count += dev->rtt_count;
+  total_rtt_sum_ms += dev->rtt_sum_ms;
+  if (dev->rtt_max_ms > total_rtt_max_ms) total_rtt_max_ms = dev->rtt_max_ms;
+
+  if (verbose && dev->rtt_count) {
+    printf("set value rtt: n=%u min %.3f ms avg %.3f ms max %.3f ms\n",
+           dev->rtt_count, dev->rtt_min_ms, dev->rtt_sum_ms / dev->rtt_count,
+           dev->rtt_max_ms);
+  }
+  if (verbose) {
+    printf("device disconnected%s\n", reason);
+    fflush(stdout);
+  }
+
+  eh_del_fd(eh, dev->fd, dev);
+  srpc_free(dev->srpc);
+  close(dev->fd);
+
+  devices[dev->index] = devices[--device_count];
+  devices[dev->index]->index = dev->index;
+  free(dev);
+}
+
+static void mock_iterate(TMockDevice *dev) {
+  if (!srpc_iterate_batch(dev->srpc) || dev->closed) {
+    mock_disconnect(dev, "");
+  }
+}
+
+// A tenth of the toggle period keeps the toggles close to it
+static int mock_tick_ms(unsigned toggle_ms) {
+  unsigned ms = toggle_ms / 10;
+  return ms < 5 ? 5 : ms > MOCK_TIMER_MS ? MOCK_TIMER_MS : (int)ms;
+}
+
+// Timer tick: relay toggles and the activity timeout for every device
+static void mock_tick(unsigned toggle_ms, unsigned toggle_count) {
+  unsigned long long now = now_us();
+
+  for (int a = device_count - 1; a >= 0; a--) {
+    TMockDevice *dev = devices[a];
+
+    if (now - dev->activity_us > (dev->activity_timeout + 10) * 1000000ULL) {
+      mock_disconnect(dev, " (activity timeout)");
+      continue;
+    }
+
+    if (toggle_ms && dev->registered && dev->relay_channel >= 0 &&
+        dev->set_value_sent_us == 0 &&
+        (toggle_count == 0 || dev->toggles < toggle_count) &&
+        now - dev->toggled_us >= toggle_ms * 1000ULL) {
+      mock_toggle_relay(dev);
+      mock_iterate(dev);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  int port = 2015;
+  unsigned toggle_ms = 0;
+  unsigned toggle_count = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:t:n:r:Pqh")) != -1) {
+    switch (opt) {
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 't':
+        toggle_ms = (unsigned)strtoul(optarg, NULL, 10);
+        break;
+      case 'n':
+        toggle_count = (unsigned)strtoul(optarg, NULL, 10);
+        break;
+      case 'r':
+        register_result_code = atoi(optarg);
+        break;
+      case 'P':
+        answer_pings = 0;
+        break;
+      case 'q':
+        verbose = 0;
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-p port] [-t toggle_ms] [-n toggle_count] "
+                "[-r result_code] [-P] [-q]\n",
+                argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  int listen_fd = mock_listen(port);
+  if (listen_fd < 0) {
+    perror("listen");
+    return 1;
+  }
+
+  eh = eh_init();
+  if (eh == NULL || !eh_add_fd_ex(eh, listen_fd, EH_READ, &listen_fd) ||
+      !eh_set_timer(eh, toggle_ms ? mock_tick_ms(toggle_ms) : MOCK_TIMER_MS)) {
+    perror("eh_init");
+    return 1;
+  }
+
+  printf("mock SUPLA server listening on port %i\n", port);
+  fflush(stdout);
+
+  while (running) {
+    if (eh_wait(eh, -1) < 0) break;
+
+    for (int a = 0; a < eh->ready_count; a++) {
+      void *ready = eh_get_ready(eh, a, NULL);
+
+      if (ready == &listen_fd) {
+        int fd;
+        while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+          mock_accept(fd);
+        }
+      } else if (ready != NULL) {
+        mock_iterate((TMockDevice *)ready);
+      }
+    }
+
+    if (eh->timer_expirations) {
+      mock_tick(toggle_ms, toggle_count);
+    }
+  }
+
+  while (device_count > 0) {
+    mock_disconnect(devices[device_count - 1], "");
+  }
+
+  if (!verbose) {
+    printf("devices %llu, set value rtt: n=%llu avg %.3f ms max %.3f ms\n",
+           total_devices, total_rtt_count,
+           total_rtt_count ? total_rtt_sum_ms / total_rtt_count : 0.0,
+           total_rtt_max_ms);
+  }
+
+  free(devices);
+  eh_free(eh);
+  close(listen_fd);
+  return 0;
+}
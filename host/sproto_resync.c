@@ -0,0 +1,347 @@
+/*
+ Tag scan benchmark and recovery-rate check for sproto resynchronization.
+
+ -b measures sproto_find_tag() in MB/s over a buffer with no tag in it (the
+ whole buffer has to be scanned) next to a bytewise memcmp() scan.
+
+ Otherwise a stream of frames, recorded with -f or generated, is corrupted
+ at the given rate (replaced, dropped and inserted bytes, in equal parts)
+ and fed to sproto in random-sized chunks. A frame counts as recovered when
+ it comes out of sproto_pop_in_sdp() byte-identical; the recovery rate is
+ taken against the frames the corruption did not touch. Build with
+ -DSPROTO_RESYNC=OFF to compare with the discard-everything behaviour.
+ With -t the exit status is 1 when the recovery rate is below the given
+ percentage (ctest runs it that way).
+
+   sproto_resync -b [-m MB]
+   sproto_resync [-f stream] [-w stream] [-n frames] [-e errors_per_mille]
+                 [-s seed] [-t min_recovery_percent]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "proto.h"
+
+#define FRAME_HEADER_SIZE (sizeof(TSuplaDataPacket) - SUPLA_MAX_DATA_SIZE)
+
+static unsigned int rnd_state = 1;
+
+static unsigned int rnd(void) {
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static unsigned _supla_int_t bytewise_find_tag(const char *data,
+                                               unsigned _supla_int_t size) {
+  for (unsigned _supla_int_t i = 0; i < size; i++) {
+    unsigned _supla_int_t n = size - i < SUPLA_TAG_SIZE ? size - i
+                                                        : SUPLA_TAG_SIZE;
+    if (memcmp(&data[i], sproto_tag, n) == 0) return i;
+  }
+  return size;
+}
+
+static int benchmark(unsigned mb) {
+  const size_t size = 1024 * 1024;
+  char *buf = malloc(size);
+  if (buf == NULL) return 1;
+
+  // Plenty of 'S' and 'SU' so that the candidate checks are exercised
+  for (size_t i = 0; i < size; i++) {
+    unsigned int r = rnd() % 16;
+    buf[i] = r == 0 ? 'S' : r == 1 ? 'U' : (char)(rnd() & 0x7F);
+    if (buf[i] == 'A') buf[i] = 'a';
+  }
+
+  struct {
+    const char *name;
+    unsigned _supla_int_t (*find)(const char *, unsigned _supla_int_t);
+  } scans[] = {{"sproto_find_tag", sproto_find_tag},
+               {"bytewise", bytewise_find_tag}};
+
+  for (size_t s = 0; s < sizeof(scans) / sizeof(scans[0]); s++) {
+    volatile unsigned _supla_int_t sink = 0;
+    double t0 = now_s();
+    for (unsigned i = 0; i < mb; i++) {
+      sink += scans[s].find(buf, size);
+    }
+    double elapsed = now_s() - t0;
+    (void)sink;
+    printf("%-16s %8.1f MB/s\n", scans[s].name, mb / elapsed);
+  }
+
+  free(buf);
+  return 0;
+}
+
+static size_t generate(char *stream, size_t capacity, unsigned frames) {
+  void *spd = sproto_init();
+  TSuplaDataPacket sdp;
+  char payload[256];
+  size_t len = 0;
+
+  for (unsigned f = 0; f < frames; f++) {
+    unsigned size = rnd() % sizeof(payload);
+    for (unsigned i = 0; i < size; i++) payload[i] = (char)rnd();
+    // Some payloads carry a tag of their own
+    if (f % 5 == 0 && size >= SUPLA_TAG_SIZE) {
+      memcpy(&payload[rnd() % (size - SUPLA_TAG_SIZE + 1)], sproto_tag,
+             SUPLA_TAG_SIZE);
+    }
+
+    sproto_sdp_init(spd, &sdp);
+    sproto_set_data(&sdp, payload, size, SUPLA_SD_CALL_CHANNEL_SET_VALUE);
+
+    size_t frame_size = FRAME_HEADER_SIZE + size;
+    if (len + frame_size + SUPLA_TAG_SIZE > capacity) break;
+    memcpy(&stream[len], &sdp, frame_size);
+    len += frame_size;
+    memcpy(&stream[len], sproto_tag, SUPLA_TAG_SIZE);
+    len += SUPLA_TAG_SIZE;
+  }
+
+  sproto_free(spd);
+  return len;
+}
+
+// Frame boundaries of a clean stream; returns the number of frames
+static unsigned index_frames(const char *stream, size_t len, size_t *offsets,
+                             unsigned max) {
+  unsigned n = 0;
+  size_t off = 0;
+
+  while (n < max && off + FRAME_HEADER_SIZE + SUPLA_TAG_SIZE <= len) {
+    TSuplaDataPacket header;
+    memcpy(&header, &stream[off], FRAME_HEADER_SIZE);
+    if (memcmp(header.tag, sproto_tag, SUPLA_TAG_SIZE) != 0 ||
+        header.data_size > SUPLA_MAX_DATA_SIZE) {
+      break;
+    }
+    offsets[n++] = off;
+    off += FRAME_HEADER_SIZE + header.data_size + SUPLA_TAG_SIZE;
+  }
+
+  offsets[n] = off;
+  return n;
+}
+
+static unsigned frame_at(const size_t *offsets, unsigned frames, size_t pos) {
+  unsigned lo = 0, hi = frames;
+  while (lo + 1 < hi) {
+    unsigned mid = (lo + hi) / 2;
+    if (offsets[mid] <= pos) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static int frame_equals(const char *stream, const size_t *offsets, unsigned n,
+                        const TSuplaDataPacket *sdp, size_t size) {
+  return offsets[n + 1] - offsets[n] == size + SUPLA_TAG_SIZE &&
+         memcmp(&stream[offsets[n]], sdp, size) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *in_file = NULL;
+  const char *out_file = NULL;
+  unsigned frames = 20000;
+  unsigned per_mille = 1;
+  unsigned mb = 256;
+  double min_recovery = 0;
+  int bench = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "bm:f:w:n:e:s:t:")) != -1) {
+    switch (opt) {
+      case 'b':
+        bench = 1;
+        break;
+      case 'm':
+        mb = atoi(optarg);
+        break;
+      case 'f':
+        in_file = optarg;
+        break;
+      case 'w':
+        out_file = optarg;
+        break;
+      case 'n':
+        frames = atoi(optarg);
+        break;
+      case 'e':
+        per_mille = atoi(optarg);
+        break;
+      case 's':
+        rnd_state = atoi(optarg) | 1;
+        break;
+      case 't':
+        min_recovery = atof(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s -b [-m MB]\n"
+                "       %s [-f stream] [-w stream] [-n frames] "
+                "[-e errors_per_mille] [-s seed] [-t min_recovery_percent]\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+  }
+
+  if (bench) return benchmark(mb);
+
+  size_t capacity = (size_t)frames * (FRAME_HEADER_SIZE + 256 + SUPLA_TAG_SIZE);
+  size_t len = 0;
+  char *stream;
+
+  if (in_file) {
+    FILE *f = fopen(in_file, "rb");
+    if (f == NULL) {
+      perror(in_file);
+      return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    capacity = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    stream = malloc(capacity ? capacity : 1);
+    len = fread(stream, 1, capacity, f);
+    fclose(f);
+    frames = len / (FRAME_HEADER_SIZE + SUPLA_TAG_SIZE);
+  } else {
+    stream = malloc(capacity);
+    len = generate(stream, capacity, frames);
+  }
+
+  if (out_file) {
+    FILE *f = fopen(out_file, "wb");
+    if (f == NULL || fwrite(stream, 1, len, f) != len) {
+      perror(out_file);
+      return 1;
+    }
+    fclose(f);
+  }
+
+  size_t *offsets = malloc((frames + 1) * sizeof(size_t));
+  unsigned char *touched = calloc(frames + 1, 1);
+  unsigned char *seen = calloc(frames + 1, 1);
+  char *corrupted = malloc(len * 2 + 1);
+
+  frames = index_frames(stream, len, offsets, frames);
+  if (frames == 0) {
+    fprintf(stderr, "no frames in stream\n");
+    return 1;
+  }
+
+  size_t corrupted_len = 0;
+  unsigned errors = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (rnd() % 1000 < per_mille) {
+      errors++;
+      touched[frame_at(offsets, frames, i)] = 1;
+      switch (rnd() % 3) {
+        case 0:
+          corrupted[corrupted_len++] = (char)(stream[i] ^ (1 + rnd() % 255));
+          continue;
+        case 1:
+          continue;
+        case 2:
+          corrupted[corrupted_len++] = (char)rnd();
+          break;
+      }
+    }
+    corrupted[corrupted_len++] = stream[i];
+  }
+
+  void *spd = sproto_init();
+  TSuplaDataPacket sdp;
+  unsigned delivered = 0, recovered = 0, damaged = 0, errors_reported = 0;
+
+  for (size_t pos = 0; pos < corrupted_len;) {
+    size_t chunk = 1 + rnd() % 512;
+    if (chunk > corrupted_len - pos) chunk = corrupted_len - pos;
+
+    if (sproto_in_buffer_append(spd, &corrupted[pos], chunk) !=
+        SUPLA_RESULT_TRUE) {
+      fprintf(stderr, "sproto_in_buffer_append failed at %zu\n", pos);
+      return 1;
+    }
+    pos += chunk;
+
+    char result;
+    while ((result = sproto_pop_in_sdp(spd, &sdp)) != SUPLA_RESULT_FALSE) {
+      if (result != SUPLA_RESULT_TRUE) {
+        errors_reported++;
+        continue;
+      }
+
+      delivered++;
+      size_t size = FRAME_HEADER_SIZE + sdp.data_size;
+      // Recorded rr_ids are usually sequential; when that guess fails the
+      // frame is looked up by content
+      unsigned n = sdp.rr_id - 1;
+      if (n >= frames || !frame_equals(stream, offsets, n, &sdp, size)) {
+        for (n = 0; n < frames; n++) {
+          if (!seen[n] && frame_equals(stream, offsets, n, &sdp, size)) break;
+        }
+      }
+      if (n < frames) {
+        seen[n] = 1;
+        recovered++;
+      } else {
+        damaged++;
+      }
+    }
+  }
+
+  unsigned untouched = 0, untouched_recovered = 0;
+  for (unsigned n = 0; n < frames; n++) {
+    if (!touched[n]) {
+      untouched++;
+      if (seen[n]) untouched_recovered++;
+    }
+  }
+
+#ifndef SPROTO_WITHOUT_RESYNC
+  TSuplaProtoResyncStats stats;
+  sproto_get_resync_stats(spd, &stats);
+  printf("resync on: %u resyncs, %u bytes discarded\n", stats.count,
+         stats.discarded);
+#else
+  printf("resync off\n");
+#endif /*SPROTO_WITHOUT_RESYNC*/
+  printf("frames %u, bytes %zu, corrupted bytes %u (%u per mille)\n", frames,
+         len, errors, per_mille);
+  printf("delivered %u, intact %u, damaged %u, errors reported %u\n",
+         delivered, recovered, damaged, errors_reported);
+  double recovery = untouched ? 100.0 * untouched_recovered / untouched : 0.0;
+  printf("untouched frames %u, recovered %u (%.2f%%)\n", untouched,
+         untouched_recovered, recovery);
+
+  sproto_free(spd);
+  free(corrupted);
+  free(seen);
+  free(touched);
+  free(offsets);
+  free(stream);
+
+  if (recovery < min_recovery) {
+    fprintf(stderr, "recovery %.2f%% below %.2f%%\n", recovery, min_recovery);
+    return 1;
+  }
+
+  return 0;
+}
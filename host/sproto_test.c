@@ -0,0 +1,545 @@
+/*
+ sproto input framing test, run by ctest.
+
+ Streams of frames are fed to sproto in every chunk size from 1 byte up and
+ drained both with sproto_pop_in_sdp() (the copying path) and with
+ sproto_peek_in_sdp()/sproto_consume_in_sdp(). Every frame has to come out
+ byte-identical to what was sent, in order, through both paths.
+
+ Built against the ring buffer backend (sproto_ring_test) it also puts the
+ ring head at every offset before a frame, so that the header, the payload
+ and either tag wrap around the end of the ring, and checks the same way
+ that the frame comes out intact.
+
+ Unless built with SPROTO_WITHOUT_RESYNC, streams with one damaged frame
+ (junk before it, a broken opening or closing tag, a wrong data_size) have
+ to lose that frame only, and the resync counters have to move.
+
+ Exits with 0 when every check passes, 1 otherwise.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "proto.h"
+
+#define FRAME_HEADER_SIZE (sizeof(TSuplaDataPacket) - SUPLA_MAX_DATA_SIZE)
+#define STREAM_MAX_SIZE 16384
+
+#define CHECK(COND)                                                     \
+  do {                                                                  \
+    if (!(COND)) {                                                      \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #COND); \
+      failures++;                                                       \
+      return;                                                           \
+    }                                                                   \
+  } while (0)
+
+typedef struct {
+  char data[STREAM_MAX_SIZE];
+  size_t size;
+  unsigned count;  // frames in data
+} TStream;
+
+static unsigned failures;
+
+// Appends a frame (header, payload, closing tag) to stream
+static void add_frame(TStream *stream, unsigned _supla_int_t rr_id,
+                      unsigned _supla_int_t call_id,
+                      unsigned _supla_int_t data_size) {
+  TSuplaDataPacket sdp;
+
+  memset(&sdp, 0, sizeof(sdp));
+  memcpy(sdp.tag, sproto_tag, SUPLA_TAG_SIZE);
+  sdp.version = SUPLA_PROTO_VERSION;
+  sdp.rr_id = rr_id;
+  sdp.call_id = call_id;
+  sdp.data_size = data_size;
+
+  // Lowercase only, so a payload never contains a tag
+  for (unsigned _supla_int_t i = 0; i < data_size; i++) {
+    sdp.data[i] = (char)('a' + (rr_id + i * 7) % 26);
+  }
+
+  memcpy(&stream->data[stream->size], &sdp, FRAME_HEADER_SIZE + data_size);
+  stream->size += FRAME_HEADER_SIZE + data_size;
+  memcpy(&stream->data[stream->size], sproto_tag, SUPLA_TAG_SIZE);
+  stream->size += SUPLA_TAG_SIZE;
+  stream->count++;
+}
+
+// Pops every complete frame, appending it to out as it was on the wire.
+// Returns the number of results other than SUPLA_RESULT_TRUE/FALSE.
+static unsigned drain(void *spd, unsigned char peek, TStream *out) {
+  TSuplaDataPacket sdp;
+  TSuplaDataPacket *view;
+  unsigned errors = 0;
+  char result;
+
+  for (;;) {
+    if (peek) {
+      result = sproto_peek_in_sdp(spd, &view, NULL);
+    } else {
+      result = sproto_pop_in_sdp(spd, &sdp);
+      view = &sdp;
+    }
+
+    if (result == SUPLA_RESULT_FALSE) break;
+
+    if (result != SUPLA_RESULT_TRUE) {
+      errors++;
+      continue;
+    }
+
+    size_t size = FRAME_HEADER_SIZE + view->data_size;
+    if (out->size + size + SUPLA_TAG_SIZE <= STREAM_MAX_SIZE) {
+      memcpy(&out->data[out->size], view, size);
+      memcpy(&out->data[out->size + size], sproto_tag, SUPLA_TAG_SIZE);
+    }
+    out->size += size + SUPLA_TAG_SIZE;
+    out->count++;
+
+    if (peek) sproto_consume_in_sdp(spd);
+  }
+
+  return errors;
+}
+
+// Feeds stream[from..] in chunks of the given size, draining after each one
+static unsigned feed(void *spd, const TStream *stream, size_t from,
+                     size_t chunk, unsigned char peek, TStream *out) {
+  unsigned errors = 0;
+
+  for (size_t pos = from; pos < stream->size; pos += chunk) {
+    size_t size = stream->size - pos < chunk ? stream->size - pos : chunk;
+
+    if (sproto_in_buffer_append(spd, (char *)&stream->data[pos], size) !=
+        SUPLA_RESULT_TRUE) {
+      return errors + 1;
+    }
+
+    errors += drain(spd, peek, out);
+  }
+
+  return errors;
+}
+
+// A peeked frame stays in the buffer until consumed and peeking again
+// returns the same frame
+static void test_peek_consume(void) {
+  static TStream stream;
+  TSuplaDataPacket *first;
+  TSuplaDataPacket *again;
+  TSuplaDataPacket sdp;
+
+  memset(&stream, 0, sizeof(stream));
+  add_frame(&stream, 1, SUPLA_SD_CALL_CHANNEL_SET_VALUE, 10);
+  add_frame(&stream, 2, SUPLA_SD_CALL_CHANNEL_SET_VALUE, 20);
+
+  void *spd = sproto_init();
+  CHECK(spd != NULL);
+  CHECK(sproto_in_buffer_append(spd, stream.data, stream.size) ==
+        SUPLA_RESULT_TRUE);
+
+  CHECK(sproto_peek_in_sdp(spd, &first, NULL) == SUPLA_RESULT_TRUE);
+  CHECK(first->rr_id == 1);
+  CHECK(sproto_peek_in_sdp(spd, &again, NULL) == SUPLA_RESULT_TRUE);
+  CHECK(again->rr_id == 1);
+  CHECK(memcmp(again, stream.data, FRAME_HEADER_SIZE + 10) == 0);
+
+  sproto_consume_in_sdp(spd);
+  // Consuming twice must not drop the next frame
+  sproto_consume_in_sdp(spd);
+
+  CHECK(sproto_pop_in_sdp(spd, &sdp) == SUPLA_RESULT_TRUE);
+  CHECK(sdp.rr_id == 2);
+  CHECK(memcmp(&sdp, &stream.data[FRAME_HEADER_SIZE + 10 + SUPLA_TAG_SIZE],
+               FRAME_HEADER_SIZE + 20) == 0);
+  CHECK(sproto_in_dataexists(spd) == SUPLA_RESULT_FALSE);
+  CHECK(sproto_peek_in_sdp(spd, &first, NULL) == SUPLA_RESULT_FALSE);
+
+  sproto_free(spd);
+}
+
+#if defined(SPROTO_RING_BUFFER) && defined(SPROTO_RING_BUFFER_SIZE)
+#define MIN_FRAME_SIZE (FRAME_HEADER_SIZE + SUPLA_TAG_SIZE)
+
+// Appends filler frames that add up to offset (modulo the ring size) and
+// stores where each one ends
+static unsigned add_fillers(TStream *stream, unsigned _supla_int_t offset,
+                            size_t *ends) {
+  unsigned _supla_int_t lengths[2];
+  unsigned count = 0;
+
+  if (offset > MIN_FRAME_SIZE + SUPLA_MAX_DATA_SIZE) {
+    lengths[count++] = offset / 2;
+    lengths[count++] = offset - offset / 2;
+  } else if (offset >= MIN_FRAME_SIZE) {
+    lengths[count++] = offset;
+  } else if (offset > 0) {
+    lengths[count++] = SPROTO_RING_BUFFER_SIZE / 2;
+    lengths[count++] = SPROTO_RING_BUFFER_SIZE / 2 + offset;
+  }
+
+  for (unsigned a = 0; a < count; a++) {
+    add_frame(stream, 1000 + a, SUPLA_SD_CALL_CHANNEL_SET_VALUE,
+              lengths[a] - MIN_FRAME_SIZE);
+    ends[a] = stream->size;
+  }
+
+  return count;
+}
+
+// Pops the fillers, each one with the first byte after it already in the
+// ring: the ring never runs empty (which would rewind the head to 0), so the
+// head ends up at the offset the fillers add up to. Returns the position in
+// stream to continue from, 0 on failure.
+static size_t rotate(void *spd, const TStream *stream, const size_t *ends,
+                     unsigned count) {
+  TSuplaDataPacket sdp;
+  size_t pos = 0;
+
+  for (unsigned a = 0; a < count; a++) {
+    if (sproto_in_buffer_append(spd, (char *)&stream->data[pos],
+                                ends[a] + 1 - pos) != SUPLA_RESULT_TRUE ||
+        sproto_pop_in_sdp(spd, &sdp) != SUPLA_RESULT_TRUE ||
+        sdp.rr_id != 1000 + a) {
+      return 0;
+    }
+    pos = ends[a] + 1;
+  }
+
+  return pos;
+}
+
+#endif /*SPROTO_RING_BUFFER*/
+
+// Builds the frames to send into stream and what has to come out of sproto
+// into expected
+typedef void (*_func_build)(TStream *stream, TStream *expected,
+                            unsigned _supla_int_t arg);
+
+// Sends the frames from build in chunks, starting at the given ring offset
+// (always 0 without a ring)
+static void run_at(unsigned _supla_int_t offset, _func_build build,
+                   unsigned _supla_int_t arg, size_t chunk,
+                   unsigned char peek) {
+  static TStream stream, expected, out;
+  size_t pos = 0;
+  unsigned count = 0;
+
+  memset(&stream, 0, sizeof(stream));
+  memset(&expected, 0, sizeof(expected));
+#if defined(SPROTO_RING_BUFFER) && defined(SPROTO_RING_BUFFER_SIZE)
+  size_t ends[2];
+  count = add_fillers(&stream, offset, ends);
+#endif /*SPROTO_RING_BUFFER*/
+  build(&stream, &expected, arg);
+
+  void *spd = sproto_init();
+  CHECK(spd != NULL);
+
+#if defined(SPROTO_RING_BUFFER) && defined(SPROTO_RING_BUFFER_SIZE)
+  if (count > 0) {
+    pos = rotate(spd, &stream, ends, count);
+  }
+#endif /*SPROTO_RING_BUFFER*/
+
+  // rotate() leaves the first byte of the frames in the ring, feed() goes
+  // on from the next one
+  memset(&out, 0, sizeof(out));
+  unsigned errors = pos > 0 || count == 0
+                        ? feed(spd, &stream, pos, chunk, peek, &out)
+                        : 1;
+  char left = sproto_in_dataexists(spd);
+  sproto_free(spd);
+
+  if (errors || left != SUPLA_RESULT_FALSE || out.count != expected.count ||
+      out.size != expected.size ||
+      memcmp(out.data, expected.data, out.size) != 0) {
+    fprintf(stderr, "offset %u, arg %u, chunk %zu, %s: ", (unsigned)offset,
+            (unsigned)arg, chunk, peek ? "peek" : "pop");
+  }
+
+  CHECK(errors == 0);
+  CHECK(left == SUPLA_RESULT_FALSE);
+  CHECK(out.count == expected.count);
+  CHECK(out.size == expected.size);
+  CHECK(memcmp(out.data, expected.data, out.size) == 0);
+}
+
+// Frames of every size class, split at every possible chunk boundary
+static void build_sizes(TStream *stream, TStream *expected,
+                        unsigned _supla_int_t arg) {
+  static const unsigned _supla_int_t sizes[] = {0, 1, 8, 100, 1000,
+                                                SUPLA_MAX_DATA_SIZE};
+  (void)arg;
+
+  for (unsigned a = 0; a < sizeof(sizes) / sizeof(sizes[0]); a++) {
+    add_frame(expected, a + 1, SUPLA_SD_CALL_CHANNEL_SET_VALUE, sizes[a]);
+  }
+
+  memcpy(&stream->data[stream->size], expected->data, expected->size);
+  stream->size += expected->size;
+  stream->count += expected->count;
+}
+
+static void test_chunks(unsigned char peek) {
+  for (size_t chunk = 1; chunk <= 256; chunk++) {
+    unsigned before = failures;
+    run_at(0, build_sizes, 0, chunk, peek);
+    if (failures != before) return;
+  }
+}
+
+#if defined(SPROTO_RING_BUFFER) && defined(SPROTO_RING_BUFFER_SIZE)
+// Two frames, the first one data_size long
+static void build_pair(TStream *stream, TStream *expected,
+                       unsigned _supla_int_t data_size) {
+  add_frame(expected, 1, SUPLA_SD_CALL_CHANNEL_SET_VALUE, data_size);
+  add_frame(expected, 2, SUPLA_SD_CALL_CHANNEL_SET_VALUE, 8);
+
+  memcpy(&stream->data[stream->size], expected->data, expected->size);
+  stream->size += expected->size;
+  stream->count += expected->count;
+}
+
+// Frames starting at every offset of the ring
+static void test_wraparound(unsigned char peek) {
+  static const unsigned _supla_int_t sizes[] = {0, 1, 100,
+                                                SUPLA_MAX_DATA_SIZE};
+  static const size_t chunks[] = {1, 61, STREAM_MAX_SIZE};
+
+  for (unsigned _supla_int_t offset = 0; offset < SPROTO_RING_BUFFER_SIZE;
+       offset++) {
+    for (unsigned a = 0; a < sizeof(sizes) / sizeof(sizes[0]); a++) {
+      for (unsigned b = 0; b < sizeof(chunks) / sizeof(chunks[0]); b++) {
+        unsigned before = failures;
+        run_at(offset, build_pair, sizes[a], chunks[b], peek);
+        if (failures != before) return;
+      }
+    }
+  }
+}
+
+// The cases above that split a tag across the end of the ring, byte by
+// byte so that sproto also sees the partial tag
+static void test_split_tags(unsigned char peek) {
+  const unsigned _supla_int_t data_size = 100;
+  const unsigned _supla_int_t frame_size = FRAME_HEADER_SIZE + data_size;
+
+  for (unsigned _supla_int_t cut = 1; cut < SUPLA_TAG_SIZE; cut++) {
+    // Opening tag
+    run_at(SPROTO_RING_BUFFER_SIZE - cut, build_pair, data_size, 1, peek);
+    // Closing tag
+    run_at(SPROTO_RING_BUFFER_SIZE - frame_size - cut, build_pair, data_size,
+           1, peek);
+  }
+}
+
+// A peeked frame that wraps around the end of the ring stays intact while
+// more data is appended, up to filling the ring
+static void test_peek_wrapped(void) {
+  static TStream stream;
+  const unsigned _supla_int_t data_size = 100;
+  const size_t frame_size = FRAME_HEADER_SIZE + data_size + SUPLA_TAG_SIZE;
+  TSuplaDataPacket *view;
+  TSuplaDataPacket sdp;
+  size_t ends[2];
+
+  for (size_t cut = 1; cut < frame_size; cut += 7) {
+    memset(&stream, 0, sizeof(stream));
+    unsigned count = add_fillers(&stream, SPROTO_RING_BUFFER_SIZE - cut, ends);
+    size_t first = stream.size;
+    add_frame(&stream, 1, SUPLA_SD_CALL_CHANNEL_SET_VALUE, data_size);
+    size_t second = stream.size;
+    add_frame(&stream, 2, SUPLA_SD_CALL_CHANNEL_SET_VALUE, 8);
+
+    void *spd = sproto_init();
+    CHECK(spd != NULL);
+    size_t pos = rotate(spd, &stream, ends, count);
+    CHECK(pos > 0);
+    CHECK(sproto_in_buffer_append(spd, &stream.data[pos], second - pos) ==
+          SUPLA_RESULT_TRUE);
+    CHECK(sproto_peek_in_sdp(spd, &view, NULL) == SUPLA_RESULT_TRUE);
+
+    CHECK(sproto_in_buffer_append(spd, &stream.data[second],
+                                  stream.size - second) == SUPLA_RESULT_TRUE);
+    while (sproto_in_buffer_append(spd, "x", 1) == SUPLA_RESULT_TRUE) {
+    }
+
+    CHECK(memcmp(view, &stream.data[first], frame_size - SUPLA_TAG_SIZE) ==
+          0);
+    sproto_consume_in_sdp(spd);
+    CHECK(sproto_pop_in_sdp(spd, &sdp) == SUPLA_RESULT_TRUE);
+    CHECK(sdp.rr_id == 2);
+    sproto_free(spd);
+  }
+}
+#endif /*SPROTO_RING_BUFFER*/
+
+#ifndef SPROTO_WITHOUT_RESYNC
+#define CORRUPT_JUNK 0  // garbage with partial tags before a frame
+#define CORRUPT_OPENING_TAG 1
+#define CORRUPT_CLOSING_TAG 2  // the frame's only integrity check
+#define CORRUPT_LENGTH_LONGER 3
+#define CORRUPT_LENGTH_SHORTER 4
+#define CORRUPT_LENGTH_HUGE 5  // data_size past SUPLA_MAX_DATA_SIZE
+#define CORRUPT_COUNT 6
+
+// Four frames, the second one damaged. Only the damaged frame may be lost:
+// the ones before and after it have to come out intact.
+static void build_corrupted(TStream *stream, TStream *expected,
+                            unsigned _supla_int_t corruption) {
+  static const char junk[] = "xSUPxxSUxS\x01\x02SUPL";
+  static TStream frames;
+  size_t offsets[5];
+  unsigned _supla_int_t data_size;
+
+  memset(&frames, 0, sizeof(frames));
+  offsets[0] = 0;
+  add_frame(&frames, 1, SUPLA_SD_CALL_CHANNEL_SET_VALUE, 40);
+  offsets[1] = frames.size;
+  add_frame(&frames, 2, SUPLA_SD_CALL_CHANNEL_SET_VALUE, 60);
+  offsets[2] = frames.size;
+  add_frame(&frames, 3, SUPLA_SD_CALL_CHANNEL_SET_VALUE, 100);
+  offsets[3] = frames.size;
+  add_frame(&frames, 4, SUPLA_SD_CALL_CHANNEL_SET_VALUE, 8);
+  offsets[4] = frames.size;
+
+  for (unsigned a = 0; a < 4; a++) {
+    const char *frame = &frames.data[offsets[a]];
+    size_t size = offsets[a + 1] - offsets[a];
+
+    if (a == 1 && corruption == CORRUPT_JUNK) {
+      memcpy(&stream->data[stream->size], junk, sizeof(junk) - 1);
+      stream->size += sizeof(junk) - 1;
+    }
+
+    memcpy(&stream->data[stream->size], frame, size);
+
+    if (a == 1) {
+      char *damaged = &stream->data[stream->size];
+      char *size_field = &damaged[offsetof(TSuplaDataPacket, data_size)];
+
+      memcpy(&data_size, size_field, sizeof(data_size));
+
+      switch (corruption) {
+        case CORRUPT_OPENING_TAG:
+          damaged[0] = 'X';
+          break;
+        case CORRUPT_CLOSING_TAG:
+          damaged[size - 1] ^= 0x20;
+          break;
+        case CORRUPT_LENGTH_LONGER:
+          data_size += 40;
+          break;
+        case CORRUPT_LENGTH_SHORTER:
+          data_size -= 3;
+          break;
+        case CORRUPT_LENGTH_HUGE:
+          data_size = 0x7FFFFFF0;
+          break;
+      }
+
+      memcpy(size_field, &data_size, sizeof(data_size));
+    }
+
+    stream->size += size;
+    stream->count++;
+
+    if (a != 1 || corruption == CORRUPT_JUNK) {
+      memcpy(&expected->data[expected->size], frame, size);
+      expected->size += size;
+      expected->count++;
+    }
+  }
+}
+
+// Every corruption, in every chunk size up to a frame and a half, and (with
+// a ring) at every ring offset
+static void test_resync(unsigned char peek) {
+  for (unsigned _supla_int_t corruption = 0; corruption < CORRUPT_COUNT;
+       corruption++) {
+    for (size_t chunk = 1; chunk <= 150; chunk++) {
+      unsigned before = failures;
+      run_at(0, build_corrupted, corruption, chunk, peek);
+      if (failures != before) return;
+    }
+
+#if defined(SPROTO_RING_BUFFER) && defined(SPROTO_RING_BUFFER_SIZE)
+    for (unsigned _supla_int_t offset = 0; offset < SPROTO_RING_BUFFER_SIZE;
+         offset++) {
+      unsigned before = failures;
+      run_at(offset, build_corrupted, corruption, 1, peek);
+      run_at(offset, build_corrupted, corruption, STREAM_MAX_SIZE, peek);
+      if (failures != before) return;
+    }
+#endif /*SPROTO_RING_BUFFER*/
+  }
+}
+
+// Resync is counted, and a clean stream never triggers it
+static void test_resync_stats(void) {
+  static TStream stream, expected, out;
+  TSuplaProtoResyncStats stats;
+
+  for (unsigned _supla_int_t corruption = 0; corruption <= CORRUPT_COUNT;
+       corruption++) {
+    memset(&stream, 0, sizeof(stream));
+    memset(&expected, 0, sizeof(expected));
+    memset(&out, 0, sizeof(out));
+
+    if (corruption < CORRUPT_COUNT) {
+      build_corrupted(&stream, &expected, corruption);
+    } else {
+      add_frame(&stream, 1, SUPLA_SD_CALL_CHANNEL_SET_VALUE, 40);
+      add_frame(&stream, 2, SUPLA_SD_CALL_CHANNEL_SET_VALUE, 60);
+    }
+
+    void *spd = sproto_init();
+    CHECK(spd != NULL);
+    unsigned errors = feed(spd, &stream, 0, STREAM_MAX_SIZE, 0, &out);
+    sproto_get_resync_stats(spd, &stats);
+    sproto_free(spd);
+
+    CHECK(errors == 0);
+    if (corruption < CORRUPT_COUNT) {
+      CHECK(stats.count > 0);
+      CHECK(stats.discarded > 0);
+      CHECK(stats.discarded <= stream.size - expected.size);
+    } else {
+      CHECK(stats.count == 0);
+      CHECK(stats.discarded == 0);
+    }
+  }
+}
+#endif /*SPROTO_WITHOUT_RESYNC*/
+
+int main(void) {
+  test_chunks(0);
+  test_chunks(1);
+  test_peek_consume();
+#if defined(SPROTO_RING_BUFFER) && defined(SPROTO_RING_BUFFER_SIZE)
+  test_wraparound(0);
+  test_wraparound(1);
+  test_split_tags(0);
+  test_split_tags(1);
+  test_peek_wrapped();
+#endif /*SPROTO_RING_BUFFER*/
+#ifndef SPROTO_WITHOUT_RESYNC
+  test_resync(0);
+  test_resync(1);
+  test_resync_stats();
+#endif /*SPROTO_WITHOUT_RESYNC*/
+
+  if (failures) {
+    fprintf(stderr, "%u check(s) failed\n", failures);
+    return 1;
+  }
+
+  printf("sproto_test: ok\n");
+  return 0;
+}
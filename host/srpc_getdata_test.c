@@ -0,0 +1,348 @@
+/*
+ srpc_getdata() test against the call descriptor table, run by ctest.
+
+ Raw frames go to a device-configured srpc through an in-memory pipe and
+ are decoded in on_remote_call_received with srpc_getdata() (heap and
+ TsrpcParams.rd_arena) and srpc_getdata_in_place(). For every case the
+ result has to match what the per-call switch did before the table: reject
+ payloads of the wrong size and hand out a zeroed structure with the payload
+ copied over its head, byte for byte. Variable-size payloads are sent right
+ after a full-size one of the same call, so a stale tail left in the input
+ buffer shows up as a mismatch.
+
+ Exits with 0 when every check passes, 1 otherwise.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "proto.h"
+#include "srpc.h"
+
+#define FRAME_HEADER_SIZE (sizeof(TSuplaDataPacket) - SUPLA_MAX_DATA_SIZE)
+#define PIPE_SIZE (2 * sizeof(TSuplaDataPacket))
+
+#define CHECK(COND)                                                     \
+  do {                                                                  \
+    if (!(COND)) {                                                      \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #COND); \
+      failures++;                                                       \
+      return;                                                           \
+    }                                                                   \
+  } while (0)
+
+#define DECODE_NO_DATA 0
+#define DECODE_FIXED 1
+#define DECODE_VARIABLE 2
+
+typedef struct {
+  unsigned _supla_int_t call_id;
+  unsigned char min_version;
+  unsigned char decode;
+  unsigned _supla_int_t size;
+  unsigned _supla_int_t header_size;
+  unsigned _supla_int_t item_size;
+  unsigned _supla_int_t max_count;
+  size_t count_offset;
+  size_t count_width;
+} TGetdataCase;
+
+#define CASE_NO_DATA(CALL_ID, MIN_VERSION) \
+  { CALL_ID, MIN_VERSION, DECODE_NO_DATA, 0, 0, 0, 0, 0, 0 }
+
+#define CASE_FIXED(CALL_ID, MIN_VERSION, TYPE) \
+  { CALL_ID, MIN_VERSION, DECODE_FIXED, sizeof(TYPE), 0, 0, 0, 0, 0 }
+
+#define CASE_VARIABLE(CALL_ID, MIN_VERSION, TYPE, ITEM_TYPE, COUNT, MAX)     \
+  {                                                                          \
+    CALL_ID, MIN_VERSION, DECODE_VARIABLE, sizeof(TYPE),                     \
+        sizeof(TYPE) - sizeof(ITEM_TYPE) * (MAX), sizeof(ITEM_TYPE), (MAX),  \
+        offsetof(TYPE, COUNT), sizeof(((TYPE *)0)->COUNT)                    \
+  }
+
+// Calls a device build decodes, with the min_version and size rule the
+// switch had for them
+static const TGetdataCase cases[] = {
+    CASE_NO_DATA(SUPLA_DCS_CALL_GETVERSION, 1),
+    CASE_FIXED(SUPLA_SDC_CALL_GETVERSION_RESULT, 1,
+               TSDC_SuplaGetVersionResult),
+    CASE_FIXED(SUPLA_SDC_CALL_VERSIONERROR, 1, TSDC_SuplaVersionError),
+    CASE_FIXED(SUPLA_SDC_CALL_PING_SERVER_RESULT, 1,
+               TSDC_SuplaPingServerResult),
+    CASE_FIXED(SUPLA_SD_CALL_REGISTER_DEVICE_RESULT, 1,
+               TSD_SuplaRegisterDeviceResult),
+    CASE_VARIABLE(SUPLA_SD_CALL_REGISTER_DEVICE_RESULT_B, 25,
+                  TSD_SuplaRegisterDeviceResult_B, unsigned char,
+                  channel_report_size, CHANNEL_REPORT_MAXSIZE),
+    CASE_VARIABLE(SUPLA_DS_CALL_REGISTER_DEVICE_E, 10,
+                  TDS_SuplaRegisterDevice_E, TDS_SuplaDeviceChannel_C,
+                  channel_count, SUPLA_CHANNELMAXCOUNT),
+    CASE_FIXED(SUPLA_DS_CALL_DEVICE_CHANNEL_VALUE_CHANGED_C, 12,
+               TDS_SuplaDeviceChannelValue_C),
+    CASE_FIXED(SUPLA_SD_CALL_CHANNEL_SET_VALUE, 1, TSD_SuplaChannelNewValue),
+    CASE_FIXED(SUPLA_SD_CALL_CHANNELGROUP_SET_VALUE, 13,
+               TSD_SuplaChannelGroupNewValue),
+    CASE_FIXED(SUPLA_SDC_CALL_SET_ACTIVITY_TIMEOUT_RESULT, 2,
+               TSDC_SuplaSetActivityTimeoutResult),
+    CASE_NO_DATA(SUPLA_DCS_CALL_GET_REGISTRATION_ENABLED, 7),
+    CASE_VARIABLE(SUPLA_SD_CALL_DEVICE_CALCFG_REQUEST, 10,
+                  TSD_DeviceCalCfgRequest, char, DataSize,
+                  SUPLA_CALCFG_DATA_MAXSIZE),
+    CASE_VARIABLE(SUPLA_DCS_CALL_GET_USER_LOCALTIME_RESULT, 11,
+                  TSDC_UserLocalTimeResult, char, timezoneSize,
+                  SUPLA_TIMEZONE_MAXSIZE),
+    CASE_FIXED(SUPLA_DSC_CALL_CHANNEL_STATE_RESULT, 12, TDSC_ChannelState),
+};
+
+typedef struct {
+  char buf[PIPE_SIZE];
+  size_t head;
+  size_t size;
+} TPipe;
+
+static TPipe pipe_to_device;
+static unsigned failures;
+
+// Filled in by on_remote_call_received
+static unsigned char in_place;
+static unsigned received;
+static char result;
+static unsigned _supla_int_t got_size;
+static char got[4096];
+static unsigned char got_null;
+
+static _supla_int_t pipe_read(void *buf, _supla_int_t count,
+                              void *user_params) {
+  TPipe *p = (TPipe *)user_params;
+  size_t available = p->size - p->head;
+
+  if (available == 0) {
+    return -1;
+  }
+
+  if ((size_t)count > available) {
+    count = available;
+  }
+
+  memcpy(buf, &p->buf[p->head], count);
+  p->head += count;
+  return count;
+}
+
+static _supla_int_t null_write(void *buf, _supla_int_t count,
+                               void *user_params) {
+  (void)buf;
+  (void)user_params;
+  return count;
+}
+
+static void on_remote_call_received(void *_srpc, unsigned _supla_int_t rr_id,
+                                    unsigned _supla_int_t call_id,
+                                    void *user_params,
+                                    unsigned char proto_version) {
+  TsrpcReceivedData rd;
+  (void)call_id;
+  (void)user_params;
+  (void)proto_version;
+
+  received++;
+  result = in_place ? srpc_getdata_in_place(_srpc, &rd, rr_id)
+                    : srpc_getdata(_srpc, &rd, rr_id);
+
+  if (result == SUPLA_RESULT_TRUE) {
+    got_null = rd.data.dcs_ping == NULL;
+    if (!got_null) {
+      memcpy(got, rd.data.dcs_ping, got_size);
+    }
+    srpc_rd_free(&rd);
+  }
+}
+
+// Sends one frame and decodes it. Returns the srpc_getdata*() result.
+static char call(void *device, unsigned _supla_int_t call_id,
+                 const char *payload, unsigned _supla_int_t size) {
+  TSuplaDataPacket sdp;
+  static unsigned _supla_int_t rr_id;
+
+  memset(&sdp, 0, sizeof(sdp));
+  memcpy(sdp.tag, sproto_tag, SUPLA_TAG_SIZE);
+  sdp.version = SUPLA_PROTO_VERSION;
+  sdp.rr_id = ++rr_id;
+  sdp.call_id = call_id;
+  sdp.data_size = size;
+  memcpy(sdp.data, payload, size);
+
+  if (pipe_to_device.head == pipe_to_device.size) {
+    pipe_to_device.head = 0;
+    pipe_to_device.size = 0;
+  }
+
+  memcpy(&pipe_to_device.buf[pipe_to_device.size], &sdp,
+         FRAME_HEADER_SIZE + size);
+  pipe_to_device.size += FRAME_HEADER_SIZE + size;
+  memcpy(&pipe_to_device.buf[pipe_to_device.size], sproto_tag,
+         SUPLA_TAG_SIZE);
+  pipe_to_device.size += SUPLA_TAG_SIZE;
+
+  received = 0;
+  result = SUPLA_RESULT_FALSE;
+  memset(got, 0, sizeof(got));
+  got_null = 0;
+
+  // srpc_iterate() reads at most SRPC_BUFFER_SIZE bytes per call
+  for (int a = 0; a < 64 && received == 0; a++) {
+    srpc_iterate(device);
+  }
+
+  return received == 1 ? result : (char)SUPLA_RESULT_FALSE;
+}
+
+static void set_count(char *payload, const TGetdataCase *c,
+                      unsigned _supla_int_t count) {
+  // Little endian, like the devices
+  memcpy(&payload[c->count_offset], &count, c->count_width);
+}
+
+// What the switch handed out: a zeroed structure with the payload on top
+static int matches(const TGetdataCase *c, const char *payload,
+                   unsigned _supla_int_t size) {
+  char expected[sizeof(got)];
+
+  memset(expected, 0, c->size);
+  memcpy(expected, payload, size);
+  return !got_null && memcmp(got, expected, c->size) == 0;
+}
+
+static void test_case(void *device, const TGetdataCase *c) {
+  char payload[sizeof(TSuplaDataPacket)];
+  unsigned _supla_int_t size;
+  unsigned _supla_int_t top;
+
+  CHECK(c->size <= sizeof(got));
+  got_size = c->size;
+
+  CHECK(srpc_call_min_version_required(device, c->call_id) ==
+        c->min_version);
+
+  for (unsigned _supla_int_t i = 0; i < sizeof(payload); i++) {
+    payload[i] = (char)(0xA5 ^ (i * 13));
+  }
+
+  switch (c->decode) {
+    case DECODE_NO_DATA:
+      CHECK(call(device, c->call_id, payload, 0) == SUPLA_RESULT_TRUE);
+      CHECK(got_null);
+      break;
+
+    case DECODE_FIXED:
+      CHECK(call(device, c->call_id, payload, c->size) == SUPLA_RESULT_TRUE);
+      CHECK(matches(c, payload, c->size));
+      CHECK(call(device, c->call_id, payload, c->size - 1) !=
+            SUPLA_RESULT_TRUE);
+      CHECK(call(device, c->call_id, payload, c->size + 1) !=
+            SUPLA_RESULT_TRUE);
+      break;
+
+    case DECODE_VARIABLE:
+      // Largest payload first (the whole structure, unless it does not fit
+      // in a packet), then every count down, so each shorter payload lands
+      // on the tail of the previous one
+      top = c->max_count;
+      if (c->header_size + top * c->item_size > SUPLA_MAX_DATA_SIZE) {
+        top = (SUPLA_MAX_DATA_SIZE - c->header_size) / c->item_size;
+      }
+
+      for (unsigned _supla_int_t n = top + 1; n-- > 0;) {
+        size = c->header_size + n * c->item_size;
+        set_count(payload, c, n);
+        CHECK(call(device, c->call_id, payload, size) == SUPLA_RESULT_TRUE);
+        CHECK(matches(c, payload, size));
+      }
+
+      // Counter and size disagree
+      size = c->header_size + c->item_size;
+      set_count(payload, c, 2);
+      CHECK(call(device, c->call_id, payload, size) != SUPLA_RESULT_TRUE);
+      set_count(payload, c, c->max_count + 1);
+      CHECK(call(device, c->call_id, payload,
+                 c->header_size + top * c->item_size) != SUPLA_RESULT_TRUE);
+      // Shorter than the fixed part
+      set_count(payload, c, 0);
+      if (c->header_size > 0) {
+        CHECK(call(device, c->call_id, payload, c->header_size - 1) !=
+              SUPLA_RESULT_TRUE);
+      }
+      break;
+  }
+}
+
+static void test_custom(void *device) {
+  char payload[sizeof(TSD_FirmwareUpdate_UrlResult)];
+  TsrpcRdStats stats;
+
+  memset(payload, 0x5A, sizeof(payload));
+  got_size = sizeof(TSD_FirmwareUpdate_UrlResult);
+
+  // One-byte "no update" answer: a zeroed structure, the byte copied over
+  // its head like any other payload
+  CHECK(call(device, SUPLA_SD_CALL_GET_FIRMWARE_UPDATE_URL_RESULT, payload,
+             1) == SUPLA_RESULT_TRUE);
+  CHECK(!got_null);
+  CHECK(got[0] == payload[0]);
+  for (size_t i = 1; i < sizeof(TSD_FirmwareUpdate_UrlResult); i++) {
+    CHECK(got[i] == 0);
+  }
+
+  CHECK(call(device, SUPLA_SD_CALL_GET_FIRMWARE_UPDATE_URL_RESULT, payload,
+             sizeof(payload)) == SUPLA_RESULT_TRUE);
+  CHECK(memcmp(got, payload, sizeof(payload)) == 0);
+
+  // Unknown calls and client calls in a device build are rejected
+  CHECK(srpc_call_min_version_required(device, 1) == 255);
+  CHECK(call(device, 1, payload, 0) != SUPLA_RESULT_TRUE);
+  CHECK(call(device, SUPLA_SC_CALL_EVENT, payload, 0) != SUPLA_RESULT_TRUE);
+
+  srpc_get_rd_stats(device, &stats);
+  CHECK(in_place || stats.in_place_count == 0);
+}
+
+static void run(unsigned char arena, unsigned char _in_place) {
+  TsrpcParams params;
+
+  srpc_params_init(&params);
+  params.data_read = pipe_read;
+  params.data_write = null_write;
+  params.on_remote_call_received = on_remote_call_received;
+  params.user_params = &pipe_to_device;
+  params.rd_arena = arena;
+
+  void *device = srpc_init(&params);
+  CHECK(device != NULL);
+
+  in_place = _in_place;
+  memset(&pipe_to_device, 0, sizeof(pipe_to_device));
+
+  for (size_t a = 0; a < sizeof(cases) / sizeof(cases[0]); a++) {
+    test_case(device, &cases[a]);
+  }
+  test_custom(device);
+
+  srpc_free(device);
+}
+
+int main(void) {
+  run(0, 0);
+  run(1, 0);
+  run(0, 1);
+  run(1, 1);
+
+  if (failures) {
+    fprintf(stderr, "%u check(s) failed\n", failures);
+    return 1;
+  }
+
+  printf("srpc_getdata_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ Two-thread throughput of the srpc out queue.
+
+ An application thread keeps calling srpc_sd_async_set_channel_value() while
+ an I/O thread runs srpc_iterate_batch() into a writer that only counts
+ bytes, until the given number of packets has been written out. With the
+ default queue both threads take srpc->lck; build with -DSRPC_QUEUE_SPSC=ON
+ to compare with the lock-free ring, or with -DLCK_BACKEND=adaptive to
+ compare lock implementations. A call that finds the queue full is retried
+ and counted; the lock counters show how often the threads met. Both threads
+ yield when they have nothing to do, so the numbers stay meaningful on a
+ single core. The I/O thread also sets the protocol version now and then,
+ as a GETVERSION_RESULT handler would, so a ThreadSanitizer build
+ (-DCMAKE_C_FLAGS=-fsanitize=thread) sees the producer's packet headers
+ racing with it if they are not synchronized.
+
+   srpc_queue_bench [-n packets]
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "proto.h"
+#include "srpc.h"
+
+// srpc_iterate_batch() calls between two srpc_set_proto_version()
+#define VERSION_PERIOD 256
+
+#define FRAME_SIZE                                                    \
+  (sizeof(TSuplaDataPacket) - SUPLA_MAX_DATA_SIZE +                    \
+   sizeof(TSD_SuplaChannelNewValue) + SUPLA_TAG_SIZE)
+
+static void *srpc;
+static unsigned long long packets = 2000000;
+static unsigned long long full_retries;
+static unsigned long long iterations;
+static unsigned long long written;
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static _supla_int_t counting_write(void *buf, _supla_int_t count,
+                                   void *user_params) {
+  (void)buf;
+  (void)user_params;
+  __atomic_add_fetch(&written, count, __ATOMIC_RELAXED);
+  return count;
+}
+
+static _supla_int_t empty_read(void *buf, _supla_int_t count,
+                               void *user_params) {
+  (void)buf;
+  (void)count;
+  (void)user_params;
+  return -1;
+}
+
+static void *producer(void *arg) {
+  TSD_SuplaChannelNewValue value;
+  (void)arg;
+
+  memset(&value, 0, sizeof(value));
+  value.ChannelNumber = 0;
+
+  for (unsigned long long n = 0; n < packets;) {
+    value.SenderID = (_supla_int_t)n;
+    value.value[0] = n & 1;
+
+    if (srpc_sd_async_set_channel_value(srpc, &value) > 0) {
+      n++;
+    } else {
+      full_retries++;
+      sched_yield();
+    }
+  }
+
+  return NULL;
+}
+
+static void *consumer(void *arg) {
+  (void)arg;
+
+  unsigned long long last = 0, now;
+
+  while ((now = __atomic_load_n(&written, __ATOMIC_RELAXED)) <
+         packets * FRAME_SIZE) {
+    // Idle ticks give the CPU away, as a poll() with no events would
+    if (now == last) sched_yield();
+    last = now;
+
+    srpc_iterate_batch(srpc);
+    if (++iterations % VERSION_PERIOD == 0) {
+      srpc_set_proto_version(srpc, SUPLA_PROTO_VERSION);
+    }
+  }
+
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n':
+        packets = strtoull(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n packets]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  TsrpcParams params;
+  srpc_params_init(&params);
+  params.data_read = empty_read;
+  params.data_write = counting_write;
+
+  srpc = srpc_init(&params);
+  if (srpc == NULL) {
+    fprintf(stderr, "srpc_init failed\n");
+    return 1;
+  }
+
+  pthread_t app, io;
+  double t0 = now_s();
+  pthread_create(&io, NULL, consumer, NULL);
+  pthread_create(&app, NULL, producer, NULL);
+  pthread_join(app, NULL);
+  pthread_join(io, NULL);
+  double elapsed = now_s() - t0;
+
+#ifdef SRPC_QUEUE_SPSC
+  printf("queue spsc\n");
+#else
+  printf("queue locked\n");
+#endif /*SRPC_QUEUE_SPSC*/
+  printf("packets %llu in %.3f s: %.0f packets/s\n", packets, elapsed,
+         packets / elapsed);
+  printf("queue full retries %llu, srpc_iterate_batch calls %llu\n",
+         full_retries, iterations);
+
+  TLckStats lck_stats;
+  srpc_get_lck_stats(srpc, &lck_stats);
+  printf("locks %llu, contended %llu (%.2f%%), parked %llu\n",
+         lck_stats.locks, lck_stats.contended,
+         lck_stats.locks ? 100.0 * lck_stats.contended / lck_stats.locks : 0,
+         lck_stats.parked);
+
+  srpc_free(srpc);
+  return written == packets * FRAME_SIZE ? 0 : 1;
+}
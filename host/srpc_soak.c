@@ -0,0 +1,243 @@
+/*
+ Soak run for the receive path of a device-configured srpc.
+
+ A second srpc plays the server and sends the usual device traffic (mostly
+ SUPLA_SD_CALL_CHANNEL_SET_VALUE, plus activity timeout, register and
+ firmware update URL results) through an in-memory pipe, as fast as
+ possible, for the given number of simulated hours. Once per simulated hour
+ it prints the TsrpcRdStats counters and the process heap (glibc
+ mallinfo2), so a flat heap with TsrpcParams.rd_arena can be compared
+ against the calloc/free path.
+
+   srpc_soak [-a] [-H hours] [-r calls_per_second]
+ */
+
+#include <getopt.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "proto.h"
+#include "srpc.h"
+
+#define SOAK_PIPE_SIZE 65536
+
+typedef struct {
+  char buf[SOAK_PIPE_SIZE];
+  size_t head;
+  size_t size;
+} TSoakPipe;
+
+static TSoakPipe pipe_to_device;
+static unsigned long long received_count;
+static unsigned long long decode_errors;
+
+static _supla_int_t pipe_write(void *buf, _supla_int_t count,
+                               void *user_params) {
+  TSoakPipe *p = (TSoakPipe *)user_params;
+
+  if (p->head > 0 && p->head == p->size) {
+    p->head = 0;
+    p->size = 0;
+  }
+
+  if (count <= 0 || (size_t)count > SOAK_PIPE_SIZE - p->size) {
+    return -1;
+  }
+
+  memcpy(&p->buf[p->size], buf, count);
+  p->size += count;
+  return count;
+}
+
+static _supla_int_t pipe_read(void *buf, _supla_int_t count,
+                              void *user_params) {
+  TSoakPipe *p = (TSoakPipe *)user_params;
+  size_t available = p->size - p->head;
+
+  if (available == 0) {
+    return -1;
+  }
+
+  if ((size_t)count > available) {
+    count = available;
+  }
+
+  memcpy(buf, &p->buf[p->head], count);
+  p->head += count;
+  return count;
+}
+
+static _supla_int_t null_write(void *buf, _supla_int_t count,
+                               void *user_params) {
+  (void)buf;
+  (void)user_params;
+  return count;
+}
+
+static _supla_int_t null_read(void *buf, _supla_int_t count,
+                              void *user_params) {
+  (void)buf;
+  (void)count;
+  (void)user_params;
+  return -1;
+}
+
+static void on_remote_call_received(void *_srpc, unsigned _supla_int_t rr_id,
+                                    unsigned _supla_int_t call_id,
+                                    void *user_params,
+                                    unsigned char proto_version) {
+  TsrpcReceivedData rd;
+  (void)call_id;
+  (void)user_params;
+  (void)proto_version;
+
+  if (srpc_getdata(_srpc, &rd, rr_id) == SUPLA_RESULT_TRUE) {
+    received_count++;
+    srpc_rd_free(&rd);
+  } else {
+    decode_errors++;
+  }
+}
+
+// One call of the simulated server->device traffic mix
+static _supla_int_t send_call(void *server, unsigned long long n) {
+  switch (n % 16) {
+    case 0: {
+      TSDC_SuplaSetActivityTimeoutResult r;
+      memset(&r, 0, sizeof(r));
+      r.activity_timeout = 120;
+      r.min = 30;
+      r.max = 240;
+      return srpc_dcs_async_set_activity_timeout_result(server, &r);
+    }
+    case 1: {
+      TSD_SuplaRegisterDeviceResult r;
+      memset(&r, 0, sizeof(r));
+      r.result_code = SUPLA_RESULTCODE_TRUE;
+      r.activity_timeout = 120;
+      r.version = SUPLA_PROTO_VERSION;
+      r.version_min = SUPLA_PROTO_VERSION_MIN;
+      return srpc_sd_async_registerdevice_result(server, &r);
+    }
+    case 2: {
+      TSD_FirmwareUpdate_UrlResult r;
+      memset(&r, 0, sizeof(r));
+      r.exists = 1;
+      snprintf(r.url.host, sizeof(r.url.host), "update.supla.org");
+      r.url.port = 443;
+      snprintf(r.url.path, sizeof(r.url.path), "/esphome/%llu.bin", n);
+      return srpc_sd_async_get_firmware_update_url_result(server, &r);
+    }
+  }
+
+  TSD_SuplaChannelNewValue v;
+  memset(&v, 0, sizeof(v));
+  v.SenderID = (_supla_int_t)n;
+  v.ChannelNumber = n % 2;
+  v.value[0] = n & 1;
+  return srpc_sd_async_set_channel_value(server, &v);
+}
+
+static void print_row(unsigned hour, void *device) {
+  TsrpcRdStats stats;
+  struct mallinfo2 mi = mallinfo2();
+
+  srpc_get_rd_stats(device, &stats);
+  printf("%5u %12llu %10u %10u %10u %12u %10zu %10zu %8zu\n", hour,
+         received_count, stats.arena_count, stats.in_place_count,
+         stats.heap_count, stats.heap_bytes, mi.uordblks, mi.fordblks,
+         mi.ordblks);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned hours = 24;
+  unsigned rate = 2;
+  unsigned char arena = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "aH:r:")) != -1) {
+    switch (opt) {
+      case 'a':
+        arena = 1;
+        break;
+      case 'H':
+        hours = atoi(optarg);
+        break;
+      case 'r':
+        rate = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-a] [-H hours] [-r calls_per_second]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+
+  TsrpcParams params;
+  srpc_params_init(&params);
+  params.data_read = pipe_read;
+  params.data_write = null_write;
+  params.on_remote_call_received = on_remote_call_received;
+  params.user_params = &pipe_to_device;
+  params.rd_arena = arena;
+  void *device = srpc_init(&params);
+
+  srpc_params_init(&params);
+  params.data_read = null_read;
+  params.data_write = pipe_write;
+  params.user_params = &pipe_to_device;
+  void *server = srpc_init(&params);
+
+  if (device == NULL || server == NULL) {
+    fprintf(stderr, "srpc_init failed\n");
+    return 1;
+  }
+
+  TsrpcRdStats stats;
+  srpc_get_rd_stats(device, &stats);
+  printf("rd_arena %s, arena size %u bytes, %u calls/s for %u h\n",
+         arena ? "on" : "off", stats.arena_size, rate, hours);
+  printf("%5s %12s %10s %10s %10s %12s %10s %10s %8s\n", "hour", "received",
+         "arena", "in_place", "heap", "heap_bytes", "in_use", "free",
+         "free_chk");
+  print_row(0, device);
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  unsigned long long n = 0;
+  unsigned long long sent = 0;
+  for (unsigned hour = 1; hour <= hours; hour++) {
+    for (unsigned sec = 0; sec < 3600; sec++) {
+      for (unsigned c = 0; c < rate; c++) {
+        if (send_call(server, n++) > 0) {
+          sent++;
+        }
+      }
+
+      srpc_iterate_batch(server);
+
+      while (pipe_to_device.head < pipe_to_device.size) {
+        srpc_iterate_device(device);
+      }
+    }
+
+    print_row(hour, device);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double elapsed =
+      (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1000000000.0;
+
+  printf("sent %llu, received %llu, decode errors %llu, %.0f ns/call\n", sent,
+         received_count, decode_errors,
+         received_count ? elapsed * 1e9 / received_count : 0.0);
+
+  srpc_free(server);
+  srpc_free(device);
+
+  return sent == n && received_count == n && decode_errors == 0 ? 0 : 1;
+}
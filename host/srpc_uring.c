@@ -0,0 +1,494 @@
+/*
+ io_uring transport for srpc sessions, see srpc_uring.h.
+
+ Raw io_uring_setup/enter/register syscalls, so there is no dependency on
+ liburing. Every session owns one read and one write slice of a single
+ registered arena. At most one read and one write per session are in
+ flight, so a ring of 2 * max_conns entries never overflows.
+
+ data_write() appends behind the bytes already in flight; the write is
+ prepared in srpc_uring_run(), so everything srpc produced for all sessions
+ since the previous call goes out with one io_uring_enter(). When the
+ slice is full data_write() returns -1, srpc keeps the rest in its output
+ buffer and the session is reported again once the write completes.
+ */
+
+#include "srpc_uring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SRPC_URING_OP_WRITE 1ULL
+
+struct TSrpcUringConn {
+  TSrpcUring *ur;
+  int fd;
+  void *user_data;
+
+  char *rbuf;
+  unsigned r_len;
+  unsigned r_off;
+
+  char *wbuf;
+  unsigned w_len;       // staged bytes, in-flight ones included
+  unsigned w_inflight;  // leading bytes of wbuf being written
+
+  unsigned char r_armed;
+  unsigned char closed;
+  unsigned char w_blocked;
+  unsigned char dirty;
+  unsigned char queued;
+  unsigned char removed;
+  unsigned char pending_ops;
+
+  TSrpcUringConn *next_free;
+};
+
+struct TSrpcUring {
+  int ring_fd;
+  unsigned features;
+
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned *sq_array;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  char *arena;
+  size_t arena_size;
+  unsigned buffer_size;
+
+  TSrpcUringConn *conns;
+  TSrpcUringConn *free_conns;
+  TSrpcUringConn **dirty;
+  unsigned dirty_count;
+  TSrpcUringConn **ready;
+  int ready_count;
+
+  unsigned long long enter_count;
+};
+
+static int srpc_uring_enter(TSrpcUring *ur, unsigned to_submit,
+                            unsigned min_complete, unsigned flags, void *arg,
+                            size_t argsz) {
+  ur->enter_count++;
+  return (int)syscall(__NR_io_uring_enter, ur->ring_fd, to_submit,
+                      min_complete, flags, arg, argsz);
+}
+
+// SQEs not consumed by the kernel yet
+static unsigned srpc_uring_to_submit(TSrpcUring *ur) {
+  return *ur->sq_tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static struct io_uring_sqe *srpc_uring_get_sqe(TSrpcUring *ur) {
+  unsigned tail = *ur->sq_tail;
+
+  if (srpc_uring_to_submit(ur) >= ur->sq_entries) {
+    // Cannot happen with one read and one write per session, but a full
+    // ring is flushed rather than overrun
+    if (srpc_uring_enter(ur, ur->sq_entries, 0, 0, NULL, 0) < 0) return NULL;
+  }
+
+  struct io_uring_sqe *sqe = &ur->sqes[tail & ur->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  ur->sq_array[tail & ur->sq_mask] = tail & ur->sq_mask;
+  __atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  return sqe;
+}
+
+static void srpc_uring_arm_read(TSrpcUringConn *conn) {
+  struct io_uring_sqe *sqe = srpc_uring_get_sqe(conn->ur);
+
+  if (sqe == NULL) {
+    conn->closed = 1;
+    return;
+  }
+
+  sqe->opcode = IORING_OP_READ_FIXED;
+  sqe->fd = conn->fd;
+  sqe->addr = (uint64_t)(uintptr_t)conn->rbuf;
+  sqe->len = conn->ur->buffer_size;
+  sqe->buf_index = 0;
+  sqe->user_data = (uint64_t)(uintptr_t)conn;
+
+  conn->r_armed = 1;
+  conn->r_len = 0;
+  conn->r_off = 0;
+  conn->pending_ops++;
+}
+
+static void srpc_uring_arm_write(TSrpcUringConn *conn) {
+  struct io_uring_sqe *sqe = srpc_uring_get_sqe(conn->ur);
+
+  if (sqe == NULL) {
+    conn->closed = 1;
+    return;
+  }
+
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = conn->fd;
+  sqe->addr = (uint64_t)(uintptr_t)conn->wbuf;
+  sqe->len = conn->w_len;
+  sqe->buf_index = 0;
+  sqe->user_data = (uint64_t)(uintptr_t)conn | SRPC_URING_OP_WRITE;
+
+  conn->w_inflight = conn->w_len;
+  conn->pending_ops++;
+}
+
+static void srpc_uring_queue(TSrpcUring *ur, TSrpcUringConn *conn) {
+  if (!conn->queued && !conn->removed) {
+    conn->queued = 1;
+    ur->ready[ur->ready_count++] = conn;
+  }
+}
+
+static void srpc_uring_release(TSrpcUring *ur, TSrpcUringConn *conn) {
+  conn->next_free = ur->free_conns;
+  ur->free_conns = conn;
+}
+
+static _supla_int_t srpc_uring_data_read(void *buf, _supla_int_t count,
+                                         void *user_params) {
+  TSrpcUringConn *conn = (TSrpcUringConn *)user_params;
+
+  if (conn->r_off < conn->r_len) {
+    unsigned n = conn->r_len - conn->r_off;
+    if (n > (unsigned)count) n = (unsigned)count;
+
+    memcpy(buf, &conn->rbuf[conn->r_off], n);
+    conn->r_off += n;
+    return (_supla_int_t)n;
+  }
+
+  if (conn->closed) {
+    return 0;
+  }
+
+  if (!conn->r_armed) {
+    srpc_uring_arm_read(conn);
+  }
+
+  return -1;
+}
+
+static _supla_int_t srpc_uring_data_write(void *buf, _supla_int_t count,
+                                          void *user_params) {
+  TSrpcUringConn *conn = (TSrpcUringConn *)user_params;
+  unsigned space = conn->ur->buffer_size - conn->w_len;
+
+  if (conn->closed) {
+    return -1;
+  }
+
+  if (space == 0) {
+    conn->w_blocked = 1;
+    return -1;
+  }
+
+  if ((unsigned)count > space) count = (_supla_int_t)space;
+
+  memcpy(&conn->wbuf[conn->w_len], buf, count);
+  conn->w_len += count;
+
+  if (!conn->dirty) {
+    conn->dirty = 1;
+    conn->ur->dirty[conn->ur->dirty_count++] = conn;
+  }
+
+  return count;
+}
+
+TSrpcUring *srpc_uring_init(unsigned max_conns, unsigned buffer_size) {
+  TSrpcUring *ur = calloc(1, sizeof(TSrpcUring));
+  if (ur == NULL) return NULL;
+
+  ur->ring_fd = -1;
+  ur->buffer_size = buffer_size;
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ur->ring_fd = (int)syscall(__NR_io_uring_setup,
+                             max_conns * 2 < 8 ? 8 : max_conns * 2, &p);
+  if (ur->ring_fd < 0) goto fail;
+  ur->features = p.features;
+
+  ur->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ur->cq_ring_size =
+      p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ur->cq_ring_size > ur->sq_ring_size) {
+      ur->sq_ring_size = ur->cq_ring_size;
+    }
+    ur->cq_ring_size = 0;
+  }
+
+  ur->sq_ring = mmap(NULL, ur->sq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_SQ_RING);
+  if (ur->sq_ring == MAP_FAILED) goto fail;
+
+  if (ur->cq_ring_size) {
+    ur->cq_ring =
+        mmap(NULL, ur->cq_ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_CQ_RING);
+    if (ur->cq_ring == MAP_FAILED) goto fail;
+  } else {
+    ur->cq_ring = ur->sq_ring;
+  }
+
+  ur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ur->sqes = mmap(NULL, ur->sqes_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_SQES);
+  if (ur->sqes == MAP_FAILED) goto fail;
+
+  char *sq = (char *)ur->sq_ring;
+  ur->sq_head = (unsigned *)(sq + p.sq_off.head);
+  ur->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ur->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+  ur->sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+  ur->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+  char *cq = (char *)ur->cq_ring;
+  ur->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ur->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ur->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+  ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  // One registered region; every session reads and writes its own slices
+  ur->arena_size = (size_t)max_conns * buffer_size * 2;
+  ur->arena = mmap(NULL, ur->arena_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ur->arena == MAP_FAILED) goto fail;
+
+  struct iovec iov = {ur->arena, ur->arena_size};
+  if (syscall(__NR_io_uring_register, ur->ring_fd, IORING_REGISTER_BUFFERS,
+              &iov, 1) != 0) {
+    goto fail;
+  }
+
+  ur->conns = calloc(max_conns, sizeof(TSrpcUringConn));
+  ur->dirty = calloc(max_conns, sizeof(TSrpcUringConn *));
+  ur->ready = calloc(max_conns, sizeof(TSrpcUringConn *));
+  if (ur->conns == NULL || ur->dirty == NULL || ur->ready == NULL) goto fail;
+
+  for (unsigned a = max_conns; a > 0; a--) {
+    TSrpcUringConn *conn = &ur->conns[a - 1];
+    conn->ur = ur;
+    conn->rbuf = &ur->arena[(size_t)(a - 1) * buffer_size * 2];
+    conn->wbuf = conn->rbuf + buffer_size;
+    srpc_uring_release(ur, conn);
+  }
+
+  return ur;
+
+fail:
+  srpc_uring_free(ur);
+  return NULL;
+}
+
+void srpc_uring_free(TSrpcUring *ur) {
+  if (ur == NULL) return;
+
+  if (ur->ring_fd >= 0) close(ur->ring_fd);
+  if (ur->arena != NULL && ur->arena != MAP_FAILED) {
+    munmap(ur->arena, ur->arena_size);
+  }
+  if (ur->sqes != NULL && ur->sqes != MAP_FAILED) {
+    munmap(ur->sqes, ur->sqes_size);
+  }
+  if (ur->cq_ring_size && ur->cq_ring != NULL && ur->cq_ring != MAP_FAILED) {
+    munmap(ur->cq_ring, ur->cq_ring_size);
+  }
+  if (ur->sq_ring != NULL && ur->sq_ring != MAP_FAILED) {
+    munmap(ur->sq_ring, ur->sq_ring_size);
+  }
+
+  free(ur->conns);
+  free(ur->dirty);
+  free(ur->ready);
+  free(ur);
+}
+
+TSrpcUringConn *srpc_uring_add(TSrpcUring *ur, int fd, void *user_data,
+                               TsrpcParams *params) {
+  TSrpcUringConn *conn = ur->free_conns;
+  if (conn == NULL) return NULL;
+
+  ur->free_conns = conn->next_free;
+
+  char *rbuf = conn->rbuf;
+  char *wbuf = conn->wbuf;
+  // A slot freed and reused between two srpc_uring_run() calls may still
+  // be on the dirty or ready list
+  unsigned char dirty = conn->dirty;
+  unsigned char queued = conn->queued;
+
+  memset(conn, 0, sizeof(TSrpcUringConn));
+  conn->ur = ur;
+  conn->fd = fd;
+  conn->user_data = user_data;
+  conn->rbuf = rbuf;
+  conn->wbuf = wbuf;
+  conn->dirty = dirty;
+  conn->queued = queued;
+
+  params->data_read = srpc_uring_data_read;
+  params->data_write = srpc_uring_data_write;
+  params->user_params = conn;
+
+  srpc_uring_arm_read(conn);
+  return conn;
+}
+
+void srpc_uring_remove(TSrpcUring *ur, TSrpcUringConn *conn) {
+  conn->removed = 1;
+  conn->closed = 1;
+
+  // A read on a socket only finishes once the socket is shut down
+  shutdown(conn->fd, SHUT_RDWR);
+
+  if (conn->pending_ops == 0) {
+    srpc_uring_release(ur, conn);
+  }
+}
+
+void *srpc_uring_user_data(void *user_params) {
+  return ((TSrpcUringConn *)user_params)->user_data;
+}
+
+static void srpc_uring_complete(TSrpcUring *ur, struct io_uring_cqe *cqe) {
+  TSrpcUringConn *conn =
+      (TSrpcUringConn *)(uintptr_t)(cqe->user_data & ~SRPC_URING_OP_WRITE);
+  int res = cqe->res;
+
+  conn->pending_ops--;
+
+  if (conn->removed) {
+    if (conn->pending_ops == 0) srpc_uring_release(ur, conn);
+    return;
+  }
+
+  if (cqe->user_data & SRPC_URING_OP_WRITE) {
+    if (res > 0) {
+      conn->w_len -= (unsigned)res;
+      memmove(conn->wbuf, &conn->wbuf[res], conn->w_len);
+    } else if (res != -EAGAIN && res != -EINTR) {
+      conn->closed = 1;
+    }
+    conn->w_inflight = 0;
+
+    if (conn->w_len > 0 && !conn->dirty) {
+      conn->dirty = 1;
+      ur->dirty[ur->dirty_count++] = conn;
+    }
+
+    if (conn->w_blocked || conn->closed) {
+      conn->w_blocked = 0;
+      srpc_uring_queue(ur, conn);
+    }
+  } else {
+    conn->r_armed = 0;
+
+    if (res > 0) {
+      conn->r_len = (unsigned)res;
+    } else if (res == 0 || (res != -EAGAIN && res != -EINTR)) {
+      conn->closed = 1;
+    }
+
+    // Also for -EAGAIN: data_read() arms the read again
+    srpc_uring_queue(ur, conn);
+  }
+}
+
+int srpc_uring_run(TSrpcUring *ur, int timeout_ms) {
+  for (int a = 0; a < ur->ready_count; a++) {
+    ur->ready[a]->queued = 0;
+  }
+  ur->ready_count = 0;
+
+  for (unsigned a = 0; a < ur->dirty_count; a++) {
+    TSrpcUringConn *conn = ur->dirty[a];
+    conn->dirty = 0;
+
+    if (!conn->removed && !conn->closed && conn->w_inflight == 0 &&
+        conn->w_len > 0) {
+      srpc_uring_arm_write(conn);
+    }
+  }
+  ur->dirty_count = 0;
+
+  unsigned flags = 0;
+  unsigned min_complete = 0;
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  void *argp = NULL;
+  size_t argsz = 0;
+
+  if (__atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE) == *ur->cq_head &&
+      timeout_ms != 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+    min_complete = 1;
+
+    if (timeout_ms > 0 && (ur->features & IORING_FEAT_EXT_ARG)) {
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+      memset(&arg, 0, sizeof(arg));
+      arg.ts = (uint64_t)(uintptr_t)&ts;
+      flags |= IORING_ENTER_EXT_ARG;
+      argp = &arg;
+      argsz = sizeof(arg);
+    }
+  }
+
+  unsigned to_submit = srpc_uring_to_submit(ur);
+
+  if (to_submit > 0 || min_complete > 0) {
+    if (srpc_uring_enter(ur, to_submit, min_complete, flags, argp, argsz) < 0 &&
+        errno != ETIME && errno != EINTR && errno != EBUSY) {
+      return -1;
+    }
+  }
+
+  unsigned head = *ur->cq_head;
+  unsigned tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++) {
+    srpc_uring_complete(ur, &ur->cqes[head & ur->cq_mask]);
+  }
+
+  __atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+
+  return ur->ready_count;
+}
+
+void *srpc_uring_ready(TSrpcUring *ur, int i) {
+  if (i < 0 || i >= ur->ready_count || ur->ready[i]->removed) return NULL;
+  return ur->ready[i]->user_data;
+}
+
+unsigned long long srpc_uring_enter_count(TSrpcUring *ur) {
+  return ur->enter_count;
+}
@@ -0,0 +1,51 @@
+/*
+ io_uring transport for srpc sessions on Linux.
+
+ One ring is shared by all sessions. srpc_uring_add() points
+ TsrpcParams.data_read/data_write at the adapter: reads complete into a
+ per-session slice of one registered buffer (IORING_OP_READ_FIXED) and
+ data_read() hands them to srpc; data_write() only stages bytes in the
+ session's write slice. srpc_uring_run() then submits the staged reads and
+ writes of every session and reaps completions with a single
+ io_uring_enter(), instead of a recv()/send() per session.
+
+ TsrpcParams.user_params is the adapter's session, so srpc callbacks reach
+ their own data through srpc_uring_user_data(user_params).
+ */
+
+#ifndef SRPC_URING_H_
+#define SRPC_URING_H_
+
+#include "srpc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TSrpcUring TSrpcUring;
+typedef struct TSrpcUringConn TSrpcUringConn;
+
+// buffer_size bytes of read and as many of write buffer per session
+TSrpcUring *srpc_uring_init(unsigned max_conns, unsigned buffer_size);
+void srpc_uring_free(TSrpcUring *ur);
+
+// fd is a connected stream socket; the first read is armed right away
+TSrpcUringConn *srpc_uring_add(TSrpcUring *ur, int fd, void *user_data,
+                               TsrpcParams *params);
+// Shuts fd down; the session is released once its I/O has completed
+void srpc_uring_remove(TSrpcUring *ur, TSrpcUringConn *conn);
+void *srpc_uring_user_data(void *user_params);
+
+// Waits up to timeout_ms (-1 without a timeout) for a completion. Returns
+// the number of sessions to run srpc_iterate_batch() for, -1 on error.
+int srpc_uring_run(TSrpcUring *ur, int timeout_ms);
+// user_data of the i-th session reported by the last srpc_uring_run()
+void *srpc_uring_ready(TSrpcUring *ur, int i);
+
+unsigned long long srpc_uring_enter_count(TSrpcUring *ur);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SRPC_URING_H_ */
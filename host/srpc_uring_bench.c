@@ -0,0 +1,255 @@
+/*
+ Syscalls per packet for srpc sessions: epoll + recv()/send() against the
+ io_uring adapter (srpc_uring.h).
+
+ N sessions run over socketpairs in one thread. Each round the client end
+ of every pair gets K SUPLA_DCS_CALL_PING_SERVER frames; the server side
+ answers them with srpc and the round ends when all answers are read back.
+ Only the server side syscalls are counted: eh_wait(), recv() and send()
+ in the epoll mode, io_uring_enter() in the io_uring mode.
+
+   srpc_uring_bench [-u] [-n sessions] [-k pings_per_round] [-r rounds]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eh.h"
+#include "proto.h"
+#include "srpc.h"
+#include "srpc_uring.h"
+
+#define BENCH_BUFFER_SIZE 16384
+#define REPLY_SIZE                                          \
+  (sizeof(TSuplaDataPacket) - SUPLA_MAX_DATA_SIZE +         \
+   sizeof(TSDC_SuplaPingServerResult) + SUPLA_TAG_SIZE)
+
+typedef struct {
+  int fd;
+  int peer_fd;
+  void *srpc;
+  unsigned long long received;
+} TBenchSession;
+
+static int use_uring;
+static unsigned long long syscalls;
+static unsigned long long answered;
+
+static TBenchSession *bench_session(void *user_params) {
+  return use_uring ? (TBenchSession *)srpc_uring_user_data(user_params)
+                   : (TBenchSession *)user_params;
+}
+
+static _supla_int_t bench_recv(void *buf, _supla_int_t count,
+                               void *user_params) {
+  TBenchSession *s = (TBenchSession *)user_params;
+  syscalls++;
+  ssize_t r = recv(s->fd, buf, count, MSG_DONTWAIT);
+
+  if (r == 0 || (r < 0 && errno != EAGAIN)) return 0;
+  return r > 0 ? (_supla_int_t)r : -1;
+}
+
+static _supla_int_t bench_send(void *buf, _supla_int_t count,
+                               void *user_params) {
+  TBenchSession *s = (TBenchSession *)user_params;
+  syscalls++;
+  ssize_t r = send(s->fd, buf, count, MSG_NOSIGNAL | MSG_DONTWAIT);
+  return r >= 0 ? (_supla_int_t)r : -1;
+}
+
+static void bench_on_remote_call_received(void *_srpc,
+                                          unsigned _supla_int_t rr_id,
+                                          unsigned _supla_int_t call_id,
+                                          void *user_params,
+                                          unsigned char proto_version) {
+  (void)rr_id;
+  (void)call_id;
+  (void)proto_version;
+  TsrpcReceivedData rd;
+
+  if (srpc_getdata(_srpc, &rd, 0) == SUPLA_RESULT_TRUE) {
+    if (rd.call_id == SUPLA_DCS_CALL_PING_SERVER) {
+      srpc_sdc_async_ping_server_result(_srpc);
+      bench_session(user_params)->received++;
+      answered++;
+    }
+    srpc_rd_free(&rd);
+  }
+}
+
+static size_t bench_ping_frames(char *buf, unsigned k) {
+  void *spd = sproto_init();
+  TSuplaDataPacket sdp;
+  TDCS_SuplaPingServer ps;
+  size_t len = 0;
+
+  memset(&ps, 0, sizeof(ps));
+  for (unsigned a = 0; a < k; a++) {
+    sproto_sdp_init(spd, &sdp);
+    sproto_set_data(&sdp, (char *)&ps, sizeof(ps), SUPLA_DCS_CALL_PING_SERVER);
+
+    size_t size = sizeof(TSuplaDataPacket) - SUPLA_MAX_DATA_SIZE + sizeof(ps);
+    memcpy(&buf[len], &sdp, size);
+    len += size;
+    memcpy(&buf[len], sproto_tag, SUPLA_TAG_SIZE);
+    len += SUPLA_TAG_SIZE;
+  }
+
+  sproto_free(spd);
+  return len;
+}
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[]) {
+  int count = 256;
+  unsigned k = 4;
+  unsigned rounds = 1000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "un:k:r:")) != -1) {
+    switch (opt) {
+      case 'u':
+        use_uring = 1;
+        break;
+      case 'n':
+        count = atoi(optarg);
+        break;
+      case 'k':
+        k = (unsigned)atoi(optarg);
+        break;
+      case 'r':
+        rounds = (unsigned)atoi(optarg);
+        break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-u] [-n sessions] [-k pings_per_round] "
+                "[-r rounds]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+
+  char *frames = malloc((size_t)k * sizeof(TSuplaDataPacket));
+  char *sink = malloc(BENCH_BUFFER_SIZE);
+  size_t frames_len = bench_ping_frames(frames, k);
+  TBenchSession *sessions = calloc(count, sizeof(TBenchSession));
+  TEventHandler *eh = use_uring ? NULL : eh_init();
+  TSrpcUring *ur = use_uring ? srpc_uring_init(count, BENCH_BUFFER_SIZE) : NULL;
+
+  if (sessions == NULL || (use_uring ? ur == NULL : eh == NULL)) {
+    fprintf(stderr, use_uring ? "srpc_uring_init failed\n" : "eh_init failed\n");
+    return 1;
+  }
+
+  for (int a = 0; a < count; a++) {
+    TBenchSession *s = &sessions[a];
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+      perror("socketpair");
+      return 1;
+    }
+    s->fd = sv[0];
+    s->peer_fd = sv[1];
+    fcntl(s->peer_fd, F_SETFL, fcntl(s->peer_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    TsrpcParams params;
+    srpc_params_init(&params);
+    params.on_remote_call_received = bench_on_remote_call_received;
+
+    if (use_uring) {
+      srpc_uring_add(ur, s->fd, s, &params);
+    } else {
+      fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL, 0) | O_NONBLOCK);
+      params.data_read = bench_recv;
+      params.data_write = bench_send;
+      params.user_params = s;
+      eh_add_fd_ex(eh, s->fd, EH_READ | EH_EDGE_TRIGGERED, s);
+    }
+
+    s->srpc = srpc_init(&params);
+  }
+
+  unsigned long long replies = 0;
+  unsigned long long reply_bytes = 0;
+  double t0 = now_s();
+
+  for (unsigned round = 1; round <= rounds; round++) {
+    for (int a = 0; a < count; a++) {
+      if (write(sessions[a].peer_fd, frames, frames_len) !=
+          (ssize_t)frames_len) {
+        perror("write");
+        return 1;
+      }
+    }
+
+    while (replies < (unsigned long long)round * k * count) {
+      int ready;
+
+      if (use_uring) {
+        ready = srpc_uring_run(ur, 100);
+        for (int a = 0; a < ready; a++) {
+          TBenchSession *s = (TBenchSession *)srpc_uring_ready(ur, a);
+          if (s != NULL) srpc_iterate_batch(s->srpc);
+        }
+        // Sends staged by the iterations above
+        srpc_uring_run(ur, 0);
+      } else {
+        syscalls++;
+        eh_wait(eh, 100000);
+        for (int a = 0; a < eh->ready_count; a++) {
+          TBenchSession *s = (TBenchSession *)eh_get_ready(eh, a, NULL);
+          if (s != NULL) srpc_iterate_batch(s->srpc);
+        }
+      }
+
+      for (int a = 0; a < count; a++) {
+        ssize_t r;
+        while ((r = read(sessions[a].peer_fd, sink, BENCH_BUFFER_SIZE)) > 0) {
+          reply_bytes += (unsigned long long)r;
+        }
+      }
+      replies = reply_bytes / REPLY_SIZE;
+    }
+  }
+
+  double elapsed = now_s() - t0;
+  unsigned long long packets = answered * 2;
+
+  printf("%s: %i sessions, %llu pings answered in %.3f s\n",
+         use_uring ? "io_uring" : "epoll", count, answered, elapsed);
+  printf("server syscalls %llu, %.4f per packet (ping + reply)\n",
+         use_uring ? srpc_uring_enter_count(ur) : syscalls,
+         (double)(use_uring ? srpc_uring_enter_count(ur) : syscalls) /
+             packets);
+
+  for (int a = 0; a < count; a++) {
+    if (use_uring) {
+      // The adapter session goes away with srpc_uring_free()
+      shutdown(sessions[a].fd, SHUT_RDWR);
+    }
+    srpc_free(sessions[a].srpc);
+    close(sessions[a].fd);
+    close(sessions[a].peer_fd);
+  }
+
+  srpc_uring_free(ur);
+  eh_free(eh);
+  free(sessions);
+  free(sink);
+  free(frames);
+  return 0;
+}
@@ -0,0 +1,155 @@
+#include "WiFiClient.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+std::string IPAddress::toString() const {
+  struct in_addr in;
+  char buf[INET_ADDRSTRLEN];
+
+  in.s_addr = address_;
+  return inet_ntop(AF_INET, &in, buf, sizeof(buf)) ? buf : "";
+}
+
+WiFiClient::~WiFiClient() { stop(); }
+
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+  struct in_addr in;
+  char host[INET_ADDRSTRLEN];
+
+  in.s_addr = ip;
+  if (inet_ntop(AF_INET, &in, host, sizeof(host)) == nullptr) {
+    return 0;
+  }
+
+  return connect(host, port);
+}
+
+int WiFiClient::connect(const char *host, uint16_t port) {
+  stop();
+
+  char service[8];
+  snprintf(service, sizeof(service), "%u", (unsigned)port);
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo *res = nullptr;
+  if (getaddrinfo(host, service, &hints, &res) != 0 || res == nullptr) {
+    return 0;
+  }
+
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd < 0) {
+    freeaddrinfo(res);
+    return 0;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+  int r = ::connect(fd, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+
+  if (r != 0 && errno == EINPROGRESS) {
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (poll(&pfd, 1, (int)timeout_ms_) == 1 &&
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+      r = 0;
+    }
+  }
+
+  if (r != 0) {
+    close(fd);
+    return 0;
+  }
+
+  fd_ = fd;
+  peer_closed_ = false;
+  setNoDelay(nodelay_);
+  return 1;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size) {
+  size_t sent = 0;
+
+  while (fd_ >= 0 && sent < size) {
+    ssize_t r = send(fd_, buf + sent, size - sent, MSG_NOSIGNAL);
+    if (r > 0) {
+      sent += r;
+      continue;
+    }
+
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd pfd = {fd_, POLLOUT, 0};
+      if (poll(&pfd, 1, (int)timeout_ms_) == 1) continue;
+    }
+    break;
+  }
+
+  return sent;
+}
+
+int WiFiClient::available() {
+  if (fd_ < 0) return 0;
+
+  int count = 0;
+  if (ioctl(fd_, FIONREAD, &count) != 0) return 0;
+
+  if (count == 0 && !peer_closed_) {
+    char c;
+    ssize_t r = recv(fd_, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      peer_closed_ = true;
+    }
+  }
+
+  return count;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size) {
+  if (fd_ < 0) return -1;
+
+  ssize_t r = recv(fd_, buf, size, MSG_DONTWAIT);
+  if (r == 0) {
+    peer_closed_ = true;
+    return -1;
+  }
+
+  return r > 0 ? (int)r : -1;
+}
+
+void WiFiClient::stop() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  peer_closed_ = false;
+}
+
+uint8_t WiFiClient::connected() {
+  if (fd_ < 0) return 0;
+  return (available() > 0 || !peer_closed_) ? 1 : 0;
+}
+
+bool WiFiClient::setNoDelay(bool nodelay) {
+  nodelay_ = nodelay;
+  if (fd_ < 0) return true;
+
+  int flag = nodelay ? 1 : 0;
+  return setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) == 0;
+}
@@ -0,0 +1,50 @@
+// Host stand-in for the Arduino WiFiClient on top of a POSIX TCP socket.
+// Mirrors the ESP8266 core semantics the bridge relies on: connect() blocks
+// for at most the configured timeout, reads never block and connected()
+// stays true while unread data is still buffered.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Arduino's IPv4 address, stored in network byte order as on the ESP cores
+class IPAddress {
+ public:
+  IPAddress(uint32_t address = 0) : address_(address) {}
+  operator uint32_t() const { return address_; }
+  std::string toString() const;
+
+ private:
+  uint32_t address_;
+};
+
+class WiFiClient {
+ public:
+  WiFiClient() = default;
+  ~WiFiClient();
+
+  WiFiClient(const WiFiClient &) = delete;
+  WiFiClient &operator=(const WiFiClient &) = delete;
+
+  int connect(const char *host, uint16_t port);
+  int connect(IPAddress ip, uint16_t port);
+  size_t write(const uint8_t *buf, size_t size);
+  int available();
+  int read(uint8_t *buf, size_t size);
+  int read(char *buf, size_t size) { return read((uint8_t *)buf, size); }
+  void flush() {}
+  void stop();
+  uint8_t connected();
+
+  void setTimeout(unsigned long timeout_ms) { timeout_ms_ = timeout_ms; }
+  bool setNoDelay(bool nodelay);
+
+  explicit operator bool() { return connected(); }
+
+ protected:
+  int fd_{-1};
+  bool peer_closed_{false};
+  bool nodelay_{false};
+  unsigned long timeout_ms_{1000};
+};
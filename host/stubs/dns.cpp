@@ -0,0 +1,45 @@
+#include "lwip/dns.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <thread>
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr,
+                        dns_found_callback found, void *callback_arg) {
+  if (hostname == nullptr || addr == nullptr || found == nullptr) {
+    return ERR_ARG;
+  }
+
+  struct in_addr in;
+  if (inet_pton(AF_INET, hostname, &in) == 1) {
+    addr->addr = in.s_addr;
+    return ERR_OK;
+  }
+
+  std::string name = hostname;
+  std::thread([name, found, callback_arg]() {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *res = nullptr;
+    if (getaddrinfo(name.c_str(), nullptr, &hints, &res) != 0 ||
+        res == nullptr) {
+      found(name.c_str(), nullptr, callback_arg);
+      return;
+    }
+
+    ip_addr_t resolved;
+    resolved.addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
+    freeaddrinfo(res);
+    found(name.c_str(), &resolved, callback_arg);
+  }).detach();
+
+  return ERR_INPROGRESS;
+}
@@ -0,0 +1,226 @@
+// Host stand-in for the parts of ESPHome used by the SUPLA bridge.
+// Only what supla_esphome_bridge.{h,cpp} touches is provided here.
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void yield();
+
+// Arduino's ESP object; free heap is a fixed budget minus glibc's in-use
+// bytes, so differences between two calls match the device.
+class EspClass {
+ public:
+  uint32_t getFreeHeap();
+};
+
+extern EspClass ESP;
+
+extern bool esphome_host_network_connected;
+
+#define ESPHOME_LOG_LEVEL_NONE 0
+#define ESPHOME_LOG_LEVEL_ERROR 1
+#define ESPHOME_LOG_LEVEL_WARN 2
+#define ESPHOME_LOG_LEVEL_INFO 3
+#define ESPHOME_LOG_LEVEL_CONFIG 4
+#define ESPHOME_LOG_LEVEL_DEBUG 5
+#define ESPHOME_LOG_LEVEL_VERBOSE 6
+#define ESPHOME_LOG_LEVEL_VERY_VERBOSE 7
+
+// esphome/core/defines.h: platforms present in the configuration
+#define USE_SENSOR
+#define USE_BINARY_SENSOR
+#define USE_SWITCH
+#define USE_LIGHT
+
+#ifndef ESPHOME_LOG_LEVEL
+#define ESPHOME_LOG_LEVEL ESPHOME_LOG_LEVEL_DEBUG
+#endif
+
+void esphome_host_log(char level, const char *tag, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOGE(tag, ...) esphome_host_log('E', tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) esphome_host_log('W', tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) esphome_host_log('I', tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) esphome_host_log('D', tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) esphome_host_log('V', tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) esphome_host_log('C', tag, __VA_ARGS__)
+
+namespace esphome {
+
+using ::millis;
+using ::micros;
+
+uint32_t random_uint32();
+
+namespace network {
+
+// Host: follows esphome_host_network_connected (bridge_host -w)
+bool is_connected();
+
+}  // namespace network
+
+class Component {
+ public:
+  virtual ~Component() = default;
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual float get_setup_priority() const { return 0.0f; }
+};
+
+namespace sensor {
+
+class Sensor {
+ public:
+  void add_on_state_callback(std::function<void(float)> &&callback) {
+    callbacks_.push_back(std::move(callback));
+  }
+
+  void publish_state(float state) {
+    this->state = state;
+    has_state_ = true;
+    for (auto &callback : callbacks_) callback(state);
+  }
+
+  bool has_state() const { return has_state_; }
+
+  float state{NAN};
+
+ protected:
+  bool has_state_{false};
+  std::vector<std::function<void(float)>> callbacks_;
+};
+
+}  // namespace sensor
+
+namespace binary_sensor {
+
+class BinarySensor {
+ public:
+  void add_on_state_callback(std::function<void(bool)> &&callback) {
+    callbacks_.push_back(std::move(callback));
+  }
+
+  void publish_state(bool state) {
+    if (has_state_ && this->state == state) return;
+    this->state = state;
+    has_state_ = true;
+    for (auto &callback : callbacks_) callback(state);
+  }
+
+  bool has_state() const { return has_state_; }
+
+  bool state{false};
+
+ protected:
+  bool has_state_{false};
+  std::vector<std::function<void(bool)>> callbacks_;
+};
+
+}  // namespace binary_sensor
+
+namespace switch_ {
+
+// Optimistic switch: turn_on()/turn_off() publish the new state at once.
+class Switch {
+ public:
+  void turn_on() { publish_state(true); }
+  void turn_off() { publish_state(false); }
+  void toggle() { publish_state(!state); }
+
+  void add_on_state_callback(std::function<void(bool)> &&callback) {
+    callbacks_.push_back(std::move(callback));
+  }
+
+  void publish_state(bool state) {
+    this->state = state;
+    for (auto &callback : callbacks_) callback(state);
+  }
+
+  bool state{false};
+
+ protected:
+  std::vector<std::function<void(bool)>> callbacks_;
+};
+
+}  // namespace switch_
+
+namespace light {
+
+class LightColorValues {
+ public:
+  bool is_on() const { return state_; }
+  void set_state(bool state) { state_ = state; }
+
+ protected:
+  bool state_{false};
+};
+
+class LightState;
+
+class LightCall {
+ public:
+  explicit LightCall(LightState *parent) : parent_(parent) {}
+
+  LightCall &set_state(bool state) {
+    state_ = state;
+    return *this;
+  }
+
+  void perform();
+
+ protected:
+  LightState *parent_;
+  bool state_{false};
+};
+
+// Binary light: target state is applied immediately and reported through
+// an optional output hook standing in for the GPIO.
+class LightState {
+ public:
+  LightCall make_call() { return LightCall(this); }
+
+  LightCall toggle() {
+    LightCall call(this);
+    call.set_state(!remote_values.is_on());
+    return call;
+  }
+
+  void add_new_remote_values_callback(std::function<void()> &&callback) {
+    callbacks_.push_back(std::move(callback));
+  }
+
+  void set_output(std::function<void(bool)> &&output) {
+    output_ = std::move(output);
+  }
+
+  LightColorValues remote_values;
+  LightColorValues current_values;
+
+ protected:
+  friend class LightCall;
+
+  std::vector<std::function<void()>> callbacks_;
+  std::function<void(bool)> output_;
+};
+
+inline void LightCall::perform() {
+  parent_->remote_values.set_state(state_);
+  for (auto &callback : parent_->callbacks_) callback();
+
+  parent_->current_values.set_state(state_);
+  if (parent_->output_) parent_->output_(state_);
+}
+
+}  // namespace light
+
+}  // namespace esphome
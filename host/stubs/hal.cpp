@@ -0,0 +1,65 @@
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "esphome.h"
+
+static uint64_t host_now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static const uint64_t host_start_us = host_now_us();
+
+uint32_t millis() { return (uint32_t)((host_now_us() - host_start_us) / 1000); }
+
+uint32_t micros() { return (uint32_t)(host_now_us() - host_start_us); }
+
+void delay(uint32_t ms) {
+  struct timespec ts = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, nullptr);
+}
+
+void yield() {}
+
+// Roughly what an esp01_1m has left for the heap with WiFi up; allocations
+// made before main() (libstdc++ pools) do not count against it.
+static const size_t HOST_HEAP_SIZE = 48 * 1024;
+static const size_t host_heap_base = mallinfo2().uordblks;
+
+EspClass ESP;
+
+uint32_t EspClass::getFreeHeap() {
+  size_t used = mallinfo2().uordblks - host_heap_base;
+  return used < HOST_HEAP_SIZE ? (uint32_t)(HOST_HEAP_SIZE - used) : 0;
+}
+
+bool esphome_host_network_connected = true;
+
+namespace esphome {
+
+uint32_t random_uint32() { return (uint32_t)random(); }
+
+namespace network {
+
+bool is_connected() { return esphome_host_network_connected; }
+
+}  // namespace network
+
+}  // namespace esphome
+
+void esphome_host_log(char level, const char *tag, const char *fmt, ...) {
+  uint64_t us = host_now_us() - host_start_us;
+  fprintf(stderr, "[%6llu.%03llu][%c][%s] ", (unsigned long long)(us / 1000),
+          (unsigned long long)(us % 1000), level, tag);
+
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+
+  fputc('\n', stderr);
+}
@@ -0,0 +1,29 @@
+// Host stand-in for the lwIP DNS client used by the SUPLA bridge.
+// Like lwIP, dns_gethostbyname() answers an IPv4 literal right away
+// (ERR_OK) and resolves anything else in the background, calling found from
+// another thread (as the tcpip thread does on ESP32) and returning
+// ERR_INPROGRESS.
+#pragma once
+
+#include <cstdint>
+
+typedef int8_t err_t;
+
+#define ERR_OK 0
+#define ERR_INPROGRESS -5
+#define ERR_ARG -16
+
+// IPv4 only, address in network byte order
+typedef struct {
+  uint32_t addr;
+} ip4_addr_t;
+typedef ip4_addr_t ip_addr_t;
+
+#define ip_2_ip4(ipaddr) (ipaddr)
+#define ip4_addr_get_u32(src_ipaddr) ((src_ipaddr)->addr)
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr,
+                                   void *callback_arg);
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr,
+                        dns_found_callback found, void *callback_arg);